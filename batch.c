@@ -0,0 +1,46 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "util.h"
+
+/* Reads every job in path up front, returning how many there are. */
+int batch_load(const char *path, struct batch_job **jobs){
+    char line[2560], time[64], *dash;
+    struct batch_job *job;
+    int count = 0, size = 0, number = 0;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r")))
+        die("Unable to open job list %s.\n", path);
+
+    *jobs = NULL;
+    while (fgets(line, sizeof(line), fp)) {
+        number++;
+        if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\n")] == '\0')
+            continue;
+        if (count == size) {
+            size = size ? 2 * size : 64;
+            if (!(*jobs = realloc(*jobs, size * sizeof(**jobs))))
+                die("Unable to allocate batch jobs.\n");
+        }
+        job = &(*jobs)[count];
+        if (sscanf(line, "%1023s %dx%d %63s %1023s", job->shader, &job->width, &job->height,
+                    time, job->output) != 5 || job->width <= 0 || job->height <= 0)
+            die("Malformed job at %s:%d: %s", path, number, line);
+
+        /* a leading minus is a sign, not a range */
+        job->start = job->end = strtod(time, &dash);
+        if (*dash == '-')
+            job->end = strtod(dash + 1, &dash);
+        if (*dash != '\0' || job->end < job->start)
+            die("Invalid time %s at %s:%d.\n", time, path, number);
+        job->line = number;
+        count++;
+    }
+    fclose(fp);
+
+    return count;
+}
@@ -0,0 +1,23 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Batch job lists, one job per line:
+ *
+ *   shader.glsl  320x180  2.5    thumb.png
+ *   shader.glsl  640x360  0-4    preview.y4m
+ *
+ * A single time renders one frame, a range start-end renders the frames
+ * in between at the output frame rate. Blank lines and lines starting
+ * with # are skipped.
+*/
+struct batch_job {
+    char shader[1024];
+    int width;
+    int height;
+    double start;
+    double end;             /* equal to start for a single frame */
+    char output[1024];
+    int line;
+};
+
+int batch_load(const char *path, struct batch_job **jobs);
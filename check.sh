@@ -0,0 +1,56 @@
+#!/bin/sh
+# See LICENSE file for copyright and license details.
+#
+# make check: renders the built-in shader with --cpu and with --headless
+# and compares the YUV4MPEG2 streams. Both must have the same size and
+# header, no sample may differ by more than TOLERANCE steps and at most
+# one sample in LIMIT may differ at all, which leaves room for libm and
+# the GPU's approximations parting by a rounding step now and then.
+
+ESSHADER=${ESSHADER:-./esshader}
+TOLERANCE=${TOLERANCE:-2}
+LIMIT=${LIMIT:-1000}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+# width height frames
+for run in "160 90 10" "97 61 5"; do
+    set -- $run
+    name="$1x$2, $3 frames"
+    if ! "$ESSHADER" --log-level error --cpu 0 -w "$1" -h "$2" -n "$3" -o "$dir/cpu.y4m" >/dev/null ||
+            ! "$ESSHADER" --log-level error --headless -w "$1" -h "$2" -n "$3" -o "$dir/gpu.y4m" >/dev/null; then
+        echo "check: $name: render failed"
+        status=1
+        continue
+    fi
+    if [ "$(head -n 1 "$dir/cpu.y4m")" != "$(head -n 1 "$dir/gpu.y4m")" ] ||
+            [ "$(wc -c < "$dir/cpu.y4m")" -ne "$(wc -c < "$dir/gpu.y4m")" ]; then
+        echo "check: $name: streams differ in format or length"
+        status=1
+        continue
+    fi
+    # cmp -l lists every differing byte as offset and both values in octal
+    if ! cmp -l "$dir/cpu.y4m" "$dir/gpu.y4m" | awk -v tol="$TOLERANCE" -v limit="$LIMIT" \
+            -v size="$(wc -c < "$dir/cpu.y4m")" -v name="$name" '
+        function octal(s,    i, n) {
+            for (i = 1; i <= length(s); i++)
+                n = n * 8 + substr(s, i, 1)
+            return n
+        }
+        {
+            d = octal($2) - octal($3)
+            if (d < 0)
+                d = -d
+            if (d > max)
+                max = d
+        }
+        END {
+            printf "check: %s: %d of %d bytes differ, by up to %d\n", name, NR, size, max
+            exit max > tol || NR * limit > size
+        }'; then
+        echo "check: $name: beyond tolerance $TOLERANCE, 1 in $LIMIT"
+        status=1
+    fi
+done
+exit $status
@@ -14,13 +14,72 @@ static const EGLint egl_config[] = {
     EGL_NONE
 };
 
-static const char options_string[] = "?fw:h:s:";
+/* long options without a short form */
+enum {
+    OPT_GPU_MEM_BUDGET = 256,
+    OPT_RECORD_INPUT,
+    OPT_REPLAY_INPUT,
+    OPT_HEADLESS,
+    OPT_SOAK,
+    OPT_ENERGY,
+    OPT_SYSFS_ROOT,
+    OPT_PERF,
+    OPT_PERF_LOG,
+    OPT_HUD,
+    OPT_METRICS_FILE,
+    OPT_METRICS_SOCKET,
+    OPT_LOG_LEVEL,
+    OPT_LOG_JSON,
+    OPT_OUTPUT_PATTERN,
+    OPT_ENCODER_THREADS,
+    OPT_DEDUP,
+    OPT_WORKERS,
+    OPT_BATCH,
+    OPT_TRACE,
+    OPT_CPU,
+    OPT_SYNC,
+    OPT_SYNC_SWAP,
+    OPT_MOSAIC,
+};
+
+static const char options_string[] = "?f3w:h:s:o:r:n:x:F:c:";
 
 static struct option long_options[] = {
     {"width", required_argument, 0, 'w'},
     {"height", required_argument, 0, 'h'},
     {"fullscreen", no_argument, 0, 'f'},
     {"source", required_argument, 0, 's'},
+    {"gles3", no_argument, 0, '3'},
+    {"output", required_argument, 0, 'o'},
+    {"output-pattern", required_argument, 0, OPT_OUTPUT_PATTERN},
+    {"encoder-threads", required_argument, 0, OPT_ENCODER_THREADS},
+    {"dedup", no_argument, 0, OPT_DEDUP},
+    {"workers", required_argument, 0, OPT_WORKERS},
+    {"batch", required_argument, 0, OPT_BATCH},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"cpu", required_argument, 0, OPT_CPU},
+    {"sync", required_argument, 0, OPT_SYNC},
+    {"sync-swap", no_argument, 0, OPT_SYNC_SWAP},
+    {"mosaic", no_argument, 0, OPT_MOSAIC},
+    {"fps", required_argument, 0, 'r'},
+    {"frames", required_argument, 0, 'n'},
+    {"scale", required_argument, 0, 'x'},
+    {"format", required_argument, 0, 'F'},
+    {"channel", required_argument, 0, 'c'},
+    {"gpu-mem-budget", required_argument, 0, OPT_GPU_MEM_BUDGET},
+    {"record-input", required_argument, 0, OPT_RECORD_INPUT},
+    {"replay-input", required_argument, 0, OPT_REPLAY_INPUT},
+    {"headless", no_argument, 0, OPT_HEADLESS},
+    {"soak", required_argument, 0, OPT_SOAK},
+    {"energy", no_argument, 0, OPT_ENERGY},
+    {"sysfs-root", required_argument, 0, OPT_SYSFS_ROOT},
+    {"perf", no_argument, 0, OPT_PERF},
+    {"perf-log", required_argument, 0, OPT_PERF_LOG},
+    {"hud", no_argument, 0, OPT_HUD},
+    {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
+    {"metrics-socket", required_argument, 0, OPT_METRICS_SOCKET},
+    {"log-level", required_argument, 0, OPT_LOG_LEVEL},
+    {"log-json", no_argument, 0, OPT_LOG_JSON},
     {"help", no_argument, 0, '?'},
     {0, 0, 0, 0}
 };
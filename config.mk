@@ -8,14 +8,30 @@ PREFIX = /usr/local
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# OpenGL ES 3.0, comment if you don't want it
+GLES3FLAGS = -DGLES3
+
 # includes and libs
 INCS = -I. -I/usr/include -I${X11INC}
-LIBS = -L/usr/lib -lc -lm -L${X11LIB} -lX11 -lEGL -lGLESv2
+LIBS = -L/usr/lib -lc -lm -lpthread -ldl -lpng -L${X11LIB} -lX11 -lEGL -lGLESv2
+PNGLIBS = -L/usr/lib -lpthread -lpng
+# make bench links stub.c instead of X, EGL and GLES
+STUBLIBS = -L/usr/lib -lc -lm -lpthread -ldl -lpng
 
 # toolchain flags
-CPPFLAGS = -DVERSION=\"${VERSION}\" -D_POSIX_C_SOURCE=200112L
+CPPFLAGS = -DVERSION=\"${VERSION}\" -D_POSIX_C_SOURCE=200809L ${GLES3FLAGS}
 CFLAGS = -std=c99 -pedantic -Wall -O3 ${INCS} ${CPPFLAGS}
 LDFLAGS = -s ${LIBS}
+PACKLDFLAGS = -s ${PNGLIBS}
+STUBLDFLAGS = ${STUBLIBS}
+
+# make bench, frames to run and any further esshader options
+BENCHFRAMES = 100000
+BENCHFLAGS =
+# make bench fails above these per frame averages, empty for no limit
+BENCHMAXNS =
+BENCHMAXCALLS = 20
 
 # compiler and linker
 CC = cc
+AR = ar
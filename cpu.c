@@ -0,0 +1,271 @@
+/* See LICENSE file for copyright and license details. */
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "cpu.h"
+#include "glsl.h"
+#include "util.h"
+
+#define TILE_WIDTH 64
+#define TILE_HEIGHT 16
+
+extern char **environ;
+
+/* the uniforms of the GL header; samplers are refused by the translator */
+static const char header[] =
+    "precision highp float;"
+    "uniform vec3 iResolution;"
+    "uniform float iGlobalTime;"
+    "uniform float iChannelTime[4];"
+    "uniform vec4 iMouse;"
+    "uniform vec4 iDate;"
+    "uniform float iSampleRate;"
+    "uniform vec3 iChannelResolution[4];"
+    "uniform sampler2D iChannel0;"
+    "uniform sampler2D iChannel1;"
+    "uniform sampler2D iChannel2;"
+    "uniform sampler2D iChannel3;\n"
+    "#define iTime iGlobalTime\n";
+
+/* tiles [next, end) not taken yet, owned by one thread */
+struct band {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+};
+
+struct thread {
+    pthread_t id;
+    int index;
+};
+
+static void *library;
+static void (*shade_tile)(unsigned char *, int, int, int, int, int);
+static int (*set_uniform)(const char *, const float *, int);
+
+static int frame_width;
+static int frame_height;
+static int columns;
+static int tiles;
+
+static struct band *bands;
+static struct thread *threads;
+static int nthreads;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static unsigned long generation;
+static int running;
+static bool stopping;
+static unsigned char *frame;
+static long stolen;
+
+static void compile(const char *dir){
+    const char *cc = getenv("CC");
+    char source[64], output[64];
+    char *argv[] = {
+        (char *)(cc && *cc ? cc : "cc"), "-std=gnu99", "-O3", "-march=native",
+        "-fno-math-errno", "-ffp-contract=off", "-fPIC", "-shared",
+        "-o", output, source, "-lm", NULL
+    };
+    int status, err;
+    pid_t pid;
+
+    snprintf(source, sizeof(source), "%s/shader.c", dir);
+    snprintf(output, sizeof(output), "%s/shader.so", dir);
+    if ((err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ)))
+        die("Unable to run %s: %s\n", argv[0], strerror(err));
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            die("Unable to wait for %s: %s\n", argv[0], strerror(errno));
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        die("Unable to compile the translated shader, see %s.\n", source);
+}
+
+static void load(const char *source){
+    char dir[] = "/tmp/esshader-cpu-XXXXXX", path[64], error[256];
+    char *code;
+    FILE *fp;
+
+    if (!(code = glsl_translate(header, source, error, sizeof(error))))
+        die("Unable to translate shader for the CPU: %s\n", error);
+    if (!mkdtemp(dir))
+        die("Unable to create a directory for the CPU shader: %s\n", strerror(errno));
+    snprintf(path, sizeof(path), "%s/shader.c", dir);
+    if (!(fp = fopen(path, "w")) || fputs(code, fp) == EOF || fclose(fp))
+        die("Unable to write %s.\n", path);
+    free(code);
+    compile(dir);
+    debug("Compiled the CPU shader in %s.\n", dir);
+
+    snprintf(path, sizeof(path), "%s/shader.so", dir);
+    if (!(library = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+        die("Unable to load %s: %s\n", path, dlerror());
+    *(void **)&shade_tile = dlsym(library, "esshader_cpu_tile");
+    *(void **)&set_uniform = dlsym(library, "esshader_cpu_uniform");
+    if (!shade_tile || !set_uniform)
+        die("%s lacks the CPU shader entry points.\n", path);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/shader.c", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+/* The front tile of band k, for its owner */
+static int take(int k){
+    struct band *b = &bands[k];
+    int tile = -1;
+
+    pthread_mutex_lock(&b->lock);
+    if (b->next < b->end)
+        tile = b->next++;
+    pthread_mutex_unlock(&b->lock);
+    return tile;
+}
+
+/*
+ * Moves the back half of the largest band into band k. Sizes are read
+ * unlocked to pick the victim and checked again under its lock.
+*/
+static bool steal(int k){
+    int victim = -1, most = 0, left, i;
+    struct band *b;
+
+    for (i = 0; i < nthreads; i++) {
+        left = bands[i].end - bands[i].next;
+        if (i != k && left > most) {
+            most = left;
+            victim = i;
+        }
+    }
+    if (victim < 0)
+        return false;
+    b = &bands[victim];
+    pthread_mutex_lock(&b->lock);
+    if ((left = b->end - b->next) <= 0) {
+        pthread_mutex_unlock(&b->lock);
+        return true;
+    }
+    pthread_mutex_lock(&bands[k].lock);
+    bands[k].end = b->end;
+    bands[k].next = b->end -= (left + 1) / 2;
+    pthread_mutex_unlock(&bands[k].lock);
+    pthread_mutex_unlock(&b->lock);
+    pthread_mutex_lock(&lock);
+    stolen++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+static void work(int k){
+    int tile, x, y;
+
+    for (;;) {
+        while ((tile = take(k)) >= 0) {
+            x = tile % columns * TILE_WIDTH;
+            y = tile / columns * TILE_HEIGHT;
+            shade_tile(frame, frame_width, x, y,
+                    x + TILE_WIDTH < frame_width ? x + TILE_WIDTH : frame_width,
+                    y + TILE_HEIGHT < frame_height ? y + TILE_HEIGHT : frame_height);
+        }
+        if (!steal(k))
+            return;
+    }
+}
+
+static void *worker(void *arg){
+    struct thread *t = arg;
+    unsigned long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (generation == seen && !stopping)
+            pthread_cond_wait(&wake, &lock);
+        if (stopping) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        seen = generation;
+        pthread_mutex_unlock(&lock);
+
+        work(t->index);
+
+        pthread_mutex_lock(&lock);
+        if (!--running)
+            pthread_cond_signal(&done);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void cpu_start(const char *source, int width, int height, int threads_wanted){
+    float resolution[3] = { width, height, 0 };
+    int i;
+
+    load(source);
+    set_uniform("iResolution", resolution, 3);
+
+    frame_width = width;
+    frame_height = height;
+    columns = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    tiles = columns * ((height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+    nthreads = threads_wanted > 0 ? threads_wanted : 1;
+    if (!(bands = calloc(nthreads, sizeof(*bands))) || !(threads = calloc(nthreads, sizeof(*threads))))
+        die("Unable to allocate CPU threads.\n");
+    for (i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&bands[i].lock, NULL);
+        threads[i].index = i;
+        if (i && pthread_create(&threads[i].id, NULL, worker, &threads[i]))
+            die("Unable to start CPU thread %d.\n", i);
+    }
+    info("Rendering on the CPU with %d threads, %d lanes each.\n", nthreads, GLSL_LANES);
+}
+
+void cpu_render(unsigned char *pixels, float time){
+    int i;
+
+    set_uniform("iGlobalTime", &time, 1);
+    frame = pixels;
+    for (i = 0; i < nthreads; i++) {
+        bands[i].next = (long)tiles * i / nthreads;
+        bands[i].end = (long)tiles * (i + 1) / nthreads;
+    }
+
+    pthread_mutex_lock(&lock);
+    generation++;
+    running = nthreads - 1;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    work(0);
+
+    pthread_mutex_lock(&lock);
+    while (running)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+void cpu_stop(void){
+    int i;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    for (i = 1; i < nthreads; i++)
+        pthread_join(threads[i].id, NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_mutex_destroy(&bands[i].lock);
+    debug("CPU threads stole %ld bands.\n", stolen);
+    free(bands);
+    free(threads);
+    dlclose(library);
+}
@@ -0,0 +1,13 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Offline rendering without a GPU. cpu_start() translates the shader to C
+ * with glsl_translate(), builds it with the system compiler and loads the
+ * result; cpu_render() then shades a frame in 64x16 tiles on a pool of
+ * threads, each starting on its own band of tiles and stealing half of the
+ * largest band left once it runs dry. Frames are RGBA8, bottom row first,
+ * like glReadPixels returns them.
+*/
+void cpu_start(const char *source, int width, int height, int threads);
+void cpu_render(unsigned char *pixels, float time);
+void cpu_stop(void);
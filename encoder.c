@@ -0,0 +1,175 @@
+/* See LICENSE file for copyright and license details. */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "encoder.h"
+#include "image.h"
+#include "util.h"
+
+struct job {
+    char path[1024];
+    int width;
+    int height;
+    const unsigned char *rgba;
+    void (*done)(void *arg);
+    void *arg;
+};
+
+static struct job *queue;
+static int depth;
+static int head;
+static int count;
+static bool stopping;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static pthread_t *threads;
+static int nthreads;
+static unsigned char **pool;
+static int pool_size;
+static int pool_free;
+static pthread_cond_t buffer_free = PTHREAD_COND_INITIALIZER;
+
+static void *encode(void *arg){
+    struct job job;
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!count && !stopping)
+            pthread_cond_wait(&not_empty, &lock);
+        if (!count) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        job = queue[(head - count + depth) % depth];
+        count--;
+        pthread_cond_signal(&not_full);
+        pthread_mutex_unlock(&lock);
+
+        if (image_save_png(job.path, job.width, job.height, job.rgba))
+            warning("Unable to write %s.\n", job.path);
+        if (job.done)
+            job.done(job.arg);
+    }
+
+    return NULL;
+}
+
+/* depth bounds the frames queued but not yet picked up by a thread */
+void encoder_start(int n, int queue_depth){
+    int i;
+
+    depth = queue_depth;
+    if (!(queue = calloc(depth, sizeof(*queue))) || !(threads = calloc(n, sizeof(*threads))) ||
+            !(pool = calloc(depth + n, sizeof(*pool))))
+        die("Unable to allocate encoder queue.\n");
+    for (i = 0; i < n; ++i)
+        if (pthread_create(&threads[i], NULL, encode, NULL))
+            die("Unable to start encoder thread.\n");
+    nthreads = n;
+}
+
+/*
+ * Take a buffer of bytes, which must not change between calls, from
+ * the pool, waiting while all of them are queued or being encoded; the
+ * time spent waiting is added to waited.
+ * Buffers are allocated as they are first needed and handed back with
+ * encoder_release, usually as the done callback of encoder_submit.
+*/
+unsigned char *encoder_buffer(size_t bytes, double *waited){
+    struct timespec start, stop;
+    unsigned char *buffer;
+
+    pthread_mutex_lock(&lock);
+    if (!pool_free && pool_size < depth + nthreads) {
+        pthread_mutex_unlock(&lock);
+        if (!(buffer = malloc(bytes)))
+            die("Unable to allocate encoder buffer.\n");
+        pthread_mutex_lock(&lock);
+        pool_size++;
+        pthread_mutex_unlock(&lock);
+        return buffer;
+    }
+    if (!pool_free) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (!pool_free)
+            pthread_cond_wait(&buffer_free, &lock);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        *waited += (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    buffer = pool[--pool_free];
+    pthread_mutex_unlock(&lock);
+
+    return buffer;
+}
+
+void encoder_release(void *buffer){
+    pthread_mutex_lock(&lock);
+    pool[pool_free++] = buffer;
+    pthread_cond_signal(&buffer_free);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Queue a frame for path. With wait unset a full queue makes this fail
+ * rather than block, returning -1.
+*/
+int encoder_submit(const char *path, int width, int height, const unsigned char *rgba,
+        int wait, void (*done)(void *arg), void *arg){
+    struct job *job;
+
+    pthread_mutex_lock(&lock);
+    while (count == depth && wait)
+        pthread_cond_wait(&not_full, &lock);
+    if (count == depth) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    job = &queue[head];
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->width = width;
+    job->height = height;
+    job->rgba = rgba;
+    job->done = done;
+    job->arg = arg;
+    head = (head + 1) % depth;
+    count++;
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+/* Finish everything queued, then let the threads go. */
+void encoder_stop(void){
+    int i;
+
+    if (!nthreads)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&not_empty);
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+
+    while (pool_free)
+        free(pool[--pool_free]);
+    free(pool);
+    free(threads);
+    free(queue);
+    pool = NULL;
+    pool_size = 0;
+    threads = NULL;
+    queue = NULL;
+    nthreads = 0;
+    stopping = false;
+}
@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Background PNG encoding. Frames are queued with the file they belong
+ * in and written by a pool of threads, in whatever order they finish.
+ * The caller keeps ownership of the pixels until done(arg) is called
+ * from the encoding thread. Frames may also come from a pool of buffers
+ * sized so that every queue slot and every thread can hold one, which
+ * bounds memory by the queue depth.
+*/
+void encoder_start(int threads, int depth);
+unsigned char *encoder_buffer(size_t bytes, double *waited);
+void encoder_release(void *buffer);
+int encoder_submit(const char *path, int width, int height, const unsigned char *rgba,
+        int wait, void (*done)(void *arg), void *arg);
+void encoder_stop(void);
@@ -0,0 +1,233 @@
+/* See LICENSE file for copyright and license details. */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "energy.h"
+#include "util.h"
+
+#define ENERGY_SOURCES 16
+#define ENERGY_SHADERS 64
+
+enum { SOURCE_ENERGY, SOURCE_POWER };
+
+/*
+ * One counter file kept open for the whole run, so a sample costs a
+ * pread rather than a path lookup. RAPL and hwmon energy inputs count
+ * microjoules, hwmon power inputs microwatts, which get integrated over
+ * the frame time instead.
+*/
+struct source {
+    char name[64];
+    int fd;
+    int kind;
+    uint64_t range;
+    uint64_t last;
+};
+
+struct shader {
+    char name[256];
+    long frames;
+    double seconds;
+    double joules[ENERGY_SOURCES];
+};
+
+static struct source sources[ENERGY_SOURCES];
+static int nsources;
+static struct shader shaders[ENERGY_SHADERS];
+static int nshaders;
+
+static bool read_counter(int fd, uint64_t *value){
+    char buf[32];
+    ssize_t n;
+
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return false;
+    buf[n] = '\0';
+    *value = strtoull(buf, NULL, 10);
+    return true;
+}
+
+static bool read_file(const char *path, char *buf, size_t size){
+    FILE *fp;
+    size_t n;
+
+    if (!(fp = fopen(path, "r")))
+        return false;
+    n = fread(buf, 1, size - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return n > 0;
+}
+
+static void add_source(const char *path, const char *name, int kind, uint64_t range){
+    struct source *s;
+    int fd;
+
+    if (nsources == ENERGY_SOURCES || (fd = open(path, O_RDONLY)) < 0)
+        return;
+
+    s = &sources[nsources];
+    s->fd = fd;
+    s->kind = kind;
+    s->range = range;
+    if (!read_counter(fd, &s->last)) {
+        close(fd);
+        return;
+    }
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    nsources++;
+}
+
+/*
+ * Only top level zones (intel-rapl:N) are taken, the subzones below them
+ * are already part of their package's count. The MMIO interface repeats
+ * the package counters and is skipped as well.
+*/
+static void scan_powercap(const char *root){
+    char dir[512], path[1024], name[64], buf[32];
+    struct dirent *de;
+    uint64_t range;
+    DIR *d;
+
+    snprintf(dir, sizeof(dir), "%s/class/powercap", root);
+    if (!(d = opendir(dir)))
+        return;
+    while ((de = readdir(d))) {
+        if (strncmp(de->d_name, "intel-rapl:", 11) || strchr(de->d_name + 11, ':'))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s/name", dir, de->d_name);
+        if (!read_file(path, buf, sizeof(buf)))
+            snprintf(buf, sizeof(buf), "%.31s", de->d_name);
+        snprintf(name, sizeof(name), "rapl %s", buf);
+        snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", dir, de->d_name);
+        range = read_file(path, buf, sizeof(buf)) ? strtoull(buf, NULL, 10) : 0;
+        snprintf(path, sizeof(path), "%s/%s/energy_uj", dir, de->d_name);
+        add_source(path, name, SOURCE_ENERGY, range);
+    }
+    closedir(d);
+}
+
+static void scan_hwmon(const char *root){
+    char dir[512], path[1024], name[64], chip[32];
+    struct dirent *de, *fe;
+    DIR *d, *f;
+    size_t len;
+    int kind;
+
+    snprintf(dir, sizeof(dir), "%s/class/hwmon", root);
+    if (!(d = opendir(dir)))
+        return;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s/name", dir, de->d_name);
+        if (!read_file(path, chip, sizeof(chip)))
+            snprintf(chip, sizeof(chip), "%.31s", de->d_name);
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (!(f = opendir(path)))
+            continue;
+        while ((fe = readdir(f))) {
+            if (!strncmp(fe->d_name, "energy", 6))
+                kind = SOURCE_ENERGY;
+            else if (!strncmp(fe->d_name, "power", 5))
+                kind = SOURCE_POWER;
+            else
+                continue;
+            len = strlen(fe->d_name);
+            if (len < 6 || strcmp(fe->d_name + len - 6, "_input"))
+                continue;
+            snprintf(name, sizeof(name), "%s %.*s", chip,
+                    (int)strcspn(fe->d_name, "_"), fe->d_name);
+            snprintf(path, sizeof(path), "%s/%s/%s", dir, de->d_name, fe->d_name);
+            add_source(path, name, kind, 0);
+        }
+        closedir(f);
+    }
+    closedir(d);
+}
+
+/* Returns the number of counters found below sysfs_root. */
+int energy_open(const char *sysfs_root){
+    int i;
+
+    scan_powercap(sysfs_root);
+    scan_hwmon(sysfs_root);
+    if (!nsources)
+        warning("No energy counters found under %s.\n", sysfs_root);
+    log_report_begin();
+    for (i = 0; i < nsources; ++i)
+        info("Energy counter: %s.\n", sources[i].name);
+    log_report_end();
+
+    return nsources;
+}
+
+void energy_frame(const char *shader, double seconds){
+    struct shader *sh = NULL;
+    uint64_t now, delta;
+    int i;
+
+    for (i = 0; i < nshaders; ++i)
+        if (!strcmp(shaders[i].name, shader))
+            sh = &shaders[i];
+    if (!sh) {
+        if (nshaders == ENERGY_SHADERS)
+            return;
+        sh = &shaders[nshaders++];
+        snprintf(sh->name, sizeof(sh->name), "%s", shader);
+    }
+    sh->frames++;
+    sh->seconds += seconds;
+
+    for (i = 0; i < nsources; ++i) {
+        if (!read_counter(sources[i].fd, &now))
+            continue;
+        if (sources[i].kind == SOURCE_POWER) {
+            sh->joules[i] += now * 1e-6 * seconds;
+            continue;
+        }
+        /* counters wrap at max_energy_range_uj; with no range a drop is a reset */
+        if (now >= sources[i].last)
+            delta = now - sources[i].last;
+        else if (sources[i].range)
+            delta = now + sources[i].range - sources[i].last;
+        else
+            delta = 0;
+        sources[i].last = now;
+        sh->joules[i] += delta * 1e-6;
+    }
+}
+
+void energy_report(void){
+    struct shader *sh;
+    int i, j;
+
+    log_report_begin();
+    for (i = 0; i < nshaders; ++i) {
+        sh = &shaders[i];
+        if (!sh->frames || sh->seconds <= 0.0)
+            continue;
+        info("Energy for %s: %ld frames, %.3f ms/frame.\n", sh->name, sh->frames,
+                sh->seconds * 1000.0 / sh->frames);
+        for (j = 0; j < nsources; ++j)
+            info("  %-24s %10.3f J %10.6f J/frame %8.2f W\n", sources[j].name,
+                    sh->joules[j], sh->joules[j] / sh->frames, sh->joules[j] / sh->seconds);
+    }
+    log_report_end();
+}
+
+void energy_close(void){
+    int i;
+
+    for (i = 0; i < nsources; ++i)
+        close(sources[i].fd);
+    nsources = 0;
+    nshaders = 0;
+}
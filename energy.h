@@ -0,0 +1,12 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Energy accounting from the RAPL powercap zones and the hwmon sensors
+ * under a sysfs root. Counters are read after every frame and the energy
+ * used since the previous read is charged to the shader that drew it,
+ * named by the caller.
+*/
+int energy_open(const char *sysfs_root);
+void energy_frame(const char *shader, double seconds);
+void energy_report(void);
+void energy_close(void);
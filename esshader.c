@@ -1,79 +1,315 @@
 /* See LICENSE file for copyright and license details. */
-#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+#ifdef GLES3
+#include <GLES3/gl3.h>
+#else
 #include <GLES2/gl2.h>
+#endif
 #include <X11/Xlib.h>
+#include <X11/XKBlib.h>
 #include <X11/Xutil.h>
 
 #include "config.h"
+#include "batch.h"
+#include "cpu.h"
+#include "encoder.h"
+#include "energy.h"
+#include "esshader.h"
+#include "farm.h"
+#include "gpumem.h"
+#include "hash.h"
+#include "hud.h"
+#include "image.h"
+#include "input.h"
+#include "metrics.h"
+#include "output.h"
+#include "pack.h"
+#include "perfctr.h"
+#include "soak.h"
+#include "sync.h"
+#include "trace.h"
+#include "util.h"
+
+/* frames in flight between glReadPixels and the CPU touching them */
+#define READBACK_DEPTH 3
+
+/* names the fences are counted under, one per readback slot and the screenshot's */
+#define SYNC_READBACK 1
+#define SYNC_SCREENSHOT (SYNC_READBACK + READBACK_DEPTH)
+
+/* timer queries in flight, results are read back this many frames late */
+#define HUD_QUERIES 4
+
+/* GL objects libesshader may hold for itself at once */
+#define LIBRARY_OBJECTS 8
+
+/* bump whenever the ETC1 encoder output changes */
+#define ETC1_CACHE_VERSION 1
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#endif
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+/* EXT_disjoint_timer_query entry points */
+typedef void (GL_APIENTRYP gen_queries_fn)(GLsizei n, GLuint *ids);
+typedef void (GL_APIENTRYP delete_queries_fn)(GLsizei n, const GLuint *ids);
+typedef void (GL_APIENTRYP begin_query_fn)(GLenum target, GLuint id);
+typedef void (GL_APIENTRYP end_query_fn)(GLenum target);
+typedef void (GL_APIENTRYP get_query_uiv_fn)(GLuint id, GLenum pname, GLuint *params);
+typedef void (GL_APIENTRYP get_query_ui64v_fn)(GLuint id, GLenum pname, uint64_t *params);
 
 static const char common_shader_header[] =
     "#version 100\n"
     "precision highp float;";
 
-static const char vertex_shader_body[] =
-    "attribute vec4 iPosition;"
-    "void main(){gl_Position=iPosition;}";
-
-static const char fragment_shader_header[] =
-    "uniform vec3 iResolution;"
-    "uniform float iGlobalTime;"
-    "uniform float iChannelTime[4];"
-    "uniform vec4 iMouse;"
-    "uniform vec4 iDate;"
-    "uniform float iSampleRate;"
-    "uniform vec3 iChannelResolution[4];"
-    "uniform sampler2D iChannel0;"
-    "uniform sampler2D iChannel1;"
-    "uniform sampler2D iChannel2;"
-    "uniform sampler2D iChannel3;\n";
-
-static const char fragment_shader_footer[] =
-    "\nvoid main(){mainImage(gl_FragColor,gl_FragCoord.xy);}";
-
-static Display *x_display;
-static Window x_root;
-static Window x_window;
-static XComposeStatus x_kstatus;
-static EGLDisplay egl_display;
-static EGLContext egl_context;
-static EGLSurface egl_surface;
+/* Performance overlay, pixel coordinates from the top left corner. */
+static const char hud_vertex_shader_body[] =
+    "attribute vec2 position;"
+    "attribute vec2 texcoord;"
+    "attribute vec4 color;"
+    "uniform vec2 size;"
+    "varying vec2 uv;"
+    "varying vec4 tint;"
+    "void main(){uv=texcoord;tint=color;"
+    "gl_Position=vec4(position.x/size.x*2.-1.,1.-position.y/size.y*2.,0.,1.);}";
+
+static const char hud_fragment_shader_body[] =
+    "varying vec2 uv;"
+    "varying vec4 tint;"
+    "uniform sampler2D font;"
+    "void main(){gl_FragColor=vec4(tint.rgb,tint.a*texture2D(font,uv).r);}";
+
+static struct esshader *context;
 static GLsizei viewport_width = -1;
 static GLsizei viewport_height = -1;
+//Image program of the frame, the library draws with it
 static GLuint shader_program;
-static GLint attrib_position;
-static GLint sampler_channel[4];
-static GLint uniform_cres;
-static GLint uniform_ctime;
-static GLint uniform_date;
-static GLint uniform_gtime;
-static GLint uniform_mouse;
-static GLint uniform_res;
-static GLint uniform_srate;
-
-static void die(const char *format, ...){
-    va_list args;
-
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-
-    exit(EXIT_FAILURE);
-}
-
-static void info(const char *format, ...) {
-    va_list args;
-
-    va_start(args, format);
-    vfprintf(stdout, format, args);
-    va_end(args);
-}
+static int gles_version = 2;
+static bool viewport_locked;
+static bool headless;
+static bool metrics;
+static const char *trace_path;
+//Index of this process in a --workers farm, -1 when it writes the output
+static int worker = -1;
+static double swap_seconds;
+//Wait for the rest of the --sync group before every swap
+static bool swap_barrier;
+static struct input_log input_recording;
+static struct input_log input_replay;
+static GLfloat mouse[4];
+static bool mouse_down;
+static volatile sig_atomic_t report_requested;
+static volatile sig_atomic_t screenshot_requested;
+static bool encoder_running;
+
+/*
+ * Offscreen rendering as asked for by -x, -F and feedback channels and
+ * handed to esshader_offscreen(). format is -1 to draw to the window.
+*/
+static struct {
+    int format;
+    float scale;
+    int flags;
+    bool warned;            /* about falling back to another format */
+} offscreen = { -1, 1.0f };
+
+/* GL objects libesshader made for itself, accounted for like our own */
+static struct esshader_object library_objects[LIBRARY_OBJECTS];
+static int nlibrary_objects;
+
+enum { CHANNEL_NONE, CHANNEL_PACK, CHANNEL_FEEDBACK, CHANNEL_KEYBOARD };
+enum { FILTER_DEFAULT, FILTER_NEAREST, FILTER_LINEAR, FILTER_MIPMAP };
+
+static const char *filter_names[] = {
+    [FILTER_NEAREST] = "nearest",
+    [FILTER_LINEAR] = "linear",
+    [FILTER_MIPMAP] = "mipmap",
+};
+
+/*
+ * Texture bound to one of the iChannel samplers. Pack channels keep the
+ * pack mapped, so an evicted texture can be uploaded again on its next
+ * use without touching the disk more than the page cache has to.
+ *
+ * Feedback channels sample the previous frame of the image pass. Their
+ * contents change every frame, but the mipmap chain is only rebuilt when
+ * the filter needs one and the program actually samples the channel:
+ * dirty tracks whether the contents moved on since the last rebuild.
+*/
+struct channel {
+    int kind;
+    int filter;
+    const char *source;
+    struct pack pack;
+    const struct pack_entry *entry;
+    GLuint texture;
+    GLsizei width;
+    GLsizei height;
+    bool dirty;
+    unsigned long mip_builds;
+    unsigned long mip_skips;
+};
+
+static struct channel channels[4];
+
+/*
+ * ShaderToy keyboard texture: 256x3 luminance, indexed by JavaScript key
+ * code, rows hold whether a key is down, was pressed this frame, and its
+ * toggle state. Only the rows that changed since the last upload are
+ * sent to the GPU, and nothing at all on frames without key activity.
+*/
+static struct {
+    bool enabled;
+    unsigned char state[3][256];
+    int dirty_first;
+    int dirty_last;
+    bool pressed;
+    GLuint texture;
+    unsigned long uploads;
+} keyboard = { .dirty_first = 0, .dirty_last = 2 };
+
+/* X keysyms without an obvious JavaScript key code */
+static const struct {
+    KeySym sym;
+    int code;
+} key_codes[] = {
+    { XK_BackSpace, 8 }, { XK_Tab, 9 }, { XK_Return, 13 }, { XK_KP_Enter, 13 },
+    { XK_Shift_L, 16 }, { XK_Shift_R, 16 }, { XK_Control_L, 17 }, { XK_Control_R, 17 },
+    { XK_Alt_L, 18 }, { XK_Alt_R, 18 }, { XK_Pause, 19 }, { XK_Caps_Lock, 20 },
+    { XK_Escape, 27 }, { XK_space, 32 }, { XK_Page_Up, 33 }, { XK_Page_Down, 34 },
+    { XK_End, 35 }, { XK_Home, 36 }, { XK_Left, 37 }, { XK_Up, 38 },
+    { XK_Right, 39 }, { XK_Down, 40 }, { XK_Insert, 45 }, { XK_Delete, 46 },
+    { XK_semicolon, 186 }, { XK_equal, 187 }, { XK_comma, 188 }, { XK_minus, 189 },
+    { XK_period, 190 }, { XK_slash, 191 }, { XK_grave, 192 }, { XK_bracketleft, 219 },
+    { XK_backslash, 220 }, { XK_bracketright, 221 }, { XK_apostrophe, 222 },
+};
+
+static struct {
+    GLsizei width;
+    GLsizei height;
+    int head;
+    int count;
+    unsigned char *pixels;
+#ifdef GLES3
+    GLuint pbo[READBACK_DEPTH];
+    GLsync fence[READBACK_DEPTH];
+#endif
+} readback;
+
+/*
+ * Overlay state. GL resources are created the first time it is shown;
+ * a hidden overlay costs nothing but a branch per frame.
+*/
+static struct {
+    bool enabled;
+    GLuint program;
+    GLuint texture;
+    GLint position;
+    GLint texcoord;
+    GLint color;
+    GLint size;
+    bool timer;
+    GLuint queries[HUD_QUERIES][2];
+    bool pending[HUD_QUERIES];
+    int head;
+    double gpu_ms;
+    double hud_ms;
+    struct timespec frame_start;
+    struct timespec last_frame;
+    struct hud_vertex vertices[HUD_MAX_VERTICES];
+} overlay = { .gpu_ms = -1.0, .hud_ms = -1.0 };
+
+/* Timer queries, shared by the overlay and the mosaic */
+static struct {
+    bool loaded;
+    bool available;
+    gen_queries_fn gen_queries;
+    delete_queries_fn delete_queries;
+    begin_query_fn begin_query;
+    end_query_fn end_query;
+    get_query_uiv_fn get_query_uiv;
+    get_query_ui64v_fn get_query_ui64v;
+} timer;
+
+/*
+ * --mosaic: one image program per cell of a grid, all drawn into the
+ * same frame and shown with one swap. esshader_draw() shifts
+ * gl_FragCoord to the cell origin and makes iResolution the cell size,
+ * which all cells share, and only sends a program what changed since it
+ * last drew.
+*/
+struct cell {
+    const char *name;
+    GLuint program;         /* 0 if the shader did not build */
+    GLint x;
+    GLint y;
+    uint64_t last_ns;
+    uint64_t gpu_ns;
+    long timed;
+};
+
+static struct {
+    int count;
+    int columns;
+    int rows;
+    int last;               /* last cell with a program, its query ends last */
+    int frame_width;        /* render size the cells were laid out for */
+    int frame_height;
+    GLsizei width;
+    GLsizei height;
+    struct cell *cells;
+    GLuint *queries;        /* HUD_QUERIES frames of one per cell, NULL untimed */
+    bool pending[HUD_QUERIES];
+    int head;
+} mosaic = { .last = -1 };
+
+enum { SHOT_IDLE, SHOT_READING, SHOT_ENCODING };
+
+/*
+ * Screenshot in flight. The render thread only issues the read and,
+ * once its fence has passed, hands the mapped buffer to the encoder; the
+ * encoder flags done when the file is written and the buffer can go back.
+*/
+static struct {
+    int state;
+    GLsizei width;
+    GLsizei height;
+    unsigned char *pixels;
+    char path[64];
+    int done;
+#ifdef GLES3
+    GLuint pbo;
+    GLsizei pbo_width;
+    GLsizei pbo_height;
+    GLsync fence;
+#endif
+} screenshot;
 
 static double timespec_diff(const struct timespec *start, const struct timespec *stop){
     struct timespec d;
@@ -94,217 +330,1307 @@ static void monotonic_time(struct timespec *tp){
         die("clock_gettime on CLOCK_MONOTIC failed.\n");
 }
 
+/* A compiler or linker log, kept whole however many lines it has. */
+static void warn_lines(const char *text){
+    size_t len;
+
+    log_report_begin();
+    for (; *text; text += len + (text[len] == '\n')) {
+        len = strcspn(text, "\n");
+        if (len)
+            warning("%.*s\n", (int)len, text);
+    }
+    log_report_end();
+}
+
 static GLuint compile_shader(GLenum type, GLsizei nsources, const char **sources){
     GLuint shader;
     GLint success, len;
     GLsizei i, srclens[nsources];
+    struct timespec start, stop;
     char *log;
 
     for (i = 0; i < nsources; ++i)
         srclens[i] = (GLsizei)strlen(sources[i]);
 
+    monotonic_time(&start);
     shader = glCreateShader(type);
     glShaderSource(shader, nsources, sources, srclens);
     glCompileShader(shader);
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    monotonic_time(&stop);
+    metrics_compile(timespec_diff(&start, &stop));
     if (!success) {
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
         if (len > 1) {
             log = malloc(len);
             glGetShaderInfoLog(shader, len, NULL, log);
-            fprintf(stderr, "%s\n\n", log);
+            warn_lines(log);
             free(log);
         }
-        die("Error compiling shader.\n");
+        warning("Error compiling shader.\n");
+        glDeleteShader(shader);
+        return 0;
     }
 
     return shader;
 }
 
 
+static bool has_extension(const char *name){
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+
+    while (exts && (exts = strstr(exts, name))) {
+        if (exts[len] == ' ' || exts[len] == '\0')
+            return true;
+        exts += len;
+    }
+
+    return false;
+}
+
+/*
+ * Drivers do not tell how much memory a program takes; the size of its
+ * binary is the closest estimate there is, where it can be queried.
+*/
+static size_t program_size(GLuint program){
+    GLint len = 0;
+
+    if (gles_version >= 3 || has_extension("GL_OES_get_program_binary"))
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &len);
+
+    return len > 0 ? (size_t)len : 0;
+}
+
+/*
+ * Link and register a program, consuming both shaders. Like
+ * compile_shader() it returns 0 on failure, which callers that cannot
+ * go on without the program turn into die().
+*/
+static GLuint link_program(GLuint vtx, GLuint frag, const char *label,
+        void (*evict)(void *arg), void *arg){
+    GLuint program;
+    GLint success, len;
+    struct timespec start, stop;
+    char *log;
+
+    if (!vtx || !frag) {
+        glDeleteShader(vtx);
+        glDeleteShader(frag);
+        return 0;
+    }
+    monotonic_time(&start);
+    program = glCreateProgram();
+    glAttachShader(program, vtx);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    monotonic_time(&stop);
+    metrics_compile(timespec_diff(&start, &stop));
+    if (!success) {
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+        if (len > 1) {
+            log = malloc(len);
+            glGetProgramInfoLog(program, len, &len, log);
+            warn_lines(log);
+            free(log);
+        }
+        warning("Error linking shader program.\n");
+        glDeleteProgram(program);
+        program = 0;
+    }
+
+    glDeleteShader(vtx);
+    glDeleteShader(frag);
+    if (program)
+        gpumem_register(GPUMEM_PROGRAM, program, program_size(program), label, evict, arg);
+
+    return program;
+}
+
+/*
+ * Follow what the library holds after its targets changed: account for
+ * its objects as for our own and warn once if the driver made a target
+ * drop to another format.
+*/
+static void library_changed(void){
+    static const int kinds[] = {
+        [ESSHADER_TEXTURE] = GPUMEM_TEXTURE,
+        [ESSHADER_FRAMEBUFFER] = GPUMEM_FRAMEBUFFER,
+        [ESSHADER_BUFFER] = GPUMEM_BUFFER,
+        [ESSHADER_PROGRAM] = GPUMEM_PROGRAM,
+    };
+    const struct esshader_object *o;
+    struct esshader_target t;
+    int i;
+
+    for (i = 0; i < nlibrary_objects; ++i)
+        gpumem_unregister(kinds[library_objects[i].kind], library_objects[i].name);
+    nlibrary_objects = 0;
+    if (!context)
+        return;
+
+    nlibrary_objects = esshader_objects(context, library_objects, LIBRARY_OBJECTS);
+    if (nlibrary_objects > LIBRARY_OBJECTS)
+        nlibrary_objects = LIBRARY_OBJECTS;
+    for (i = 0; i < nlibrary_objects; ++i) {
+        o = &library_objects[i];
+        gpumem_register(kinds[o->kind], o->name,
+                o->kind == ESSHADER_PROGRAM ? program_size(o->name) : o->bytes,
+                o->label, NULL, NULL);
+    }
+
+    for (i = 0; i < 2 && !offscreen.warned; ++i) {
+        if (esshader_target(context, i, &t) && t.format != offscreen.format) {
+            warning("Unable to render into %s target as %s, using %s.\n", t.name,
+                    esshader_format_name(offscreen.format), esshader_format_name(t.format));
+            offscreen.warned = true;
+        }
+    }
+}
+
+/*
+ * Memory held by the image target and the traffic it causes per frame:
+ * one full write by its pass and one full read by whoever samples it.
+*/
+static void target_report(double fps){
+    struct esshader_target t;
+    double bytes;
+
+    if (!esshader_target(context, 0, &t))
+        return;
+    bytes = (double)t.width * t.height * t.bytes_per_pixel;
+    info("Target %s: %dx%d %s, %.0f KiB, %.2f MiB/frame",
+            t.name, t.width, t.height, esshader_format_name(t.format),
+            bytes / 1024.0, 2.0 * bytes / (1024.0 * 1024.0));
+    if (fps > 0.0)
+        info(", %.1f MiB/s at %.1f fps", 2.0 * bytes * fps / (1024.0 * 1024.0), fps);
+    info(".\n");
+}
+
+static uint64_t hash_file(FILE *file){
+    unsigned char buf[65536];
+    uint64_t hash = 14695981039346656037ull;
+    size_t n, i;
+
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        for (i = 0; i < n; ++i)
+            hash = (hash ^ buf[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+/*
+ * Where the compressed copy of an image lives: a pack named after the
+ * hash of the image contents under $XDG_CACHE_HOME/esshader. Returns
+ * false when there is no usable cache directory.
+*/
+static bool cache_path(const char *image, char *path, size_t size){
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[4096];
+    uint64_t hash;
+    FILE *file;
+
+    if (base && *base)
+        snprintf(dir, sizeof(dir), "%s", base);
+    else if (home && *home)
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else
+        return false;
+
+    mkdir(dir, 0755);
+    strncat(dir, "/esshader", sizeof(dir) - strlen(dir) - 1);
+    if (mkdir(dir, 0755) == -1 && access(dir, W_OK) == -1)
+        return false;
+
+    if (!(file = fopen(image, "rb")))
+        die("Unable to open image %s\n", image);
+    hash = hash_file(file);
+    fclose(file);
+
+    return snprintf(path, size, "%s/%016llx-etc1-%d.pack", dir,
+            (unsigned long long)hash, ETC1_CACHE_VERSION) < (int)size;
+}
+
+/*
+ * PNG channels are compressed to ETC1 once and kept as a one entry pack
+ * in the cache, so later runs start as fast as with a prebuilt pack.
+ * Without a cache the pack goes to an unlinked temporary file instead.
+*/
+static void channel_open_image(struct channel *ch, const char *image){
+    char path[4096], tmp[4096 + 32];
+    const char *name = "image";
+    struct timespec start, stop;
+    struct image img;
+    bool cached = cache_path(image, path, sizeof(path));
+    int fd;
+
+    if (cached && pack_open(&ch->pack, path) == 0) {
+        info("Using cached ETC1 copy of %s.\n", image);
+        return;
+    }
+
+    if (image_load_png(&img, image) == -1)
+        die("Unable to load image %s\n", image);
+    if (img.width > PACK_MAX_SIZE || img.height > PACK_MAX_SIZE)
+        die("Image %s is larger than %u pixels\n", image, PACK_MAX_SIZE);
+
+    if (cached) {
+        snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+    } else {
+        snprintf(tmp, sizeof(tmp), "%s/esshader-XXXXXX",
+                getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+        if ((fd = mkstemp(tmp)) == -1)
+            die("Unable to create temporary texture pack.\n");
+        close(fd);
+    }
+
+    monotonic_time(&start);
+    if (pack_write(tmp, &name, &img, 1, PACK_ETC1, 1,
+                (int)sysconf(_SC_NPROCESSORS_ONLN)) == -1)
+        die("Unable to write texture pack %s\n", tmp);
+    monotonic_time(&stop);
+    info("Compressed %s (%ux%u) to ETC1 in %.2fs.\n", image, img.width, img.height,
+            timespec_diff(&start, &stop));
+    image_free(&img);
+
+    if (cached && rename(tmp, path) == 0) {
+        if (pack_open(&ch->pack, path) == -1)
+            die("Unable to open texture pack %s\n", path);
+        return;
+    }
+
+    if (pack_open(&ch->pack, tmp) == -1)
+        die("Unable to open texture pack %s\n", tmp);
+    unlink(tmp);
+}
+
+/*
+ * Parse a channel source: feedback, a PNG image or file.pack[:name],
+ * optionally followed by ,nearest ,linear or ,mipmap. Without a name the
+ * first entry of the pack is used.
+*/
+static void channel_open(int index, const char *source){
+    struct channel *ch = &channels[index];
+    const char *name = NULL;
+    char path[4096];
+    size_t len = strlen(source);
+    const char *sep = strrchr(source, ':');
+    const char *comma = strrchr(source, ',');
+    int f;
+
+    ch->filter = FILTER_DEFAULT;
+    if (comma) {
+        for (f = FILTER_NEAREST; f <= FILTER_MIPMAP; ++f)
+            if (!strcmp(comma + 1, filter_names[f]))
+                ch->filter = f;
+        if (ch->filter == FILTER_DEFAULT)
+            die("Unknown channel filter %s\n", comma + 1);
+        len = (size_t)(comma - source);
+    }
+
+    if (len == 8 && !strncmp(source, "keyboard", len)) {
+        ch->kind = CHANNEL_KEYBOARD;
+        ch->source = source;
+        ch->width = 256;
+        ch->height = 3;
+        if (ch->filter == FILTER_DEFAULT)
+            ch->filter = FILTER_NEAREST;
+        keyboard.enabled = true;
+        return;
+    }
+
+    if (len == 8 && !strncmp(source, "feedback", len)) {
+        ch->kind = CHANNEL_FEEDBACK;
+        ch->source = source;
+        if (ch->filter == FILTER_DEFAULT)
+            ch->filter = FILTER_LINEAR;
+        if (ch->filter == FILTER_MIPMAP)
+            offscreen.flags |= ESSHADER_MIPMAPPED;
+        return;
+    }
+
+    if (len > 4 && !strncmp(source + len - 4, ".png", 4)) {
+        channel_open_image(ch, source);
+    } else {
+        if (sep && sep > source && sep < source + len &&
+                strstr(source, ".pack") && strstr(source, ".pack") < sep) {
+            name = sep + 1;
+            len = (size_t)(sep - source);
+        }
+        if (len >= sizeof(path))
+            die("Channel source too long: %s\n", source);
+        memcpy(path, source, len);
+        path[len] = '\0';
+
+        if (pack_open(&ch->pack, path) == -1)
+            die("Unable to open texture pack %s\n", path);
+    }
+
+    if (name && comma && comma > name) {
+        len = (size_t)(comma - name);
+        if (len >= sizeof(path))
+            die("Channel source too long: %s\n", source);
+        memcpy(path, name, len);
+        path[len] = '\0';
+        name = path;
+    }
+    if (!(ch->entry = pack_find(&ch->pack, name)))
+        die("No texture %s in channel source %s\n", name ? name : "", source);
+    if (ch->filter == FILTER_DEFAULT)
+        ch->filter = ch->entry->levels > 1 ? FILTER_MIPMAP : FILTER_LINEAR;
+
+    ch->kind = CHANNEL_PACK;
+    ch->source = source;
+    ch->width = (GLsizei)ch->entry->level[0].width;
+    ch->height = (GLsizei)ch->entry->level[0].height;
+}
+
+static GLenum min_filter(int filter){
+    switch (filter) {
+        case FILTER_NEAREST:
+            return GL_NEAREST;
+        case FILTER_MIPMAP:
+            return GL_LINEAR_MIPMAP_LINEAR;
+        default:
+            return GL_LINEAR;
+    }
+}
+
+/*
+ * The contents of a dynamic channel moved on. A naive viewer rebuilds
+ * the mipmaps right here; we only note that the chain is stale and let
+ * bind_channels() rebuild it if a mipmapped sampler looks at it before
+ * the next change. Everything else counts as a skipped rebuild.
+*/
+static void channel_changed(struct channel *ch){
+    if (ch->filter != FILTER_MIPMAP || ch->dirty)
+        ch->mip_skips++;
+    ch->dirty = ch->filter == FILTER_MIPMAP;
+}
+
+static void channel_evict(void *arg){
+    struct channel *ch = arg;
+
+    glDeleteTextures(1, &ch->texture);
+    ch->texture = 0;
+}
+
+static GLenum etc1_internal_format(void){
+    if (has_extension("GL_OES_compressed_ETC1_RGB8_texture"))
+        return GL_ETC1_RGB8_OES;
+#ifdef GLES3
+    /* ETC2 decoders accept every ETC1 block unchanged */
+    if (gles_version >= 3)
+        return GL_COMPRESSED_RGB8_ETC2;
+#endif
+    return 0;
+}
+
+/*
+ * Upload a pack entry straight from the mapping. ES 2.0 without
+ * OES_texture_npot cannot mipmap or repeat non power of two textures,
+ * those only get their base level and clamp to the edge.
+*/
+static void channel_upload(int index){
+    struct channel *ch = &channels[index];
+    const struct pack_entry *e = ch->entry;
+    const struct pack_level *l;
+    const unsigned char *data;
+    GLsizei levels = (GLsizei)e->levels, i;
+    GLenum etc1 = 0;
+    bool pot = !(ch->width & (ch->width - 1)) && !(ch->height & (ch->height - 1));
+    bool npot_limited = !pot && gles_version < 3 && !has_extension("GL_OES_texture_npot");
+    size_t bytes = 0;
+
+    if (e->format == PACK_ETC1 && !(etc1 = etc1_internal_format()))
+        die("ETC1 textures are not supported by this driver.\n");
+    if (npot_limited || ch->filter != FILTER_MIPMAP)
+        levels = 1;
+    if (ch->filter == FILTER_MIPMAP && levels == 1 && (npot_limited || e->format == PACK_ETC1)) {
+        warning("Cannot mipmap channel %d, using linear filtering.\n", index);
+        ch->filter = FILTER_LINEAR;
+    }
+
+    glGenTextures(1, &ch->texture);
+    glBindTexture(GL_TEXTURE_2D, ch->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (i = 0; i < levels; ++i) {
+        l = &e->level[i];
+        data = ch->pack.data + l->offset;
+        switch (e->format) {
+            case PACK_RGBA8:
+                glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, l->width, l->height, 0,
+                        GL_RGBA, GL_UNSIGNED_BYTE, data);
+                break;
+            case PACK_RGB565:
+                glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, l->width, l->height, 0,
+                        GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+                break;
+            case PACK_ETC1:
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, etc1, l->width, l->height, 0,
+                        (GLsizei)l->size, data);
+                break;
+        }
+        bytes += l->size;
+    }
+
+    /* single level packs get their chain built on first use */
+    if (ch->filter == FILTER_MIPMAP && levels == 1) {
+        ch->dirty = true;
+        bytes += bytes / 3;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter(ch->filter));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+            ch->filter == FILTER_NEAREST ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, npot_limited ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, npot_limited ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+
+    gpumem_register(GPUMEM_TEXTURE, ch->texture, bytes, ch->source, channel_evict, ch);
+}
+
+static int js_key_code(KeySym sym){
+    size_t i;
+
+    if (sym >= XK_a && sym <= XK_z)
+        return (int)(sym - XK_a) + 'A';
+    if (sym >= XK_0 && sym <= XK_9)
+        return (int)sym;
+    if (sym >= XK_KP_0 && sym <= XK_KP_9)
+        return (int)(sym - XK_KP_0) + 96;
+    if (sym >= XK_F1 && sym <= XK_F12)
+        return (int)(sym - XK_F1) + 112;
+    for (i = 0; i < sizeof(key_codes) / sizeof(*key_codes); ++i)
+        if (key_codes[i].sym == sym)
+            return key_codes[i].code;
+
+    return -1;
+}
+
+static void keyboard_dirty(int first, int last){
+    if (keyboard.dirty_first > keyboard.dirty_last) {
+        keyboard.dirty_first = first;
+        keyboard.dirty_last = last;
+        return;
+    }
+    if (first < keyboard.dirty_first)
+        keyboard.dirty_first = first;
+    if (last > keyboard.dirty_last)
+        keyboard.dirty_last = last;
+}
+
+static void keyboard_event(KeySym sym, bool down){
+    int code = js_key_code(sym);
+
+    if (!keyboard.enabled || code < 0 || !keyboard.state[0][code] == !down)
+        return;
+
+    keyboard.state[0][code] = down ? 255 : 0;
+    if (down) {
+        keyboard.state[1][code] = 255;
+        keyboard.state[2][code] ^= 255;
+        keyboard.pressed = true;
+        keyboard_dirty(0, 2);
+    } else {
+        keyboard_dirty(0, 0);
+    }
+}
+
+/* Pressed only lasts for the frame that first sees the key go down. */
+static void keyboard_frame_done(void){
+    if (!keyboard.pressed)
+        return;
+    memset(keyboard.state[1], 0, sizeof(keyboard.state[1]));
+    keyboard.pressed = false;
+    keyboard_dirty(1, 1);
+}
+
+/*
+ * Send the changed rows to the GPU in a single sub-image upload. Returns
+ * whether the texture contents changed.
+*/
+static bool keyboard_upload(void){
+    if (!keyboard.texture) {
+        glGenTextures(1, &keyboard.texture);
+        glBindTexture(GL_TEXTURE_2D, keyboard.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 256, 3, 0,
+                GL_LUMINANCE, GL_UNSIGNED_BYTE, keyboard.state);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        gpumem_register(GPUMEM_TEXTURE, keyboard.texture, sizeof(keyboard.state),
+                "keyboard", NULL, NULL);
+    } else if (keyboard.dirty_first <= keyboard.dirty_last) {
+        glBindTexture(GL_TEXTURE_2D, keyboard.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, keyboard.dirty_first, 256,
+                keyboard.dirty_last - keyboard.dirty_first + 1,
+                GL_LUMINANCE, GL_UNSIGNED_BYTE, keyboard.state[keyboard.dirty_first]);
+    } else {
+        return false;
+    }
+
+    keyboard.uploads++;
+    keyboard.dirty_first = 3;
+    keyboard.dirty_last = 0;
+    return true;
+}
+
+/*
+ * Hand the library every channel a program samples, uploading those
+ * that are not resident and rebuilding stale mipmap chains. Unsampled
+ * channels are never uploaded nor mipmapped at all, only their size is
+ * reported.
+*/
+static void bind_channels(void){
+    struct channel *ch;
+    int i;
+
+    if (keyboard.enabled && keyboard_upload())
+        for (i = 0; i < 4; ++i)
+            if (channels[i].kind == CHANNEL_KEYBOARD)
+                channel_changed(&channels[i]);
+
+    for (i = 0; i < 4; ++i) {
+        ch = &channels[i];
+        if (ch->kind == CHANNEL_NONE)
+            continue;
+        if (ch->kind == CHANNEL_FEEDBACK)
+            esshader_size(context, &ch->width, &ch->height);
+        if (!esshader_sampled(context, i)) {
+            esshader_channel(context, i, 0, ch->width, ch->height);
+            continue;
+        }
+
+        if (ch->kind == CHANNEL_KEYBOARD || ch->kind == CHANNEL_FEEDBACK) {
+            /* the feedback texture is shared with the blit, which resets it */
+            ch->texture = ch->kind == CHANNEL_KEYBOARD ? keyboard.texture : esshader_feedback(context);
+            glBindTexture(GL_TEXTURE_2D, ch->texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter(ch->filter));
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                    ch->filter == FILTER_NEAREST ? GL_NEAREST : GL_LINEAR);
+        } else if (!ch->texture) {
+            channel_upload(i);
+        } else if (ch->dirty) {
+            glBindTexture(GL_TEXTURE_2D, ch->texture);
+        }
+        gpumem_touch(GPUMEM_TEXTURE, ch->texture);
+
+        if (ch->dirty) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            ch->dirty = false;
+            ch->mip_builds++;
+        }
+        esshader_channel(context, i, ch->texture, ch->width, ch->height);
+    }
+}
+
+static void report_channels(void){
+    int i;
+
+    if (keyboard.enabled)
+        info("Keyboard texture: %lu uploads.\n", keyboard.uploads);
+
+    for (i = 0; i < 4; ++i)
+        if (channels[i].kind == CHANNEL_FEEDBACK || channels[i].mip_builds)
+            info("Channel %d (%s): %lu mipmap builds, %lu skipped.\n", i,
+                    channels[i].source, channels[i].mip_builds, channels[i].mip_skips);
+}
+
 static void resize_viewport(GLsizei w, GLsizei h){
     if (viewport_width != w || viewport_height != h) {
-        glUniform3f(uniform_res, (float)w, (float)h, 0.0f);
-        glViewport(0, 0, w, h);
+        if (esshader_resize(context, w, h))
+            die("%s.\n", esshader_error(context));
+        library_changed();
+        target_report(0.0);
         viewport_width = w;
         viewport_height = h;
         info("Setting window size to (%d,%d).\n", w, h);
     }
 }
 
-static void startup(int width, int height, bool fullscreen)
-{
-    static const EGLint cv[] = {
-        EGL_CONTEXT_CLIENT_VERSION, 2,
-        EGL_NONE
-    };
-
-    int screen, nvi;
-    XWindowAttributes gwa;
-    XSetWindowAttributes swa;
-    XVisualInfo *vi, vit;
-    EGLint vid, ncfg, len, success;
-    EGLConfig cfg;
-    GLuint vtx, frag;
-    const char *sources[4];
-    char* log;
+static void readback_init(GLsizei w, GLsizei h){
+    readback.width = w;
+    readback.height = h;
+    readback.head = 0;
+    readback.count = 0;
+
+#ifdef GLES3
+    if (gles_version >= 3) {
+        int i;
+
+        glGenBuffers(READBACK_DEPTH, readback.pbo);
+        for (i = 0; i < READBACK_DEPTH; ++i) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, NULL, GL_STREAM_READ);
+            gpumem_register(GPUMEM_BUFFER, readback.pbo[i], (size_t)w * h * 4,
+                    "readback", NULL, NULL);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+#endif
 
-    if (!(x_display = XOpenDisplay(NULL)))
-        die("Unable to open X display.\n");
+    if (!(readback.pixels = malloc((size_t)w * h * 4)))
+        die("Unable to allocate readback buffer.\n");
+}
 
-    if ((egl_display = eglGetDisplay(x_display)) == EGL_NO_DISPLAY)
-        die("Unable to get EGL display.\n");
+/*
+ * Queue a read of the current back buffer. On ES 3.0 this only records
+ * a copy into a pixel pack buffer and a fence, so the CPU does not wait
+ * for the GPU; ES 2.0 has no such thing and reads synchronously.
+*/
+static void readback_issue(void){
+#ifdef GLES3
+    if (gles_version >= 3) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo[readback.head]);
+        glReadPixels(0, 0, readback.width, readback.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.fence[readback.head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gpumem_register(GPUMEM_SYNC, SYNC_READBACK + readback.head, 0, "readback", NULL, NULL);
+        readback.head = (readback.head + 1) % READBACK_DEPTH;
+        readback.count++;
+        return;
+    }
+#endif
 
-    if (!eglBindAPI(EGL_OPENGL_ES_API))
-        die("Unable to bind OpenGL ES API to EGL.\n");
+    glReadPixels(0, 0, readback.width, readback.height, GL_RGBA, GL_UNSIGNED_BYTE, readback.pixels);
+    readback.count = 1;
+}
 
-    if (!eglInitialize(egl_display, NULL, NULL))
-        die("Unable to initialize EGL.\n");
+/*
+ * Return the oldest finished frame, or NULL when there is none yet. A
+ * frame is only waited for when wait is set or the ring is full.
+ * Every non-NULL return must be paired with readback_unmap().
+*/
+static const unsigned char *readback_map(bool wait){
+    if (readback.count == 0)
+        return NULL;
+
+#ifdef GLES3
+    if (gles_version >= 3) {
+        int tail = (readback.head - readback.count + READBACK_DEPTH) % READBACK_DEPTH;
+
+        if (!wait && readback.count < READBACK_DEPTH &&
+                glClientWaitSync(readback.fence[tail], 0, 0) == GL_TIMEOUT_EXPIRED)
+            return NULL;
 
-    if (!eglChooseConfig(egl_display, egl_config, &cfg, 1, &ncfg))
-        die("Unable to find EGL framebuffer configuration.\n");
+        glDeleteSync(readback.fence[tail]);
+        gpumem_unregister(GPUMEM_SYNC, SYNC_READBACK + tail);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo[tail]);
+        return glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                (GLsizeiptr)readback.width * readback.height * 4, GL_MAP_READ_BIT);
+    }
+#endif
 
-    egl_context = eglCreateContext(egl_display, cfg, EGL_NO_CONTEXT, cv);
-    if (egl_context == EGL_NO_CONTEXT)
-        die("Unable to create EGL context.\n");
+    return readback.pixels;
+}
 
-    if (!eglGetConfigAttrib(egl_display, cfg, EGL_NATIVE_VISUAL_ID, &vid))
-        die("Unable to get X VisualID.\n");
+static void readback_unmap(void){
+#ifdef GLES3
+    if (gles_version >= 3) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+#endif
+    readback.count--;
+}
 
-    screen = DefaultScreen(x_display);
-    x_root = RootWindow(x_display, screen);
+static void readback_cleanup(void){
+#ifdef GLES3
+    if (gles_version >= 3 && readback.width) {
+        int i;
 
-    vit.visualid = vid;
-    if (!(vi = XGetVisualInfo(x_display, VisualIDMask, &vit, &nvi)))
-        die("Unable to find matching XVisualInfo for framebuffer.\n");
+        //Frames never mapped still hold their fences
+        for (; readback.count > 0; readback.count--) {
+            i = (readback.head - readback.count + READBACK_DEPTH) % READBACK_DEPTH;
+            glDeleteSync(readback.fence[i]);
+            gpumem_unregister(GPUMEM_SYNC, SYNC_READBACK + i);
+        }
+        for (i = 0; i < READBACK_DEPTH; ++i)
+            gpumem_unregister(GPUMEM_BUFFER, readback.pbo[i]);
+        glDeleteBuffers(READBACK_DEPTH, readback.pbo);
+    }
+#endif
+    free(readback.pixels);
+    readback.pixels = NULL;
+    readback.width = 0;
+}
 
-    swa.background_pixel = 0;
-    swa.colormap = XCreateColormap(x_display, x_root, vi->visual, AllocNone);
-    swa.event_mask =
-        ExposureMask | StructureNotifyMask |
-        KeyPressMask | PointerMotionMask;
-    swa.override_redirect = False;
+/* Load the timer query entry points once, false without the extension */
+static bool timer_init(void){
+    if (timer.loaded)
+        return timer.available;
+    timer.loaded = true;
+    if (!has_extension("GL_EXT_disjoint_timer_query"))
+        return false;
+    timer.gen_queries = (gen_queries_fn)eglGetProcAddress("glGenQueriesEXT");
+    timer.delete_queries = (delete_queries_fn)eglGetProcAddress("glDeleteQueriesEXT");
+    timer.begin_query = (begin_query_fn)eglGetProcAddress("glBeginQueryEXT");
+    timer.end_query = (end_query_fn)eglGetProcAddress("glEndQueryEXT");
+    timer.get_query_uiv = (get_query_uiv_fn)eglGetProcAddress("glGetQueryObjectuivEXT");
+    timer.get_query_ui64v = (get_query_ui64v_fn)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    timer.available = timer.gen_queries && timer.delete_queries && timer.begin_query &&
+        timer.end_query && timer.get_query_uiv && timer.get_query_ui64v;
+    return timer.available;
+}
 
-    int window_width = width;
-    int window_height = height;
-    
-    if(fullscreen) {
-        window_width = DisplayWidth(x_display, screen);
-        window_height = DisplayHeight(x_display, screen);
-        //Setting swa.override_redirect to True would result a "real" fullscreen window
-        //BUT: On multiscreen systems it would stretch over all displays 
-        //AND: Keyboard commands aren't processed anymore
-        //MAYBE: Switch to glfw or something similar to create the window. As a neat side effect the app would run on Windows too.
-        //swa.override_redirect = True;
-    }
+/* Queries are registered so that soak testing sees them pile up. */
+static void queries_gen(GLsizei n, GLuint *ids, const char *label){
+    GLsizei i;
 
-    x_window = XCreateWindow(x_display, x_root, 0, 0,
-            window_width,
-            window_height,
-            0, vi->depth, InputOutput, vi->visual,
-            CWBackPixel | CWColormap | CWEventMask |
-            CWOverrideRedirect, &swa);
+    timer.gen_queries(n, ids);
+    for (i = 0; i < n; ++i)
+        gpumem_register(GPUMEM_QUERY, ids[i], 0, label, NULL, NULL);
+}
 
-    XStoreName(x_display, x_window, "esshader");
-    XMapWindow(x_display, x_window);
-    XFlush(x_display);
+static void queries_delete(GLsizei n, const GLuint *ids){
+    GLsizei i;
 
-    egl_surface = eglCreateWindowSurface(egl_display, cfg, x_window, NULL);
-    if (egl_surface == EGL_NO_SURFACE)
-        die("Unable to create EGL window surface.\n");
+    for (i = 0; i < n; ++i)
+        gpumem_unregister(GPUMEM_QUERY, ids[i]);
+    timer.delete_queries(n, ids);
+}
 
-    eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context);
+static void overlay_init(void){
+    unsigned char pixels[HUD_FONT_WIDTH * HUD_FONT_HEIGHT];
+    const char *sources[2];
+    GLuint vtx, frag;
+    int i;
 
     sources[0] = common_shader_header;
-    sources[1] = vertex_shader_body;
+    sources[1] = hud_vertex_shader_body;
     vtx = compile_shader(GL_VERTEX_SHADER, 2, sources);
+    sources[1] = hud_fragment_shader_body;
+    frag = compile_shader(GL_FRAGMENT_SHADER, 2, sources);
+    if (!(overlay.program = link_program(vtx, frag, "hud", NULL, NULL)))
+        die("Unable to build the overlay program.\n");
+    overlay.position = glGetAttribLocation(overlay.program, "position");
+    overlay.texcoord = glGetAttribLocation(overlay.program, "texcoord");
+    overlay.color = glGetAttribLocation(overlay.program, "color");
+    overlay.size = glGetUniformLocation(overlay.program, "size");
+
+    hud_font(pixels);
+    glGenTextures(1, &overlay.texture);
+    glBindTexture(GL_TEXTURE_2D, overlay.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, HUD_FONT_WIDTH, HUD_FONT_HEIGHT, 0,
+            GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gpumem_register(GPUMEM_TEXTURE, overlay.texture, sizeof(pixels), "hud font", NULL, NULL);
+
+    if ((overlay.timer = timer_init())) {
+        for (i = 0; i < HUD_QUERIES; ++i)
+            queries_gen(2, overlay.queries[i], "hud timer");
+    } else {
+        warning("GL_EXT_disjoint_timer_query unavailable, no GPU times in the overlay.\n");
+    }
 
-    sources[0] = common_shader_header;
-    sources[1] = fragment_shader_header;
-    sources[2] = default_fragment_shader;
-    sources[3] = fragment_shader_footer;
-    frag = compile_shader(GL_FRAGMENT_SHADER, 4, sources);
+    monotonic_time(&overlay.last_frame);
+}
 
-    shader_program = glCreateProgram();
-    glAttachShader(shader_program, vtx);
-    glAttachShader(shader_program, frag);
-    glLinkProgram(shader_program);
+static void overlay_toggle(void){
+    overlay.enabled = !overlay.enabled;
+    if (overlay.enabled && !overlay.program)
+        overlay_init();
+}
 
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramiv(shader_program, GL_INFO_LOG_LENGTH, &len);
-        if (len > 1) {
-            log = malloc(len);
-            glGetProgramInfoLog(shader_program, len, &len, log);
-            fprintf(stderr, "%s\n\n", log);
-            free(log);
+/*
+ * Pick up the oldest frame's timer results if the GPU is done with them,
+ * never waiting. Results spanning a disjoint event are meaningless and
+ * thrown away.
+*/
+static void overlay_collect(void){
+    int slot = overlay.head;
+    GLuint available = 0;
+    uint64_t scene, hud;
+    GLint disjoint = 0;
+
+    if (!overlay.pending[slot])
+        return;
+    timer.get_query_uiv(overlay.queries[slot][1], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if (!available)
+        return;
+
+    if (!mosaic.count)
+        timer.get_query_ui64v(overlay.queries[slot][0], GL_QUERY_RESULT_EXT, &scene);
+    timer.get_query_ui64v(overlay.queries[slot][1], GL_QUERY_RESULT_EXT, &hud);
+    overlay.pending[slot] = false;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (!disjoint) {
+        if (!mosaic.count)
+            overlay.gpu_ms = scene / 1e6;
+        overlay.hud_ms = hud / 1e6;
+    }
+}
+
+static void overlay_begin(void){
+    monotonic_time(&overlay.frame_start);
+    if (!overlay.timer)
+        return;
+
+    overlay.head = (overlay.head + 1) % HUD_QUERIES;
+    overlay_collect();
+    /* the GPU lags by more than the ring, skip timing this frame; a
+     * mosaic times its cells itself and queries cannot nest */
+    if (overlay.pending[overlay.head] || mosaic.count)
+        return;
+    timer.begin_query(GL_TIME_ELAPSED_EXT, overlay.queries[overlay.head][0]);
+}
+
+static void overlay_scene_done(void){
+    if (overlay.timer && !overlay.pending[overlay.head] && !mosaic.count)
+        timer.end_query(GL_TIME_ELAPSED_EXT);
+}
+
+/*
+ * Draw the overlay on top of the finished frame as one triangle list,
+ * timing that draw separately so its own cost shows up as well.
+*/
+static void overlay_draw(void){
+    struct hud_vertex *v = overlay.vertices;
+    bool timed = overlay.timer && !overlay.pending[overlay.head];
+    struct timespec now;
+    int n;
+
+    monotonic_time(&now);
+    hud_sample(timespec_diff(&overlay.last_frame, &now) * 1000.0,
+            timespec_diff(&overlay.frame_start, &now) * 1000.0,
+            overlay.gpu_ms, overlay.hud_ms);
+    overlay.last_frame = now;
+    n = hud_build(v, viewport_width, viewport_height);
+
+    if (timed)
+        timer.begin_query(GL_TIME_ELAPSED_EXT, overlay.queries[overlay.head][1]);
+    glViewport(0, 0, viewport_width, viewport_height);
+    glUseProgram(overlay.program);
+    glUniform2f(overlay.size, (float)viewport_width, (float)viewport_height);
+    glBindTexture(GL_TEXTURE_2D, overlay.texture);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnableVertexAttribArray(overlay.position);
+    glEnableVertexAttribArray(overlay.texcoord);
+    glEnableVertexAttribArray(overlay.color);
+    glVertexAttribPointer(overlay.position, 2, GL_FLOAT, GL_FALSE, sizeof(*v), &v->x);
+    glVertexAttribPointer(overlay.texcoord, 2, GL_FLOAT, GL_FALSE, sizeof(*v), &v->u);
+    glVertexAttribPointer(overlay.color, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(*v), v->color);
+    glDrawArrays(GL_TRIANGLES, 0, n);
+    glDisableVertexAttribArray(overlay.texcoord);
+    glDisableVertexAttribArray(overlay.color);
+    glDisableVertexAttribArray(overlay.position);
+    glDisable(GL_BLEND);
+    if (timed) {
+        timer.end_query(GL_TIME_ELAPSED_EXT);
+        overlay.pending[overlay.head] = true;
+    }
+}
+
+static void overlay_cleanup(void){
+    int i;
+
+    if (!overlay.program)
+        return;
+    if (overlay.timer)
+        for (i = 0; i < HUD_QUERIES; ++i)
+            queries_delete(2, overlay.queries[i]);
+    gpumem_unregister(GPUMEM_TEXTURE, overlay.texture);
+    glDeleteTextures(1, &overlay.texture);
+    gpumem_unregister(GPUMEM_PROGRAM, overlay.program);
+    glDeleteProgram(overlay.program);
+}
+
+static void screenshot_written(void *arg){
+    (void)arg;
+    __atomic_store_n(&screenshot.done, 1, __ATOMIC_RELEASE);
+}
+
+static void screenshot_encode(const unsigned char *pixels){
+    if (!encoder_running) {
+        encoder_start(1, 2);
+        encoder_running = true;
+    }
+    screenshot.done = 0;
+    screenshot.state = SHOT_ENCODING;
+    if (encoder_submit(screenshot.path, screenshot.width, screenshot.height, pixels,
+                false, screenshot_written, NULL)) {
+        warning("Encoder busy, dropping screenshot %s.\n", screenshot.path);
+        screenshot.path[0] = '\0';
+        screenshot.done = 1;
+    }
+}
+
+/*
+ * Start reading the frame just drawn. Only one screenshot is taken at a
+ * time, further requests wait for it to finish.
+*/
+static void screenshot_issue(void){
+    struct tm tm;
+    struct timespec ts;
+
+    if (screenshot.state != SHOT_IDLE)
+        return;
+    screenshot_requested = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(screenshot.path, sizeof(screenshot.path), "esshader-%Y%m%d-%H%M%S", &tm);
+    snprintf(screenshot.path + strlen(screenshot.path), sizeof(screenshot.path) - strlen(screenshot.path),
+            "-%03ld.png", ts.tv_nsec / 1000000);
+    screenshot.width = viewport_width;
+    screenshot.height = viewport_height;
+
+#ifdef GLES3
+    if (gles_version >= 3) {
+        if (screenshot.pbo && (screenshot.pbo_width != viewport_width ||
+                    screenshot.pbo_height != viewport_height)) {
+            gpumem_unregister(GPUMEM_BUFFER, screenshot.pbo);
+            glDeleteBuffers(1, &screenshot.pbo);
+            screenshot.pbo = 0;
+        }
+        if (!screenshot.pbo) {
+            glGenBuffers(1, &screenshot.pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)viewport_width * viewport_height * 4,
+                    NULL, GL_STREAM_READ);
+            gpumem_register(GPUMEM_BUFFER, screenshot.pbo, (size_t)viewport_width * viewport_height * 4,
+                    "screenshot", NULL, NULL);
+            screenshot.pbo_width = viewport_width;
+            screenshot.pbo_height = viewport_height;
         }
-        die("Error linking shader program.\n");
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+        glReadPixels(0, 0, viewport_width, viewport_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        screenshot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gpumem_register(GPUMEM_SYNC, SYNC_SCREENSHOT, 0, "screenshot", NULL, NULL);
+        screenshot.state = SHOT_READING;
+        return;
     }
+#endif
+
+    //ES 2.0 cannot read asynchronously, only the encoding moves off thread
+    if (!(screenshot.pixels = malloc((size_t)viewport_width * viewport_height * 4)))
+        die("Unable to allocate screenshot buffer.\n");
+    glReadPixels(0, 0, viewport_width, viewport_height, GL_RGBA, GL_UNSIGNED_BYTE, screenshot.pixels);
+    screenshot_encode(screenshot.pixels);
+}
+
+/* Move a screenshot along without ever waiting on the GPU or the encoder. */
+static void screenshot_poll(void){
+#ifdef GLES3
+    if (screenshot.state == SHOT_READING) {
+        const unsigned char *pixels;
+
+        if (glClientWaitSync(screenshot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(screenshot.fence);
+        gpumem_unregister(GPUMEM_SYNC, SYNC_SCREENSHOT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+        pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                (GLsizeiptr)screenshot.width * screenshot.height * 4, GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!pixels) {
+            //Start over with a fresh buffer next time
+            warning("Unable to map the readback, dropping screenshot %s.\n", screenshot.path);
+            gpumem_unregister(GPUMEM_BUFFER, screenshot.pbo);
+            glDeleteBuffers(1, &screenshot.pbo);
+            screenshot.pbo = 0;
+            screenshot.state = SHOT_IDLE;
+            return;
+        }
+        screenshot_encode(pixels);
+        return;
+    }
+#endif
+
+    if (screenshot.state != SHOT_ENCODING || !__atomic_load_n(&screenshot.done, __ATOMIC_ACQUIRE))
+        return;
+
+    if (screenshot.path[0])
+        info("Saved screenshot %s.\n", screenshot.path);
+#ifdef GLES3
+    if (gles_version >= 3) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshot.pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+#endif
+    free(screenshot.pixels);
+    screenshot.pixels = NULL;
+    screenshot.state = SHOT_IDLE;
+}
+
+/* At exit, a read still in flight is waited for and handed on. */
+static void screenshot_flush(void){
+#ifdef GLES3
+    if (screenshot.state == SHOT_READING) {
+        glClientWaitSync(screenshot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        screenshot_poll();
+    }
+#endif
+}
+
+/* Called once the encoder has been stopped, so nothing uses the buffer. */
+static void screenshot_cleanup(void){
+    screenshot_poll();
+#ifdef GLES3
+    if (screenshot.pbo) {
+        gpumem_unregister(GPUMEM_BUFFER, screenshot.pbo);
+        glDeleteBuffers(1, &screenshot.pbo);
+    }
+#endif
+}
+
+/* Build the image pass around a ShaderToy mainImage(), 0 if it fails. */
+static GLuint build_image_program(const char *source, const char *label,
+        void (*evict)(void *arg), void *arg){
+    struct timespec start, stop;
+    GLuint program;
+
+    monotonic_time(&start);
+    program = esshader_program(context, source);
+    monotonic_time(&stop);
+    metrics_compile(timespec_diff(&start, &stop));
+    if (!program) {
+        warn_lines(esshader_error(context));
+        warning("Error building shader program.\n");
+        return 0;
+    }
+    gpumem_register(GPUMEM_PROGRAM, program, program_size(program), label, evict, arg);
+
+    return program;
+}
+
+/* Make program the image pass, the library keeps its uniform locations. */
+static void use_image_program(GLuint program){
+    if (esshader_use(context, program))
+        die("%s.\n", esshader_error(context));
+    shader_program = program;
+    gpumem_touch(GPUMEM_PROGRAM, program);
+}
+
+static void startup(int width, int height, bool fullscreen, bool gles3)
+{
+    struct esshader_native native;
+    XWindowAttributes gwa;
+    GLuint program;
+    const char *error;
+    char path[1024];
+    int flags;
+
+    flags = (headless ? ESSHADER_HEADLESS : 0) | (gles3 ? ESSHADER_GLES3 : 0) |
+        (fullscreen ? ESSHADER_FULLSCREEN : 0);
+    if (trace_path) {
+        //Workers of a farm each keep their own trace
+        if (worker >= 0)
+            snprintf(path, sizeof(path), "%s.%d", trace_path, worker);
+        else
+            snprintf(path, sizeof(path), "%s", trace_path);
+        if (trace_open(path, width, height, flags) == -1)
+            die("Unable to create trace %s.\n", path);
+        info("Tracing GL calls to %s.\n", path);
+    }
+
+    context = esshader_create(width, height, flags, egl_config, &error);
+    if (!context)
+        die("%s.\n", error);
+
+    //The library renders; input, channels and the overlay are ours
+    esshader_native(context, &native);
+    gles_version = native.gles_version;
+    //Without this, held keys produce release/press pairs that would
+    //flicker through a keyboard texture
+    if (native.x_display)
+        XkbSetDetectableAutoRepeat(native.x_display, True, NULL);
+#ifdef GLES3
+    if (gles3 && gles_version < 3)
+        warning("OpenGL ES 3.0 unavailable, falling back to OpenGL ES 2.0.\n");
+#else
+    if (gles3)
+        warning("Built without OpenGL ES 3.0 support, using OpenGL ES 2.0.\n");
+#endif
+    info("Using OpenGL ES %d.0.\n", gles_version);
+
+    if (offscreen.format >= 0 &&
+            esshader_offscreen(context, offscreen.format, offscreen.scale, offscreen.flags)) {
+        warn_lines(esshader_error(context));
+        die("Unable to render offscreen.\n");
+    }
+
+    if (!(program = build_image_program(default_fragment_shader, "image", NULL, NULL)))
+        die("Unable to build the shader program.\n");
+    use_image_program(program);
 
-    glDeleteShader(vtx);
-    glDeleteShader(frag);
     glReleaseShaderCompiler();
 
-    glUseProgram(shader_program);
-    glValidateProgram(shader_program);
-
-    attrib_position = glGetAttribLocation(shader_program, "iPosition");
-    sampler_channel[0] = glGetUniformLocation(shader_program, "iChannel0");
-    sampler_channel[1] = glGetUniformLocation(shader_program, "iChannel1");
-    sampler_channel[2] = glGetUniformLocation(shader_program, "iChannel2");
-    sampler_channel[3] = glGetUniformLocation(shader_program, "iChannel3");
-    uniform_cres = glGetUniformLocation(shader_program, "iChannelResolution");
-    uniform_ctime = glGetUniformLocation(shader_program, "iChannelTime");
-    uniform_date = glGetUniformLocation(shader_program, "iDate");
-    uniform_gtime = glGetUniformLocation(shader_program, "iGlobalTime");
-    uniform_mouse = glGetUniformLocation(shader_program, "iMouse");
-    uniform_res = glGetUniformLocation(shader_program, "iResolution");
-    uniform_srate = glGetUniformLocation(shader_program, "iSampleRate");
-
-    if (!XGetWindowAttributes(x_display, x_window, &gwa))
+    if (headless) {
+        resize_viewport(width, height);
+        return;
+    }
+
+    if (!XGetWindowAttributes(native.x_display, native.x_window, &gwa))
         die("Unable to get window size.\n");
 
     resize_viewport(gwa.width, gwa.height);
 }
 
 static void shutdown(void){
-    glDeleteProgram(shader_program);
-    eglDestroyContext(egl_display, egl_context);
-    eglDestroySurface(egl_display, egl_surface);
-    eglTerminate(egl_display);
-    XDestroyWindow(x_display, x_window);
-    XCloseDisplay(x_display);
+    int i;
+
+    readback_cleanup();
+    screenshot_cleanup();
+    overlay_cleanup();
+    for (i = 0; i < 4; ++i) {
+        //Keyboard and feedback channels only borrow their owner's texture
+        if (channels[i].kind == CHANNEL_PACK && channels[i].texture) {
+            gpumem_unregister(GPUMEM_TEXTURE, channels[i].texture);
+            glDeleteTextures(1, &channels[i].texture);
+        }
+        pack_close(&channels[i].pack);
+    }
+    if (keyboard.texture) {
+        gpumem_unregister(GPUMEM_TEXTURE, keyboard.texture);
+        glDeleteTextures(1, &keyboard.texture);
+    }
+    //The library deletes the programs it built along with the context
+    gpumem_unregister(GPUMEM_PROGRAM, shader_program);
+    esshader_destroy(context);
+    context = NULL;
+    library_changed();
+    if (trace_close() == -1)
+        warning("Unable to write the GL trace.\n");
+}
+
+/*
+ * ShaderToy convention: xy follows the pointer while the button is held,
+ * zw is where it went down and turns negative once it is released.
+*/
+static void mouse_event(int type, int x, int y){
+    int render_width, render_height;
+    GLfloat mx, my;
+
+    if (type != INPUT_BUTTON_DOWN && !mouse_down)
+        return;
+
+    esshader_size(context, &render_width, &render_height);
+    mx = (GLfloat)x * render_width / viewport_width;
+    my = (GLfloat)(viewport_height - y) * render_height / viewport_height;
+    mouse[0] = mx;
+    mouse[1] = my;
+    if (type == INPUT_BUTTON_DOWN) {
+        mouse[2] = mx;
+        mouse[3] = my;
+        mouse_down = true;
+    } else if (type == INPUT_BUTTON_UP) {
+        mouse[2] = -mouse[2];
+        mouse[3] = -mouse[3];
+        mouse_down = false;
+    }
 }
 
-static bool process_event(XEvent *ev){
-    char kbuf[32];
-    KeySym key;
+/* Act on one input event, returns false when it asks to quit. */
+static bool handle_input(const struct input_event *ev){
+    if (input_recording.fp)
+        input_record(&input_recording, ev);
 
     switch (ev->type) {
-        case ConfigureNotify:
-            resize_viewport(ev->xconfigure.width, ev->xconfigure.height);
+        case INPUT_RESIZE:
+            if (viewport_locked)
+                break;
+            //replayed sizes are forced onto the window as well
+            resize_viewport(ev->a, ev->b);
             break;
-        case KeyPress:
-            XLookupString(&ev->xkey, kbuf, sizeof(kbuf), &key, &x_kstatus);
-            if (key == XK_Escape || key == XK_q)
+        case INPUT_KEY_DOWN:
+            //q is an ordinary key for shaders reading the keyboard
+            if (ev->a == XK_Escape || (ev->a == XK_q && !keyboard.enabled))
                 return false;
+            if (ev->a == XK_F1) {
+                overlay_toggle();
+                break;
+            }
+            if (ev->a == XK_F12) {
+                screenshot_requested = 1;
+                break;
+            }
+            keyboard_event((KeySym)ev->a, true);
+            break;
+        case INPUT_KEY_UP:
+            keyboard_event((KeySym)ev->a, false);
             break;
         default:
+            mouse_event(ev->type, ev->a, ev->b);
             break;
     }
 
     return true;
 }
 
-static bool process_events(void){
+static bool process_event(XEvent *ev, long frame, double time){
+    struct input_event ie = { frame, time, INPUT_LAST, 0, 0 };
+
+    switch (ev->type) {
+        case ConfigureNotify:
+            ie.type = INPUT_RESIZE;
+            ie.a = ev->xconfigure.width;
+            ie.b = ev->xconfigure.height;
+            if (ie.a == viewport_width && ie.b == viewport_height)
+                return true;
+            break;
+        case KeyPress:
+        case KeyRelease:
+            ie.type = ev->type == KeyPress ? INPUT_KEY_DOWN : INPUT_KEY_UP;
+            ie.a = (int)XLookupKeysym(&ev->xkey, 0);
+            break;
+        case ButtonPress:
+        case ButtonRelease:
+            if (ev->xbutton.button != Button1)
+                return true;
+            ie.type = ev->type == ButtonPress ? INPUT_BUTTON_DOWN : INPUT_BUTTON_UP;
+            ie.a = ev->xbutton.x;
+            ie.b = ev->xbutton.y;
+            break;
+        case MotionNotify:
+            ie.type = INPUT_MOTION;
+            ie.a = ev->xmotion.x;
+            ie.b = ev->xmotion.y;
+            break;
+        default:
+            return true;
+    }
+
+    //While replaying, live input is ignored except for the way out
+    if (input_replay.fp && !(ie.type == INPUT_KEY_DOWN && ie.a == XK_Escape))
+        return true;
+
+    return handle_input(&ie);
+}
+
+static bool process_events(long frame, double time){
+    struct esshader_native native;
+    struct input_event ie;
     bool done = false;
     XEvent ev;
 
-    while (XPending(x_display)) {
-        XNextEvent(x_display, &ev);
-        if (!process_event(&ev)) {
+    if (input_replay.fp) {
+        while (input_replay_next(&input_replay, frame, &ie)) {
+            ie.frame = frame;
+            ie.time = time;
+            if (!handle_input(&ie))
+                done = true;
+        }
+    }
+
+    esshader_native(context, &native);
+    while (native.x_display && XPending(native.x_display)) {
+        XNextEvent(native.x_display, &ev);
+        if (!process_event(&ev, frame, time)) {
             done = true;
         }
     }
@@ -312,23 +1638,418 @@ static bool process_events(void){
     return !done;
 }
 
+/* Cells fill the grid row by row from the top left, the remainder stays black */
+static void mosaic_layout(int render_width, int render_height){
+    struct cell *cell;
+    int i;
+
+    mosaic.frame_width = render_width;
+    mosaic.frame_height = render_height;
+    mosaic.width = render_width / mosaic.columns > 0 ? render_width / mosaic.columns : 1;
+    mosaic.height = render_height / mosaic.rows > 0 ? render_height / mosaic.rows : 1;
+    for (i = 0; i < mosaic.count; ++i) {
+        cell = &mosaic.cells[i];
+        cell->x = i % mosaic.columns * mosaic.width;
+        cell->y = render_height - (i / mosaic.columns + 1) * mosaic.height;
+    }
+}
+
+/*
+ * Pick up the cell times of the oldest frame in the ring if the GPU is
+ * done with them, waiting only when asked to. The overlay shows their
+ * sum.
+*/
+static void mosaic_collect(bool wait){
+    GLuint *queries = mosaic.queries + mosaic.head * mosaic.count;
+    GLuint available = 0;
+    GLint disjoint = 0;
+    uint64_t sum = 0;
+    int i;
+
+    if (!mosaic.pending[mosaic.head])
+        return;
+    if (!wait) {
+        timer.get_query_uiv(queries[mosaic.last], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available)
+            return;
+    }
+
+    for (i = 0; i <= mosaic.last; ++i)
+        if (mosaic.cells[i].program)
+            timer.get_query_ui64v(queries[i], GL_QUERY_RESULT_EXT, &mosaic.cells[i].last_ns);
+    mosaic.pending[mosaic.head] = false;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint)
+        return;
+    for (i = 0; i <= mosaic.last; ++i) {
+        if (!mosaic.cells[i].program)
+            continue;
+        mosaic.cells[i].gpu_ns += mosaic.cells[i].last_ns;
+        mosaic.cells[i].timed++;
+        sum += mosaic.cells[i].last_ns;
+    }
+    overlay.gpu_ms = sum / 1e6;
+}
+
+static void mosaic_draw(void){
+    GLuint *queries = NULL;
+    struct cell *cell;
+    int w, h, i;
+
+    esshader_size(context, &w, &h);
+    if (w != mosaic.frame_width || h != mosaic.frame_height)
+        mosaic_layout(w, h);
+    if (mosaic.queries) {
+        mosaic.head = (mosaic.head + 1) % HUD_QUERIES;
+        mosaic_collect(false);
+        /* the GPU lags by more than the ring, skip timing this frame */
+        if (!mosaic.pending[mosaic.head])
+            queries = mosaic.queries + mosaic.head * mosaic.count;
+    }
+
+    for (i = 0; i < mosaic.count; ++i) {
+        cell = &mosaic.cells[i];
+        if (!cell->program)
+            continue;
+        gpumem_touch(GPUMEM_PROGRAM, cell->program);
+        if (queries)
+            timer.begin_query(GL_TIME_ELAPSED_EXT, queries[i]);
+        if (esshader_draw(context, cell->program, cell->x, cell->y, mosaic.width, mosaic.height))
+            die("%s.\n", esshader_error(context));
+        if (queries)
+            timer.end_query(GL_TIME_ELAPSED_EXT);
+    }
+    if (queries)
+        mosaic.pending[mosaic.head] = true;
+}
+
 static void render(float abstime){
-    static const GLfloat vertices[] = {
-        -1.0f, -1.0f,
-        1.0f, -1.0f,
-        -1.0f, 1.0f,
-        1.0f, 1.0f,
-    };
+    int w, h, i;
+
+    if (overlay.enabled)
+        overlay_begin();
+    esshader_uniform(context, "iGlobalTime", 1, &abstime);
+    esshader_uniform(context, "iMouse", 4, mouse);
+    bind_channels();
+
+    esshader_begin(context);
+    if (mosaic.count) {
+        mosaic_draw();
+    } else {
+        esshader_size(context, &w, &h);
+        if (esshader_draw(context, 0, 0, 0, w, h))
+            die("%s.\n", esshader_error(context));
+        gpumem_touch(GPUMEM_PROGRAM, shader_program);
+    }
+    esshader_end(context);
+
+    //This frame is what the feedback channels see next
+    if (esshader_feedback(context))
+        for (i = 0; i < 4; ++i)
+            if (channels[i].kind == CHANNEL_FEEDBACK)
+                channel_changed(&channels[i]);
+
+    if (overlay.enabled)
+        overlay_scene_done();
+    //Read back before the overlay goes on, it is not part of the output
+    if (readback.width)
+        readback_issue();
+    if (overlay.enabled)
+        overlay_draw();
+    //Screenshots take what is on screen, overlay included
+    if (screenshot_requested)
+        screenshot_issue();
+    //Everything is queued, so the others only wait out the swap itself
+    if (swap_barrier)
+        sync_swap();
+    if (metrics) {
+        struct timespec start, stop;
+
+        monotonic_time(&start);
+        esshader_swap(context);
+        monotonic_time(&stop);
+        swap_seconds = timespec_diff(&start, &stop);
+    } else {
+        esshader_swap(context);
+    }
+}
+
+/*
+ * Image sequence output: every frame read back is copied into one of
+ * the encoder's pooled buffers and queued under its own name, so files
+ * may be finished in any order. Waiting for a free buffer is the only
+ * way the render thread is held up by the encoders.
+*/
+static struct {
+    const char *pattern;
+    long next;
+    long source;
+    long encoded;
+    long repeated;          /* linked or listed, never encoded */
+    double waited;
+    size_t buffer_bytes;    /* pool buffers must all be this large */
+    struct {
+        long frame;
+        long source;
+    } *links;
+    size_t nlinks;
+    size_t links_size;
+    FILE *manifest;
+} sequence;
+
+/*
+ * With --dedup every frame read back is hashed, and one identical to the
+ * frame before is neither converted nor encoded again.
+*/
+static struct {
+    bool enabled;
+    uint64_t last;
+    long frames;
+    long repeats;
+} dedup;
+
+/* A pattern must hold exactly one integer conversion for the frame number. */
+static bool valid_pattern(const char *pattern){
+    const char *p;
+    int conversions = 0;
+
+    for (p = pattern; (p = strchr(p, '%')); ++p) {
+        if (p[1] == '%') {
+            ++p;
+            continue;
+        }
+        p += strspn(p + 1, "0123456789-+ #") + 1;
+        if (*p != 'd' && *p != 'i' && *p != 'u')
+            return false;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+static void write_png(const char *path, const unsigned char *pixels, int width, int height){
+    size_t bytes = (size_t)width * height * 4;
+    unsigned char *buffer;
+
+    if (sequence.buffer_bytes < bytes)
+        sequence.buffer_bytes = bytes;
+    buffer = encoder_buffer(sequence.buffer_bytes, &sequence.waited);
+
+    memcpy(buffer, pixels, bytes);
+    encoder_submit(path, width, height, buffer, true, encoder_release, buffer);
+}
+
+static void write_sequence_frame(const unsigned char *pixels, int width, int height){
+    char path[1024];
+
+    sequence.source = sequence.next;
+    sequence.encoded++;
+    snprintf(path, sizeof(path), sequence.pattern, (int)sequence.next++);
+    write_png(path, pixels, width, height);
+}
+
+/* A repeated frame becomes a hard link to the last file actually encoded. */
+static void repeat_sequence_frame(void){
+    if (sequence.nlinks == sequence.links_size) {
+        sequence.links_size = sequence.links_size ? 2 * sequence.links_size : 64;
+        sequence.links = realloc(sequence.links, sequence.links_size * sizeof(*sequence.links));
+        if (!sequence.links)
+            die("Unable to allocate frame links.\n");
+    }
+    sequence.links[sequence.nlinks].frame = sequence.next++;
+    sequence.links[sequence.nlinks].source = sequence.source;
+    sequence.nlinks++;
+    sequence.repeated++;
+}
+
+/*
+ * Links are made once the encoder has created the source file; being
+ * the same inode, it does not matter whether it is written completely
+ * yet. Where links cannot be made, or on the final pass for sources that
+ * never appeared, the pair goes to duplicates.txt next to the frames.
+*/
+static void link_sequence_frames(bool final){
+    char path[1024], source[1024];
+    size_t i, kept = 0;
+    const char *slash;
+
+    for (i = 0; i < sequence.nlinks; ++i) {
+        snprintf(path, sizeof(path), sequence.pattern, (int)sequence.links[i].frame);
+        snprintf(source, sizeof(source), sequence.pattern, (int)sequence.links[i].source);
+        if (!link(source, path))
+            continue;
+        if (errno == EEXIST && !unlink(path) && !link(source, path))
+            continue;
+        if (errno == ENOENT && !final) {
+            sequence.links[kept++] = sequence.links[i];
+            continue;
+        }
+
+        if (!sequence.manifest) {
+            slash = strrchr(sequence.pattern, '/');
+            snprintf(path, sizeof(path), "%.*sduplicates.txt",
+                    slash ? (int)(slash - sequence.pattern + 1) : 0, sequence.pattern);
+            if (!(sequence.manifest = fopen(path, "w")))
+                die("Unable to open %s.\n", path);
+            info("Listing repeated frames in %s.\n", path);
+        }
+        snprintf(path, sizeof(path), sequence.pattern, (int)sequence.links[i].frame);
+        fprintf(sequence.manifest, "%s %s\n", path, source);
+    }
+    sequence.nlinks = kept;
+}
+
+static void write_frame(struct output *out, const unsigned char *pixels, int width, int height){
+    bool repeat = false;
+    uint64_t hash;
+
+    if (dedup.enabled) {
+        hash = hash_frame(pixels, (size_t)width * height * 4);
+        repeat = dedup.frames++ && hash == dedup.last;
+        dedup.repeats += repeat;
+        dedup.last = hash;
+    }
+    if (out->fp) {
+        if (repeat)
+            output_repeat(out);
+        else
+            output_write(out, pixels);
+    }
+    if (sequence.pattern) {
+        if (repeat)
+            repeat_sequence_frame();
+        else
+            write_sequence_frame(pixels, width, height);
+    }
+}
+
+static void write_frames(struct output *out, bool drain){
+    const unsigned char *pixels;
+
+    while ((pixels = readback_map(drain))) {
+        if (worker >= 0)
+            farm_send(pixels, (size_t)readback.width * readback.height * 4);
+        else
+            write_frame(out, pixels, readback.width, readback.height);
+        readback_unmap();
+    }
+    if (sequence.nlinks)
+        link_sequence_frames(false);
+}
+
+static void open_outputs(struct output *out, const char *path, int width, int height,
+        int fps, int encoder_threads){
+    if (path) {
+        output_open(out, path, width, height, fps);
+        info("Writing frames to %s.\n", path);
+    }
+    if (sequence.pattern) {
+        //Two queued frames per thread keep every encoder fed while the
+        //next readbacks land
+        encoder_start(encoder_threads, 2 * encoder_threads);
+        encoder_running = true;
+        info("Writing frames to %s with %d encoder threads.\n", sequence.pattern, encoder_threads);
+    }
+}
+
+//Runs once the encoders have stopped, so every frame file exists
+static void finish_sequence(void){
+    if (sequence.pattern) {
+        link_sequence_frames(true);
+        if (sequence.manifest)
+            fclose(sequence.manifest);
+        free(sequence.links);
+        info("Encoded %ld PNG frames and reused them for %ld repeats, rendering waited %.2fs for encoders.\n",
+                sequence.encoded, sequence.repeated, sequence.waited);
+    }
+    if (dedup.enabled) {
+        info("%ld of %ld frames repeated the one before.\n", dedup.repeats, dedup.frames);
+    }
+}
+
+//The coordinator of a farm only merges, it never touches GL
+static int coordinate(const char *output_path, int fps, int encoder_threads){
+    struct output out = {0};
+    const unsigned char *pixels;
+    int width, height, failed;
+
+    farm_size(&width, &height);
+    open_outputs(&out, output_path, width, height, fps, encoder_threads);
+    while ((pixels = farm_next((size_t)width * height * 4))) {
+        write_frame(&out, pixels, width, height);
+        if (sequence.nlinks)
+            link_sequence_frames(false);
+    }
+    output_close(&out);
+    failed = farm_stop();
+    if (encoder_running) {
+        encoder_stop();
+    }
+    finish_sequence();
+    return failed;
+}
+
+//Renders the offline frames with the CPU backend, never touching EGL
+static int run_cpu(const char *output_path, int width, int height, long frames, int fps,
+        int threads, int encoder_threads){
+    struct output out = {0};
+    struct timespec start, stop;
+    unsigned char *pixels;
+    long frame;
+
+    if (!(pixels = malloc((size_t)width * height * 4)))
+        die("Unable to allocate the CPU frame.\n");
+    cpu_start(default_fragment_shader, width, height,
+            threads ? threads : (int)sysconf(_SC_NPROCESSORS_ONLN));
+    open_outputs(&out, output_path, width, height, fps, encoder_threads);
+    monotonic_time(&start);
+    for (frame = 0; frame < frames; ++frame) {
+        cpu_render(pixels, (float)((double)frame / fps));
+        write_frame(&out, pixels, width, height);
+        if (sequence.nlinks)
+            link_sequence_frames(false);
+    }
+    monotonic_time(&stop);
+    info("Rendered %ld frames on the CPU at %.1f fps.\n", frames, frames / timespec_diff(&start, &stop));
+    output_close(&out);
+    if (encoder_running) {
+        encoder_stop();
+    }
+    finish_sequence();
+    cpu_stop();
+    free(pixels);
+    return 0;
+}
 
-    if(uniform_gtime >= 0)
-        glUniform1f(uniform_gtime, abstime);
+static void request_screenshot(int sig){
+    (void)sig;
+    screenshot_requested = 1;
+}
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glEnableVertexAttribArray(attrib_position);
-    glVertexAttribPointer(attrib_position, 2, GL_FLOAT, GL_FALSE, 0, vertices);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    eglSwapBuffers(egl_display, egl_surface);
+static void request_report(int sig){
+    (void)sig;
+    report_requested = 1;
+}
+
+//Parses a byte count with an optional K, M or G suffix
+//Return 0 on failure
+static size_t parse_size(const char *str) {
+    char *end;
+    double value = strtod(str, &end);
+
+    switch(*end) {
+        case 'G': case 'g': value *= 1024.0;
+        /* fall through */
+        case 'M': case 'm': value *= 1024.0;
+        /* fall through */
+        case 'K': case 'k': value *= 1024.0;
+            ++end;
+            break;
+    }
+    if(*end != '\0' || value < 0.0) {
+        return 0;
+    }
+    return (size_t)value;
 }
 
 //Reads a file into a string
@@ -360,15 +2081,314 @@ static char* read_file_into_str(const char *filename) {
     return NULL;
 }
 
+/*
+ * Build a program per mosaic cell. One that does not build leaves its
+ * cell black rather than taking the whole wall down.
+*/
+static void mosaic_start(char **paths, int count){
+    struct cell *cell;
+    char *source;
+    int i;
+
+    if (!(mosaic.cells = calloc(count, sizeof(*mosaic.cells))))
+        die("Unable to allocate %d mosaic cells.\n", count);
+    mosaic.count = count;
+    for (mosaic.columns = 1; mosaic.columns * mosaic.columns < count; ++mosaic.columns)
+        ;
+    mosaic.rows = (count + mosaic.columns - 1) / mosaic.columns;
+
+    for (i = 0; i < count; ++i) {
+        cell = &mosaic.cells[i];
+        cell->name = paths[i];
+        if (!(source = read_file_into_str(paths[i]))) {
+            warning("Unable to read %s, its cell stays black.\n", paths[i]);
+            continue;
+        }
+        cell->program = build_image_program(source, paths[i], NULL, NULL);
+        free(source);
+        if (!cell->program) {
+            warning("%s does not build, its cell stays black.\n", paths[i]);
+            continue;
+        }
+        mosaic.last = i;
+    }
+
+    if (mosaic.last >= 0 && timer_init()) {
+        if (!(mosaic.queries = calloc((size_t)HUD_QUERIES * count, sizeof(*mosaic.queries))))
+            die("Unable to allocate mosaic queries.\n");
+        queries_gen(HUD_QUERIES * count, mosaic.queries, "mosaic timer");
+    } else if (mosaic.last >= 0) {
+        warning("GL_EXT_disjoint_timer_query unavailable, no GPU times per cell.\n");
+    }
+    info("Showing %d shaders in a %dx%d mosaic.\n", count, mosaic.columns, mosaic.rows);
+}
+
+static void mosaic_report(void){
+    const struct cell *cell;
+    int i;
+
+    //The last frames are still in flight, oldest first
+    for (i = 0; i < HUD_QUERIES; ++i) {
+        mosaic.head = (mosaic.head + 1) % HUD_QUERIES;
+        mosaic_collect(true);
+    }
+    log_report_begin();
+    for (i = 0; i < mosaic.count; ++i) {
+        cell = &mosaic.cells[i];
+        if (cell->timed)
+            info("Cell %d (%s): %.3f ms GPU per frame over %ld frames.\n", i, cell->name,
+                    cell->gpu_ns / 1e6 / cell->timed, cell->timed);
+    }
+    log_report_end();
+}
+
+static void mosaic_stop(void){
+    int i;
+
+    for (i = 0; i < mosaic.count; ++i) {
+        if (mosaic.cells[i].program) {
+            gpumem_unregister(GPUMEM_PROGRAM, mosaic.cells[i].program);
+            esshader_release(context, mosaic.cells[i].program);
+        }
+    }
+    if (mosaic.queries) {
+        queries_delete(HUD_QUERIES * mosaic.count, mosaic.queries);
+        free(mosaic.queries);
+    }
+    free(mosaic.cells);
+    memset(&mosaic, 0, sizeof(mosaic));
+    mosaic.last = -1;
+}
+
+/*
+ * Image programs of --batch jobs, keyed by a hash of their source so a
+ * shader shared by many jobs is compiled once. They are registered as
+ * evictable, which lets --gpu-mem-budget bound the cache.
+*/
+struct cached_program {
+    uint64_t key;
+    GLuint program;
+    char label[64];
+    struct cached_program *next;
+};
+
+static struct cached_program *program_cache;
+
+//One evicted while the current job still draws with it lives on until replaced
+static void program_evict(void *arg){
+    struct cached_program *entry = arg, **p;
+
+    for (p = &program_cache; *p != entry; p = &(*p)->next)
+        ;
+    *p = entry->next;
+    esshader_release(context, entry->program);
+    free(entry);
+}
+
+/* The program for source, built on a miss; 0 if it does not build. */
+static GLuint cached_program(const char *source, const char *name, bool *hit){
+    uint64_t key = hash_frame((const unsigned char *)source, strlen(source));
+    const char *base = strrchr(name, '/');
+    struct cached_program *entry;
+
+    for (entry = program_cache; entry; entry = entry->next) {
+        if (entry->key == key) {
+            *hit = true;
+            return entry->program;
+        }
+    }
+
+    *hit = false;
+    if (!(entry = calloc(1, sizeof(*entry))))
+        die("Unable to allocate program cache entry.\n");
+    entry->key = key;
+    snprintf(entry->label, sizeof(entry->label), "%.63s", base ? base + 1 : name);
+    if (!(entry->program = build_image_program(source, entry->label, program_evict, entry))) {
+        free(entry);
+        return 0;
+    }
+    entry->next = program_cache;
+    program_cache = entry;
+
+    return entry->program;
+}
+
+static bool has_suffix(const char *str, const char *suffix){
+    size_t len = strlen(str), slen = strlen(suffix);
+
+    return len >= slen && !strcmp(str + len - slen, suffix);
+}
+
+/*
+ * Run every job of a --batch list in one context. The pbuffer is made
+ * as large as the largest job up front, so a change of resolution only
+ * reallocates the offscreen target and the readback buffers; programs
+ * come from the cache. A job that fails is reported and skipped.
+*/
+static int run_batch(const char *list, bool gles3, int fps, int encoder_threads, bool energy){
+    struct batch_job *jobs, *job;
+    struct output out = {0};
+    struct timespec start, job_start, built, stop, prev, cur;
+    double compile_seconds = 0.0, render_seconds = 0.0;
+    int njobs = batch_load(list, &jobs);
+    int width = 1, height = 1, failed = 0, built_programs = 0, reused = 0, resizes = 0;
+    const unsigned char *pixels;
+    GLuint base, program;
+    long frame, nframes;
+    char *source;
+    bool hit;
+    int i;
+
+    for (i = 0; i < njobs; ++i) {
+        width = jobs[i].width > width ? jobs[i].width : width;
+        height = jobs[i].height > height ? jobs[i].height : height;
+    }
+    startup(width, height, false, gles3);
+    base = shader_program;
+    //Jobs of any size share the encoder pool
+    sequence.buffer_bytes = (size_t)width * height * 4;
+    viewport_locked = true;
+    encoder_start(encoder_threads, 2 * encoder_threads);
+    encoder_running = true;
+    info("Running %d jobs from %s.\n", njobs, list);
+    monotonic_time(&start);
+    //Every job gets its line, however fast they go
+    log_report_begin();
+
+    for (i = 0; i < njobs; ++i) {
+        job = &jobs[i];
+        monotonic_time(&job_start);
+        if (!(source = read_file_into_str(job->shader))) {
+            warning("%s:%d: unable to read %s.\n", list, job->line, job->shader);
+            failed++;
+            continue;
+        }
+        program = cached_program(source, job->shader, &hit);
+        free(source);
+        if (!program) {
+            warning("%s:%d: %s does not build.\n", list, job->line, job->shader);
+            failed++;
+            continue;
+        }
+        built_programs += !hit;
+        reused += hit;
+        use_image_program(program);
+        monotonic_time(&built);
+
+        if (readback.width != job->width || readback.height != job->height) {
+            resizes += readback.width != 0;
+            resize_viewport(job->width, job->height);
+            readback_cleanup();
+            readback_init(job->width, job->height);
+        }
+
+        nframes = (long)((job->end - job->start) * fps + 0.5);
+        nframes = nframes > 0 ? nframes : 1;
+        if (has_suffix(job->output, ".y4m")) {
+            output_open(&out, job->output, job->width, job->height, fps);
+        } else if (valid_pattern(job->output)) {
+            sequence.pattern = job->output;
+            sequence.next = 0;
+        } else if (nframes > 1) {
+            warning("%s:%d: %ld frames need a .y4m or a %%d pattern, not %s.\n",
+                    list, job->line, nframes, job->output);
+            failed++;
+            continue;
+        }
+
+        //Energy goes to the job's shader, building it included, and the
+        //last frame is charged once its output is written
+        prev = job_start;
+        for (frame = 0; frame < nframes; ++frame) {
+            render((float)(job->start + (double)frame / fps));
+            if (out.fp || sequence.pattern)
+                write_frames(&out, false);
+            if (energy && frame + 1 < nframes) {
+                monotonic_time(&cur);
+                energy_frame(job->shader, timespec_diff(&prev, &cur));
+                prev = cur;
+            }
+        }
+        if (out.fp || sequence.pattern) {
+            write_frames(&out, true);
+        } else if ((pixels = readback_map(true))) {
+            write_png(job->output, pixels, job->width, job->height);
+            readback_unmap();
+        }
+        output_close(&out);
+        if (energy) {
+            monotonic_time(&cur);
+            energy_frame(job->shader, timespec_diff(&prev, &cur));
+        }
+        sequence.pattern = NULL;
+        gpumem_tick();
+
+        monotonic_time(&stop);
+        compile_seconds += timespec_diff(&job_start, &built);
+        render_seconds += timespec_diff(&built, &stop);
+        debug("%s: %s %dx%d, %ld frames, %.1f ms to build, %.1f ms to render.\n", job->output,
+                hit ? "cached" : "built", job->width, job->height, nframes,
+                1e3 * timespec_diff(&job_start, &built), 1e3 * timespec_diff(&built, &stop));
+    }
+
+    log_report_end();
+    encoder_stop();
+    encoder_running = false;
+    monotonic_time(&stop);
+    info("Ran %d jobs in %.2fs, %d failed: %d programs built and %d reused in %.2fs, "
+            "%.2fs rendering, %d resizes.\n", njobs, timespec_diff(&start, &stop), failed,
+            built_programs, reused, compile_seconds, render_seconds, resizes);
+
+    while (program_cache) {
+        gpumem_unregister(GPUMEM_PROGRAM, program_cache->program);
+        program_evict(program_cache);
+    }
+    use_image_program(base);
+    free(jobs);
+
+    return failed;
+}
+
 int main(int argc, char **argv){
     info("ESShader -  Version: %s\n", VERSION);
 
-    struct timespec start, cur;
+    struct timespec start, cur, prev;
+    struct output out = {0};
     
     //Default selected_options
     bool fullscreen = false;
+    bool gles3 = false;
     int window_width = 640;
     int window_height = 360;
+    const char *output_path = NULL;
+    const char *batch_path = NULL;
+    int encoder_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = 0;
+    int cpu_threads = -1;
+    const char *sync_name = NULL;
+    int sync_instances = 0;
+    bool show_mosaic = false;
+    bool offline;
+    int output_fps = 60;
+    long frames = 0;
+    long frame;
+    size_t gpu_mem_budget = 0;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    double now;
+    double soak_interval = 0.0;
+    bool energy = false;
+    const char *sysfs_root = "/sys";
+    const char *shader_name = "default";
+    bool perf = false;
+    bool show_hud = false;
+    const char *perf_log = NULL;
+    const char *metrics_file = NULL;
+    const char *metrics_socket = NULL;
+    int log_level = LOG_INFO;
+    bool log_json = false;
+    int leaks, failed;
+    struct sigaction sa;
 
     int temp_width = 0;
     int temp_height = 0;
@@ -384,6 +2404,140 @@ int main(int argc, char **argv){
         case 'f':
             fullscreen = true;
             break;
+        case '3':
+            gles3 = true;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'r':
+            if((output_fps = atoi(optarg)) <= 0) {
+                die("Invalid frame rate %s\n", optarg);
+            }
+            break;
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 'x':
+            offscreen.scale = (float)atof(optarg);
+            if(offscreen.scale <= 0.0f || offscreen.scale > 8.0f) {
+                die("Invalid render scale %s\n", optarg);
+            }
+            if(offscreen.format < 0) {
+                offscreen.format = ESSHADER_RGBA8;
+            }
+            break;
+        case 'F':
+            for(offscreen.format = 0; offscreen.format < ESSHADER_FORMATS; ++offscreen.format) {
+                if(!strcmp(optarg, esshader_format_name(offscreen.format))) {
+                    break;
+                }
+            }
+            if(offscreen.format == ESSHADER_FORMATS) {
+                die("Unknown target format %s (rgba8, rgb565, rgba4, half)\n", optarg);
+            }
+            break;
+        case 'c':
+            if(optarg[0] < '0' || optarg[0] > '3' || optarg[1] != '=') {
+                die("Invalid channel %s, expected [0-3]=source\n", optarg);
+            }
+            channel_open(optarg[0] - '0', optarg + 2);
+            break;
+        case OPT_RECORD_INPUT:
+            record_path = optarg;
+            break;
+        case OPT_REPLAY_INPUT:
+            replay_path = optarg;
+            break;
+        case OPT_ENERGY:
+            energy = true;
+            break;
+        case OPT_SYSFS_ROOT:
+            sysfs_root = optarg;
+            break;
+        case OPT_PERF:
+            perf = true;
+            break;
+        case OPT_PERF_LOG:
+            perf = true;
+            perf_log = optarg;
+            break;
+        case OPT_METRICS_FILE:
+            metrics_file = optarg;
+            break;
+        case OPT_METRICS_SOCKET:
+            metrics_socket = optarg;
+            break;
+        case OPT_OUTPUT_PATTERN:
+            if(!valid_pattern(optarg)) {
+                die("Output pattern %s needs exactly one %%d for the frame number\n", optarg);
+            }
+            sequence.pattern = optarg;
+            break;
+        case OPT_WORKERS:
+            if((workers = atoi(optarg)) <= 0) {
+                die("Invalid number of workers %s\n", optarg);
+            }
+            break;
+        case OPT_BATCH:
+            batch_path = optarg;
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_CPU:
+            if((cpu_threads = atoi(optarg)) < 0) {
+                die("Invalid number of CPU threads %s\n", optarg);
+            }
+            break;
+        case OPT_SYNC: {
+            char *colon = strrchr(optarg, ':');
+
+            if(!colon || colon == optarg || (sync_instances = atoi(colon + 1)) < 1) {
+                die("Invalid sync group %s, expected name:instances\n", optarg);
+            }
+            *colon = '\0';
+            sync_name = optarg;
+            break;
+        }
+        case OPT_SYNC_SWAP:
+            swap_barrier = true;
+            break;
+        case OPT_MOSAIC:
+            show_mosaic = true;
+            break;
+        case OPT_DEDUP:
+            dedup.enabled = true;
+            break;
+        case OPT_ENCODER_THREADS:
+            if((encoder_threads = atoi(optarg)) <= 0) {
+                die("Invalid number of encoder threads %s\n", optarg);
+            }
+            break;
+        case OPT_LOG_LEVEL:
+            if((log_level = log_level_from_name(optarg)) < 0) {
+                die("Unknown log level %s (debug, info, warning, error)\n", optarg);
+            }
+            break;
+        case OPT_LOG_JSON:
+            log_json = true;
+            break;
+        case OPT_HUD:
+            show_hud = true;
+            break;
+        case OPT_SOAK:
+            if((soak_interval = atof(optarg)) <= 0.0) {
+                die("Invalid soak interval %s\n", optarg);
+            }
+            break;
+        case OPT_HEADLESS:
+            headless = true;
+            break;
+        case OPT_GPU_MEM_BUDGET:
+            if((gpu_mem_budget = parse_size(optarg)) == 0) {
+                die("Invalid GPU memory budget %s\n", optarg);
+            }
+            break;
         case 'w':
             temp_width = atoi(optarg);
             if(temp_width > 0) {
@@ -403,39 +2557,355 @@ int main(int argc, char **argv){
                 die("Could not read shader program %s\n", optarg);
             }
             default_fragment_shader = program_source;
+            shader_name = optarg;
             break;
         case '?':
             info(   "\nUsage: esshader [OPTIONS]\n"
                     "Example: esshader --width 1280 --height 720\n\n"
                     "Options:\n"
                     " -f, --fullscreen \truns the program in (fake) fullscreen mode.\n"
+                    " -3, --gles3 \t\tuse OpenGL ES 3.0 if available.\n"
                     " -?, --help \t\tshows this help.\n"
                     " -w, --width [value] \tsets the window width to [value].\n"
                     " -h, --height [value] \tsets the window height to [value].\n"
                     " -s, --source [path] \tpath to shader program\n"
+                    " -o, --output [path] \twrite rendered frames as a YUV4MPEG2 stream.\n"
+                    " --output-pattern [fmt] write rendered frames as PNG files named by printf\n"
+                    "                      \tformat [fmt], e.g. frame%%05d.png.\n"
+                    " --encoder-threads [n] PNG encoder threads (default: one per CPU).\n"
+                    " --dedup \t\tdo not convert or encode frames identical to the one\n"
+                    "                      \tbefore, hard linking them in image sequences.\n"
+                    " --batch [path] \trender the jobs listed in [path] in one headless\n"
+                    "                      \tcontext, see README.\n"
+                    " --trace [path] \twrite every GL and EGL call to [path] for essreplay.\n"
+                    " --workers [n] \t\tsplit -n frames of -o or --output-pattern across [n]\n"
+                    "                      \theadless worker processes.\n"
+                    " --cpu [n] \t\trender -n frames of -o or --output-pattern on [n]\n"
+                    "                      \tCPU threads without a GPU, 0 for one per CPU.\n"
+                    " --sync [name:n] \tshare the clock with the other n - 1 instances\n"
+                    "                      \tjoining the group [name], for video walls.\n"
+                    " --sync-swap \t\twait for the whole --sync group before every swap.\n"
+                    " --mosaic [paths] \tdraw the shaders given as arguments side by side\n"
+                    "                      \tin one window, timing each on the GPU.\n"
+                    " -r, --fps [value] \tframe rate of the output stream (default 60).\n"
+                    " -n, --frames [value] \tstop after [value] frames.\n"
+                    " -x, --scale [value] \trender offscreen at [value] times the window size.\n"
+                    " -F, --format [name] \toffscreen format: rgba8, rgb565, rgba4 or half.\n"
+                    " -c, --channel [n=src] \tbind src to iChannel[n]: image.png, file.pack[:name]\n"
+                    "                      \tfeedback or keyboard, optionally followed by ,nearest\n"
+                    "                      \t,linear or ,mipmap.\n"
+                    " --gpu-mem-budget [size] evict cached GPU objects above [size] (K, M, G).\n"
+                    " --record-input [path] \tlog input and resize events per frame to [path].\n"
+                    " --replay-input [path] \tfeed the events logged in [path] back in.\n"
+                    " --headless \t\trender into a pbuffer without opening a window.\n"
+                    " --hud \t\tstart with the performance overlay shown, [F1] toggles it.\n"
+                    " --metrics-file [path] \tkeep Prometheus metrics in [path] for a textfile collector.\n"
+                    " --metrics-socket [path] serve Prometheus metrics on the UNIX socket [path].\n"
+                    " --log-level [level] \tdebug, info, warning or error (default info).\n"
+                    " --log-json \t\twrite log records as JSON lines to stderr.\n"
+                    " --soak [seconds] \tsample memory, fds, GL objects and frame time every\n"
+                    "                      \t[seconds] and fail if any of them keeps growing.\n"
+                    " --energy \t\treport joules per frame and watts from RAPL and hwmon.\n"
+                    " --sysfs-root [path] \tread energy counters below [path] (default /sys).\n"
+                    " --perf \t\tcount cycles, instructions, LLC misses and context\n"
+                    "                      \tswitches per frame across all threads.\n"
+                    " --perf-log [path] \tlike --perf, also writing per-frame counts as CSV.\n"
+                    "\nSend SIGUSR2 to print a GPU memory report, SIGUSR1 or press [F12] to save\n"
+                    "a screenshot.\n"
                     );
             return 0;
         }
     }
 
-    info("Press [ESC] or [q] to exit.\n");
+    //Feedback channels sample the previous frame of the image pass, which
+    //thus has to live offscreen
+    for(int i = 0; i < 4; ++i) {
+        if(channels[i].kind == CHANNEL_FEEDBACK) {
+            if(offscreen.format < 0) {
+                offscreen.format = ESSHADER_RGBA8;
+            }
+            offscreen.flags |= ESSHADER_FEEDBACK;
+        }
+    }
+
+    if (batch_path) {
+        if (output_path || sequence.pattern || workers || dedup.enabled) {
+            die("--batch takes its outputs from the job list\n");
+        }
+        if (record_path || replay_path) {
+            die("Input cannot be recorded or replayed in a batch\n");
+        }
+        if (offscreen.flags & ESSHADER_FEEDBACK) {
+            die("Feedback channels cannot be shared between batch jobs\n");
+        }
+        headless = true;
+    }
+
+    if (workers) {
+        if ((!output_path && !sequence.pattern) || frames <= 0) {
+            die("--workers needs -o or --output-pattern and a number of frames\n");
+        }
+        if (record_path) {
+            die("Input cannot be recorded across workers\n");
+        }
+        if (offscreen.flags & ESSHADER_FEEDBACK) {
+            die("Feedback channels need every frame rendered by one process\n");
+        }
+        //Workers only render and pipe frames back; outputs, exporters
+        //and the logs that matter stay with the coordinator
+        if ((worker = farm_start(workers)) >= 0) {
+            headless = true;
+            show_hud = false;
+            output_path = NULL;
+            sequence.pattern = NULL;
+            dedup.enabled = false;
+            metrics_file = metrics_socket = NULL;
+            if (log_level < LOG_WARNING)
+                log_level = LOG_WARNING;
+        }
+    }
+
+    //The CPU backend only shades the image pass into an RGBA8 frame of
+    //the window size
+    if (cpu_threads >= 0) {
+        if ((!output_path && !sequence.pattern) || frames <= 0) {
+            die("--cpu needs -o or --output-pattern and a number of frames\n");
+        }
+        if (batch_path || workers || trace_path) {
+            die("--cpu cannot be combined with --batch, --workers or --trace\n");
+        }
+        if (show_hud || record_path || replay_path) {
+            die("--cpu takes no input and draws no overlay\n");
+        }
+        for(int i = 0; i < 4; ++i) {
+            if(channels[i].kind != CHANNEL_NONE) {
+                die("--cpu cannot sample channels\n");
+            }
+        }
+        if (offscreen.format >= 0) {
+            die("--cpu renders RGBA8 at the window size, without -x or -F\n");
+        }
+    }
+
+    //Every cell is its own image pass into a slice of the one frame
+    if (show_mosaic) {
+        if (optind >= argc) {
+            die("--mosaic needs the shaders to show as arguments\n");
+        }
+        if (program_source) {
+            die("--mosaic takes its shaders as arguments, not from -s\n");
+        }
+        if (batch_path || cpu_threads >= 0) {
+            die("--mosaic cannot be combined with --batch or --cpu\n");
+        }
+        if (offscreen.flags & ESSHADER_FEEDBACK) {
+            die("Feedback channels cannot be shared between mosaic cells\n");
+        }
+        shader_name = "mosaic";
+    }
+
+    //A group shares the wall clock, which offline runs do not follow
+    if (swap_barrier && !sync_name) {
+        die("--sync-swap needs a --sync group\n");
+    }
+    if (sync_name && (output_path || sequence.pattern || workers || batch_path || cpu_threads >= 0)) {
+        die("--sync is for live rendering, not -o, --output-pattern, --workers, --batch or --cpu\n");
+    }
+
+    //Without a window the pbuffer cannot follow replayed resizes, so
+    //render offscreen at whatever size the log asks for
+    if(headless && offscreen.format < 0) {
+        offscreen.format = ESSHADER_RGBA8;
+    }
+
+    //From here on nothing the render loop logs may block it
+    log_start(log_level, log_json);
+
+    if (cpu_threads >= 0) {
+        failed = run_cpu(output_path, window_width, window_height, frames, output_fps,
+                cpu_threads, encoder_threads);
+        free(program_source);
+        log_stop();
+        return failed ? EXIT_FAILURE : 0;
+    }
+    if (workers && worker < 0) {
+        failed = coordinate(output_path, output_fps, encoder_threads);
+        free(program_source);
+        log_stop();
+        return failed ? EXIT_FAILURE : 0;
+    }
+
+    info(keyboard.enabled ? "Press [ESC] to exit.\n" : "Press [ESC] or [q] to exit.\n");
     info("Run with --help flag for more information.\n\n");
-    startup(window_width, window_height, fullscreen);
-    monotonic_time(&start);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_report;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+    sa.sa_handler = request_screenshot;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    gpumem_set_budget(gpu_mem_budget);
+    if (batch_path) {
+        if (energy && !energy_open(sysfs_root))
+            energy = false;
+        failed = run_batch(batch_path, gles3, output_fps, encoder_threads, energy);
+        gpumem_report();
+        if (energy) {
+            energy_report();
+            energy_close();
+        }
+        shutdown();
+        free(program_source);
+        log_stop();
+        return failed ? EXIT_FAILURE : 0;
+    }
+    //Counters only follow threads created after them, so open them before
+    //the GL driver starts its own
+    if (perf && !perfctr_open(perf_log)) {
+        perf = false;
+    }
+    startup(window_width, window_height, fullscreen, gles3);
+    if (show_mosaic) {
+        mosaic_start(argv + optind, argc - optind);
+    }
+
+    if (show_hud) {
+        overlay_toggle();
+    }
+
+    offline = output_path || sequence.pattern || worker >= 0;
+    if (offline) {
+        //Frames are sampled at fixed steps, so the window size must not
+        //change under the stream either
+        viewport_locked = true;
+        readback_init(viewport_width, viewport_height);
+    }
+    if (worker >= 0) {
+        farm_hello(viewport_width, viewport_height);
+    }
+    open_outputs(&out, output_path, viewport_width, viewport_height, output_fps, encoder_threads);
 
-    for (;;) {
-        if (!process_events()) {
+    if (replay_path) {
+        input_replay_open(&input_replay, replay_path);
+        info("Replaying input from %s.\n", replay_path);
+    }
+    if (record_path) {
+        struct input_event ie = { 0, 0.0, INPUT_RESIZE, viewport_width, viewport_height };
+
+        //The starting size goes first so a replay opens at the same size
+        input_record_open(&input_recording, record_path);
+        if (!replay_path)
+            input_record(&input_recording, &ie);
+        info("Recording input to %s.\n", record_path);
+    }
+
+    if (metrics_file || metrics_socket) {
+        metrics = true;
+        metrics_start(metrics_file, metrics_socket);
+    }
+    soak_start(soak_interval);
+    if (energy && !energy_open(sysfs_root))
+        energy = false;
+    if (sync_name) {
+        sync_join(sync_name, sync_instances, swap_barrier, &start);
+    } else {
+        monotonic_time(&start);
+    }
+    cur = start;
+
+    //Worker k of a farm renders every workers-th frame starting at k
+    for (frame = worker >= 0 ? worker : 0; !frames || frame < frames;
+            frame += worker >= 0 ? workers : 1) {
+        if (offline) {
+            now = (double)frame / output_fps;
+        } else {
+            now = sync_name ? sync_time() : timespec_diff(&start, &cur);
+        }
+        if (!process_events(frame, now)) {
             break;
         }
-        render((float)timespec_diff(&start, &cur));
+        render((float)now);
+        if (offline) {
+            write_frames(&out, false);
+        }
+        if (screenshot.state != SHOT_IDLE) {
+            screenshot_poll();
+        }
+        keyboard_frame_done();
+        prev = cur;
         monotonic_time(&cur);
+        if (energy) {
+            energy_frame(shader_name, timespec_diff(&prev, &cur));
+        }
+        if (perf) {
+            perfctr_frame(frame);
+        }
+        if (metrics) {
+            //Dropped means the frame missed the next refresh at --fps
+            double seconds = timespec_diff(&prev, &cur);
+            metrics_frame(seconds, swap_seconds, seconds > 1.5 / output_fps,
+                    gpumem_total(), gpumem_count());
+        }
+        gpumem_tick();
+        if (report_requested) {
+            report_requested = 0;
+            gpumem_report();
+        }
+        if (soak_due(timespec_diff(&start, &cur))) {
+            soak_sample(timespec_diff(&start, &cur), frame + 1);
+        }
+    }
+    //Let the rest of the group run on without waiting for this one
+    sync_leave();
+
+    target_report(frame / timespec_diff(&start, &cur));
+    mosaic_report();
+    report_channels();
+    if (energy) {
+        energy_report();
+        energy_close();
+    }
+    if (perf) {
+        perfctr_report();
+        perfctr_close();
+    }
+    if (metrics) {
+        metrics_stop();
+    }
+    if (input_recording.fp) {
+        info("Recorded %lu input events over %ld frames.\n", input_recording.events, frame);
+        input_close(&input_recording);
     }
+    if (input_replay.fp) {
+        if (input_replay.pending)
+            warning("Input replay stopped at frame %ld, before the log ended.\n", frame);
+        info("Replayed %lu input events.\n", input_replay.events);
+        input_close(&input_replay);
+    }
+
+    if (offline) {
+        write_frames(&out, true);
+        output_close(&out);
+    }
+
+    gpumem_report();
+    leaks = soak_finish();
 
+    screenshot_flush();
+    if (encoder_running) {
+        encoder_stop();
+    }
+    finish_sequence();
+    if (worker >= 0) {
+        farm_stop();
+    }
+    mosaic_stop();
     shutdown();
     if(program_source != NULL) {
         free(program_source);
         program_source = NULL;
     }
-    return 0;
+    log_stop();
+    return leaks ? EXIT_FAILURE : 0;
 }
 
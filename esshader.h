@@ -0,0 +1,160 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * libesshader: renders ShaderToy style fragment shaders into an X window
+ * or, headless, straight into memory. Everything hangs off the context
+ * made by esshader_create(), which each call makes current on the
+ * calling thread; a context must only be used by one thread at a time.
+ * Calls that can fail return -1 and leave a message for esshader_error().
+*/
+enum {
+    ESSHADER_HEADLESS = 1 << 0,     /* pbuffer instead of a window */
+    ESSHADER_GLES3 = 1 << 1,        /* OpenGL ES 3.0 if available */
+    ESSHADER_FULLSCREEN = 1 << 2,
+};
+
+struct esshader;
+
+/*
+ * config lists eglChooseConfig attributes up to EGL_NONE, or is NULL for
+ * 8 bits of red, green and blue; the renderable and surface types are
+ * chosen from flags. On failure returns NULL and points *error at the
+ * reason.
+*/
+struct esshader *esshader_create(int width, int height, int flags, const int *config,
+        const char **error);
+void esshader_destroy(struct esshader *es);
+const char *esshader_error(const struct esshader *es);
+
+/*
+ * Build the image pass for source and return its GL program, or 0 on
+ * failure. Programs stay with the context until esshader_release() and
+ * keep track of what they were last sent, so drawing with one only
+ * uploads the inputs that changed since. mainImage() sees gl_FragCoord
+ * less the corner of the rectangle esshader_draw() fills.
+*/
+unsigned int esshader_program(struct esshader *es, const char *source);
+
+/* Make program the one esshader_draw() and esshader_render() use by default. */
+int esshader_use(struct esshader *es, unsigned int program);
+
+/* Delete program, or once it is no longer in use if it still is. */
+void esshader_release(struct esshader *es, unsigned int program);
+
+/* Compile source and use it from now on, releasing the program before. */
+int esshader_load(struct esshader *es, const char *source);
+
+/*
+ * Set a uniform of count floats. The ShaderToy inputs (iGlobalTime or
+ * iTime, iMouse, iDate, iSampleRate) apply to every program; iResolution
+ * follows what is drawn. Any other name is set on the current program
+ * and fails if it has no such uniform.
+*/
+int esshader_uniform(struct esshader *es, const char *name, int count, const float *values);
+
+/*
+ * Sample texture through iChannel<index> from the next frame on, and
+ * report width x height as its iChannelResolution. A texture of 0 binds
+ * nothing but still reports the size; a width of 0 reports no channel.
+*/
+int esshader_channel(struct esshader *es, int index, unsigned int texture, int width, int height);
+
+/* Whether any program of the context samples iChannel<index>. */
+int esshader_sampled(const struct esshader *es, int index);
+
+/* Offscreen formats; esshader_format_name() has them as "rgba8" and so on. */
+enum {
+    ESSHADER_RGBA8,
+    ESSHADER_RGB565,
+    ESSHADER_RGBA4,
+    ESSHADER_HALF,
+    ESSHADER_FORMATS
+};
+
+/* esshader_offscreen() flags */
+enum {
+    ESSHADER_FEEDBACK = 1 << 0,     /* keep the previous frame, see esshader_feedback() */
+    ESSHADER_MIPMAPPED = 1 << 1,    /* the caller builds mipmaps of the feedback */
+};
+
+/*
+ * Render into an offscreen target of scale times the window size and
+ * copy it to the window at the end of each frame. Headless contexts
+ * always render offscreen, in RGBA8 until told otherwise. A format the
+ * driver cannot render into drops to RGBA8, which esshader_target()
+ * then reports.
+*/
+int esshader_offscreen(struct esshader *es, int format, float scale, int flags);
+
+/* NULL beyond the last format */
+const char *esshader_format_name(int format);
+
+/* The size frames are rendered at, the window size times the scale. */
+void esshader_size(const struct esshader *es, int *width, int *height);
+
+/* Texture holding the previous frame, 0 without ESSHADER_FEEDBACK. */
+unsigned int esshader_feedback(const struct esshader *es);
+
+struct esshader_target {
+    const char *name;
+    int format;
+    int width;
+    int height;
+    int bytes_per_pixel;
+};
+
+/* Describe the image target, or the feedback one; 0 if there is none. */
+int esshader_target(const struct esshader *es, int feedback, struct esshader_target *target);
+
+enum { ESSHADER_TEXTURE, ESSHADER_FRAMEBUFFER, ESSHADER_BUFFER, ESSHADER_PROGRAM };
+
+struct esshader_object {
+    int kind;
+    unsigned int name;
+    unsigned long bytes;
+    const char *label;
+};
+
+/*
+ * List up to max of the GL objects the context made for itself, for
+ * callers keeping account of GPU memory, and return how many there are.
+ * They change with esshader_offscreen() and esshader_resize(); programs
+ * from esshader_program() are not among them.
+*/
+int esshader_objects(const struct esshader *es, struct esshader_object *objects, int max);
+
+int esshader_resize(struct esshader *es, int width, int height);
+
+/*
+ * A frame in steps, for drawing more than one program into it or adding
+ * to it before the swap. esshader_begin() binds the target and the
+ * channels and clears it; esshader_draw() fills the rectangle at x, y of
+ * the render size with program, 0 for the current one; esshader_end()
+ * copies an offscreen frame to the window, leaving the window bound.
+*/
+void esshader_begin(struct esshader *es);
+int esshader_draw(struct esshader *es, unsigned int program, int x, int y, int width, int height);
+void esshader_end(struct esshader *es);
+void esshader_swap(struct esshader *es);
+
+/*
+ * Draw a frame with the current program and, if rgba is not NULL, read
+ * it into width * height * 4 bytes of RGBA at the render size, top row
+ * first.
+*/
+int esshader_render(struct esshader *es, unsigned char *rgba);
+
+/*
+ * Lower level access for callers that drive GL on the context directly,
+ * such as essreplay or the esshader tool for its input and overlay.
+*/
+struct esshader_native {
+    void *x_display;            /* NULL when headless */
+    unsigned long x_window;
+    void *egl_display;
+    void *egl_context;
+    void *egl_surface;
+    int gles_version;
+};
+
+void esshader_native(const struct esshader *es, struct esshader_native *native);
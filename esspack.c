@@ -0,0 +1,86 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "pack.h"
+#include "util.h"
+
+static void usage(void){
+    die("usage: esspack [-M] [-f rgba8|rgb565|etc1] [-j threads] -o pack name=image.png ...\n");
+}
+
+int main(int argc, char **argv){
+    struct image *images;
+    const char **names;
+    const char *out_path = NULL;
+    struct pack pack;
+    const struct pack_entry *e;
+    uint32_t i, count;
+    int format = PACK_RGBA8, mipmaps = 1, threads, opt;
+    char *eq;
+
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "Mf:j:o:")) != -1) {
+        switch (opt) {
+            case 'M':
+                mipmaps = 0;
+                break;
+            case 'f':
+                if ((format = pack_format(optarg)) < 0)
+                    die("esspack: unknown format %s\n", optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (!out_path || optind == argc)
+        usage();
+
+    count = (uint32_t)(argc - optind);
+    images = calloc(count, sizeof(*images));
+    names = calloc(count, sizeof(*names));
+    if (!images || !names)
+        die("Unable to allocate image list.\n");
+
+    for (i = 0; i < count; ++i) {
+        if (!(eq = strchr(argv[optind + i], '=')) || eq == argv[optind + i] ||
+                eq - argv[optind + i] >= PACK_NAME_MAX)
+            usage();
+        *eq = '\0';
+        names[i] = argv[optind + i];
+        if (image_load_png(&images[i], eq + 1) == -1)
+            die("esspack: unable to load %s\n", eq + 1);
+        if (mipmaps && (images[i].width > PACK_MAX_SIZE || images[i].height > PACK_MAX_SIZE))
+            die("esspack: %s is larger than %u pixels, the most a mipmap chain holds\n",
+                    eq + 1, PACK_MAX_SIZE);
+    }
+
+    if (pack_write(out_path, names, images, count, format, mipmaps, threads) == -1)
+        die("esspack: error writing %s\n", out_path);
+    if (pack_open(&pack, out_path) == -1)
+        die("esspack: %s is not readable back\n", out_path);
+
+    for (i = 0; i < count; ++i) {
+        e = &pack.entries[i];
+        printf("%s: %ux%u %s, %u levels\n", e->name, e->level[0].width,
+                e->level[0].height, pack_format_names[e->format], e->levels);
+        image_free(&images[i]);
+    }
+
+    pack_close(&pack);
+    free(names);
+    free(images);
+    return 0;
+}
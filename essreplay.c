@@ -0,0 +1,585 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#ifdef GLES3
+#include <GLES3/gl3.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+
+#include "esshader.h"
+#define TRACE_REAL
+#include "trace.h"
+#include "util.h"
+
+#define MAX_WORDS 64
+#define MAX_ATTRIBS 16
+#define MAX_SYNCS 64
+
+struct record {
+    int call;
+    int nwords;
+    uint32_t w[MAX_WORDS];
+    const unsigned char *blob;      /* NULL without one */
+    uint32_t len;
+};
+
+/*
+ * Names and locations in a trace are those the recording driver handed
+ * out; these map them to what this one returns. Entries hold the new
+ * value plus one, so 0 marks a name never seen.
+*/
+struct map {
+    uint32_t *to;
+    size_t size;
+};
+
+struct program {
+    struct map uniforms;
+    struct map blocks;
+};
+
+static struct map objects, textures, buffers, framebuffers, attrib_locations;
+static struct program *programs;
+static size_t nprograms;
+static GLuint current;
+
+static struct {
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    int client;
+    uint64_t address;               /* as recorded */
+    const void *pointer;            /* as set here */
+} attribs[MAX_ATTRIBS];
+
+/*
+ * Copies of the client memory vertex arrays point into, by recorded
+ * address. They stay put from draw to draw, so pointers set up once
+ * remain good just as they did while recording.
+*/
+static struct {
+    uint64_t base;
+    uint32_t len;
+    unsigned char *data;
+    size_t capacity;
+} regions[MAX_ATTRIBS];
+static int next_region;
+
+#ifdef GLES3
+static struct {
+    uint64_t from;
+    GLsync to;
+} syncs[MAX_SYNCS];
+#endif
+
+static unsigned char *scratch;
+static size_t scratch_size;
+
+static void usage(void){
+    die("usage: essreplay [-d] [-H] trace\n");
+}
+
+static void map_set(struct map *m, uint32_t from, uint32_t to){
+    size_t size;
+
+    if (from >= m->size) {
+        size = m->size ? m->size : 64;
+        while (size <= from)
+            size *= 2;
+        if (!(m->to = realloc(m->to, size * sizeof(*m->to))))
+            die("Unable to allocate name map.\n");
+        memset(m->to + m->size, 0, (size - m->size) * sizeof(*m->to));
+        m->size = size;
+    }
+    m->to[from] = to + 1;
+}
+
+/* Unknown names pass through unchanged, 0 among them. */
+static GLuint name(const struct map *m, uint32_t from){
+    return from < m->size && m->to[from] ? m->to[from] - 1 : from;
+}
+
+/* Unknown locations become -1, which GL silently ignores. */
+static GLint location(const struct map *m, uint32_t from){
+    return from < m->size && m->to[from] ? (GLint)(m->to[from] - 1) : -1;
+}
+
+static struct program *program(uint32_t from){
+    size_t size;
+
+    if (from >= nprograms) {
+        size = nprograms ? nprograms : 16;
+        while (size <= from)
+            size *= 2;
+        if (!(programs = realloc(programs, size * sizeof(*programs))))
+            die("Unable to allocate program map.\n");
+        memset(programs + nprograms, 0, (size - nprograms) * sizeof(*programs));
+        nprograms = size;
+    }
+    return &programs[from];
+}
+
+static void *scratch_space(size_t size){
+    if (size > scratch_size) {
+        if (!(scratch = realloc(scratch, size)))
+            die("Unable to allocate %zu bytes.\n", size);
+        scratch_size = size;
+    }
+    return scratch;
+}
+
+/* Names and source strings are blobs without their terminator. */
+static const char *string(const struct record *r){
+    char *s = scratch_space(r->len + 1);
+
+    memcpy(s, r->blob, r->len);
+    s[r->len] = '\0';
+    return s;
+}
+
+static GLfloat f(uint32_t w){
+    GLfloat v;
+
+    memcpy(&v, &w, sizeof(v));
+    return v;
+}
+
+static void gen(struct map *m, const struct record *r, void (*generate)(GLsizei, GLuint *)){
+    GLuint *names = scratch_space(r->w[0] * sizeof(*names));
+    uint32_t i, from;
+
+    generate(r->w[0], names);
+    for (i = 0; i < r->w[0] && (i + 1) * sizeof(from) <= r->len; ++i) {
+        memcpy(&from, r->blob + i * sizeof(from), sizeof(from));
+        map_set(m, from, names[i]);
+    }
+}
+
+static void delete(const struct map *m, const struct record *r, void (*remove)(GLsizei, const GLuint *)){
+    GLuint *names = scratch_space(r->w[0] * sizeof(*names));
+    uint32_t i, from;
+
+    for (i = 0; i < r->w[0] && (i + 1) * sizeof(from) <= r->len; ++i) {
+        memcpy(&from, r->blob + i * sizeof(from), sizeof(from));
+        names[i] = name(m, from);
+    }
+    remove(i, names);
+}
+
+#ifdef GLES3
+static GLsync *sync_slot(uint64_t from, int create){
+    int i, free_slot = -1;
+
+    for (i = 0; i < MAX_SYNCS; ++i) {
+        if (syncs[i].to && syncs[i].from == from)
+            return &syncs[i].to;
+        if (!syncs[i].to && free_slot < 0)
+            free_slot = i;
+    }
+    if (!create || free_slot < 0)
+        return NULL;
+    syncs[free_slot].from = from;
+    return &syncs[free_slot].to;
+}
+#endif
+
+static GLuint attrib(uint32_t from){
+    return name(&attrib_locations, from);
+}
+
+static const void *client_pointer(uint64_t address){
+    int i;
+
+    for (i = 0; i < MAX_ATTRIBS; ++i)
+        if (regions[i].data && address >= regions[i].base &&
+                address < regions[i].base + regions[i].len)
+            return regions[i].data + (address - regions[i].base);
+
+    return NULL;
+}
+
+static void attrib_data(const struct record *r){
+    uint64_t base = r->w[0] | (uint64_t)r->w[1] << 32;
+    const void *pointer;
+    int i;
+
+    for (i = 0; i < MAX_ATTRIBS && (!regions[i].data || regions[i].base != base); ++i)
+        ;
+    if (i == MAX_ATTRIBS)
+        i = next_region++ % MAX_ATTRIBS;
+    if (r->len > regions[i].capacity) {
+        free(regions[i].data);
+        if (!(regions[i].data = malloc(r->len)))
+            die("Unable to allocate vertex data.\n");
+        regions[i].capacity = r->len;
+    }
+    regions[i].base = base;
+    regions[i].len = r->len;
+    memcpy(regions[i].data, r->blob, r->len);
+
+    //Only the first draw, or one after the arrays moved, needs this
+    for (i = 0; i < MAX_ATTRIBS; ++i) {
+        if (!attribs[i].client || !(pointer = client_pointer(attribs[i].address)) ||
+                pointer == attribs[i].pointer)
+            continue;
+        glVertexAttribPointer(i, attribs[i].size, attribs[i].type, attribs[i].normalized,
+                attribs[i].stride, pointer);
+        attribs[i].pointer = pointer;
+    }
+}
+
+static void vertex_attrib_pointer(const struct record *r){
+    GLuint index = attrib(r->w[0]);
+    const void *pointer;
+
+    if (r->w[5]) {
+        pointer = (const void *)(uintptr_t)r->w[6];
+        if (index < MAX_ATTRIBS)
+            attribs[index].client = 0;
+    } else {
+        pointer = client_pointer(r->w[6] | (uint64_t)r->w[7] << 32);
+        if (index < MAX_ATTRIBS) {
+            attribs[index].size = r->w[1];
+            attribs[index].type = r->w[2];
+            attribs[index].normalized = r->w[3];
+            attribs[index].stride = r->w[4];
+            attribs[index].client = 1;
+            attribs[index].address = r->w[6] | (uint64_t)r->w[7] << 32;
+            attribs[index].pointer = pointer;
+        }
+    }
+    glVertexAttribPointer(index, r->w[1], r->w[2], r->w[3], r->w[4], pointer);
+}
+
+static void uniform_fv(const struct record *r, void (*set)(GLint, GLsizei, const GLfloat *)){
+    set(location(&program(current)->uniforms, r->w[0]), r->w[1], (const GLfloat *)r->blob);
+}
+
+static void shader_source(const struct record *r){
+    const GLchar *strings[MAX_WORDS];
+    GLint lengths[MAX_WORDS];
+    uint32_t i, offset = 0;
+
+    for (i = 0; i < r->w[1] && i + 2 < (uint32_t)r->nwords; ++i) {
+        strings[i] = (const GLchar *)r->blob + offset;
+        lengths[i] = r->w[2 + i];
+        offset += r->w[2 + i];
+    }
+    glShaderSource(name(&objects, r->w[0]), i, strings, lengths);
+}
+
+/* Returns 1 when the record ended a frame. */
+static int replay(const struct record *r, const struct esshader_native *native){
+    const uint32_t *w = r->w;
+    GLint values[16];
+
+    switch (r->call) {
+        case TRACE_glActiveTexture: glActiveTexture(w[0]); break;
+        case TRACE_glAttachShader: glAttachShader(name(&objects, w[0]), name(&objects, w[1])); break;
+        case TRACE_glBindBuffer: glBindBuffer(w[0], name(&buffers, w[1])); break;
+        case TRACE_glBindFramebuffer: glBindFramebuffer(w[0], name(&framebuffers, w[1])); break;
+        case TRACE_glBindTexture: glBindTexture(w[0], name(&textures, w[1])); break;
+        case TRACE_glBlendFunc: glBlendFunc(w[0], w[1]); break;
+        case TRACE_glBufferData: glBufferData(w[0], w[1], r->blob, w[2]); break;
+        case TRACE_glBufferSubData: glBufferSubData(w[0], w[1], w[2], r->blob); break;
+        case TRACE_glCheckFramebufferStatus: glCheckFramebufferStatus(w[0]); break;
+        case TRACE_glClear: glClear(w[0]); break;
+        case TRACE_glClearColor: glClearColor(f(w[0]), f(w[1]), f(w[2]), f(w[3])); break;
+        case TRACE_glCompileShader: glCompileShader(name(&objects, w[0])); break;
+        case TRACE_glCompressedTexImage2D:
+            glCompressedTexImage2D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], r->blob);
+            break;
+        case TRACE_glCreateProgram: map_set(&objects, w[0], glCreateProgram()); break;
+        case TRACE_glCreateShader: map_set(&objects, w[1], glCreateShader(w[0])); break;
+        case TRACE_glDeleteBuffers: delete(&buffers, r, glDeleteBuffers); break;
+        case TRACE_glDeleteFramebuffers: delete(&framebuffers, r, glDeleteFramebuffers); break;
+        case TRACE_glDeleteProgram: glDeleteProgram(name(&objects, w[0])); break;
+        case TRACE_glDeleteShader: glDeleteShader(name(&objects, w[0])); break;
+        case TRACE_glDeleteTextures: delete(&textures, r, glDeleteTextures); break;
+        case TRACE_glDisable: glDisable(w[0]); break;
+        case TRACE_glDisableVertexAttribArray: glDisableVertexAttribArray(attrib(w[0])); break;
+        case TRACE_glDrawArrays: glDrawArrays(w[0], w[1], w[2]); break;
+        case TRACE_glEnable: glEnable(w[0]); break;
+        case TRACE_glEnableVertexAttribArray: glEnableVertexAttribArray(attrib(w[0])); break;
+        case TRACE_glFramebufferTexture2D:
+            glFramebufferTexture2D(w[0], w[1], w[2], name(&textures, w[3]), w[4]);
+            break;
+        case TRACE_glGenBuffers: gen(&buffers, r, glGenBuffers); break;
+        case TRACE_glGenFramebuffers: gen(&framebuffers, r, glGenFramebuffers); break;
+        case TRACE_glGenTextures: gen(&textures, r, glGenTextures); break;
+        case TRACE_glGenerateMipmap: glGenerateMipmap(w[0]); break;
+        case TRACE_glGetAttribLocation:
+            if ((GLint)w[1] >= 0)
+                map_set(&attrib_locations, w[1],
+                        glGetAttribLocation(name(&objects, w[0]), string(r)));
+            break;
+        case TRACE_glGetError: glGetError(); break;
+        case TRACE_glGetIntegerv: glGetIntegerv(w[0], values); break;
+        case TRACE_glGetProgramInfoLog:
+            glGetProgramInfoLog(name(&objects, w[0]), w[1], NULL, scratch_space(w[1] + 1));
+            break;
+        case TRACE_glGetProgramiv: glGetProgramiv(name(&objects, w[0]), w[1], values); break;
+        case TRACE_glGetShaderInfoLog:
+            glGetShaderInfoLog(name(&objects, w[0]), w[1], NULL, scratch_space(w[1] + 1));
+            break;
+        case TRACE_glGetShaderiv: glGetShaderiv(name(&objects, w[0]), w[1], values); break;
+        case TRACE_glGetString: glGetString(w[0]); break;
+        case TRACE_glGetUniformLocation:
+            if ((GLint)w[1] >= 0)
+                map_set(&program(w[0])->uniforms, w[1],
+                        glGetUniformLocation(name(&objects, w[0]), string(r)));
+            break;
+        case TRACE_glLinkProgram: glLinkProgram(name(&objects, w[0])); break;
+        case TRACE_glPixelStorei: glPixelStorei(w[0], w[1]); break;
+        case TRACE_glReadPixels:
+            glReadPixels(w[0], w[1], w[2], w[3], w[4], w[5], w[6] ?
+                    (void *)(uintptr_t)w[7] : scratch_space((size_t)w[2] * w[3] * 16));
+            break;
+        case TRACE_glReleaseShaderCompiler: glReleaseShaderCompiler(); break;
+        case TRACE_glShaderSource: shader_source(r); break;
+        case TRACE_glTexImage2D:
+            glTexImage2D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], r->blob);
+            break;
+        case TRACE_glTexParameteri: glTexParameteri(w[0], w[1], w[2]); break;
+        case TRACE_glTexSubImage2D:
+            glTexSubImage2D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], r->blob);
+            break;
+        case TRACE_glUniform1f:
+            glUniform1f(location(&program(current)->uniforms, w[0]), f(w[1]));
+            break;
+        case TRACE_glUniform1fv: uniform_fv(r, glUniform1fv); break;
+        case TRACE_glUniform1i:
+            glUniform1i(location(&program(current)->uniforms, w[0]), w[1]);
+            break;
+        case TRACE_glUniform2f:
+            glUniform2f(location(&program(current)->uniforms, w[0]), f(w[1]), f(w[2]));
+            break;
+        case TRACE_glUniform2fv: uniform_fv(r, glUniform2fv); break;
+        case TRACE_glUniform3f:
+            glUniform3f(location(&program(current)->uniforms, w[0]), f(w[1]), f(w[2]), f(w[3]));
+            break;
+        case TRACE_glUniform3fv: uniform_fv(r, glUniform3fv); break;
+        case TRACE_glUniform4fv: uniform_fv(r, glUniform4fv); break;
+        case TRACE_glUseProgram:
+            current = w[0];
+            glUseProgram(name(&objects, w[0]));
+            break;
+        case TRACE_glValidateProgram: glValidateProgram(name(&objects, w[0])); break;
+        case TRACE_glVertexAttribPointer: vertex_attrib_pointer(r); break;
+        case TRACE_glViewport: glViewport(w[0], w[1], w[2], w[3]); break;
+#ifdef GLES3
+        case TRACE_glBindBufferBase: glBindBufferBase(w[0], w[1], name(&buffers, w[2])); break;
+        case TRACE_glClientWaitSync: {
+            GLsync *sync = sync_slot(w[0] | (uint64_t)w[1] << 32, 0);
+
+            if (sync)
+                glClientWaitSync(*sync, w[2], w[3] | (uint64_t)w[4] << 32);
+            break;
+        }
+        case TRACE_glDeleteSync: {
+            GLsync *sync = sync_slot(w[0] | (uint64_t)w[1] << 32, 0);
+
+            if (sync) {
+                glDeleteSync(*sync);
+                *sync = NULL;
+            }
+            break;
+        }
+        case TRACE_glFenceSync: {
+            GLsync *sync = sync_slot(w[2] | (uint64_t)w[3] << 32, 1);
+
+            if (!sync)
+                die("More than %d fences in flight.\n", MAX_SYNCS);
+            *sync = glFenceSync(w[0], w[1]);
+            break;
+        }
+        case TRACE_glGetUniformBlockIndex:
+            map_set(&program(w[0])->blocks, w[1],
+                    glGetUniformBlockIndex(name(&objects, w[0]), string(r)));
+            break;
+        case TRACE_glMapBufferRange: glMapBufferRange(w[0], w[1], w[2], w[3]); break;
+        case TRACE_glUniformBlockBinding:
+            glUniformBlockBinding(name(&objects, w[0]), name(&program(w[0])->blocks, w[1]), w[2]);
+            break;
+        case TRACE_glUnmapBuffer: glUnmapBuffer(w[0]); break;
+#else
+        case TRACE_glBindBufferBase:
+        case TRACE_glClientWaitSync:
+        case TRACE_glDeleteSync:
+        case TRACE_glFenceSync:
+        case TRACE_glGetUniformBlockIndex:
+        case TRACE_glMapBufferRange:
+        case TRACE_glUniformBlockBinding:
+        case TRACE_glUnmapBuffer:
+            die("The trace uses OpenGL ES 3.0, essreplay was built without it.\n");
+#endif
+        case TRACE_ATTRIB_DATA: attrib_data(r); break;
+        case TRACE_eglSwapBuffers:
+            eglSwapBuffers(native->egl_display, native->egl_surface);
+            return 1;
+        default:
+            //The context is essreplay's own, so the other EGL calls are moot
+            break;
+    }
+
+    return 0;
+}
+
+static int next_record(const unsigned char **p, const unsigned char *end, struct record *r){
+    uint16_t head[2];
+
+    if (*p == end)
+        return 0;
+    if (end - *p < (long)sizeof(head))
+        die("Truncated trace.\n");
+    memcpy(head, *p, sizeof(head));
+    *p += sizeof(head);
+    r->call = head[0];
+    r->nwords = head[1] & ~TRACE_BLOB;
+    if (r->call >= TRACE_LAST || r->nwords > MAX_WORDS ||
+            end - *p < (long)(r->nwords * sizeof(uint32_t)))
+        die("Corrupt trace record.\n");
+    memcpy(r->w, *p, r->nwords * sizeof(uint32_t));
+    *p += r->nwords * sizeof(uint32_t);
+    r->blob = NULL;
+    r->len = 0;
+    if (head[1] & TRACE_BLOB) {
+        if (end - *p < (long)sizeof(r->len))
+            die("Truncated trace.\n");
+        memcpy(&r->len, *p, sizeof(r->len));
+        *p += sizeof(r->len);
+        if ((size_t)(end - *p) < ((r->len + 3) & ~3u))
+            die("Truncated trace.\n");
+        r->blob = *p;
+        *p += (r->len + 3) & ~3u;
+    }
+
+    return 1;
+}
+
+static void dump(const struct record *r, long frame){
+    int i;
+
+    printf("%ld %s", frame, trace_call_names[r->call]);
+    for (i = 0; i < r->nwords; ++i)
+        printf(" %d", (int)r->w[i]);
+    if (r->blob) {
+        switch (r->call) {
+            case TRACE_glShaderSource:
+            case TRACE_glGetAttribLocation:
+            case TRACE_glGetUniformLocation:
+            case TRACE_glGetUniformBlockIndex:
+                printf(" \"%.*s\"", (int)r->len, (const char *)r->blob);
+                break;
+            default:
+                printf(" [%u bytes]", r->len);
+        }
+    }
+    putchar('\n');
+}
+
+static unsigned char *load(const char *path, size_t *size){
+    unsigned char *data = NULL, *p;
+    size_t n, capacity = 0;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "rb")))
+        die("essreplay: unable to open %s\n", path);
+    *size = 0;
+    do {
+        if (*size == capacity) {
+            capacity = capacity ? 2 * capacity : 1 << 20;
+            if (!(p = realloc(data, capacity)))
+                die("essreplay: unable to allocate %zu bytes\n", capacity);
+            data = p;
+        }
+        n = fread(data + *size, 1, capacity - *size, fp);
+        *size += n;
+    } while (n > 0);
+    if (ferror(fp))
+        die("essreplay: error reading %s\n", path);
+    fclose(fp);
+
+    return data;
+}
+
+int main(int argc, char **argv){
+    struct esshader *es = NULL;
+    struct esshader_native native;
+    struct record r;
+    struct timespec start, stop;
+    const unsigned char *p, *end;
+    unsigned char *data;
+    const char *error;
+    int32_t header[5];
+    size_t size;
+    long frames = 0, calls = 0;
+    int dumping = 0, headless = 0, opt;
+    double seconds;
+
+    while ((opt = getopt(argc, argv, "dH")) != -1) {
+        switch (opt) {
+            case 'd':
+                dumping = 1;
+                break;
+            case 'H':
+                headless = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    data = load(argv[optind], &size);
+    if (size < 8 + sizeof(header) || memcmp(data, "ESTRACE", 8))
+        die("essreplay: %s is not a trace\n", argv[optind]);
+    memcpy(header, data + 8, sizeof(header));
+    if (header[0] != 0x01020304)
+        die("essreplay: %s was recorded with the other byte order\n", argv[optind]);
+    if (header[1] != TRACE_VERSION)
+        die("essreplay: %s is trace version %d, expected %d\n", argv[optind],
+                header[1], TRACE_VERSION);
+    p = data + 8 + sizeof(header);
+    end = data + size;
+
+    if (dumping) {
+        printf("%dx%d, flags %d\n", header[2], header[3], header[4]);
+        while (next_record(&p, end, &r)) {
+            dump(&r, frames);
+            frames += r.call == TRACE_eglSwapBuffers;
+        }
+        free(data);
+        return 0;
+    }
+
+    if (!(es = esshader_create(header[2], header[3],
+                    header[4] | (headless ? ESSHADER_HEADLESS : 0), NULL, &error)))
+        die("essreplay: %s\n", error);
+    esshader_native(es, &native);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (next_record(&p, end, &r)) {
+        frames += replay(&r, &native);
+        calls++;
+    }
+    glFinish();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%ld calls, %ld frames in %.3f s: %.1f frames/s, %.3f ms/frame\n", calls, frames,
+            seconds, frames / seconds, frames ? 1000.0 * seconds / frames : 0.0);
+
+    esshader_destroy(es);
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,261 @@
+/* See LICENSE file for copyright and license details. */
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "etc1.h"
+#include "util.h"
+
+/* modifier per pixel index, in the order the index bits encode them */
+static const int modifiers[8][4] = {
+    {   2,   8,   -2,   -8 },
+    {   5,  17,   -5,  -17 },
+    {   9,  29,   -9,  -29 },
+    {  13,  42,  -13,  -42 },
+    {  18,  60,  -18,  -60 },
+    {  24,  80,  -24,  -80 },
+    {  33, 106,  -33, -106 },
+    {  47, 183,  -47, -183 },
+};
+
+struct subblock {
+    int rgb[8][3];
+    int pos[8];
+};
+
+struct fit {
+    unsigned int error;
+    int table;
+    int index[8];
+    int pos[8];
+};
+
+struct job {
+    const unsigned char *rgba;
+    uint32_t width;
+    uint32_t height;
+    unsigned char *out;
+    int first;
+    int step;
+};
+
+size_t etc1_size(uint32_t width, uint32_t height){
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * ETC1_BLOCK_SIZE;
+}
+
+static int clamp255(int v){
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/*
+ * Pick the modifier table and per pixel modifiers that bring a subblock
+ * closest to its base colour. The loops have fixed trip counts and no
+ * early exits so the compiler can vectorise them over pixels.
+*/
+static void fit_subblock(const struct subblock *sb, const int base[3], struct fit *best){
+    unsigned int err[8][4], total, e;
+    int t, m, p, c, v;
+
+    best->error = UINT_MAX;
+    for (t = 0; t < 8; ++t) {
+        for (p = 0; p < 8; ++p) {
+            for (m = 0; m < 4; ++m) {
+                e = 0;
+                for (c = 0; c < 3; ++c) {
+                    v = clamp255(base[c] + modifiers[t][m]) - sb->rgb[p][c];
+                    e += (unsigned int)(v * v);
+                }
+                err[p][m] = e;
+            }
+        }
+
+        total = 0;
+        for (p = 0; p < 8; ++p) {
+            e = err[p][0];
+            for (m = 1; m < 4; ++m)
+                e = err[p][m] < e ? err[p][m] : e;
+            total += e;
+        }
+
+        if (total < best->error) {
+            best->error = total;
+            best->table = t;
+            for (p = 0; p < 8; ++p) {
+                best->index[p] = 0;
+                for (m = 1; m < 4; ++m)
+                    if (err[p][m] < err[p][best->index[p]])
+                        best->index[p] = m;
+            }
+        }
+    }
+}
+
+static void average(const struct subblock *sb, int avg[3]){
+    int c, p;
+
+    for (c = 0; c < 3; ++c) {
+        avg[c] = 0;
+        for (p = 0; p < 8; ++p)
+            avg[c] += sb->rgb[p][c];
+        avg[c] = (avg[c] + 4) / 8;
+    }
+}
+
+static void split(const unsigned char pixels[16][4], int flip, struct subblock sb[2]){
+    int x, y, s, n[2] = {0, 0};
+
+    /* pixel p of the index table is column major: p = x * 4 + y */
+    for (x = 0; x < 4; ++x) {
+        for (y = 0; y < 4; ++y) {
+            s = flip ? y >= 2 : x >= 2;
+            sb[s].rgb[n[s]][0] = pixels[y * 4 + x][0];
+            sb[s].rgb[n[s]][1] = pixels[y * 4 + x][1];
+            sb[s].rgb[n[s]][2] = pixels[y * 4 + x][2];
+            sb[s].pos[n[s]++] = x * 4 + y;
+        }
+    }
+}
+
+void etc1_encode_block(const unsigned char pixels[16][4], unsigned char block[ETC1_BLOCK_SIZE]){
+    struct subblock sb[2];
+    struct fit fit[2], best[2];
+    int avg[2][3], q[2][3], base[2][3], delta[3];
+    int flip, diff, best_flip = 0, best_diff = 0, best_q[2][3] = {{0}}, c, s, p;
+    unsigned int best_error = UINT_MAX;
+    uint32_t hi, lo;
+
+    for (flip = 0; flip < 2; ++flip) {
+        split(pixels, flip, sb);
+        average(&sb[0], avg[0]);
+        average(&sb[1], avg[1]);
+
+        for (diff = 0; diff < 2; ++diff) {
+            for (s = 0; s < 2; ++s) {
+                for (c = 0; c < 3; ++c) {
+                    if (diff) {
+                        q[s][c] = (avg[s][c] * 31 + 127) / 255;
+                        base[s][c] = q[s][c] << 3 | q[s][c] >> 2;
+                    } else {
+                        q[s][c] = (avg[s][c] * 15 + 127) / 255;
+                        base[s][c] = q[s][c] << 4 | q[s][c];
+                    }
+                }
+            }
+
+            if (diff) {
+                for (c = 0; c < 3; ++c) {
+                    delta[c] = q[1][c] - q[0][c];
+                    if (delta[c] < -4 || delta[c] > 3)
+                        break;
+                }
+                if (c < 3)
+                    continue;
+            }
+
+            fit_subblock(&sb[0], base[0], &fit[0]);
+            fit_subblock(&sb[1], base[1], &fit[1]);
+            if (fit[0].error + fit[1].error < best_error) {
+                best_error = fit[0].error + fit[1].error;
+                best_flip = flip;
+                best_diff = diff;
+                memcpy(best_q, q, sizeof(q));
+                for (s = 0; s < 2; ++s) {
+                    best[s] = fit[s];
+                    memcpy(best[s].pos, sb[s].pos, sizeof(sb[s].pos));
+                }
+            }
+        }
+    }
+
+    if (best_diff) {
+        hi = (uint32_t)best_q[0][0] << 27 | (uint32_t)((best_q[1][0] - best_q[0][0]) & 7) << 24 |
+            (uint32_t)best_q[0][1] << 19 | (uint32_t)((best_q[1][1] - best_q[0][1]) & 7) << 16 |
+            (uint32_t)best_q[0][2] << 11 | (uint32_t)((best_q[1][2] - best_q[0][2]) & 7) << 8;
+    } else {
+        hi = (uint32_t)best_q[0][0] << 28 | (uint32_t)best_q[1][0] << 24 |
+            (uint32_t)best_q[0][1] << 20 | (uint32_t)best_q[1][1] << 16 |
+            (uint32_t)best_q[0][2] << 12 | (uint32_t)best_q[1][2] << 8;
+    }
+    hi |= (uint32_t)best[0].table << 5 | (uint32_t)best[1].table << 2 |
+        (uint32_t)best_diff << 1 | (uint32_t)best_flip;
+
+    lo = 0;
+    for (s = 0; s < 2; ++s) {
+        for (p = 0; p < 8; ++p) {
+            lo |= (uint32_t)(best[s].index[p] & 1) << best[s].pos[p] |
+                (uint32_t)(best[s].index[p] >> 1) << (best[s].pos[p] + 16);
+        }
+    }
+
+    block[0] = (unsigned char)(hi >> 24);
+    block[1] = (unsigned char)(hi >> 16);
+    block[2] = (unsigned char)(hi >> 8);
+    block[3] = (unsigned char)hi;
+    block[4] = (unsigned char)(lo >> 24);
+    block[5] = (unsigned char)(lo >> 16);
+    block[6] = (unsigned char)(lo >> 8);
+    block[7] = (unsigned char)lo;
+}
+
+static void *encode_rows(void *arg){
+    const struct job *job = arg;
+    unsigned char pixels[16][4];
+    uint32_t bw = (job->width + 3) / 4, bh = (job->height + 3) / 4, bx, by, x, y, sx, sy;
+
+    for (by = (uint32_t)job->first; by < bh; by += (uint32_t)job->step) {
+        for (bx = 0; bx < bw; ++bx) {
+            for (y = 0; y < 4; ++y) {
+                sy = by * 4 + y < job->height ? by * 4 + y : job->height - 1;
+                for (x = 0; x < 4; ++x) {
+                    sx = bx * 4 + x < job->width ? bx * 4 + x : job->width - 1;
+                    memcpy(pixels[y * 4 + x], job->rgba + ((size_t)sy * job->width + sx) * 4, 4);
+                }
+            }
+            etc1_encode_block((const unsigned char (*)[4])pixels,
+                    job->out + ((size_t)by * bw + bx) * ETC1_BLOCK_SIZE);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Rows of blocks are dealt out round robin, so neighbouring threads work
+ * on neighbouring rows and the load stays even across the image.
+*/
+void etc1_encode(const unsigned char *rgba, uint32_t width, uint32_t height,
+        unsigned char *out, int threads){
+    pthread_t *tids;
+    struct job *jobs;
+    int i, rows = (int)((height + 3) / 4);
+
+    if (threads > rows)
+        threads = rows;
+    if (threads < 1)
+        threads = 1;
+
+    tids = calloc(threads, sizeof(*tids));
+    jobs = calloc(threads, sizeof(*jobs));
+    if (!tids || !jobs)
+        die("Unable to allocate ETC1 encoder threads.\n");
+
+    for (i = 0; i < threads; ++i) {
+        jobs[i].rgba = rgba;
+        jobs[i].width = width;
+        jobs[i].height = height;
+        jobs[i].out = out;
+        jobs[i].first = i;
+        jobs[i].step = threads;
+        if (i > 0 && pthread_create(&tids[i], NULL, encode_rows, &jobs[i]))
+            die("Unable to start ETC1 encoder thread.\n");
+    }
+
+    encode_rows(&jobs[0]);
+    for (i = 1; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+
+    free(jobs);
+    free(tids);
+}
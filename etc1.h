@@ -0,0 +1,13 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * ETC1 encoder. Input is tightly packed RGBA8, alpha is dropped; the
+ * output holds one 8 byte block per 4x4 pixels, partial blocks at the
+ * right and top edges repeat the last column or row.
+*/
+#define ETC1_BLOCK_SIZE 8
+
+size_t etc1_size(uint32_t width, uint32_t height);
+void etc1_encode_block(const unsigned char pixels[16][4], unsigned char block[ETC1_BLOCK_SIZE]);
+void etc1_encode(const unsigned char *rgba, uint32_t width, uint32_t height,
+        unsigned char *out, int threads);
@@ -0,0 +1,221 @@
+/* See LICENSE file for copyright and license details. */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "farm.h"
+#include "util.h"
+
+/* large enough for a few frames in flight, if the system allows it */
+#define FARM_PIPE_SIZE (4 << 20)
+
+struct header {
+    long frame;
+    double busy;            /* seconds spent on the frame outside the pipe */
+};
+
+struct worker {
+    pid_t pid;
+    int fd;
+    long frames;
+    double busy;
+};
+
+static struct worker *workers;
+static int nworkers;
+static int self = -1;
+static int pipe_fd = -1;
+static long sent;
+static long next;
+static unsigned char *frame;
+static int frame_width;
+static int frame_height;
+static double waited;
+static struct timespec started;
+static struct timespec last_send;
+
+static double seconds_since(const struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void write_all(int fd, const void *data, size_t size){
+    const char *p = data;
+    ssize_t n;
+
+    while (size) {
+        if ((n = write(fd, p, size)) < 0) {
+            if (errno == EINTR)
+                continue;
+            die("Worker %d lost the coordinator.\n", self);
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+}
+
+/* Returns false on a clean end of file before anything was read. */
+static bool read_all(int fd, void *data, size_t size){
+    char *p = data;
+    size_t left = size;
+    ssize_t n;
+
+    while (left) {
+        if ((n = read(fd, p, left)) < 0) {
+            if (errno == EINTR)
+                continue;
+            die("Unable to read from worker: %s\n", strerror(errno));
+        }
+        if (n == 0) {
+            if (left == size)
+                return false;
+            die("Worker ended in the middle of a frame.\n");
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    return true;
+}
+
+int farm_start(int n){
+    int fds[2];
+    int i, j;
+
+    if (!(workers = calloc(n, sizeof(*workers))))
+        die("Unable to allocate workers.\n");
+    nworkers = n;
+    fflush(NULL);
+    for (i = 0; i < n; ++i) {
+        if (pipe(fds))
+            die("Unable to create a pipe for worker %d.\n", i);
+#ifdef F_SETPIPE_SZ
+        fcntl(fds[1], F_SETPIPE_SZ, FARM_PIPE_SIZE);
+#endif
+        if ((workers[i].pid = fork()) < 0)
+            die("Unable to start worker %d.\n", i);
+        if (workers[i].pid == 0) {
+            for (j = 0; j < i; ++j)
+                close(workers[j].fd);
+            close(fds[0]);
+            free(workers);
+            workers = NULL;
+            self = i;
+            pipe_fd = fds[1];
+            return i;
+        }
+        close(fds[1]);
+        workers[i].fd = fds[0];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    return -1;
+}
+
+void farm_hello(int width, int height){
+    int size[2] = { width, height };
+
+    write_all(pipe_fd, size, sizeof(size));
+    clock_gettime(CLOCK_MONOTONIC, &last_send);
+}
+
+/*
+ * Everything between two sends counts as busy, the send itself as idle:
+ * it only blocks when the coordinator is waiting on another worker.
+*/
+void farm_send(const unsigned char *pixels, size_t bytes){
+    struct header h = { self + sent++ * nworkers, seconds_since(&last_send) };
+
+    write_all(pipe_fd, &h, sizeof(h));
+    write_all(pipe_fd, pixels, bytes);
+    clock_gettime(CLOCK_MONOTONIC, &last_send);
+}
+
+void farm_size(int *width, int *height){
+    int size[2];
+    int i;
+
+    for (i = 0; i < nworkers; ++i) {
+        if (!read_all(workers[i].fd, size, sizeof(size)))
+            die("Worker %d exited before rendering.\n", i);
+        if (i && (size[0] != frame_width || size[1] != frame_height))
+            die("Worker %d renders %dx%d, not %dx%d.\n", i, size[0], size[1],
+                    frame_width, frame_height);
+        frame_width = size[0];
+        frame_height = size[1];
+    }
+    *width = frame_width;
+    *height = frame_height;
+}
+
+/* The next frame in order, or NULL once its worker has finished. */
+const unsigned char *farm_next(size_t bytes){
+    struct worker *w = &workers[next % nworkers];
+    struct timespec start;
+    struct header h;
+
+    if (!frame && !(frame = malloc(bytes)))
+        die("Unable to allocate farm frame.\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!read_all(w->fd, &h, sizeof(h)))
+        return NULL;
+    if (h.frame != next)
+        die("Worker %ld sent frame %ld instead of %ld.\n", next % nworkers, h.frame, next);
+    read_all(w->fd, frame, bytes);
+    waited += seconds_since(&start);
+    w->frames++;
+    w->busy += h.busy;
+    next++;
+    return frame;
+}
+
+/*
+ * Reaps the workers and reports throughput and how much of the run each
+ * worker spent rendering rather than blocked on the merge. Returns the
+ * number of workers that failed.
+*/
+int farm_stop(void){
+    double seconds = seconds_since(&started);
+    int failed = 0;
+    int i, status;
+    pid_t pid;
+
+    if (self >= 0) {
+        close(pipe_fd);
+        return 0;
+    }
+    for (i = 0; i < nworkers; ++i)
+        close(workers[i].fd);
+    log_report_begin();
+    for (i = 0; i < nworkers; ++i) {
+        while ((pid = waitpid(workers[i].pid, &status, 0)) < 0 && errno == EINTR)
+            ;
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            warning("Worker %d failed.\n", i);
+            failed++;
+        }
+    }
+
+    info("Farm merged %ld frames in %.2fs (%.1f fps) from %d workers, waiting %.2fs on them.\n",
+            next, seconds, next / seconds, nworkers, waited);
+    for (i = 0; i < nworkers; ++i) {
+        info("  worker %d  %6ld frames  %5.1f%% busy  %7.2f ms/frame\n", i, workers[i].frames,
+                100.0 * workers[i].busy / seconds,
+                workers[i].frames ? 1e3 * workers[i].busy / workers[i].frames : 0.0);
+    }
+    log_report_end();
+
+    free(workers);
+    free(frame);
+    workers = NULL;
+    frame = NULL;
+    return failed;
+}
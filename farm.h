@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Offline rendering split across worker processes. Worker k of n renders
+ * frames k, k + n, k + 2n, ... with its own context and pipes the pixels
+ * back; the coordinator reads the pipes round robin, which puts frames
+ * back in order, and blocks workers that run ahead of the slowest one.
+ * farm_start() returns the worker index in each child and -1 in the
+ * coordinator, which then learns the frame size from farm_size().
+*/
+int farm_start(int workers);
+void farm_hello(int width, int height);
+void farm_send(const unsigned char *pixels, size_t bytes);
+void farm_size(int *width, int *height);
+const unsigned char *farm_next(size_t bytes);
+int farm_stop(void);
@@ -0,0 +1,2463 @@
+/* See LICENSE file for copyright and license details. */
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glsl.h"
+
+#define MAX_PARAMS 16
+#define MAX_COMPONENTS 16
+#define MAX_NESTING 64
+
+enum {
+    TOKEN_END,
+    TOKEN_IDENT,
+    TOKEN_INT,
+    TOKEN_FLOAT,
+    TOKEN_PUNCT
+};
+
+struct token {
+    int kind;
+    int line;
+    int space;              /* whitespace before it, for #define f( */
+    const char *text;
+};
+
+struct tokens {
+    struct token *data;
+    size_t len;
+    size_t size;
+};
+
+struct buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+struct macro {
+    const char *name;
+    int function;
+    int nparams;
+    const char *params[MAX_PARAMS];
+    struct tokens body;
+    struct macro *next;
+};
+
+/* #if nesting: whether the enclosing group, any branch and this one are on */
+struct cond {
+    int parent;
+    int taken;
+    int active;
+};
+
+/* vectors and matrices count up from their two component form */
+enum {
+    TY_VOID,
+    TY_FLOAT,
+    TY_INT,
+    TY_BOOL,
+    TY_VEC2,
+    TY_VEC3,
+    TY_VEC4,
+    TY_MAT2,
+    TY_MAT3,
+    TY_MAT4,
+    TY_SAMPLER
+};
+
+static const struct {
+    const char *name;
+    const char *c;
+    const char *mangle;
+} types[] = {
+    [TY_VOID] = { "void", "void", "" },
+    [TY_FLOAT] = { "float", "vf", "f" },
+    [TY_INT] = { "int", "vi", "i" },
+    [TY_BOOL] = { "bool", "vi", "b" },
+    [TY_VEC2] = { "vec2", "v2", "v2" },
+    [TY_VEC3] = { "vec3", "v3", "v3" },
+    [TY_VEC4] = { "vec4", "v4", "v4" },
+    [TY_MAT2] = { "mat2", "m2", "m2" },
+    [TY_MAT3] = { "mat3", "m3", "m3" },
+    [TY_MAT4] = { "mat4", "m4", "m4" },
+    [TY_SAMPLER] = { "sampler2D", "", "s" },
+};
+
+/* GLSL ES 1.00 types the lane code has no representation for */
+static const char *const unsupported_types[] = {
+    "ivec2", "ivec3", "ivec4", "bvec2", "bvec3", "bvec4", "samplerCube", NULL
+};
+
+/* builtins that sample, need derivatives or return bvecs */
+static const char *const unsupported_builtins[] = {
+    "texture2D", "texture2DProj", "texture2DLod", "texture2DProjLod",
+    "textureCube", "textureCubeLod", "dFdx", "dFdy", "fwidth",
+    "lessThan", "lessThanEqual", "greaterThan", "greaterThanEqual",
+    "equal", "notEqual", "any", "all", "not", NULL
+};
+
+/*
+ * Builtins applied component by component through a helper of the
+ * prelude. Forms list the accepted argument lists: g is float or a vec,
+ * the same one throughout, f a float and m a matrix.
+*/
+static const struct {
+    const char *name;
+    const char *pattern;
+    const char *forms;
+} lanewise[] = {
+    { "radians", "b_radians(%s)", "g" },
+    { "degrees", "b_degrees(%s)", "g" },
+    { "sin", "b_sin(%s)", "g" },
+    { "cos", "b_cos(%s)", "g" },
+    { "tan", "b_tan(%s)", "g" },
+    { "asin", "b_asin(%s)", "g" },
+    { "acos", "b_acos(%s)", "g" },
+    { "atan", "b_atan(%s)", "g" },
+    { "atan", "b_atan2(%s, %s)", "gg" },
+    { "pow", "b_pow(%s, %s)", "gg" },
+    { "exp", "b_exp(%s)", "g" },
+    { "log", "b_log(%s)", "g" },
+    { "exp2", "b_exp2(%s)", "g" },
+    { "log2", "b_log2(%s)", "g" },
+    { "sqrt", "b_sqrt(%s)", "g" },
+    { "inversesqrt", "b_inversesqrt(%s)", "g" },
+    { "abs", "b_abs(%s)", "g" },
+    { "sign", "b_sign(%s)", "g" },
+    { "floor", "b_floor(%s)", "g" },
+    { "ceil", "b_ceil(%s)", "g" },
+    { "fract", "b_fract(%s)", "g" },
+    { "mod", "b_mod(%s, %s)", "gg gf" },
+    { "min", "b_min(%s, %s)", "gg gf" },
+    { "max", "b_max(%s, %s)", "gg gf" },
+    { "clamp", "b_clamp(%s, %s, %s)", "ggg gff" },
+    { "mix", "b_mix(%s, %s, %s)", "ggg ggf" },
+    { "step", "b_step(%s, %s)", "gg fg" },
+    { "smoothstep", "b_smoothstep(%s, %s, %s)", "ggg ffg" },
+    { "matrixCompMult", "(%s * %s)", "mm" },
+    { NULL, NULL, NULL }
+};
+
+static const char *const puncts[] = {
+    "<<=", ">>=", "++", "--", "&&", "||", "^^", "==", "!=", "<=", ">=",
+    "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<", ">>", "##", NULL
+};
+
+static const struct {
+    const char *op;
+    int prec;
+} cond_ops[] = {
+    { "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 },
+    { "==", 6 }, { "!=", 6 }, { "<", 7 }, { ">", 7 }, { "<=", 7 }, { ">=", 7 },
+    { "<<", 8 }, { ">>", 8 }, { "+", 9 }, { "-", 9 }, { "*", 10 }, { "/", 10 },
+    { "%", 10 }, { NULL, 0 }
+};
+
+static const struct {
+    const char *op;
+    int prec;
+} binary_ops[] = {
+    { "||", 1 }, { "^^", 2 }, { "&&", 3 }, { "==", 4 }, { "!=", 4 },
+    { "<", 5 }, { ">", 5 }, { "<=", 5 }, { ">=", 5 },
+    { "+", 6 }, { "-", 6 }, { "*", 7 }, { "/", 7 }, { NULL, 0 }
+};
+
+/*
+ * Everything the generated code leans on. Values are vectors of W lanes,
+ * bools and masks all-ones or zero per lane, vecs and matrices structs of
+ * them. Transcendentals go through libm one lane at a time.
+*/
+static const char prelude[] =
+    "#include <math.h>\n"
+    "#include <string.h>\n"
+    "#ifdef __SSE__\n"
+    "#include <xmmintrin.h>\n"
+    "#endif\n"
+    "\n"
+    "typedef float vf __attribute__((vector_size(4 * W)));\n"
+    "typedef int vi __attribute__((vector_size(4 * W)));\n"
+    "typedef struct { vf c[2]; } v2;\n"
+    "typedef struct { vf c[3]; } v3;\n"
+    "typedef struct { vf c[4]; } v4;\n"
+    "typedef struct { v2 c[2]; } m2;\n"
+    "typedef struct { v3 c[3]; } m3;\n"
+    "typedef struct { v4 c[4]; } m4;\n"
+    "\n"
+    "#define F(x) ((vf){0} + (x))\n"
+    "#define I(x) ((vi){0} + (x))\n"
+    "#define LANES(name, expr) static inline vf name(vf x) "
+        "{ vf r; int i; for (i = 0; i < W; i++) r[i] = expr; return r; }\n"
+    "#define LANES2(name, expr) static inline vf name(vf x, vf y) "
+        "{ vf r; int i; for (i = 0; i < W; i++) r[i] = expr; return r; }\n"
+    "\n"
+    "static inline vf self(vi m, vf a, vf b) { return (vf)(((vi)a & m) | ((vi)b & ~m)); }\n"
+    "static inline vi seli(vi m, vi a, vi b) { return (a & m) | (b & ~m); }\n"
+    "static inline int any(vi m) { int i, r = 0; for (i = 0; i < W; i++) r |= m[i]; return r != 0; }\n"
+    "static inline vi idiv(vi a, vi b) { return a / (b + ((b == I(0)) & 1)); }\n"
+    "static inline vf itof(vi x) { return __builtin_convertvector(x, vf); }\n"
+    "static inline vi ftoi(vf x) { return __builtin_convertvector(x, vi); }\n"
+    "\n"
+    "LANES(b_sin, sinf(x[i]))\n"
+    "LANES(b_cos, cosf(x[i]))\n"
+    "LANES(b_tan, tanf(x[i]))\n"
+    "LANES(b_asin, asinf(x[i]))\n"
+    "LANES(b_acos, acosf(x[i]))\n"
+    "LANES(b_atan, atanf(x[i]))\n"
+    "LANES(b_exp, expf(x[i]))\n"
+    "LANES(b_log, logf(x[i]))\n"
+    "LANES(b_exp2, exp2f(x[i]))\n"
+    "LANES(b_log2, log2f(x[i]))\n"
+    "LANES(b_sqrt, sqrtf(x[i]))\n"
+    "LANES(b_floor, floorf(x[i]))\n"
+    "LANES(b_ceil, ceilf(x[i]))\n"
+    "LANES2(b_atan2, atan2f(x[i], y[i]))\n"
+    "LANES2(b_pow, powf(x[i], y[i]))\n"
+    "static inline vf b_radians(vf x) { return x * 0.017453292519943295f; }\n"
+    "static inline vf b_degrees(vf x) { return x * 57.29577951308232f; }\n"
+    "static inline vf b_inversesqrt(vf x) { return 1.0f / b_sqrt(x); }\n"
+    "static inline vf b_abs(vf x) { return (vf)((vi)x & 0x7fffffff); }\n"
+    "static inline vf b_sign(vf x) { return self(x > 0.0f, F(1.0f), self(x < 0.0f, F(-1.0f), F(0.0f))); }\n"
+    "static inline vf b_fract(vf x) { return x - b_floor(x); }\n"
+    "static inline vf b_mod(vf x, vf y) { return x - y * b_floor(x / y); }\n"
+    "static inline vf b_min(vf x, vf y) { return self(y < x, y, x); }\n"
+    "static inline vf b_max(vf x, vf y) { return self(x < y, y, x); }\n"
+    "static inline vf b_clamp(vf x, vf lo, vf hi) { return b_min(b_max(x, lo), hi); }\n"
+    "static inline vf b_mix(vf x, vf y, vf a) { return x * (1.0f - a) + y * a; }\n"
+    "static inline vf b_step(vf e, vf x) { return self(x < e, F(0.0f), F(1.0f)); }\n"
+    "static inline vf b_smoothstep(vf e0, vf e1, vf x)\n"
+    "{\n"
+    "    vf t = b_clamp((x - e0) / (e1 - e0), F(0.0f), F(1.0f));\n"
+    "    return t * (t * (3.0f - 2.0f * t));\n"
+    "}\n"
+    "\n"
+    "static inline unsigned char unorm(float x)\n"
+    "{\n"
+    "    return x > 0.0f ? x < 1.0f ? (unsigned char)(x * 255.0f + 0.5f) : 255 : 0;\n"
+    "}\n"
+    "\n";
+
+/* Where each component of an assignable expression is stored */
+struct slot {
+    const char *lval;
+    int comp;
+    const char *guard;      /* lanes it applies to, after a dynamic index */
+};
+
+/*
+ * A translated expression. Simple ones are cheap and free of side
+ * effects, so they may be repeated instead of bound to a temporary.
+*/
+struct expr {
+    int type;
+    int array;              /* length of a whole array */
+    const char *code;
+    int simple;
+    int constant;           /* value holds the int or bool */
+    long value;
+    struct slot *slots;
+    int nslots;
+    const char *setup;      /* runs once before the slots are stored to */
+    const char *stored;     /* code reading the value once setup has run */
+};
+
+struct symbol {
+    const char *name;
+    const char *code;
+    int type;
+    int array;
+    int readonly;
+    int constant;
+    long value;
+    int depth;
+};
+
+enum {
+    QUAL_IN,
+    QUAL_OUT,
+    QUAL_INOUT
+};
+
+struct function {
+    const char *name;
+    const char *code;
+    int type;
+    int nparams;
+    int params[MAX_PARAMS];
+    int quals[MAX_PARAMS];
+    int defined;
+};
+
+static jmp_buf failed;
+static char *error_text;
+static size_t error_size;
+static int line;
+
+static void **allocs;
+static size_t nallocs;
+static size_t allocs_size;
+
+static struct macro *macros;
+static struct macro *active[MAX_NESTING];
+static int nactive;
+static struct cond conds[MAX_NESTING];
+static int nconds;
+
+static struct tokens tokens;
+static size_t pos;
+
+static struct symbol *symbols;
+static size_t nsymbols;
+static size_t symbols_size;
+static int depth;
+
+static struct function *functions;
+static size_t nfunctions;
+static size_t functions_size;
+
+static int loops[MAX_NESTING];
+static int nloops;
+static int returns;
+static int temps;
+static int in_function;
+
+static struct buf uniforms;
+static struct buf table;
+static struct buf fields;
+static struct buf inits;
+static struct buf funcs;
+
+static void fail(const char *format, ...){
+    va_list ap;
+    int n;
+
+    n = snprintf(error_text, error_size, "line %d: ", line);
+    if (n >= 0 && (size_t)n < error_size) {
+        va_start(ap, format);
+        vsnprintf(error_text + n, error_size - n, format, ap);
+        va_end(ap);
+    }
+    longjmp(failed, 1);
+}
+
+/* Everything is allocated here and freed in one go once translation ends */
+static void *alloc(size_t size){
+    void **grown;
+    void *p;
+
+    if (nallocs == allocs_size) {
+        allocs_size = allocs_size ? 2 * allocs_size : 1024;
+        if (!(grown = realloc(allocs, allocs_size * sizeof(*allocs))))
+            fail("out of memory");
+        allocs = grown;
+    }
+    if (!(p = calloc(1, size ? size : 1)))
+        fail("out of memory");
+    allocs[nallocs++] = p;
+    return p;
+}
+
+static void vbput(struct buf *b, const char *format, va_list ap){
+    va_list copy;
+    size_t size;
+    char *data;
+    int n;
+
+    va_copy(copy, ap);
+    n = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (b->len + n + 1 > b->size) {
+        for (size = b->size ? b->size : 256; size < b->len + n + 1; size *= 2)
+            ;
+        data = alloc(size);
+        if (b->len)
+            memcpy(data, b->data, b->len);
+        b->data = data;
+        b->size = size;
+    }
+    vsnprintf(b->data + b->len, n + 1, format, ap);
+    b->len += n;
+}
+
+static void bput(struct buf *b, const char *format, ...){
+    va_list ap;
+
+    va_start(ap, format);
+    vbput(b, format, ap);
+    va_end(ap);
+}
+
+static char *fmt(const char *format, ...){
+    struct buf b = {0};
+    va_list ap;
+
+    va_start(ap, format);
+    vbput(&b, format, ap);
+    va_end(ap);
+    return b.data ? b.data : "";
+}
+
+static char *copy(const char *s, size_t n){
+    char *p = alloc(n + 1);
+
+    memcpy(p, s, n);
+    return p;
+}
+
+static void push(struct tokens *v, struct token t){
+    struct token *data;
+
+    if (v->len == v->size) {
+        v->size = v->size ? 2 * v->size : 64;
+        data = alloc(v->size * sizeof(*data));
+        if (v->len)
+            memcpy(data, v->data, v->len * sizeof(*data));
+        v->data = data;
+    }
+    v->data[v->len++] = t;
+}
+
+static void append(struct tokens *v, const struct tokens *from){
+    size_t i;
+
+    for (i = 0; i < from->len; i++)
+        push(v, from->data[i]);
+}
+
+/* Comments and line splices out, newlines kept for the line numbers */
+static char *strip(const char *s){
+    char *out = alloc(strlen(s) + 1), *o = out;
+
+    while (*s) {
+        if (s[0] == '\\' && s[1] == '\n') {
+            s += 2;
+        } else if (s[0] == '/' && s[1] == '/') {
+            while (*s && *s != '\n')
+                s++;
+            *o++ = ' ';
+        } else if (s[0] == '/' && s[1] == '*') {
+            for (s += 2; *s && !(s[0] == '*' && s[1] == '/'); s++)
+                if (*s == '\n')
+                    *o++ = '\n';
+            if (!*s)
+                fail("unterminated comment");
+            s += 2;
+            *o++ = ' ';
+        } else {
+            *o++ = *s++;
+        }
+    }
+    return out;
+}
+
+static void lex(const char *s, int number, struct tokens *out){
+    struct token t;
+    const char *p;
+    int i, space = 1;
+
+    while (*s) {
+        if (isspace((unsigned char)*s)) {
+            s++;
+            space = 1;
+            continue;
+        }
+        t.line = number;
+        t.space = space;
+        space = 0;
+        p = s;
+        if (isalpha((unsigned char)*s) || *s == '_') {
+            while (isalnum((unsigned char)*p) || *p == '_')
+                p++;
+            t.kind = TOKEN_IDENT;
+        } else if (isdigit((unsigned char)*s) || (*s == '.' && isdigit((unsigned char)s[1]))) {
+            t.kind = TOKEN_INT;
+            if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+                for (p += 2; isxdigit((unsigned char)*p); p++)
+                    ;
+            } else {
+                while (isdigit((unsigned char)*p))
+                    p++;
+                if (*p == '.') {
+                    t.kind = TOKEN_FLOAT;
+                    for (p++; isdigit((unsigned char)*p); p++)
+                        ;
+                }
+                if ((*p == 'e' || *p == 'E') && (isdigit((unsigned char)p[1]) ||
+                        ((p[1] == '+' || p[1] == '-') && isdigit((unsigned char)p[2])))) {
+                    t.kind = TOKEN_FLOAT;
+                    for (p += 2; isdigit((unsigned char)*p); p++)
+                        ;
+                }
+            }
+        } else {
+            t.kind = TOKEN_PUNCT;
+            for (i = 0; puncts[i] && strncmp(s, puncts[i], strlen(puncts[i])); i++)
+                ;
+            p = s + (puncts[i] ? strlen(puncts[i]) : 1);
+        }
+        t.text = copy(s, p - s);
+        push(out, t);
+        s = p;
+    }
+}
+
+static struct macro *find_macro(const char *name){
+    struct macro *m;
+
+    for (m = macros; m; m = m->next)
+        if (!strcmp(m->name, name))
+            return m;
+    return NULL;
+}
+
+static int is_active(const struct macro *m){
+    int i;
+
+    for (i = 0; i < nactive; i++)
+        if (active[i] == m)
+            return 1;
+    return 0;
+}
+
+/*
+ * Expands the macros in, which stops short with -1 when a call to a
+ * function-like macro is not closed before the end and more lines may
+ * follow. Arguments are expanded before substitution and the result is
+ * rescanned with the macro itself switched off.
+*/
+static int expand(const struct token *in, size_t n, struct tokens *out, int last){
+    struct tokens args[MAX_PARAMS], body;
+    size_t i, j, k, start[MAX_PARAMS], end[MAX_PARAMS];
+    struct macro *m;
+    struct token t;
+    int nargs, level, p;
+
+    for (i = 0; i < n; i++) {
+        m = in[i].kind == TOKEN_IDENT ? find_macro(in[i].text) : NULL;
+        if (!m || is_active(m)) {
+            push(out, in[i]);
+            continue;
+        }
+        if (nactive == MAX_NESTING)
+            fail("macros nest too deeply");
+        memset(&body, 0, sizeof(body));
+        if (m->function) {
+            if (i + 1 == n && !last)
+                return -1;
+            if (i + 1 == n || strcmp(in[i + 1].text, "(")) {
+                push(out, in[i]);
+                continue;
+            }
+            nargs = level = 0;
+            start[0] = i + 2;
+            for (j = i + 2; j < n; j++) {
+                if (!strcmp(in[j].text, "(")) {
+                    level++;
+                } else if (!strcmp(in[j].text, ")")) {
+                    if (!level--)
+                        break;
+                } else if (!strcmp(in[j].text, ",") && !level) {
+                    if (nargs == MAX_PARAMS - 1)
+                        fail("too many arguments to %s", m->name);
+                    end[nargs++] = j;
+                    start[nargs] = j + 1;
+                }
+            }
+            if (j == n) {
+                if (!last)
+                    return -1;
+                fail("unterminated call of macro %s", m->name);
+            }
+            end[nargs++] = j;
+            if (!m->nparams && nargs == 1 && start[0] == end[0])
+                nargs = 0;
+            if (nargs != m->nparams)
+                fail("macro %s takes %d arguments", m->name, m->nparams);
+            for (p = 0; p < nargs; p++) {
+                memset(&args[p], 0, sizeof(args[p]));
+                expand(in + start[p], end[p] - start[p], &args[p], 1);
+            }
+            for (k = 0; k < m->body.len; k++) {
+                t = m->body.data[k];
+                for (p = 0; p < nargs && (t.kind != TOKEN_IDENT || strcmp(t.text, m->params[p])); p++)
+                    ;
+                if (p < nargs) {
+                    append(&body, &args[p]);
+                } else {
+                    t.line = in[i].line;
+                    push(&body, t);
+                }
+            }
+            i = j;
+        } else {
+            for (k = 0; k < m->body.len; k++) {
+                t = m->body.data[k];
+                t.line = in[i].line;
+                push(&body, t);
+            }
+        }
+        active[nactive++] = m;
+        expand(body.data, body.len, out, 1);
+        nactive--;
+    }
+    return 0;
+}
+
+static long cond_binary(const struct tokens *t, size_t *at, int min);
+
+static long cond_unary(const struct tokens *t, size_t *at){
+    const struct token *tok;
+    long v;
+
+    if (*at == t->len)
+        fail("incomplete #if expression");
+    tok = &t->data[(*at)++];
+    if (!strcmp(tok->text, "(")) {
+        v = cond_binary(t, at, 1);
+        if (*at == t->len || strcmp(t->data[(*at)++].text, ")"))
+            fail("expected ) in #if expression");
+        return v;
+    }
+    if (!strcmp(tok->text, "!"))
+        return !cond_unary(t, at);
+    if (!strcmp(tok->text, "-"))
+        return -cond_unary(t, at);
+    if (!strcmp(tok->text, "+"))
+        return cond_unary(t, at);
+    if (!strcmp(tok->text, "~"))
+        return ~cond_unary(t, at);
+    if (tok->kind == TOKEN_INT)
+        return strtol(tok->text, NULL, 0);
+    if (tok->kind == TOKEN_IDENT)
+        return 0;
+    fail("unexpected %s in #if expression", tok->text);
+    return 0;
+}
+
+static long cond_binary(const struct tokens *t, size_t *at, int min){
+    long a = cond_unary(t, at), b;
+    const char *op;
+    int i;
+
+    for (;;) {
+        for (i = 0; *at < t->len && cond_ops[i].op && strcmp(t->data[*at].text, cond_ops[i].op); i++)
+            ;
+        if (*at == t->len || !cond_ops[i].op || cond_ops[i].prec < min)
+            return a;
+        op = cond_ops[i].op;
+        (*at)++;
+        b = cond_binary(t, at, cond_ops[i].prec + 1);
+        if ((op[0] == '/' || op[0] == '%') && !b)
+            fail("division by zero in #if expression");
+        switch (op[0]) {
+        case '|': a = op[1] ? a || b : a | b; break;
+        case '&': a = op[1] ? a && b : a & b; break;
+        case '^': a = a ^ b; break;
+        case '=': a = a == b; break;
+        case '!': a = a != b; break;
+        case '<': a = op[1] == '<' ? a << b : op[1] ? a <= b : a < b; break;
+        case '>': a = op[1] == '>' ? a >> b : op[1] ? a >= b : a > b; break;
+        case '+': a = a + b; break;
+        case '-': a = a - b; break;
+        case '*': a = a * b; break;
+        case '/': a = a / b; break;
+        case '%': a = a % b; break;
+        }
+    }
+}
+
+static long condition(const struct tokens *t){
+    struct tokens in = {0}, out = {0};
+    struct token value;
+    size_t i, at = 0;
+    long v;
+    int paren;
+
+    for (i = 1; i < t->len; i++) {
+        if (strcmp(t->data[i].text, "defined")) {
+            push(&in, t->data[i]);
+            continue;
+        }
+        paren = i + 1 < t->len && !strcmp(t->data[i + 1].text, "(");
+        i += 1 + paren;
+        if (i >= t->len || t->data[i].kind != TOKEN_IDENT)
+            fail("defined needs a macro name");
+        value = t->data[i];
+        value.kind = TOKEN_INT;
+        value.text = find_macro(value.text) ? "1" : "0";
+        push(&in, value);
+        if (paren && (++i >= t->len || strcmp(t->data[i].text, ")")))
+            fail("expected ) after defined");
+    }
+    expand(in.data, in.len, &out, 1);
+    if (!out.len)
+        fail("#if without an expression");
+    v = cond_binary(&out, &at, 1);
+    if (at != out.len)
+        fail("invalid #if expression");
+    return v;
+}
+
+static int enabled(void){
+    return !nconds || conds[nconds - 1].active;
+}
+
+static void define(const struct tokens *t){
+    struct macro *m, **p;
+    size_t i = 2;
+
+    if (t->len < 2 || t->data[1].kind != TOKEN_IDENT)
+        fail("#define needs a name");
+    m = alloc(sizeof(*m));
+    m->name = t->data[1].text;
+    if (t->len > 2 && !strcmp(t->data[2].text, "(") && !t->data[2].space) {
+        m->function = 1;
+        if (++i < t->len && !strcmp(t->data[i].text, ")")) {
+            i++;
+        } else {
+            for (;;) {
+                if (i >= t->len || t->data[i].kind != TOKEN_IDENT)
+                    fail("invalid parameters of macro %s", m->name);
+                if (m->nparams == MAX_PARAMS)
+                    fail("too many parameters of macro %s", m->name);
+                m->params[m->nparams++] = t->data[i++].text;
+                if (i < t->len && !strcmp(t->data[i].text, ")")) {
+                    i++;
+                    break;
+                }
+                if (i >= t->len || strcmp(t->data[i++].text, ","))
+                    fail("invalid parameters of macro %s", m->name);
+            }
+        }
+    }
+    for (; i < t->len; i++) {
+        if (!strcmp(t->data[i].text, "#") || !strcmp(t->data[i].text, "##"))
+            fail("# and ## are not supported in macros");
+        push(&m->body, t->data[i]);
+    }
+    for (p = &macros; *p; p = &(*p)->next) {
+        if (!strcmp((*p)->name, m->name)) {
+            *p = (*p)->next;
+            break;
+        }
+    }
+    m->next = macros;
+    macros = m;
+}
+
+static void directive(const char *text){
+    struct tokens t = {0};
+    struct macro **p;
+    const char *name;
+    int on;
+
+    lex(text, line, &t);
+    if (!t.len)
+        return;
+    name = t.data[0].text;
+    if (!strcmp(name, "if") || !strcmp(name, "ifdef") || !strcmp(name, "ifndef")) {
+        if (nconds == MAX_NESTING)
+            fail("#if nests too deeply");
+        on = enabled();
+        if (on && name[2]) {
+            if (t.len != 2 || t.data[1].kind != TOKEN_IDENT)
+                fail("#%s needs a macro name", name);
+            on = !find_macro(t.data[1].text) == (name[2] == 'n');
+        } else if (on) {
+            on = condition(&t) != 0;
+        }
+        conds[nconds].parent = enabled();
+        conds[nconds].taken = conds[nconds].active = on;
+        nconds++;
+        return;
+    }
+    if (!strcmp(name, "elif") || !strcmp(name, "else") || !strcmp(name, "endif")) {
+        if (!nconds)
+            fail("#%s without #if", name);
+        if (name[1] == 'n') {
+            nconds--;
+            return;
+        }
+        on = conds[nconds - 1].parent && !conds[nconds - 1].taken;
+        if (on && name[2] == 'i')
+            on = condition(&t) != 0;
+        conds[nconds - 1].active = on;
+        conds[nconds - 1].taken |= on;
+        return;
+    }
+    if (!enabled())
+        return;
+    if (!strcmp(name, "define")) {
+        define(&t);
+    } else if (!strcmp(name, "undef")) {
+        if (t.len != 2)
+            fail("#undef needs a macro name");
+        for (p = &macros; *p; p = &(*p)->next) {
+            if (!strcmp((*p)->name, t.data[1].text)) {
+                *p = (*p)->next;
+                break;
+            }
+        }
+    } else if (!strcmp(name, "error")) {
+        fail("#error");
+    } else if (strcmp(name, "version") && strcmp(name, "extension") &&
+            strcmp(name, "pragma") && strcmp(name, "line")) {
+        fail("unknown directive #%s", name);
+    }
+}
+
+/*
+ * Runs the preprocessor over source, appending what it produces to the
+ * tokens. A macro call left open at the end of a line takes in the next.
+*/
+static void preprocess(const char *source, int numbered){
+    struct tokens pending = {0}, out;
+    char *s, *end;
+    int number = numbered;
+
+    for (s = strip(source); *s; s = *end ? end + 1 : end, number += numbered) {
+        if (!(end = strchr(s, '\n')))
+            end = s + strlen(s);
+        line = number;
+        s = copy(s, end - s);
+        while (isspace((unsigned char)*s))
+            s++;
+        if (*s == '#') {
+            directive(s + 1);
+            continue;
+        }
+        if (!enabled())
+            continue;
+        lex(s, number, &pending);
+        memset(&out, 0, sizeof(out));
+        if (expand(pending.data, pending.len, &out, 0) < 0)
+            continue;
+        append(&tokens, &out);
+        memset(&pending, 0, sizeof(pending));
+    }
+    if (pending.len) {
+        memset(&out, 0, sizeof(out));
+        expand(pending.data, pending.len, &out, 1);
+        append(&tokens, &out);
+    }
+    if (nconds)
+        fail("#if without #endif");
+}
+
+static const struct token *peek(void){
+    static const struct token end = { TOKEN_END, 0, 0, "end of shader" };
+
+    return pos < tokens.len ? &tokens.data[pos] : &end;
+}
+
+static const struct token *peek_after(void){
+    static const struct token end = { TOKEN_END, 0, 0, "end of shader" };
+
+    return pos + 1 < tokens.len ? &tokens.data[pos + 1] : &end;
+}
+
+static int is(const char *text){
+    return peek()->kind != TOKEN_END && !strcmp(peek()->text, text);
+}
+
+static const char *next(void){
+    if (pos == tokens.len)
+        fail("unexpected end of shader");
+    line = tokens.data[pos].line;
+    return tokens.data[pos++].text;
+}
+
+static int accept(const char *text){
+    if (!is(text))
+        return 0;
+    next();
+    return 1;
+}
+
+static void expect(const char *text){
+    if (peek()->kind != TOKEN_END)
+        line = peek()->line;
+    if (!accept(text))
+        fail("expected %s before %s", text, peek()->text);
+}
+
+static const char *identifier(void){
+    if (peek()->kind != TOKEN_IDENT)
+        fail("expected a name before %s", peek()->text);
+    return next();
+}
+
+static int is_vec(int t){
+    return t >= TY_VEC2 && t <= TY_VEC4;
+}
+
+static int is_mat(int t){
+    return t >= TY_MAT2 && t <= TY_MAT4;
+}
+
+static int dim(int t){
+    return is_vec(t) ? t - TY_VEC2 + 2 : is_mat(t) ? t - TY_MAT2 + 2 : 1;
+}
+
+static int components(int t){
+    return is_mat(t) ? dim(t) * dim(t) : dim(t);
+}
+
+static int scalar(int t){
+    return is_vec(t) || is_mat(t) ? TY_FLOAT : t;
+}
+
+static int vec(int n){
+    return n == 1 ? TY_FLOAT : TY_VEC2 + n - 2;
+}
+
+/* C for component k of a value of type t */
+static const char *suffix(int t, int k){
+    if (is_vec(t))
+        return fmt(".c[%d]", k);
+    if (is_mat(t))
+        return fmt(".c[%d].c[%d]", k / dim(t), k % dim(t));
+    return "";
+}
+
+/* The type a name stands for, -1 if it is not one */
+static int type_name(const char *name){
+    int i;
+
+    for (i = 0; unsupported_types[i]; i++)
+        if (!strcmp(name, unsupported_types[i]))
+            fail("%s is not supported on the CPU", name);
+    for (i = TY_VOID; i <= TY_SAMPLER; i++)
+        if (!strcmp(name, types[i].name))
+            return i;
+    return -1;
+}
+
+static int expect_type(void){
+    int type;
+
+    if (peek()->kind != TOKEN_IDENT)
+        fail("expected a type before %s", peek()->text);
+    if (is("struct"))
+        fail("structs are not supported on the CPU");
+    if ((type = type_name(peek()->text)) < 0)
+        fail("unknown type %s", peek()->text);
+    next();
+    return type;
+}
+
+static const char *tmp(void){
+    return fmt("_t%d", ++temps);
+}
+
+static void emit(const char *format, ...){
+    va_list ap;
+
+    va_start(ap, format);
+    vbput(&funcs, format, ap);
+    va_end(ap);
+}
+
+static void enter(void){
+    depth++;
+}
+
+static void leave(void){
+    depth--;
+    while (nsymbols && symbols[nsymbols - 1].depth > depth)
+        nsymbols--;
+}
+
+static struct symbol *lookup(const char *name){
+    size_t i;
+
+    for (i = nsymbols; i-- > 0;)
+        if (!strcmp(symbols[i].name, name))
+            return &symbols[i];
+    return NULL;
+}
+
+static void declare(const struct symbol *s){
+    struct symbol *data, *old = lookup(s->name);
+
+    if (old && old->depth == depth)
+        fail("%s is already declared", s->name);
+    if (nsymbols == symbols_size) {
+        symbols_size = symbols_size ? 2 * symbols_size : 64;
+        data = alloc(symbols_size * sizeof(*data));
+        if (nsymbols)
+            memcpy(data, symbols, nsymbols * sizeof(*data));
+        symbols = data;
+    }
+    symbols[nsymbols] = *s;
+    symbols[nsymbols++].depth = depth;
+}
+
+static struct expr rvalue(int type, const char *code, int simple){
+    struct expr e;
+
+    memset(&e, 0, sizeof(e));
+    e.type = type;
+    e.code = code;
+    e.simple = simple;
+    return e;
+}
+
+static struct expr constant(int type, long value){
+    struct expr e = rvalue(type, type == TY_BOOL ? (value ? "I(-1)" : "I(0)") : fmt("I(%ld)", value), 1);
+
+    e.constant = 1;
+    e.value = value;
+    return e;
+}
+
+static struct expr variable(const struct symbol *s){
+    struct expr e = rvalue(s->type, s->code, 1);
+    int count = s->array ? s->array : 1, n = components(s->type), i, k;
+
+    e.array = s->array;
+    e.constant = s->constant;
+    e.value = s->value;
+    if (s->readonly)
+        return e;
+    e.nslots = count * n;
+    e.slots = alloc(e.nslots * sizeof(*e.slots));
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < n; k++) {
+            e.slots[i * n + k].lval = fmt("%s%s%s", s->code,
+                    s->array ? fmt("[%d]", i) : "", suffix(s->type, k));
+            e.slots[i * n + k].comp = i * n + k;
+        }
+    }
+    return e;
+}
+
+static void check_value(struct expr e){
+    if (e.array)
+        fail("arrays cannot be used as values");
+    if (e.type == TY_VOID)
+        fail("void value used");
+    if (e.type == TY_SAMPLER)
+        fail("texture lookups are not supported on the CPU");
+}
+
+static struct expr component(struct expr e, int k){
+    return rvalue(scalar(e.type), fmt("%s%s", e.code, suffix(e.type, k)), e.simple);
+}
+
+static const char *compose(int type, const char **codes){
+    struct buf b = {0};
+    int n = dim(type), i, j;
+
+    if (components(type) == 1)
+        return codes[0];
+    bput(&b, "(%s){{", types[type].c);
+    if (is_vec(type)) {
+        for (i = 0; i < n; i++)
+            bput(&b, "%s%s", i ? ", " : "", codes[i]);
+    } else {
+        for (j = 0; j < n; j++) {
+            bput(&b, "%s{{", j ? ", " : "");
+            for (i = 0; i < n; i++)
+                bput(&b, "%s%s", i ? ", " : "", codes[j * n + i]);
+            bput(&b, "}}");
+        }
+    }
+    bput(&b, "}}");
+    return b.data;
+}
+
+/* Evaluates e once into a temporary declared in b, unless it is simple */
+static struct expr bind(struct buf *b, struct expr e){
+    struct expr r;
+
+    check_value(e);
+    if (e.simple) {
+        e.slots = NULL;
+        e.nslots = 0;
+        return e;
+    }
+    r = rvalue(e.type, tmp(), 1);
+    r.constant = e.constant;
+    r.value = e.value;
+    bput(b, "%s %s = %s; ", types[e.type].c, r.code, e.code);
+    return r;
+}
+
+/* e with the temporaries of b in front, as a statement expression */
+static struct expr finish(struct buf *b, struct expr e){
+    struct expr r;
+
+    if (!b->len)
+        return e;
+    r = rvalue(e.type, fmt("({ %s%s; })", b->data, e.code), 0);
+    r.constant = e.constant;
+    r.value = e.value;
+    return r;
+}
+
+/* pattern applied per component of type, scalar arguments broadcast */
+static struct expr map(const char *pattern, int type, int n, const struct expr *args){
+    const char *codes[MAX_COMPONENTS], *c[3] = { "", "", "" };
+    struct buf b = {0};
+    struct expr a[3];
+    int many = components(type) > 1, i, k;
+
+    for (i = 0; i < n; i++)
+        a[i] = many ? bind(&b, args[i]) : args[i];
+    for (k = 0; k < components(type); k++) {
+        for (i = 0; i < n; i++)
+            c[i] = components(a[i].type) == 1 ? a[i].code : component(a[i], k).code;
+        codes[k] = fmt(pattern, c[0], c[1], c[2]);
+    }
+    return finish(&b, rvalue(type, compose(type, codes), 0));
+}
+
+static void store(struct buf *b, struct expr lhs, const char *value){
+    const struct slot *s;
+    int i;
+
+    for (i = 0; i < lhs.nslots; i++) {
+        s = &lhs.slots[i];
+        bput(b, "%s = %s(_m%s%s, %s%s, %s); ", s->lval,
+                scalar(lhs.type) == TY_FLOAT ? "self" : "seli",
+                s->guard ? " & " : "", s->guard ? s->guard : "",
+                value, suffix(lhs.type, s->comp), s->lval);
+    }
+}
+
+/* e read again once its setup has run */
+static struct expr current(struct expr e){
+    if (e.setup) {
+        e.code = e.stored;
+        e.simple = 0;
+        e.setup = NULL;
+    }
+    return e;
+}
+
+/* r, derived from current(e), carrying the setup of e on */
+static struct expr defer(const char *setup, struct expr r){
+    r.setup = r.setup ? fmt("%s%s", setup, r.setup) : setup;
+    r.stored = r.stored ? r.stored : r.code;
+    r.code = fmt("({ %s%s; })", r.setup, r.stored);
+    r.simple = 0;
+    return r;
+}
+
+/* Writes only the lanes of the current mask */
+static struct expr assign(struct expr lhs, struct expr rhs){
+    struct buf b = {0};
+    struct expr t;
+
+    if (!lhs.slots || lhs.array)
+        fail("cannot assign to this expression");
+    check_value(rhs);
+    if (lhs.type != rhs.type)
+        fail("cannot assign %s to %s", types[rhs.type].name, types[lhs.type].name);
+    t = rvalue(rhs.type, tmp(), 1);
+    if (lhs.setup)
+        bput(&b, "%s", lhs.setup);
+    bput(&b, "%s %s = %s; ", types[t.type].c, t.code, rhs.code);
+    store(&b, lhs, t.code);
+    return finish(&b, t);
+}
+
+static struct expr choose(struct expr c, struct expr a, struct expr b){
+    struct expr args[3];
+
+    check_value(a);
+    check_value(b);
+    if (c.type != TY_BOOL || c.array)
+        fail("condition must be a bool");
+    if (a.type != b.type)
+        fail("both sides of ?: must have the same type");
+    if (c.constant)
+        return c.value ? a : b;
+    args[0] = c;
+    args[1] = a;
+    args[2] = b;
+    return map(scalar(a.type) == TY_FLOAT ? "self(%s, %s, %s)" : "seli(%s, %s, %s)", a.type, 3, args);
+}
+
+/* Matrix products, each sum added up left to right */
+static struct expr multiply(struct expr a, struct expr b){
+    const char *codes[MAX_COMPONENTS];
+    struct buf buf = {0}, sum;
+    int n = dim(is_mat(a.type) ? a.type : b.type), type, i, j, k;
+
+    if (is_mat(a.type) && is_mat(b.type)) {
+        if (a.type != b.type)
+            fail("cannot multiply %s by %s", types[a.type].name, types[b.type].name);
+        type = a.type;
+    } else if (is_mat(a.type)) {
+        if (b.type != vec(n))
+            fail("cannot multiply %s by %s", types[a.type].name, types[b.type].name);
+        type = b.type;
+    } else {
+        if (a.type != vec(n))
+            fail("cannot multiply %s by %s", types[a.type].name, types[b.type].name);
+        type = a.type;
+    }
+    a = bind(&buf, a);
+    b = bind(&buf, b);
+    for (j = 0; j < (is_mat(type) ? n : 1); j++) {
+        for (i = 0; i < n; i++) {
+            memset(&sum, 0, sizeof(sum));
+            for (k = 0; k < n; k++) {
+                bput(&sum, k ? " + " : "(");
+                if (is_mat(type))
+                    bput(&sum, "%s.c[%d].c[%d] * %s.c[%d].c[%d]", a.code, k, i, b.code, j, k);
+                else if (is_mat(a.type))
+                    bput(&sum, "%s.c[%d].c[%d] * %s.c[%d]", a.code, k, i, b.code, k);
+                else
+                    bput(&sum, "%s.c[%d] * %s.c[%d].c[%d]", a.code, n - 1 - k, b.code, i, n - 1 - k);
+            }
+            bput(&sum, ")");
+            codes[j * n + i] = sum.data;
+        }
+    }
+    return finish(&buf, rvalue(type, compose(type, codes), 0));
+}
+
+static struct expr arithmetic(int op, struct expr a, struct expr b){
+    struct expr args[2];
+    long v;
+
+    check_value(a);
+    check_value(b);
+    if (a.type == TY_INT && b.type == TY_INT) {
+        if (a.constant && b.constant) {
+            if (op == '/' && !b.value)
+                fail("division by zero");
+            v = op == '+' ? a.value + b.value : op == '-' ? a.value - b.value :
+                op == '*' ? a.value * b.value : a.value / b.value;
+            return constant(TY_INT, v);
+        }
+        if (op == '/')
+            return rvalue(TY_INT, fmt("idiv(%s, %s)", a.code, b.code), 0);
+        return rvalue(TY_INT, fmt("(%s %c %s)", a.code, op, b.code), 0);
+    }
+    if (scalar(a.type) != TY_FLOAT || scalar(b.type) != TY_FLOAT)
+        fail("cannot apply %c to %s and %s", op, types[a.type].name, types[b.type].name);
+    if (op == '*' && ((is_mat(a.type) && b.type != TY_FLOAT) || (is_vec(a.type) && is_mat(b.type))))
+        return multiply(a, b);
+    if (a.type != b.type && a.type != TY_FLOAT && b.type != TY_FLOAT)
+        fail("cannot apply %c to %s and %s", op, types[a.type].name, types[b.type].name);
+    args[0] = a;
+    args[1] = b;
+    return map(fmt("(%%s %c %%s)", op), a.type == TY_FLOAT ? b.type : a.type, 2, args);
+}
+
+static struct expr negate(struct expr e){
+    check_value(e);
+    if (e.type == TY_INT)
+        return e.constant ? constant(TY_INT, -e.value) : rvalue(TY_INT, fmt("(-%s)", e.code), 0);
+    if (scalar(e.type) != TY_FLOAT)
+        fail("cannot negate %s", types[e.type].name);
+    return map("(-%s)", e.type, 1, &e);
+}
+
+static struct expr compare(const char *op, struct expr a, struct expr b){
+    long v;
+
+    check_value(a);
+    check_value(b);
+    if (a.type != b.type || (a.type != TY_FLOAT && a.type != TY_INT))
+        fail("%s needs two floats or two ints", op);
+    if (a.constant && b.constant) {
+        v = op[0] == '<' ? (op[1] ? a.value <= b.value : a.value < b.value) :
+            (op[1] ? a.value >= b.value : a.value > b.value);
+        return constant(TY_BOOL, v);
+    }
+    return rvalue(TY_BOOL, fmt("(%s %s %s)", a.code, op, b.code), 0);
+}
+
+/* == and != compare whole vectors and matrices */
+static struct expr equal(struct expr a, struct expr b, int negated){
+    struct buf buf = {0}, all = {0};
+    int k;
+
+    check_value(a);
+    check_value(b);
+    if (a.type != b.type)
+        fail("cannot compare %s with %s", types[a.type].name, types[b.type].name);
+    if (a.constant && b.constant)
+        return constant(TY_BOOL, (a.value == b.value) != negated);
+    if (components(a.type) == 1)
+        return rvalue(TY_BOOL, fmt("(%s %s %s)", a.code, negated ? "!=" : "==", b.code), 0);
+    a = bind(&buf, a);
+    b = bind(&buf, b);
+    for (k = 0; k < components(a.type); k++)
+        bput(&all, "%s%s == %s", k ? " & " : "", component(a, k).code, component(b, k).code);
+    return finish(&buf, rvalue(TY_BOOL, fmt(negated ? "~(%s)" : "(%s)", all.data), 0));
+}
+
+static struct expr logic(const char *op, struct expr a, struct expr b){
+    long v;
+
+    if (a.type != TY_BOOL || b.type != TY_BOOL || a.array || b.array)
+        fail("%s needs two bools", op);
+    if (a.constant && b.constant) {
+        v = op[0] == '&' ? a.value && b.value : op[0] == '|' ? a.value || b.value : a.value != b.value;
+        return constant(TY_BOOL, v);
+    }
+    return rvalue(TY_BOOL, fmt("(%s %c %s)", a.code, op[0], b.code), 0);
+}
+
+static struct expr operate(const char *op, struct expr a, struct expr b){
+    if (!op[1] && strchr("+-*/", op[0]))
+        return arithmetic(op[0], a, b);
+    if (op[0] == '<' || op[0] == '>')
+        return compare(op, a, b);
+    if (op[1] == '=')
+        return equal(a, b, op[0] == '!');
+    return logic(op, a, b);
+}
+
+static struct expr increment(struct expr e, int op, int pre){
+    struct buf b = {0};
+    struct expr one, old;
+
+    check_value(e);
+    if (e.type != TY_INT && scalar(e.type) != TY_FLOAT)
+        fail("cannot apply %c%c to %s", op, op, types[e.type].name);
+    one = e.type == TY_INT ? constant(TY_INT, 1) : rvalue(TY_FLOAT, "F(1.f)", 1);
+    if (pre)
+        return assign(e, arithmetic(op, current(e), one));
+    old = rvalue(e.type, tmp(), 1);
+    if (e.setup)
+        bput(&b, "%s", e.setup);
+    bput(&b, "%s %s = %s; ", types[e.type].c, old.code, current(e).code);
+    e.setup = NULL;
+    bput(&b, "%s; ", assign(e, arithmetic(op, old, one)).code);
+    return finish(&b, old);
+}
+
+static struct expr swizzle(struct expr e, const char *name){
+    static const char *const sets[] = { "xyzw", "rgba", "stpq" };
+    const char *codes[4], *p;
+    int idx[4], n = strlen(name), set = -1, unique = 1, i, j;
+    struct buf b = {0};
+    struct expr r, v;
+
+    if (!is_vec(e.type) || e.array)
+        fail("cannot select .%s from %s", name, types[e.type].name);
+    if (e.setup)
+        return defer(e.setup, swizzle(current(e), name));
+    if (n > 4)
+        fail("invalid swizzle .%s", name);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 3; j++) {
+            if ((p = strchr(sets[j], name[i])) && (set < 0 || set == j)) {
+                set = j;
+                idx[i] = p - sets[j];
+                break;
+            }
+        }
+        if (j == 3 || idx[i] >= dim(e.type))
+            fail("invalid swizzle .%s of %s", name, types[e.type].name);
+        for (j = 0; j < i; j++)
+            if (idx[j] == idx[i])
+                unique = 0;
+    }
+    if (n == 1) {
+        r = component(e, idx[0]);
+    } else {
+        v = e.simple ? e : bind(&b, e);
+        for (i = 0; i < n; i++)
+            codes[i] = component(v, idx[i]).code;
+        r = finish(&b, rvalue(vec(n), compose(vec(n), codes), e.simple));
+    }
+    if (e.slots && unique) {
+        r.slots = alloc(e.nslots * sizeof(*r.slots));
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < e.nslots; j++) {
+                if (e.slots[j].comp == idx[i]) {
+                    r.slots[r.nslots] = e.slots[j];
+                    r.slots[r.nslots++].comp = i;
+                }
+            }
+        }
+    }
+    return r;
+}
+
+static const char *item(struct expr e, int k){
+    return fmt(e.array ? "%s[%d]" : "%s.c[%d]", e.code, k);
+}
+
+/* Dynamic indices select among all the elements, lane by lane */
+static struct expr subscript(struct expr e, struct expr i){
+    int element, count, stride, k;
+    struct buf b = {0};
+    struct expr base, index, r;
+    struct slot *s;
+
+    if (i.type != TY_INT || i.array)
+        fail("index must be an int");
+    if (e.array) {
+        element = e.type;
+        count = e.array;
+    } else if (is_vec(e.type)) {
+        element = TY_FLOAT;
+        count = dim(e.type);
+    } else if (is_mat(e.type)) {
+        element = vec(dim(e.type));
+        count = dim(e.type);
+    } else {
+        fail("cannot index %s", types[e.type].name);
+        return e;
+    }
+    stride = components(element);
+    if (e.setup)
+        return defer(e.setup, subscript(current(e), i));
+    if (e.slots && !i.simple && !i.constant && in_function) {
+        index = rvalue(TY_INT, tmp(), 1);
+        emit("vi %s;\n", index.code);
+        return defer(fmt("%s = %s; ", index.code, i.code), subscript(e, index));
+    }
+    if (i.constant) {
+        if (i.value < 0 || i.value >= count)
+            fail("index %ld out of range", i.value);
+        r = rvalue(element, item(e, i.value), e.simple);
+        if (e.slots) {
+            r.slots = alloc(stride * sizeof(*r.slots) + 1);
+            for (k = 0; k < e.nslots; k++) {
+                if (e.slots[k].comp / stride == i.value) {
+                    r.slots[r.nslots] = e.slots[k];
+                    r.slots[r.nslots++].comp = e.slots[k].comp % stride;
+                }
+            }
+        }
+        return r;
+    }
+    index = bind(&b, i);
+    base = e.array ? e : bind(&b, e);
+    r = rvalue(element, item(base, 0), 1);
+    for (k = 1; k < count; k++)
+        r = choose(rvalue(TY_BOOL, fmt("(%s == I(%d))", index.code, k), 1),
+                rvalue(element, item(base, k), 1), r);
+    r = finish(&b, r);
+    if (e.slots && i.simple) {
+        r.nslots = e.nslots;
+        r.slots = alloc(e.nslots * sizeof(*r.slots));
+        for (k = 0; k < e.nslots; k++) {
+            s = &r.slots[k];
+            *s = e.slots[k];
+            s->guard = fmt("%s%s(%s == I(%d))", s->guard ? s->guard : "", s->guard ? " & " : "",
+                    i.code, e.slots[k].comp / stride);
+            s->comp = e.slots[k].comp % stride;
+        }
+    }
+    return r;
+}
+
+static const char *convert(const char *code, int from, int to){
+    if (from == to)
+        return code;
+    if (to == TY_FLOAT)
+        return fmt(from == TY_INT ? "itof(%s)" : "itof(%s & I(1))", code);
+    if (to == TY_INT)
+        return fmt(from == TY_FLOAT ? "ftoi(%s)" : "(%s & I(1))", code);
+    return fmt(from == TY_FLOAT ? "(%s != F(0.f))" : "(%s != I(0))", code);
+}
+
+static struct expr construct(int type, struct expr *args, int n){
+    const char *codes[MAX_COMPONENTS], *c;
+    int count = components(type), d = dim(type), have = 0, i, j, k, m;
+    struct buf b = {0};
+    struct expr a;
+
+    if (type == TY_VOID || type == TY_SAMPLER)
+        fail("cannot construct %s", types[type].name);
+    if (!n)
+        fail("%s() needs arguments", types[type].name);
+    for (i = 0; i < n; i++)
+        check_value(args[i]);
+    if (count == 1) {
+        if (n > 1)
+            fail("too many arguments to %s", types[type].name);
+        a = args[0];
+        if (a.constant && type != TY_FLOAT)
+            return constant(type, type == TY_BOOL ? a.value != 0 : a.value);
+        c = components(a.type) > 1 ? component(a, 0).code : a.code;
+        return rvalue(type, convert(c, scalar(a.type), type), 0);
+    }
+    if (n == 1 && components(args[0].type) == 1) {
+        a = bind(&b, args[0]);
+        c = convert(a.code, a.type, TY_FLOAT);
+        for (k = 0; k < count; k++)
+            codes[k] = is_mat(type) && k / d != k % d ? "F(0.f)" : c;
+        return finish(&b, rvalue(type, compose(type, codes), 0));
+    }
+    if (n == 1 && is_mat(type) && is_mat(args[0].type)) {
+        a = bind(&b, args[0]);
+        m = dim(a.type);
+        for (j = 0; j < d; j++)
+            for (i = 0; i < d; i++)
+                codes[j * d + i] = j < m && i < m ? fmt("%s.c[%d].c[%d]", a.code, j, i) :
+                    i == j ? "F(1.f)" : "F(0.f)";
+        return finish(&b, rvalue(type, compose(type, codes), 0));
+    }
+    for (i = 0; i < n; i++) {
+        if (have == count)
+            fail("too many arguments to %s", types[type].name);
+        a = bind(&b, args[i]);
+        for (k = 0; k < components(a.type) && have < count; k++)
+            codes[have++] = convert(component(a, k).code, scalar(a.type), TY_FLOAT);
+    }
+    if (have < count)
+        fail("not enough arguments to %s", types[type].name);
+    return finish(&b, rvalue(type, compose(type, codes), 0));
+}
+
+static struct expr dot(struct expr a, struct expr b){
+    struct buf buf = {0}, sum = {0};
+    int k;
+
+    a = bind(&buf, a);
+    b = bind(&buf, b);
+    for (k = components(a.type); k-- > 0;)
+        bput(&sum, "%s%s * %s", k == components(a.type) - 1 ? "(" : " + ",
+                component(a, k).code, component(b, k).code);
+    bput(&sum, ")");
+    return finish(&buf, rvalue(TY_FLOAT, sum.data, 0));
+}
+
+static struct expr length(struct expr a){
+    struct buf buf = {0};
+
+    a = bind(&buf, a);
+    return finish(&buf, rvalue(TY_FLOAT, fmt("b_sqrt(%s)", dot(a, a).code), 0));
+}
+
+static struct expr number(const char *code){
+    return rvalue(TY_FLOAT, code, 1);
+}
+
+static int gentype(int t){
+    return t == TY_FLOAT || is_vec(t);
+}
+
+static int matches(const char *form, size_t len, const struct expr *args, int n, int *type){
+    int t = -1, i;
+
+    if ((int)len != n)
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (args[i].array)
+            return 0;
+        if (form[i] == 'f') {
+            if (args[i].type != TY_FLOAT)
+                return 0;
+            continue;
+        }
+        if (t < 0)
+            t = args[i].type;
+        if (args[i].type != t || (form[i] == 'g' && !gentype(t)) || (form[i] == 'm' && !is_mat(t)))
+            return 0;
+    }
+    *type = t < 0 ? TY_FLOAT : t;
+    return 1;
+}
+
+/* Geometric builtins, built from the operators like the GLSL spec has them */
+static int geometric(const char *name, struct expr *a, int n, struct expr *r){
+    struct buf b = {0};
+    struct expr d, k, t;
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (a[i].array || !gentype(a[i].type))
+            return 0;
+    if (!strcmp(name, "length") && n == 1) {
+        *r = length(a[0]);
+    } else if (!strcmp(name, "distance") && n == 2 && a[0].type == a[1].type) {
+        *r = length(arithmetic('-', a[0], a[1]));
+    } else if (!strcmp(name, "dot") && n == 2 && a[0].type == a[1].type) {
+        *r = dot(a[0], a[1]);
+    } else if (!strcmp(name, "normalize") && n == 1) {
+        t = bind(&b, a[0]);
+        d = number(fmt("b_inversesqrt(%s)", dot(t, t).code));
+        *r = finish(&b, arithmetic('*', t, d));
+    } else if (!strcmp(name, "cross") && n == 2 && a[0].type == TY_VEC3 && a[1].type == TY_VEC3) {
+        const char *codes[3];
+
+        t = bind(&b, a[0]);
+        d = bind(&b, a[1]);
+        for (i = 0; i < 3; i++)
+            codes[i] = fmt("(%s.c[%d] * %s.c[%d] - %s.c[%d] * %s.c[%d])",
+                    t.code, (i + 1) % 3, d.code, (i + 2) % 3, d.code, (i + 1) % 3, t.code, (i + 2) % 3);
+        *r = finish(&b, rvalue(TY_VEC3, compose(TY_VEC3, codes), 0));
+    } else if (!strcmp(name, "reflect") && n == 2 && a[0].type == a[1].type) {
+        t = bind(&b, a[0]);
+        d = bind(&b, a[1]);
+        k = arithmetic('*', number("F(2.f)"), dot(d, t));
+        *r = finish(&b, arithmetic('-', t, arithmetic('*', k, d)));
+    } else if (!strcmp(name, "faceforward") && n == 3 && a[0].type == a[1].type && a[1].type == a[2].type) {
+        t = bind(&b, a[0]);
+        *r = finish(&b, choose(compare("<", dot(a[2], a[1]), number("F(0.f)")), t, negate(t)));
+    } else if (!strcmp(name, "refract") && n == 3 && a[0].type == a[1].type && a[2].type == TY_FLOAT) {
+        struct expr in = bind(&b, a[0]), normal = bind(&b, a[1]), eta = bind(&b, a[2]);
+
+        d = bind(&b, dot(normal, in));
+        k = bind(&b, arithmetic('-', number("F(1.f)"), arithmetic('*', arithmetic('*', eta, eta),
+                arithmetic('-', number("F(1.f)"), arithmetic('*', d, d)))));
+        t = arithmetic('-', arithmetic('*', eta, in), arithmetic('*',
+                arithmetic('+', arithmetic('*', eta, d), number(fmt("b_sqrt(%s)", k.code))), normal));
+        d = number("F(0.f)");
+        *r = finish(&b, choose(compare("<", k, d), construct(in.type, &d, 1), t));
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int builtin(const char *name, struct expr *args, int n, struct expr *r){
+    const char *form, *end;
+    int i, type, known = 0;
+
+    for (i = 0; unsupported_builtins[i]; i++)
+        if (!strcmp(name, unsupported_builtins[i]))
+            fail("%s is not supported on the CPU", name);
+    for (i = 0; lanewise[i].name; i++) {
+        if (strcmp(name, lanewise[i].name))
+            continue;
+        known = 1;
+        for (form = lanewise[i].forms; *form; form = *end ? end + 1 : end) {
+            end = form + strcspn(form, " ");
+            if (matches(form, end - form, args, n, &type)) {
+                *r = map(lanewise[i].pattern, type, n, args);
+                return 1;
+            }
+        }
+    }
+    if (geometric(name, args, n, r))
+        return 1;
+    if (known || !strcmp(name, "length") || !strcmp(name, "distance") || !strcmp(name, "dot") ||
+            !strcmp(name, "normalize") || !strcmp(name, "cross") || !strcmp(name, "reflect") ||
+            !strcmp(name, "faceforward") || !strcmp(name, "refract"))
+        fail("no matching overload of %s", name);
+    return 0;
+}
+
+/* Out and inout arguments go through temporaries copied back under the mask */
+static struct expr call(const struct function *f, struct expr *args, int n){
+    struct buf b = {0}, list = {0}, stores = {0};
+    const char *code;
+    struct expr a, r;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (f->quals[i] == QUAL_IN) {
+            bput(&list, ", %s", args[i].code);
+            continue;
+        }
+        if (!args[i].slots)
+            fail("argument %d of %s must be assignable", i + 1, f->name);
+        a = rvalue(args[i].type, tmp(), 1);
+        if (args[i].setup)
+            bput(&b, "%s", args[i].setup);
+        bput(&b, "%s %s = %s; ", types[a.type].c, a.code, current(args[i]).code);
+        bput(&list, ", &%s", a.code);
+        store(&stores, args[i], a.code);
+    }
+    code = fmt("%s(_g, _m%s)", f->code, list.len ? list.data : "");
+    if (!stores.len)
+        return finish(&b, rvalue(f->type, code, 0));
+    if (f->type == TY_VOID) {
+        bput(&b, "%s; %s", code, stores.data);
+        return finish(&b, rvalue(TY_VOID, "(void)0", 0));
+    }
+    r = rvalue(f->type, tmp(), 1);
+    bput(&b, "%s %s = %s; %s", types[r.type].c, r.code, code, stores.data);
+    return finish(&b, r);
+}
+
+static struct expr call_named(const char *name, struct expr *args, int n){
+    struct expr r;
+    size_t i;
+    int k, known = 0;
+
+    for (i = 0; i < nfunctions; i++) {
+        if (strcmp(functions[i].name, name))
+            continue;
+        known = 1;
+        if (functions[i].nparams != n)
+            continue;
+        for (k = 0; k < n && !args[k].array && args[k].type == functions[i].params[k]; k++)
+            ;
+        if (k == n)
+            return call(&functions[i], args, n);
+    }
+    if (builtin(name, args, n, &r))
+        return r;
+    fail(known ? "no matching overload of %s" : "unknown function %s", name);
+    return r;
+}
+
+static struct expr expression(void);
+static struct expr assignment(void);
+
+static int arguments(struct expr *args){
+    int n = 0;
+
+    if (accept(")"))
+        return 0;
+    do {
+        if (n == MAX_PARAMS)
+            fail("too many arguments");
+        args[n++] = assignment();
+    } while (accept(","));
+    expect(")");
+    return n;
+}
+
+static struct expr primary(void){
+    const struct token *t = peek();
+    struct expr args[MAX_PARAMS], e;
+    const struct symbol *s;
+    const char *name;
+    int type, n;
+
+    line = t->line;
+    if (t->kind == TOKEN_INT) {
+        next();
+        return constant(TY_INT, strtol(t->text, NULL, 0));
+    }
+    if (t->kind == TOKEN_FLOAT) {
+        next();
+        return number(fmt("F(%sf)", t->text));
+    }
+    if (accept("(")) {
+        e = expression();
+        expect(")");
+        return e;
+    }
+    if (t->kind != TOKEN_IDENT)
+        fail("unexpected %s", t->text);
+    if (accept("true"))
+        return constant(TY_BOOL, 1);
+    if (accept("false"))
+        return constant(TY_BOOL, 0);
+    if ((type = type_name(t->text)) >= 0) {
+        next();
+        expect("(");
+        n = arguments(args);
+        return construct(type, args, n);
+    }
+    name = next();
+    if (accept("(")) {
+        n = arguments(args);
+        return call_named(name, args, n);
+    }
+    if (!(s = lookup(name)))
+        fail("%s is not declared", name);
+    if (s->type == TY_SAMPLER)
+        fail("%s: texture lookups are not supported on the CPU", name);
+    return variable(s);
+}
+
+static struct expr postfix(void){
+    struct expr e = primary(), i;
+
+    for (;;) {
+        if (accept("[")) {
+            i = expression();
+            expect("]");
+            e = subscript(e, i);
+        } else if (accept(".")) {
+            e = swizzle(e, identifier());
+        } else if (accept("++")) {
+            e = increment(e, '+', 0);
+        } else if (accept("--")) {
+            e = increment(e, '-', 0);
+        } else {
+            return e;
+        }
+    }
+}
+
+static struct expr unary(void){
+    struct expr e;
+
+    if (accept("++"))
+        return increment(unary(), '+', 1);
+    if (accept("--"))
+        return increment(unary(), '-', 1);
+    if (accept("-"))
+        return negate(unary());
+    if (accept("+")) {
+        e = unary();
+        check_value(e);
+        if (e.type == TY_BOOL)
+            fail("cannot apply + to bool");
+        return e;
+    }
+    if (accept("!")) {
+        e = unary();
+        if (e.type != TY_BOOL || e.array)
+            fail("! needs a bool");
+        return e.constant ? constant(TY_BOOL, !e.value) : rvalue(TY_BOOL, fmt("(~%s)", e.code), 0);
+    }
+    if (is("~"))
+        fail("~ is reserved in GLSL ES 1.00");
+    return postfix();
+}
+
+static struct expr binary(int min){
+    struct expr a = unary();
+    int i;
+
+    for (;;) {
+        if (is("%") || is("&") || is("|") || is("^") || is("<<") || is(">>"))
+            fail("%s is reserved in GLSL ES 1.00", peek()->text);
+        for (i = 0; binary_ops[i].op && !is(binary_ops[i].op); i++)
+            ;
+        if (!binary_ops[i].op || binary_ops[i].prec < min)
+            return a;
+        next();
+        a = operate(binary_ops[i].op, a, binary(binary_ops[i].prec + 1));
+    }
+}
+
+static struct expr conditional(void){
+    struct expr c = binary(1), a;
+
+    if (!accept("?"))
+        return c;
+    a = expression();
+    expect(":");
+    return choose(c, a, assignment());
+}
+
+static struct expr assignment(void){
+    static const char *const ops[] = { "=", "+=", "-=", "*=", "/=", NULL };
+    struct expr lhs = conditional(), rhs;
+    int i;
+
+    for (i = 0; ops[i]; i++) {
+        if (accept(ops[i])) {
+            rhs = assignment();
+            if (ops[i][0] != '=')
+                rhs = arithmetic(ops[i][0], current(lhs), rhs);
+            return assign(lhs, rhs);
+        }
+    }
+    if (is("%=") || is("<<=") || is(">>=") || is("&=") || is("|=") || is("^="))
+        fail("%s is reserved in GLSL ES 1.00", peek()->text);
+    return lhs;
+}
+
+static struct expr expression(void){
+    struct expr e = assignment(), r;
+
+    while (accept(",")) {
+        r = assignment();
+        e = rvalue(r.type, fmt("(%s, %s)", e.code, r.code), 0);
+    }
+    return e;
+}
+
+static int qualifier(const char *text){
+    static const char *const names[] = {
+        "const", "uniform", "highp", "mediump", "lowp", "invariant",
+        "precision", "attribute", "varying", "struct", NULL
+    };
+    int i;
+
+    for (i = 0; names[i]; i++)
+        if (!strcmp(text, names[i]))
+            return 1;
+    return 0;
+}
+
+static int declaration_start(void){
+    const struct token *t = peek();
+
+    if (t->kind != TOKEN_IDENT)
+        return 0;
+    if (qualifier(t->text))
+        return 1;
+    return type_name(t->text) >= 0 && strcmp(peek_after()->text, "(");
+}
+
+static void declarator(int type, const char *name, int readonly, int uniform, int global){
+    struct expr init, size;
+    struct symbol s;
+    const char *c = types[type].c, *array;
+
+    memset(&s, 0, sizeof(s));
+    memset(&init, 0, sizeof(init));
+    s.name = name;
+    s.type = type;
+    s.readonly = readonly || uniform;
+    if (type == TY_VOID)
+        fail("%s cannot be void", name);
+    if (type == TY_SAMPLER && !uniform)
+        fail("samplers must be uniforms");
+    if (accept("[")) {
+        size = conditional();
+        expect("]");
+        if (size.type != TY_INT || !size.constant || size.value <= 0)
+            fail("size of %s must be a positive constant", name);
+        s.array = size.value;
+    }
+    array = s.array ? fmt("[%d]", s.array) : "";
+    if (accept("=")) {
+        if (uniform || s.array)
+            fail("%s cannot be initialized", name);
+        init = assignment();
+        check_value(init);
+        if (init.type != type)
+            fail("cannot initialize %s %s with %s", types[type].name, name, types[init.type].name);
+        if (readonly && init.constant) {
+            s.constant = 1;
+            s.value = init.value;
+        }
+    } else if (readonly && !uniform) {
+        fail("const %s needs an initializer", name);
+    }
+
+    if (uniform) {
+        s.code = fmt("u_%s", name);
+        if (type != TY_SAMPLER)
+            bput(&uniforms, "static %s %s%s;\n", c, s.code, array);
+        if (scalar(type) == TY_FLOAT)
+            bput(&table, "    { \"%s\", (vf *)&%s, %d },\n", name, s.code,
+                    components(type) * (s.array ? s.array : 1));
+    } else if (global) {
+        s.code = fmt("_g->g_%s", name);
+        bput(&fields, "    %s g_%s%s;\n", c, name, array);
+        if (init.code)
+            bput(&inits, "%s = %s;\n", s.code, init.code);
+    } else {
+        s.code = fmt("l_%s", name);
+        if (init.code)
+            emit("%s %s = %s;\n", c, s.code, init.code);
+        else
+            emit("%s %s%s;\nmemset(&%s, 0, sizeof(%s));\n", c, s.code, array, s.code, s.code);
+    }
+    declare(&s);
+}
+
+static void declaration(void){
+    int readonly = 0, type;
+
+    for (;;) {
+        if (accept("precision")) {
+            while (!accept(";"))
+                next();
+            return;
+        }
+        if (accept("const"))
+            readonly = 1;
+        else if (!accept("highp") && !accept("mediump") && !accept("lowp"))
+            break;
+    }
+    if (is("uniform") || is("attribute") || is("varying") || is("invariant"))
+        fail("%s is not allowed here", peek()->text);
+    type = expect_type();
+    do {
+        declarator(type, identifier(), readonly, 0, 0);
+    } while (accept(","));
+    expect(";");
+}
+
+static const char *restore(void){
+    return nloops ? fmt(" & _fm & _im%d", loops[nloops - 1]) : " & _fm";
+}
+
+static void statement(void);
+
+static void substatement(void){
+    emit("{\n");
+    enter();
+    statement();
+    leave();
+    emit("}\n");
+}
+
+/* Both branches run, each under its lanes, skipped when it has none */
+static void if_statement(void){
+    const char *s = tmp(), *v = tmp();
+    struct expr c;
+
+    expect("(");
+    c = expression();
+    expect(")");
+    if (c.type != TY_BOOL || c.array)
+        fail("if needs a bool condition");
+    emit("{\nvi %s = _m, %s = %s;\n_m = %s & %s;\nif (any(_m)) ", s, v, c.code, s, v);
+    substatement();
+    if (accept("else")) {
+        emit("_m = %s & ~%s;\nif (any(_m)) ", s, v);
+        substatement();
+    }
+    emit("_m = %s%s;\n}\n", s, restore());
+}
+
+/*
+ * Loops run until no lane is left in _lm. break drops lanes from it,
+ * continue only from _im, the lanes still running this iteration.
+*/
+static void loop_begin(int id, const char *cond){
+    if (nloops == MAX_NESTING)
+        fail("loops nest too deeply");
+    emit("vi _s%d = _m, _lm%d = _m;\nfor (;;) {\n", id, id);
+    if (cond)
+        emit("_lm%d &= %s;\nif (!any(_lm%d))\nbreak;\n", id, cond, id);
+    emit("vi _im%d = _lm%d;\n_m = _lm%d;\n", id, id, id);
+    loops[nloops++] = id;
+}
+
+static void loop_next(int id){
+    emit("_lm%d &= _fm;\n_m = _lm%d;\n", id, id);
+}
+
+static void loop_end(int id){
+    nloops--;
+    emit("}\n_m = _s%d%s;\n", id, restore());
+}
+
+static struct expr loop_condition(void){
+    struct expr c = expression();
+
+    if (c.type != TY_BOOL || c.array)
+        fail("loop condition must be a bool");
+    return c;
+}
+
+static void for_statement(void){
+    struct expr c, step;
+    int id = ++temps;
+
+    memset(&c, 0, sizeof(c));
+    memset(&step, 0, sizeof(step));
+    expect("(");
+    emit("{\n");
+    enter();
+    if (declaration_start()) {
+        declaration();
+    } else if (!accept(";")) {
+        emit("%s;\n", expression().code);
+        expect(";");
+    }
+    if (!is(";"))
+        c = loop_condition();
+    expect(";");
+    if (!is(")"))
+        step = expression();
+    expect(")");
+    loop_begin(id, c.code ? c.code : "I(-1)");
+    substatement();
+    loop_next(id);
+    if (step.code)
+        emit("%s;\n", step.code);
+    loop_end(id);
+    leave();
+    emit("}\n");
+}
+
+static void while_statement(void){
+    struct expr c;
+    int id = ++temps;
+
+    expect("(");
+    c = loop_condition();
+    expect(")");
+    emit("{\n");
+    loop_begin(id, c.code);
+    substatement();
+    loop_next(id);
+    loop_end(id);
+    emit("}\n");
+}
+
+static void do_statement(void){
+    struct expr c;
+    int id = ++temps;
+
+    emit("{\n");
+    loop_begin(id, NULL);
+    substatement();
+    expect("while");
+    expect("(");
+    c = loop_condition();
+    expect(")");
+    expect(";");
+    loop_next(id);
+    emit("_lm%d &= %s;\nif (!any(_lm%d))\nbreak;\n", id, c.code, id);
+    loop_end(id);
+    emit("}\n");
+}
+
+static void return_statement(void){
+    struct symbol ret;
+    struct buf b = {0};
+    struct expr e;
+    const char *t;
+
+    if (returns == TY_VOID) {
+        expect(";");
+    } else {
+        if (is(";"))
+            fail("return needs a %s", types[returns].name);
+        e = expression();
+        expect(";");
+        check_value(e);
+        if (e.type != returns)
+            fail("cannot return %s from a %s function", types[e.type].name, types[returns].name);
+        memset(&ret, 0, sizeof(ret));
+        ret.code = "_ret";
+        ret.type = returns;
+        t = tmp();
+        bput(&b, "%s %s = %s; ", types[returns].c, t, e.code);
+        store(&b, variable(&ret), t);
+        emit("{ %s}\n", b.data);
+    }
+    emit("_fm &= ~_m;\n_m = I(0);\n");
+}
+
+static void statement(void){
+    struct expr e;
+
+    if (accept("{")) {
+        emit("{\n");
+        enter();
+        while (!accept("}"))
+            statement();
+        leave();
+        emit("}\n");
+    } else if (accept(";")) {
+    } else if (accept("if")) {
+        if_statement();
+    } else if (accept("for")) {
+        for_statement();
+    } else if (accept("while")) {
+        while_statement();
+    } else if (accept("do")) {
+        do_statement();
+    } else if (accept("break") || accept("continue")) {
+        if (!nloops)
+            fail("%s outside a loop", tokens.data[pos - 1].text);
+        if (tokens.data[pos - 1].text[0] == 'b')
+            emit("_lm%d &= ~_m;\n", loops[nloops - 1]);
+        emit("_im%d &= ~_m;\n_m = I(0);\n", loops[nloops - 1]);
+        expect(";");
+    } else if (accept("return")) {
+        return_statement();
+    } else if (accept("discard")) {
+        expect(";");
+        emit("_g->discarded |= _m;\n_fm &= ~_m;\n_m = I(0);\n");
+    } else if (declaration_start()) {
+        declaration();
+    } else {
+        e = expression();
+        expect(";");
+        emit("%s;\n", e.code);
+    }
+}
+
+static void function(int type, const char *name){
+    const char *names[MAX_PARAMS];
+    struct buf mangle = {0}, signature = {0};
+    struct function f, *data;
+    struct symbol s;
+    size_t i;
+    int k;
+
+    memset(&f, 0, sizeof(f));
+    f.name = name;
+    f.type = type;
+    expect("(");
+    if (is("void") && !strcmp(peek_after()->text, ")"))
+        next();
+    if (!accept(")")) {
+        do {
+            if (f.nparams == MAX_PARAMS)
+                fail("too many parameters of %s", name);
+            f.quals[f.nparams] = QUAL_IN;
+            for (;;) {
+                if (accept("out"))
+                    f.quals[f.nparams] = QUAL_OUT;
+                else if (accept("inout"))
+                    f.quals[f.nparams] = QUAL_INOUT;
+                else if (!accept("in") && !accept("const") && !accept("highp") &&
+                        !accept("mediump") && !accept("lowp"))
+                    break;
+            }
+            f.params[f.nparams] = expect_type();
+            if (f.params[f.nparams] == TY_VOID || f.params[f.nparams] == TY_SAMPLER)
+                fail("%s parameters are not supported", types[f.params[f.nparams]].name);
+            names[f.nparams] = peek()->kind == TOKEN_IDENT ? next() : NULL;
+            if (is("["))
+                fail("array parameters are not supported on the CPU");
+            bput(&mangle, "%s", types[f.params[f.nparams]].mangle);
+            f.nparams++;
+        } while (accept(","));
+        expect(")");
+    }
+    f.code = fmt("f_%s_%s", name, f.nparams ? mangle.data : "v");
+    for (i = 0; i < nfunctions && strcmp(functions[i].code, f.code); i++)
+        ;
+    if (i < nfunctions && functions[i].type != type)
+        fail("%s redeclared with another return type", name);
+    if (i == nfunctions) {
+        if (nfunctions == functions_size) {
+            functions_size = functions_size ? 2 * functions_size : 32;
+            data = alloc(functions_size * sizeof(*data));
+            if (nfunctions)
+                memcpy(data, functions, nfunctions * sizeof(*data));
+            functions = data;
+        }
+        functions[nfunctions++] = f;
+    }
+
+    bput(&signature, "static %s %s(struct globals *_g, vi _m", types[type].c, f.code);
+    for (k = 0; k < f.nparams; k++) {
+        if (!names[k])
+            names[k] = fmt("_p%d", k);
+        bput(&signature, f.quals[k] == QUAL_IN ? ", %s l_%s" : ", %s *p_%s",
+                types[f.params[k]].c, names[k]);
+    }
+    bput(&signature, ")");
+    if (accept(";")) {
+        bput(&funcs, "%s;\n", signature.data);
+        return;
+    }
+    if (functions[i].defined)
+        fail("%s is already defined", name);
+    functions[i].defined = 1;
+
+    emit("\n%s\n{\nvi _fm = _m;\n", signature.data);
+    if (type != TY_VOID)
+        emit("%s _ret;\nmemset(&_ret, 0, sizeof(_ret));\n", types[type].c);
+    enter();
+    for (k = 0; k < f.nparams; k++) {
+        memset(&s, 0, sizeof(s));
+        s.name = names[k];
+        s.code = fmt("l_%s", names[k]);
+        s.type = f.params[k];
+        declare(&s);
+        if (f.quals[k] != QUAL_IN)
+            emit("%s l_%s = *p_%s;\n", types[s.type].c, names[k], names[k]);
+    }
+    returns = type;
+    nloops = 0;
+    in_function = 1;
+    expect("{");
+    while (!accept("}"))
+        statement();
+    in_function = 0;
+    leave();
+    for (k = 0; k < f.nparams; k++)
+        if (f.quals[k] != QUAL_IN)
+            emit("*p_%s = l_%s;\n", names[k], names[k]);
+    if (type != TY_VOID)
+        emit("return _ret;\n");
+    emit("}\n");
+}
+
+static void external(void){
+    int readonly = 0, uniform = 0, type;
+    const char *name;
+
+    for (;;) {
+        if (accept("precision")) {
+            while (!accept(";"))
+                next();
+            return;
+        }
+        if (accept("const"))
+            readonly = 1;
+        else if (accept("uniform"))
+            uniform = 1;
+        else if (is("attribute") || is("varying"))
+            fail("%s variables are not supported on the CPU", peek()->text);
+        else if (!accept("highp") && !accept("mediump") && !accept("lowp") && !accept("invariant"))
+            break;
+    }
+    type = expect_type();
+    if (accept(";"))
+        return;
+    name = identifier();
+    if (is("(")) {
+        if (readonly || uniform)
+            fail("functions cannot be qualified");
+        function(type, name);
+        return;
+    }
+    declarator(type, name, readonly, uniform, 1);
+    while (accept(","))
+        declarator(type, identifier(), readonly, uniform, 1);
+    expect(";");
+}
+
+static void builtin_variable(const char *name, const char *code, int type){
+    struct symbol s;
+
+    memset(&s, 0, sizeof(s));
+    s.name = name;
+    s.code = code;
+    s.type = type;
+    s.readonly = 1;
+    declare(&s);
+}
+
+static const struct function *main_image(void){
+    size_t i;
+
+    for (i = 0; i < nfunctions; i++) {
+        if (!strcmp(functions[i].name, "mainImage") && functions[i].defined &&
+                functions[i].type == TY_VOID && functions[i].nparams == 2 &&
+                functions[i].params[0] == TY_VEC4 && functions[i].quals[0] != QUAL_IN &&
+                functions[i].params[1] == TY_VEC2 && functions[i].quals[1] == QUAL_IN)
+            return &functions[i];
+    }
+    line = 0;
+    fail("no mainImage(out vec4, in vec2) defined");
+    return NULL;
+}
+
+static char *assemble(void){
+    const struct function *entry = main_image();
+    struct buf out = {0};
+    char *result;
+
+    bput(&out, "#define W %d\n%s", GLSL_LANES, prelude);
+    bput(&out, "%s\n", uniforms.len ? uniforms.data : "");
+    bput(&out, "struct globals {\n    vi discarded;\n    v4 gl_FragCoord;\n%s};\n",
+            fields.len ? fields.data : "");
+    bput(&out, "%s\n", funcs.len ? funcs.data : "");
+    bput(&out,
+            "static void init(struct globals *_g, vi _m, v2 coord)\n"
+            "{\n"
+            "memset(_g, 0, sizeof(*_g));\n"
+            "_g->gl_FragCoord.c[0] = coord.c[0];\n"
+            "_g->gl_FragCoord.c[1] = coord.c[1];\n"
+            "_g->gl_FragCoord.c[2] = F(0.5f);\n"
+            "_g->gl_FragCoord.c[3] = F(1.f);\n"
+            "%s"
+            "}\n\n", inits.len ? inits.data : "");
+    bput(&out,
+            "static const struct {\n"
+            "    const char *name;\n"
+            "    vf *lanes;\n"
+            "    int count;\n"
+            "} uniforms[] = {\n"
+            "%s"
+            "    { 0, 0, 0 }\n"
+            "};\n\n"
+            "int esshader_cpu_uniform(const char *name, const float *values, int count)\n"
+            "{\n"
+            "    int i, j;\n\n"
+            "    for (i = 0; uniforms[i].name; i++) {\n"
+            "        if (strcmp(uniforms[i].name, name))\n"
+            "            continue;\n"
+            "        for (j = 0; j < count && j < uniforms[i].count; j++)\n"
+            "            uniforms[i].lanes[j] = F(values[j]);\n"
+            "        return 1;\n"
+            "    }\n"
+            "    return 0;\n"
+            "}\n\n", table.len ? table.data : "");
+    bput(&out,
+            "void esshader_cpu_tile(unsigned char *pixels, int width, int x0, int y0, int x1, int y1)\n"
+            "{\n"
+            "    struct globals g;\n"
+            "    unsigned char *p;\n"
+            "    int x, y, i;\n"
+            "    v4 color;\n"
+            "    v2 coord;\n"
+            "    vi m;\n"
+            "#ifdef __SSE__\n"
+            "    unsigned int csr = _mm_getcsr();\n\n"
+            "    /* denormals flushed, like GPUs do */\n"
+            "    _mm_setcsr(csr | 0x8040);\n"
+            "#endif\n"
+            "    for (y = y0; y < y1; y++) {\n"
+            "        for (x = x0; x < x1; x += W) {\n"
+            "            for (i = 0; i < W; i++) {\n"
+            "                m[i] = x + i < x1 ? -1 : 0;\n"
+            "                coord.c[0][i] = x + i + 0.5f;\n"
+            "                coord.c[1][i] = y + 0.5f;\n"
+            "            }\n"
+            "            init(&g, m, coord);\n"
+            "            memset(&color, 0, sizeof(color));\n"
+            "            %s(&g, m, &color, coord);\n"
+            "            m &= ~g.discarded;\n"
+            "            for (i = 0; i < W && x + i < x1; i++) {\n"
+            "                p = pixels + 4 * ((size_t)y * width + x + i);\n"
+            "                if (!m[i]) {\n"
+            "                    p[0] = p[1] = p[2] = 0;\n"
+            "                    p[3] = 255;\n"
+            "                    continue;\n"
+            "                }\n"
+            "                p[0] = unorm(color.c[0][i]);\n"
+            "                p[1] = unorm(color.c[1][i]);\n"
+            "                p[2] = unorm(color.c[2][i]);\n"
+            "                p[3] = unorm(color.c[3][i]);\n"
+            "            }\n"
+            "        }\n"
+            "    }\n"
+            "#ifdef __SSE__\n"
+            "    _mm_setcsr(csr);\n"
+            "#endif\n"
+            "}\n", entry->code);
+
+    if ((result = malloc(out.len + 1)))
+        memcpy(result, out.data, out.len + 1);
+    return result;
+}
+
+static void reset(void){
+    size_t i;
+
+    for (i = 0; i < nallocs; i++)
+        free(allocs[i]);
+    free(allocs);
+    allocs = NULL;
+    nallocs = allocs_size = 0;
+    macros = NULL;
+    nactive = nconds = 0;
+    memset(&tokens, 0, sizeof(tokens));
+    pos = 0;
+    symbols = NULL;
+    nsymbols = symbols_size = 0;
+    depth = 0;
+    functions = NULL;
+    nfunctions = functions_size = 0;
+    nloops = temps = in_function = 0;
+    memset(&uniforms, 0, sizeof(uniforms));
+    memset(&table, 0, sizeof(table));
+    memset(&fields, 0, sizeof(fields));
+    memset(&inits, 0, sizeof(inits));
+    memset(&funcs, 0, sizeof(funcs));
+}
+
+char *glsl_translate(const char *header, const char *source, char *error, size_t size){
+    /* set inside the setjmp region, so it must survive a longjmp */
+    char *volatile result = NULL;
+
+    error_text = error;
+    error_size = size;
+    line = 0;
+    if (!setjmp(failed)) {
+        preprocess("#define GL_ES 1\n#define __VERSION__ 100\n#define GL_FRAGMENT_PRECISION_HIGH 1\n", 0);
+        preprocess(header, 0);
+        preprocess(source, 1);
+        builtin_variable("gl_FragCoord", "_g->gl_FragCoord", TY_VEC4);
+        builtin_variable("gl_FrontFacing", "I(-1)", TY_BOOL);
+        while (pos < tokens.len)
+            external();
+        if (!(result = assemble()))
+            fail("out of memory");
+    }
+    reset();
+    return result;
+}
@@ -0,0 +1,24 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * GLSL ES 1.00 to C for the CPU backend. The translator covers what
+ * ShaderToy image shaders without textures use: the preprocessor, float,
+ * int and bool, vec2-4 and mat2-4, arrays, functions with in, out and
+ * inout parameters, loops and discard, and the builtins that do not
+ * sample. The C source it returns evaluates GLSL_LANES pixels at a time
+ * with GCC vector extensions, control flow becoming lane masks, and
+ * exports
+ *
+ *     void esshader_cpu_tile(unsigned char *pixels, int width,
+ *             int x0, int y0, int x1, int y1);
+ *     int esshader_cpu_uniform(const char *name, const float *values, int count);
+ *
+ * The first shades the RGBA8 rectangle [x0, x1) x [y0, y1) of a frame
+ * stored bottom row first, the second sets a float uniform for the next
+ * tiles and returns 0 when the shader does not declare it. The header,
+ * numbered line 0, is read before the source; the result is malloc'd, or
+ * NULL with the first error written to error.
+*/
+#define GLSL_LANES 8
+
+char *glsl_translate(const char *header, const char *source, char *error, size_t size);
@@ -0,0 +1,175 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "gpumem.h"
+#include "util.h"
+
+struct resource {
+    int kind;
+    unsigned int name;
+    size_t bytes;
+    const char *label;
+    unsigned long last_use;
+    void (*evict)(void *arg);
+    void *arg;
+};
+
+static const char *kind_names[GPUMEM_LAST] = {
+    [GPUMEM_TEXTURE] = "texture",
+    [GPUMEM_RENDERBUFFER] = "renderbuffer",
+    [GPUMEM_FRAMEBUFFER] = "framebuffer",
+    [GPUMEM_BUFFER] = "buffer",
+    [GPUMEM_PROGRAM] = "program",
+    [GPUMEM_QUERY] = "query",
+    [GPUMEM_SYNC] = "fence",
+};
+
+static struct resource *resources;
+static size_t nresources;
+static size_t capacity;
+static size_t total;
+static size_t peak;
+static size_t budget;
+static unsigned long tick;
+static unsigned long evictions;
+
+static struct resource *find(int kind, unsigned int name){
+    size_t i;
+
+    for (i = 0; i < nresources; ++i)
+        if (resources[i].kind == kind && resources[i].name == name)
+            return &resources[i];
+
+    return NULL;
+}
+
+/*
+ * Drop least recently used evictable resources until the total fits the
+ * budget again. Only idle ones go: anything touched or registered during
+ * the current tick may be bound for the frame being drawn, and keep is
+ * never evicted, so a fresh allocation cannot push itself out.
+*/
+static void enforce(const struct resource *keep){
+    struct resource *victim;
+    int kind, keep_kind = keep ? keep->kind : 0;
+    unsigned int name, keep_name = keep ? keep->name : 0;
+    size_t i;
+
+    while (budget && total > budget) {
+        victim = NULL;
+        for (i = 0; i < nresources; ++i) {
+            if (!resources[i].evict || &resources[i] == keep || resources[i].last_use == tick)
+                continue;
+            if (!victim || resources[i].last_use < victim->last_use)
+                victim = &resources[i];
+        }
+
+        if (!victim) {
+            warning("GPU memory budget exceeded by %zu KiB, nothing left to evict.\n",
+                    (total - budget) / 1024);
+            return;
+        }
+
+        info("Evicting %s %s (%zu KiB).\n",
+                kind_names[victim->kind], victim->label, victim->bytes / 1024);
+        evictions++;
+        kind = victim->kind;
+        name = victim->name;
+        victim->evict(victim->arg);
+        gpumem_unregister(kind, name);
+        /* removal moves the last entry into the hole */
+        if (keep)
+            keep = find(keep_kind, keep_name);
+    }
+}
+
+void gpumem_register(int kind, unsigned int name, size_t bytes, const char *label,
+        void (*evict)(void *arg), void *arg){
+    struct resource *r;
+
+    if (!name)
+        return;
+
+    if (!(r = find(kind, name))) {
+        if (nresources == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            if (!(resources = realloc(resources, capacity * sizeof(*resources))))
+                die("Unable to grow GPU memory registry.\n");
+        }
+        r = &resources[nresources++];
+        r->bytes = 0;
+    }
+
+    total = total - r->bytes + bytes;
+    if (total > peak)
+        peak = total;
+
+    r->kind = kind;
+    r->name = name;
+    r->bytes = bytes;
+    r->label = label;
+    r->last_use = tick;
+    r->evict = evict;
+    r->arg = arg;
+
+    enforce(r);
+}
+
+void gpumem_unregister(int kind, unsigned int name){
+    struct resource *r = find(kind, name);
+
+    if (!r)
+        return;
+
+    total -= r->bytes;
+    *r = resources[--nresources];
+}
+
+void gpumem_touch(int kind, unsigned int name){
+    struct resource *r = find(kind, name);
+
+    if (r)
+        r->last_use = tick;
+}
+
+void gpumem_tick(void){
+    tick++;
+}
+
+void gpumem_set_budget(size_t bytes){
+    budget = bytes;
+    enforce(NULL);
+}
+
+size_t gpumem_total(void){
+    return total;
+}
+
+size_t gpumem_count(void){
+    return nresources;
+}
+
+void gpumem_report(void){
+    size_t bytes[GPUMEM_LAST] = {0}, count[GPUMEM_LAST] = {0};
+    size_t i;
+    int k;
+
+    for (i = 0; i < nresources; ++i) {
+        bytes[resources[i].kind] += resources[i].bytes;
+        count[resources[i].kind]++;
+    }
+
+    log_report_begin();
+    info("GPU memory: %zu KiB in %zu objects, peak %zu KiB",
+            total / 1024, nresources, peak / 1024);
+    if (budget)
+        info(", budget %zu KiB, %lu evictions", budget / 1024, evictions);
+    info(".\n");
+
+    for (k = 0; k < GPUMEM_LAST; ++k)
+        if (count[k])
+            info("  %-12s %4zu %10zu KiB\n", kind_names[k], count[k], bytes[k] / 1024);
+    log_report_end();
+}
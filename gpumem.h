@@ -0,0 +1,32 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Registry of the GL objects esshader owns and roughly how much memory
+ * they occupy. Objects registered with an evict callback may be dropped,
+ * least recently used first, to keep the total under a budget; the
+ * callback releases the object and the registry forgets it afterwards.
+ * Callers touch what they bind, and nothing used since the last tick is
+ * evicted. Queries and fences occupy no memory but are registered all
+ * the same so they can be counted; a fence has no GL name, so its owner
+ * picks a nonzero one.
+*/
+enum {
+    GPUMEM_TEXTURE,
+    GPUMEM_RENDERBUFFER,
+    GPUMEM_FRAMEBUFFER,
+    GPUMEM_BUFFER,
+    GPUMEM_PROGRAM,
+    GPUMEM_QUERY,
+    GPUMEM_SYNC,
+    GPUMEM_LAST
+};
+
+void gpumem_register(int kind, unsigned int name, size_t bytes, const char *label,
+        void (*evict)(void *arg), void *arg);
+void gpumem_unregister(int kind, unsigned int name);
+void gpumem_touch(int kind, unsigned int name);
+void gpumem_tick(void);
+void gpumem_set_budget(size_t bytes);
+size_t gpumem_total(void);
+size_t gpumem_count(void);
+void gpumem_report(void);
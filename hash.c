@@ -0,0 +1,47 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+/* independent 32 bit lanes, eight of them fill a 256 bit vector */
+#define LANES 8
+
+#define PRIME1 2654435761u
+#define PRIME2 2246822519u
+
+/*
+ * xxHash32 style rounds over eight interleaved lanes. The lanes do not
+ * depend on each other, so -O3 turns the inner loop into vector
+ * multiplies and rotates; the lanes are only folded together at the end.
+*/
+uint64_t hash_frame(const unsigned char *data, size_t len){
+    uint32_t acc[LANES], word[LANES];
+    uint64_t h = len * 0x9E3779B97F4A7C15ull;
+    size_t i, blocks = len / sizeof(word);
+    int l;
+
+    for (l = 0; l < LANES; ++l)
+        acc[l] = PRIME1 * (uint32_t)(l + 1);
+
+    for (i = 0; i < blocks; ++i, data += sizeof(word)) {
+        memcpy(word, data, sizeof(word));
+        for (l = 0; l < LANES; ++l) {
+            acc[l] += word[l] * PRIME2;
+            acc[l] = (acc[l] << 13) | (acc[l] >> 19);
+            acc[l] *= PRIME1;
+        }
+    }
+
+    for (l = 0; l < LANES; ++l)
+        h = (h ^ acc[l]) * 0x100000001B3ull;
+    for (i = 0; i < len % sizeof(word); ++i)
+        h = (h ^ data[i]) * 0x100000001B3ull;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+
+    return h;
+}
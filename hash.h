@@ -0,0 +1,4 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Fast non-cryptographic 64 bit hash of a read-back frame or any other buffer. */
+uint64_t hash_frame(const unsigned char *data, size_t len);
@@ -0,0 +1,154 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <string.h>
+
+#include "hud.h"
+
+/* frames in the rolling graph, one pixel column each */
+#define HISTORY 120
+/* how often the numbers change, so they stay readable */
+#define TEXT_INTERVAL_MS 500.0
+#define GRAPH_HEIGHT 32
+#define GRAPH_MS 50.0
+
+#define CELL_WIDTH 4
+#define CELL_HEIGHT 6
+
+/*
+ * 3x5 glyphs, one row per three bits from the top. The first cell is
+ * solid and serves the panel and the graph bars.
+*/
+static const char glyph_chars[] = "#0123456789.:/ACDFGHMNPSU";
+static const unsigned short glyphs[] = {
+    0x7fff,
+    075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+    000002, 002020, 011244,
+    025755, 034443, 065556, 074644, 034553, 055755, 057755, 065555, 065644, 034216,
+    055557,
+};
+
+static const unsigned char text_color[4] = { 255, 255, 255, 255 };
+static const unsigned char panel_color[4] = { 0, 0, 0, 160 };
+static const unsigned char line_color[4] = { 255, 255, 255, 96 };
+static const unsigned char good_color[4] = { 64, 224, 64, 255 };
+static const unsigned char slow_color[4] = { 240, 200, 32, 255 };
+static const unsigned char bad_color[4] = { 240, 48, 32, 255 };
+
+static struct {
+    float history[HISTORY];
+    int head;
+    double elapsed;
+    long frames;
+    double cpu, gpu, hud;
+    long gpu_frames;
+    char lines[4][16];
+} hud;
+
+void hud_font(unsigned char *pixels){
+    int g, x, y;
+
+    memset(pixels, 0, HUD_FONT_WIDTH * HUD_FONT_HEIGHT);
+    for (g = 0; g < (int)(sizeof(glyphs) / sizeof(*glyphs)); ++g)
+        for (y = 0; y < CELL_HEIGHT; ++y)
+            for (x = 0; x < CELL_WIDTH; ++x)
+                if (g == 0 || (x < 3 && y < 5 && (glyphs[g] >> ((4 - y) * 3 + 2 - x)) & 1))
+                    pixels[y * HUD_FONT_WIDTH + g * CELL_WIDTH + x] = 255;
+}
+
+/*
+ * Times in milliseconds, gpu_ms and hud_ms negative while no timer
+ * result is available.
+*/
+void hud_sample(double frame_ms, double cpu_ms, double gpu_ms, double hud_ms){
+    hud.history[hud.head] = (float)frame_ms;
+    hud.head = (hud.head + 1) % HISTORY;
+
+    hud.elapsed += frame_ms;
+    hud.frames++;
+    hud.cpu += cpu_ms;
+    if (gpu_ms >= 0.0) {
+        hud.gpu += gpu_ms;
+        hud.hud += hud_ms;
+        hud.gpu_frames++;
+    }
+    if (hud.elapsed < TEXT_INTERVAL_MS)
+        return;
+
+    snprintf(hud.lines[0], sizeof(hud.lines[0]), "FPS %.1f", hud.frames * 1000.0 / hud.elapsed);
+    snprintf(hud.lines[1], sizeof(hud.lines[1]), "CPU %.2f MS", hud.cpu / hud.frames);
+    if (hud.gpu_frames) {
+        snprintf(hud.lines[2], sizeof(hud.lines[2]), "GPU %.2f MS", hud.gpu / hud.gpu_frames);
+        snprintf(hud.lines[3], sizeof(hud.lines[3]), "HUD %.3f MS", hud.hud / hud.gpu_frames);
+    } else {
+        snprintf(hud.lines[2], sizeof(hud.lines[2]), "GPU N/A");
+        snprintf(hud.lines[3], sizeof(hud.lines[3]), "HUD N/A");
+    }
+    hud.elapsed = hud.cpu = hud.gpu = hud.hud = 0.0;
+    hud.frames = hud.gpu_frames = 0;
+}
+
+static struct hud_vertex *quad(struct hud_vertex *v, float x0, float y0, float x1, float y1,
+        int glyph, const unsigned char *color){
+    static const int corners[6][2] = { {0, 0}, {1, 0}, {0, 1}, {0, 1}, {1, 0}, {1, 1} };
+    float u0 = (float)glyph * CELL_WIDTH / HUD_FONT_WIDTH;
+    float u1 = (float)(glyph * CELL_WIDTH + CELL_WIDTH) / HUD_FONT_WIDTH;
+    int i;
+
+    /* the solid cell is sampled at a single texel */
+    if (glyph == 0)
+        u0 = u1 = 0.5f / HUD_FONT_WIDTH;
+    for (i = 0; i < 6; ++i, ++v) {
+        v->x = corners[i][0] ? x1 : x0;
+        v->y = corners[i][1] ? y1 : y0;
+        v->u = corners[i][0] ? u1 : u0;
+        v->v = corners[i][1] ? 1.0f : 0.0f;
+        if (glyph == 0)
+            v->v = 0.5f / HUD_FONT_HEIGHT;
+        memcpy(v->color, color, 4);
+    }
+
+    return v;
+}
+
+/*
+ * Lay the overlay out in pixels from the top left corner of a width x
+ * height viewport, scaled up on large displays. Returns the number of
+ * vertices written, a triangle list.
+*/
+int hud_build(struct hud_vertex *v, int width, int height){
+    struct hud_vertex *start = v;
+    const unsigned char *color;
+    const char *c, *p;
+    float s = height >= 540 ? (float)(height / 270) : 2.0f;
+    float x, y, h, left = 4 * s, top = 4 * s;
+    int i, line;
+
+    (void)width;
+    v = quad(v, left, top, left + (HISTORY + 4) * s,
+            top + (4 * (CELL_HEIGHT + 2) + GRAPH_HEIGHT + 6) * s, 0, panel_color);
+
+    y = top + 2 * s;
+    for (line = 0; line < 4; ++line, y += (CELL_HEIGHT + 2) * s) {
+        x = left + 2 * s;
+        for (c = hud.lines[line]; *c; ++c, x += CELL_WIDTH * s) {
+            if (*c == ' ' || !(p = strchr(glyph_chars + 1, *c)))
+                continue;
+            v = quad(v, x, y, x + CELL_WIDTH * s, y + CELL_HEIGHT * s,
+                    (int)(p - glyph_chars), text_color);
+        }
+    }
+
+    y += (GRAPH_HEIGHT + 2) * s;
+    for (i = 0; i < HISTORY; ++i) {
+        h = hud.history[(hud.head + i) % HISTORY];
+        color = h <= 17.0f ? good_color : h <= 34.0f ? slow_color : bad_color;
+        h = h > GRAPH_MS ? GRAPH_MS : h;
+        x = left + (2 + i) * s;
+        v = quad(v, x, y - (float)(h / GRAPH_MS * GRAPH_HEIGHT) * s, x + s, y, 0, color);
+    }
+    /* 60 Hz budget */
+    h = (float)(16.7 / GRAPH_MS * GRAPH_HEIGHT) * s;
+    v = quad(v, left + 2 * s, y - h, left + (HISTORY + 2) * s, y - h + s, 0, line_color);
+
+    return (int)(v - start);
+}
@@ -0,0 +1,20 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Performance overlay: timing statistics and the geometry that shows
+ * them. Text and the frame time graph are all quads sampling one small
+ * font atlas, so the whole overlay is a single draw.
+*/
+#define HUD_FONT_WIDTH 128
+#define HUD_FONT_HEIGHT 6
+#define HUD_MAX_VERTICES 2048
+
+struct hud_vertex {
+    float x, y;
+    float u, v;
+    unsigned char color[4];
+};
+
+void hud_font(unsigned char *pixels);
+void hud_sample(double frame_ms, double cpu_ms, double gpu_ms, double hud_ms);
+int hud_build(struct hud_vertex *v, int width, int height);
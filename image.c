@@ -0,0 +1,78 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <png.h>
+
+#include "image.h"
+#include "util.h"
+
+/*
+ * Decode a PNG file. Returns 0 on success, otherwise -1 after a warning
+ * with what libpng had to say.
+*/
+int image_load_png(struct image *img, const char *path){
+    png_image png;
+
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    img->rgba = NULL;
+    if (!png_image_begin_read_from_file(&png, path)) {
+        warning("%s: %s\n", path, png.message);
+        return -1;
+    }
+
+    png.format = PNG_FORMAT_RGBA;
+    img->width = png.width;
+    img->height = png.height;
+    if (!(img->rgba = malloc(PNG_IMAGE_SIZE(png)))) {
+        png_image_free(&png);
+        return -1;
+    }
+    if (!png_image_finish_read(&png, NULL, img->rgba, -(png_int_32)PNG_IMAGE_ROW_STRIDE(png), NULL)) {
+        warning("%s: %s\n", path, png.message);
+        image_free(img);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Encode bottom-up RGBA8 rows, as read back from GL, as an RGB PNG; a
+ * framebuffer's alpha is not what was on screen. Returns 0 on success.
+*/
+int image_save_png(const char *path, uint32_t width, uint32_t height, const unsigned char *rgba){
+    unsigned char *rgb, *d;
+    const unsigned char *s;
+    png_image png;
+    size_t i, n = (size_t)width * height;
+    int ok;
+
+    if (!(rgb = malloc(n * 3)))
+        return -1;
+    for (i = 0, s = rgba, d = rgb; i < n; ++i, s += 4, d += 3) {
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+    }
+
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    png.width = width;
+    png.height = height;
+    png.format = PNG_FORMAT_RGB;
+    ok = png_image_write_to_file(&png, path, 0, rgb, -(png_int_32)(width * 3), NULL);
+    if (!ok)
+        warning("%s: %s\n", path, png.message);
+    png_image_free(&png);
+    free(rgb);
+
+    return ok ? 0 : -1;
+}
+
+void image_free(struct image *img){
+    free(img->rgba);
+    img->rgba = NULL;
+}
@@ -0,0 +1,12 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Decoded image, tightly packed RGBA8 rows stored bottom up like GL. */
+struct image {
+    uint32_t width;
+    uint32_t height;
+    unsigned char *rgba;
+};
+
+int image_load_png(struct image *img, const char *path);
+int image_save_png(const char *path, uint32_t width, uint32_t height, const unsigned char *rgba);
+void image_free(struct image *img);
@@ -0,0 +1,89 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <string.h>
+
+#include "input.h"
+#include "util.h"
+
+#define INPUT_MAGIC "esshader-input 1"
+
+static const char *type_names[INPUT_LAST] = {
+    [INPUT_RESIZE] = "resize",
+    [INPUT_KEY_DOWN] = "keydown",
+    [INPUT_KEY_UP] = "keyup",
+    [INPUT_BUTTON_DOWN] = "press",
+    [INPUT_BUTTON_UP] = "release",
+    [INPUT_MOTION] = "motion",
+};
+
+void input_record_open(struct input_log *log, const char *path){
+    memset(log, 0, sizeof(*log));
+    if (!(log->fp = fopen(path, "w")))
+        die("Unable to open input log %s.\n", path);
+    log->path = path;
+    fputs(INPUT_MAGIC "\n# frame time event a b\n", log->fp);
+}
+
+void input_record(struct input_log *log, const struct input_event *ev){
+    fprintf(log->fp, "%ld %.6f %s %#x %d\n", ev->frame, ev->time,
+            type_names[ev->type], (unsigned)ev->a, ev->b);
+    log->events++;
+}
+
+/* Read ahead one event, so the caller can ask whether it is due yet. */
+static void read_next(struct input_log *log){
+    char line[256], name[16];
+    unsigned a;
+    int type;
+
+    log->pending = 0;
+    while (fgets(line, sizeof(line), log->fp)) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%ld %lf %15s %x %d", &log->next.frame, &log->next.time,
+                    name, &a, &log->next.b) != 5)
+            die("Malformed line in input log %s: %s", log->path, line);
+        for (type = 0; type < INPUT_LAST; ++type)
+            if (!strcmp(name, type_names[type]))
+                break;
+        if (type == INPUT_LAST)
+            die("Unknown event %s in input log %s.\n", name, log->path);
+        log->next.type = type;
+        log->next.a = (int)a;
+        log->pending = 1;
+        return;
+    }
+}
+
+void input_replay_open(struct input_log *log, const char *path){
+    char line[64];
+
+    memset(log, 0, sizeof(*log));
+    if (!(log->fp = fopen(path, "r")))
+        die("Unable to open input log %s.\n", path);
+    log->path = path;
+    if (!fgets(line, sizeof(line), log->fp) || strncmp(line, INPUT_MAGIC "\n", sizeof(line)))
+        die("%s is not an esshader input log.\n", path);
+    read_next(log);
+}
+
+/*
+ * Hand out the next event due at or before frame, returning 0 once
+ * there is none left for this frame.
+*/
+int input_replay_next(struct input_log *log, long frame, struct input_event *ev){
+    if (!log->pending || log->next.frame > frame)
+        return 0;
+
+    *ev = log->next;
+    log->events++;
+    read_next(log);
+    return 1;
+}
+
+void input_close(struct input_log *log){
+    if (log->fp)
+        fclose(log->fp);
+    log->fp = NULL;
+    log->pending = 0;
+}
@@ -0,0 +1,38 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Input logs: every input and resize event the main loop acts on, one
+ * per line, keyed by the frame it was handled in so a replay delivers it
+ * to the same frame regardless of how fast that run renders.
+*/
+enum {
+    INPUT_RESIZE,       /* a, b: window size */
+    INPUT_KEY_DOWN,     /* a: X keysym */
+    INPUT_KEY_UP,
+    INPUT_BUTTON_DOWN,  /* a, b: pointer position, top-left origin */
+    INPUT_BUTTON_UP,
+    INPUT_MOTION,
+    INPUT_LAST
+};
+
+struct input_event {
+    long frame;
+    double time;
+    int type;
+    int a;
+    int b;
+};
+
+struct input_log {
+    FILE *fp;
+    const char *path;
+    int pending;
+    struct input_event next;
+    unsigned long events;
+};
+
+void input_record_open(struct input_log *log, const char *path);
+void input_record(struct input_log *log, const struct input_event *ev);
+void input_replay_open(struct input_log *log, const char *path);
+int input_replay_next(struct input_log *log, long frame, struct input_event *ev);
+void input_close(struct input_log *log);
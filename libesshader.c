@@ -0,0 +1,1135 @@
+/* See LICENSE file for copyright and license details. */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#ifdef GLES3
+#include <GLES3/gl3.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "esshader.h"
+#include "trace.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#ifndef GL_HALF_FLOAT_OES
+#define GL_HALF_FLOAT_OES 0x8D61
+#endif
+
+/* Used when esshader_create() is given no configuration attributes. */
+static const EGLint default_config[] = {
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+    EGL_NONE
+};
+
+static const char common_shader_header[] =
+    "#version 100\n"
+    "precision highp float;";
+
+static const char vertex_shader_body[] =
+    "attribute vec4 iPosition;"
+    "void main(){gl_Position=iPosition;}";
+
+static const char fragment_shader_header[] =
+    "uniform vec3 iResolution;"
+    "uniform float iGlobalTime;"
+    "uniform float iChannelTime[4];"
+    "uniform vec4 iMouse;"
+    "uniform vec4 iDate;"
+    "uniform float iSampleRate;"
+    "uniform vec3 iChannelResolution[4];"
+    "uniform sampler2D iChannel0;"
+    "uniform sampler2D iChannel1;"
+    "uniform sampler2D iChannel2;"
+    "uniform sampler2D iChannel3;\n"
+    "#define iTime iGlobalTime\n";
+
+static const char fragment_shader_footer[] =
+    "\nuniform vec2 esshader_Offset;"
+    "void main(){mainImage(gl_FragColor,gl_FragCoord.xy-esshader_Offset);}";
+
+#ifdef GLES3
+/*
+ * ES 3.00 flavour of the above. The ShaderToy inputs live in a std140
+ * uniform block which is refreshed with a single upload per frame, and
+ * the legacy texture lookups are mapped onto texture() so both dialects
+ * compile unchanged.
+*/
+static const char common_shader_header_es3[] =
+    "#version 300 es\n"
+    "precision highp float;";
+
+static const char vertex_shader_body_es3[] =
+    "in vec4 iPosition;"
+    "void main(){gl_Position=iPosition;}";
+
+static const char fragment_shader_header_es3[] =
+    "layout(std140) uniform ShaderToy{"
+        "vec3 iResolution;"
+        "float iGlobalTime;"
+        "vec4 iMouse;"
+        "vec4 iDate;"
+        "vec3 iChannelResolution[4];"
+        "float iChannelTime[4];"
+        "float iSampleRate;"
+    "};"
+    "uniform sampler2D iChannel0;"
+    "uniform sampler2D iChannel1;"
+    "uniform sampler2D iChannel2;"
+    "uniform sampler2D iChannel3;\n"
+    "#define iTime iGlobalTime\n"
+    "#define texture2D texture\n"
+    "#define textureCube texture\n";
+
+static const char fragment_shader_footer_es3[] =
+    "\nout vec4 esshader_FragColor;"
+    "uniform vec2 esshader_Offset;"
+    "void main(){mainImage(esshader_FragColor,gl_FragCoord.xy-esshader_Offset);}";
+#endif
+
+/*
+ * Copies the offscreen image to the window, always in the ES 1.00
+ * dialect since every context version accepts it.
+*/
+static const char blit_vertex_shader_body[] =
+    "attribute vec4 iPosition;"
+    "varying vec2 uv;"
+    "void main(){uv=iPosition.xy*.5+.5;gl_Position=iPosition;}";
+
+static const char blit_fragment_shader_body[] =
+    "varying vec2 uv;"
+    "uniform sampler2D image;"
+    "void main(){gl_FragColor=texture2D(image,uv);}";
+
+/* Every pass draws this one full viewport quad. */
+static const GLfloat quad[] = {
+    -1.0f, -1.0f,
+    1.0f, -1.0f,
+    -1.0f, 1.0f,
+    1.0f, 1.0f,
+};
+
+/* CPU side of the ES 3.0 ShaderToy uniform block, padded to std140 rules. */
+struct block {
+    float resolution[3];
+    float global_time;
+    float mouse[4];
+    float date[4];
+    float channel_resolution[4][4];
+    float channel_time[4][4];
+    float sample_rate;
+    float pad[3];
+};
+
+/* ShaderToy inputs esshader_uniform() keeps in the block */
+static const struct {
+    const char *name;
+    size_t offset;
+    int count;
+} inputs[] = {
+    { "iGlobalTime", offsetof(struct block, global_time), 1 },
+    { "iTime", offsetof(struct block, global_time), 1 },
+    { "iMouse", offsetof(struct block, mouse), 4 },
+    { "iDate", offsetof(struct block, date), 4 },
+    { "iSampleRate", offsetof(struct block, sample_rate), 1 },
+};
+
+static const struct {
+    const char *name;
+    int bytes_per_pixel;
+    GLenum format;
+    GLenum type;
+} formats[] = {
+    [ESSHADER_RGBA8] = { "rgba8", 4, GL_RGBA, GL_UNSIGNED_BYTE },
+    [ESSHADER_RGB565] = { "rgb565", 2, GL_RGB, GL_UNSIGNED_SHORT_5_6_5 },
+    [ESSHADER_RGBA4] = { "rgba4", 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4 },
+    [ESSHADER_HALF] = { "half", 8, GL_RGBA, GL_HALF_FLOAT_OES },
+};
+
+/*
+ * An offscreen colour buffer. format is -1 while the image pass draws
+ * straight to the window.
+*/
+struct target {
+    const char *name;
+    int format;
+    GLenum filter;
+    GLsizei width;
+    GLsizei height;
+    GLuint texture;
+    GLuint framebuffer;
+};
+
+/*
+ * An image program with its locations. Under ES 2.0 every program holds
+ * its own copy of the inputs, so sent keeps what it was last given and
+ * only what changed since is uploaded again; ES 3.0 programs all read
+ * the one block.
+*/
+struct program {
+    GLuint name;
+    GLint position;
+    GLint sampler[4];
+    GLint offset;
+    GLint res;
+    GLint gtime;
+    GLint mouse;
+    GLint date;
+    GLint srate;
+    GLint cres;
+    GLint ctime;
+    bool fresh;             /* nothing sent yet */
+    bool retired;           /* released while current, deleted once replaced */
+    GLfloat sent_offset[2];
+    struct block sent;
+};
+
+struct esshader {
+    Display *x_display;
+    Window x_window;
+    Colormap x_colormap;
+    EGLDisplay egl_display;
+    EGLConfig egl_config;
+    EGLContext egl_context;
+    EGLSurface egl_surface;
+    bool headless;
+    int gles_version;
+    int width;
+    int height;
+    int render_width;
+    int render_height;
+    float scale;
+    int offscreen_flags;
+    struct target image;
+    struct target feedback;
+    GLuint blit;
+    GLint blit_position;
+    struct program *programs;
+    int nprograms;
+    int programs_size;
+    GLuint current;
+    GLuint bound;           /* program in use within a frame, 0 at its start */
+    GLint bound_position;
+    GLuint channel[4];
+    GLuint uniform_buffer;
+    bool uploaded;
+    struct block block;
+    struct block sent;      /* what the uniform buffer holds */
+    char error[4096];
+};
+
+/*
+ * Headless contexts share the one surfaceless display, which must stay
+ * initialised until the last of them is gone.
+*/
+static pthread_mutex_t headless_lock = PTHREAD_MUTEX_INITIALIZER;
+static int headless_contexts;
+
+static int fail(struct esshader *es, const char *format, ...){
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(es->error, sizeof(es->error), format, ap);
+    va_end(ap);
+
+    return -1;
+}
+
+static void make_current(struct esshader *es){
+    if (eglGetCurrentContext() != es->egl_context)
+        eglMakeCurrent(es->egl_display, es->egl_surface, es->egl_surface, es->egl_context);
+}
+
+static bool has_extension(const char *name){
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+
+    while (exts && (exts = strstr(exts, name))) {
+        if (exts[len] == ' ' || exts[len] == '\0')
+            return true;
+        exts += len;
+    }
+
+    return false;
+}
+
+/*
+ * Prefer a display that needs no window system at all, falling back to
+ * whatever the EGL implementation considers its default.
+*/
+static EGLDisplay headless_display(void){
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+    const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    EGLDisplay dpy;
+
+    if (ext && strstr(ext, "EGL_MESA_platform_surfaceless")) {
+        get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (dpy != EGL_NO_DISPLAY)
+                return dpy;
+        }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+/*
+ * Pick a framebuffer configuration from the caller's attributes. The
+ * renderable and surface types are ours to set, so the same attributes
+ * serve both API versions and headless contexts get a pbuffer. Attributes
+ * beyond what fits are dropped.
+*/
+static bool choose_config(struct esshader *es, const EGLint *config, EGLint renderable){
+    EGLint attribs[64];
+    EGLint ncfg;
+    size_t i, n = 0;
+
+    for (i = 0; config[i] != EGL_NONE && n < sizeof(attribs) / sizeof(*attribs) - 6; i += 2) {
+        if (config[i] == EGL_RENDERABLE_TYPE || config[i] == EGL_SURFACE_TYPE)
+            continue;
+        attribs[n++] = config[i];
+        attribs[n++] = config[i + 1];
+    }
+    attribs[n++] = EGL_RENDERABLE_TYPE;
+    attribs[n++] = renderable;
+    attribs[n++] = EGL_SURFACE_TYPE;
+    attribs[n++] = es->headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT;
+    attribs[n] = EGL_NONE;
+
+    return eglChooseConfig(es->egl_display, attribs, &es->egl_config, 1, &ncfg) && ncfg > 0;
+}
+
+static const char *create_window(struct esshader *es, int width, int height, bool fullscreen){
+    Display *dpy = es->x_display;
+    XSetWindowAttributes swa;
+    XVisualInfo *vi, vit;
+    int screen, nvi;
+    Window root;
+    EGLint vid;
+
+    if (!eglGetConfigAttrib(es->egl_display, es->egl_config, EGL_NATIVE_VISUAL_ID, &vid))
+        return "Unable to get X VisualID";
+
+    screen = DefaultScreen(dpy);
+    root = RootWindow(dpy, screen);
+
+    vit.visualid = vid;
+    if (!(vi = XGetVisualInfo(dpy, VisualIDMask, &vit, &nvi)))
+        return "Unable to find matching XVisualInfo for framebuffer";
+
+    swa.background_pixel = 0;
+    swa.colormap = es->x_colormap = XCreateColormap(dpy, root, vi->visual, AllocNone);
+    swa.event_mask =
+        ExposureMask | StructureNotifyMask |
+        KeyPressMask | KeyReleaseMask |
+        ButtonPressMask | ButtonReleaseMask | Button1MotionMask;
+    swa.override_redirect = False;
+
+    if (fullscreen) {
+        width = DisplayWidth(dpy, screen);
+        height = DisplayHeight(dpy, screen);
+        //Setting swa.override_redirect to True would result a "real" fullscreen window
+        //BUT: On multiscreen systems it would stretch over all displays
+        //AND: Keyboard commands aren't processed anymore
+        //MAYBE: Switch to glfw or something similar to create the window. As a neat side effect the app would run on Windows too.
+        //swa.override_redirect = True;
+    }
+    es->width = width;
+    es->height = height;
+
+    es->x_window = XCreateWindow(dpy, root, 0, 0, width, height,
+            0, vi->depth, InputOutput, vi->visual,
+            CWBackPixel | CWColormap | CWEventMask |
+            CWOverrideRedirect, &swa);
+    XFree(vi);
+
+    XStoreName(dpy, es->x_window, "esshader");
+    XMapWindow(dpy, es->x_window);
+    XFlush(dpy);
+
+    es->egl_surface = eglCreateWindowSurface(es->egl_display, es->egl_config, es->x_window, NULL);
+    if (es->egl_surface == EGL_NO_SURFACE)
+        return "Unable to create EGL window surface";
+
+    return NULL;
+}
+
+static const char *create_pbuffer(struct esshader *es, int width, int height){
+    EGLint pa[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+
+    es->egl_surface = eglCreatePbufferSurface(es->egl_display, es->egl_config, pa);
+    if (es->egl_surface == EGL_NO_SURFACE)
+        return "Unable to create EGL pbuffer surface";
+
+    return NULL;
+}
+
+static const char *create_context(struct esshader *es, int width, int height, int flags,
+        const EGLint *config){
+    static const EGLint cv[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+
+    if (es->headless) {
+        pthread_mutex_lock(&headless_lock);
+        es->egl_display = headless_display();
+        headless_contexts++;
+        pthread_mutex_unlock(&headless_lock);
+    } else {
+        if (!(es->x_display = XOpenDisplay(NULL)))
+            return "Unable to open X display";
+        es->egl_display = eglGetDisplay(es->x_display);
+    }
+    if (es->egl_display == EGL_NO_DISPLAY)
+        return "Unable to get EGL display";
+
+    if (!eglBindAPI(EGL_OPENGL_ES_API))
+        return "Unable to bind OpenGL ES API to EGL";
+
+    if (!eglInitialize(es->egl_display, NULL, NULL))
+        return "Unable to initialize EGL";
+
+#ifdef GLES3
+    if (flags & ESSHADER_GLES3) {
+        static const EGLint cv3[] = {
+            EGL_CONTEXT_CLIENT_VERSION, 3,
+            EGL_NONE
+        };
+
+        if (choose_config(es, config, EGL_OPENGL_ES3_BIT))
+            es->egl_context = eglCreateContext(es->egl_display, es->egl_config, EGL_NO_CONTEXT, cv3);
+        if (es->egl_context != EGL_NO_CONTEXT)
+            es->gles_version = 3;
+    }
+#endif
+
+    if (es->egl_context == EGL_NO_CONTEXT) {
+        if (!choose_config(es, config, EGL_OPENGL_ES2_BIT))
+            return "Unable to find EGL framebuffer configuration";
+
+        es->egl_context = eglCreateContext(es->egl_display, es->egl_config, EGL_NO_CONTEXT, cv);
+        if (es->egl_context == EGL_NO_CONTEXT)
+            return "Unable to create EGL context";
+    }
+
+    return es->headless ? create_pbuffer(es, width, height) :
+        create_window(es, width, height, flags & ESSHADER_FULLSCREEN);
+}
+
+
+/* Returns 0 with the info log in es->error if the shader fails to compile. */
+static GLuint compile_shader(struct esshader *es, GLenum type, GLsizei nsources,
+        const char **sources){
+    GLuint shader;
+    GLint success;
+
+    shader = glCreateShader(type);
+    glShaderSource(shader, nsources, sources, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, sizeof(es->error), NULL, es->error);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+/* Link both shaders, consuming them; 0 with the log in es->error on failure. */
+static GLuint link_program(struct esshader *es, GLuint vtx, GLuint frag){
+    GLuint program;
+    GLint success;
+
+    program = glCreateProgram();
+    glAttachShader(program, vtx);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+    glDeleteShader(vtx);
+    glDeleteShader(frag);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, sizeof(es->error), NULL, es->error);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static struct program *find_program(struct esshader *es, GLuint name){
+    int i;
+
+    for (i = 0; i < es->nprograms; ++i)
+        if (es->programs[i].name == name)
+            return &es->programs[i];
+
+    return NULL;
+}
+
+/* Removal moves the last record into the hole. */
+static void delete_program(struct esshader *es, struct program *p){
+    glDeleteProgram(p->name);
+    *p = es->programs[--es->nprograms];
+}
+
+static bool format_supported(const struct esshader *es, int format){
+    switch (format) {
+        case ESSHADER_HALF:
+            if (es->gles_version >= 3)
+                return has_extension("GL_EXT_color_buffer_half_float") ||
+                    has_extension("GL_EXT_color_buffer_float");
+            return has_extension("GL_OES_texture_half_float") &&
+                has_extension("GL_EXT_color_buffer_half_float");
+        default:
+            return true;
+    }
+}
+
+static bool format_filterable(const struct esshader *es, int format){
+    if (format == ESSHADER_HALF && es->gles_version < 3)
+        return has_extension("GL_OES_texture_half_float_linear");
+    return true;
+}
+
+static void target_destroy(struct target *t){
+    glDeleteFramebuffers(1, &t->framebuffer);
+    glDeleteTextures(1, &t->texture);
+    t->framebuffer = 0;
+    t->texture = 0;
+}
+
+/*
+ * (Re)allocate the storage of a target, dropping to RGBA8 for good when
+ * the driver turns out not to render into its format.
+*/
+static int target_resize(struct esshader *es, struct target *t, GLsizei w, GLsizei h){
+    GLenum internal;
+
+    if (!format_supported(es, t->format))
+        t->format = ESSHADER_RGBA8;
+
+    target_destroy(t);
+    t->width = w;
+    t->height = h;
+
+    internal = formats[t->format].format;
+#ifdef GLES3
+    if (es->gles_version >= 3 && t->format == ESSHADER_HALF)
+        internal = GL_RGBA16F;
+#endif
+    t->filter = format_filterable(es, t->format) ? GL_LINEAR : GL_NEAREST;
+
+    glGenTextures(1, &t->texture);
+    glBindTexture(GL_TEXTURE_2D, t->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, t->filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+#ifdef GLES3
+    if (es->gles_version >= 3 && t->format == ESSHADER_HALF)
+        glTexImage2D(GL_TEXTURE_2D, 0, internal, w, h, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+    else
+#endif
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, w, h, 0,
+            formats[t->format].format, formats[t->format].type, NULL);
+
+    glGenFramebuffers(1, &t->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, t->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->texture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (t->format == ESSHADER_RGBA8)
+            return fail(es, "Unable to render into %s target at %dx%d", t->name, w, h);
+        t->format = ESSHADER_RGBA8;
+        return target_resize(es, t, w, h);
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return 0;
+}
+
+/* Bring the render size and the targets in line with the window. */
+static int resize_targets(struct esshader *es){
+    GLsizei rw = es->width, rh = es->height;
+
+    if (es->image.format >= 0) {
+        rw = (GLsizei)(es->width * es->scale + 0.5f);
+        rh = (GLsizei)(es->height * es->scale + 0.5f);
+        rw = rw > 0 ? rw : 1;
+        rh = rh > 0 ? rh : 1;
+        if (target_resize(es, &es->image, rw, rh))
+            return -1;
+        if (es->feedback.format >= 0 && target_resize(es, &es->feedback, rw, rh))
+            return -1;
+    }
+    es->render_width = rw;
+    es->render_height = rh;
+
+    return 0;
+}
+
+struct esshader *esshader_create(int width, int height, int flags, const int *config,
+        const char **error){
+    struct esshader *es;
+
+    if (!(es = calloc(1, sizeof(*es)))) {
+        *error = "Unable to allocate esshader context";
+        return NULL;
+    }
+    es->headless = flags & ESSHADER_HEADLESS;
+    es->gles_version = 2;
+    es->width = width;
+    es->height = height;
+    es->render_width = width;
+    es->render_height = height;
+    es->image.name = "image";
+    es->image.format = -1;
+    es->feedback.name = "feedback";
+    es->feedback.format = -1;
+    es->egl_display = EGL_NO_DISPLAY;
+    es->egl_context = EGL_NO_CONTEXT;
+    es->egl_surface = EGL_NO_SURFACE;
+
+    if ((*error = create_context(es, width, height, flags,
+                    config ? config : default_config))) {
+        esshader_destroy(es);
+        return NULL;
+    }
+    eglMakeCurrent(es->egl_display, es->egl_surface, es->egl_surface, es->egl_context);
+
+#ifdef GLES3
+    if (es->gles_version >= 3) {
+        glGenBuffers(1, &es->uniform_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, es->uniform_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(es->block), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, es->uniform_buffer);
+    }
+#endif
+    //Pbuffers have a fixed size, so headless contexts render offscreen
+    //at whatever size they are given
+    if (es->headless && esshader_offscreen(es, ESSHADER_RGBA8, 1.0f, 0)) {
+        *error = "Unable to create the offscreen target";
+        esshader_destroy(es);
+        return NULL;
+    }
+
+    return es;
+}
+
+void esshader_destroy(struct esshader *es){
+    bool terminate = true;
+
+    if (es->egl_context != EGL_NO_CONTEXT) {
+        make_current(es);
+        while (es->nprograms)
+            delete_program(es, es->programs);
+        target_destroy(&es->image);
+        target_destroy(&es->feedback);
+        glDeleteProgram(es->blit);
+#ifdef GLES3
+        if (es->uniform_buffer)
+            glDeleteBuffers(1, &es->uniform_buffer);
+#endif
+        eglMakeCurrent(es->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(es->egl_display, es->egl_context);
+    }
+    if (es->egl_surface != EGL_NO_SURFACE)
+        eglDestroySurface(es->egl_display, es->egl_surface);
+    if (es->headless) {
+        pthread_mutex_lock(&headless_lock);
+        terminate = --headless_contexts == 0;
+        pthread_mutex_unlock(&headless_lock);
+    }
+    if (es->egl_display != EGL_NO_DISPLAY && terminate)
+        eglTerminate(es->egl_display);
+    if (es->x_display) {
+        if (es->x_window)
+            XDestroyWindow(es->x_display, es->x_window);
+        if (es->x_colormap)
+            XFreeColormap(es->x_display, es->x_colormap);
+        XCloseDisplay(es->x_display);
+    }
+    free(es->programs);
+    free(es);
+}
+
+const char *esshader_error(const struct esshader *es){
+    return es->error;
+}
+
+void esshader_native(const struct esshader *es, struct esshader_native *native){
+    native->x_display = es->x_display;
+    native->x_window = es->x_window;
+    native->egl_display = es->egl_display;
+    native->egl_context = es->egl_context;
+    native->egl_surface = es->egl_surface;
+    native->gles_version = es->gles_version;
+}
+
+unsigned int esshader_program(struct esshader *es, const char *source){
+    static const char *samplers[4] = { "iChannel0", "iChannel1", "iChannel2", "iChannel3" };
+    const char *sources[4];
+    GLuint vtx, frag, program;
+    struct program *p;
+    int i;
+
+    make_current(es);
+    sources[0] = common_shader_header;
+    sources[1] = vertex_shader_body;
+    sources[2] = fragment_shader_header;
+    sources[3] = fragment_shader_footer;
+#ifdef GLES3
+    if (es->gles_version >= 3) {
+        sources[0] = common_shader_header_es3;
+        sources[1] = vertex_shader_body_es3;
+        sources[2] = fragment_shader_header_es3;
+        sources[3] = fragment_shader_footer_es3;
+    }
+#endif
+
+    if (!(vtx = compile_shader(es, GL_VERTEX_SHADER, 2, sources)))
+        return 0;
+    sources[1] = sources[2];
+    sources[2] = source;
+    if (!(frag = compile_shader(es, GL_FRAGMENT_SHADER, 4, sources))) {
+        glDeleteShader(vtx);
+        return 0;
+    }
+    if (!(program = link_program(es, vtx, frag)))
+        return 0;
+
+    if (es->nprograms == es->programs_size) {
+        int size = es->programs_size ? 2 * es->programs_size : 8;
+
+        if (!(p = realloc(es->programs, size * sizeof(*p)))) {
+            glDeleteProgram(program);
+            fail(es, "Unable to allocate program");
+            return 0;
+        }
+        es->programs = p;
+        es->programs_size = size;
+    }
+    p = &es->programs[es->nprograms++];
+    memset(p, 0, sizeof(*p));
+    p->name = program;
+    p->fresh = true;
+
+    glUseProgram(program);
+    es->bound = program;
+    p->position = glGetAttribLocation(program, "iPosition");
+    for (i = 0; i < 4; ++i) {
+        p->sampler[i] = glGetUniformLocation(program, samplers[i]);
+        if (p->sampler[i] >= 0)
+            glUniform1i(p->sampler[i], i);
+    }
+    p->offset = glGetUniformLocation(program, "esshader_Offset");
+#ifdef GLES3
+    if (es->gles_version >= 3) {
+        GLuint index = glGetUniformBlockIndex(program, "ShaderToy");
+
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, 0);
+        return program;
+    }
+#endif
+    p->res = glGetUniformLocation(program, "iResolution");
+    p->gtime = glGetUniformLocation(program, "iGlobalTime");
+    p->mouse = glGetUniformLocation(program, "iMouse");
+    p->date = glGetUniformLocation(program, "iDate");
+    p->srate = glGetUniformLocation(program, "iSampleRate");
+    p->cres = glGetUniformLocation(program, "iChannelResolution");
+    p->ctime = glGetUniformLocation(program, "iChannelTime");
+
+    return program;
+}
+
+int esshader_use(struct esshader *es, unsigned int program){
+    struct program *old = find_program(es, es->current);
+
+    if (!find_program(es, program))
+        return fail(es, "Unknown program %u", program);
+    es->current = program;
+    if (old && old->retired && old->name != program) {
+        make_current(es);
+        delete_program(es, old);
+    }
+
+    return 0;
+}
+
+void esshader_release(struct esshader *es, unsigned int program){
+    struct program *p = find_program(es, program);
+
+    if (!p)
+        return;
+    if (program == es->current) {
+        p->retired = true;
+        return;
+    }
+    make_current(es);
+    delete_program(es, p);
+}
+
+int esshader_load(struct esshader *es, const char *source){
+    GLuint program, old = es->current;
+
+    if (!(program = esshader_program(es, source)))
+        return -1;
+    esshader_use(es, program);
+    esshader_release(es, old);
+
+    return 0;
+}
+
+int esshader_uniform(struct esshader *es, const char *name, int count, const float *values){
+    GLint location;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+        if (strcmp(name, inputs[i].name))
+            continue;
+        if (count != inputs[i].count)
+            return fail(es, "%s takes %d values, not %d", name, inputs[i].count, count);
+        memcpy((char *)&es->block + inputs[i].offset, values, count * sizeof(*values));
+        return 0;
+    }
+
+    if (!es->current)
+        return fail(es, "No program loaded");
+    make_current(es);
+    glUseProgram(es->current);
+    es->bound = es->current;
+    if ((location = glGetUniformLocation(es->current, name)) < 0)
+        return fail(es, "Program has no uniform %s", name);
+    switch (count) {
+    case 1: glUniform1fv(location, 1, values); break;
+    case 2: glUniform2fv(location, 1, values); break;
+    case 3: glUniform3fv(location, 1, values); break;
+    case 4: glUniform4fv(location, 1, values); break;
+    default:
+        return fail(es, "Uniforms take 1 to 4 values, not %d", count);
+    }
+
+    return 0;
+}
+
+int esshader_channel(struct esshader *es, int index, unsigned int texture, int width, int height){
+    float *cres;
+
+    if (index < 0 || index > 3)
+        return fail(es, "No channel %d", index);
+    es->channel[index] = texture;
+    cres = es->block.channel_resolution[index];
+    cres[0] = (float)width;
+    cres[1] = (float)height;
+    cres[2] = width > 0 ? 1.0f : 0.0f;
+
+    return 0;
+}
+
+int esshader_sampled(const struct esshader *es, int index){
+    int i;
+
+    for (i = 0; i < es->nprograms; ++i)
+        if (es->programs[i].sampler[index] >= 0)
+            return 1;
+
+    return 0;
+}
+
+int esshader_offscreen(struct esshader *es, int format, float scale, int flags){
+    const char *sources[2];
+    GLuint vtx, frag;
+
+    if (format < 0 || format >= ESSHADER_FORMATS)
+        return fail(es, "Unknown offscreen format %d", format);
+    if (scale <= 0.0f)
+        return fail(es, "Invalid scale %g", scale);
+
+    make_current(es);
+    if (!es->blit) {
+        sources[0] = common_shader_header;
+        sources[1] = blit_vertex_shader_body;
+        if (!(vtx = compile_shader(es, GL_VERTEX_SHADER, 2, sources)))
+            return -1;
+        sources[1] = blit_fragment_shader_body;
+        if (!(frag = compile_shader(es, GL_FRAGMENT_SHADER, 2, sources))) {
+            glDeleteShader(vtx);
+            return -1;
+        }
+        if (!(es->blit = link_program(es, vtx, frag)))
+            return -1;
+        es->blit_position = glGetAttribLocation(es->blit, "iPosition");
+    }
+
+    es->scale = scale;
+    es->offscreen_flags = flags;
+    es->image.format = format;
+    target_destroy(&es->feedback);
+    es->feedback.format = flags & ESSHADER_FEEDBACK ? format : -1;
+
+    return resize_targets(es);
+}
+
+void esshader_size(const struct esshader *es, int *width, int *height){
+    *width = es->render_width;
+    *height = es->render_height;
+}
+
+unsigned int esshader_feedback(const struct esshader *es){
+    return es->feedback.texture;
+}
+
+const char *esshader_format_name(int format){
+    return format >= 0 && format < ESSHADER_FORMATS ? formats[format].name : NULL;
+}
+
+int esshader_target(const struct esshader *es, int feedback, struct esshader_target *target){
+    const struct target *t = feedback ? &es->feedback : &es->image;
+
+    if (t->format < 0)
+        return 0;
+    target->name = t->name;
+    target->format = t->format;
+    target->width = t->width;
+    target->height = t->height;
+    target->bytes_per_pixel = formats[t->format].bytes_per_pixel;
+
+    return 1;
+}
+
+int esshader_objects(const struct esshader *es, struct esshader_object *objects, int max){
+    const struct target *targets[2] = { &es->image, &es->feedback };
+    struct esshader_object list[6];
+    size_t bytes;
+    int i, n = 0;
+
+    for (i = 0; i < 2; ++i) {
+        if (!targets[i]->texture)
+            continue;
+        /* a full mipmap chain adds a third on top of the base level */
+        bytes = (size_t)targets[i]->width * targets[i]->height *
+            formats[targets[i]->format].bytes_per_pixel;
+        if (es->offscreen_flags & ESSHADER_MIPMAPPED)
+            bytes += bytes / 3;
+        list[n++] = (struct esshader_object){ ESSHADER_TEXTURE, targets[i]->texture, bytes,
+            targets[i]->name };
+        list[n++] = (struct esshader_object){ ESSHADER_FRAMEBUFFER, targets[i]->framebuffer, 0,
+            targets[i]->name };
+    }
+    if (es->blit)
+        list[n++] = (struct esshader_object){ ESSHADER_PROGRAM, es->blit, 0, "blit" };
+    if (es->uniform_buffer)
+        list[n++] = (struct esshader_object){ ESSHADER_BUFFER, es->uniform_buffer,
+            sizeof(es->block), "uniforms" };
+
+    memcpy(objects, list, (n < max ? n : max) * sizeof(*list));
+    return n;
+}
+
+int esshader_resize(struct esshader *es, int width, int height){
+    if (width <= 0 || height <= 0)
+        return fail(es, "Invalid size %dx%d", width, height);
+    if (width == es->width && height == es->height)
+        return 0;
+
+    make_current(es);
+    if (!es->headless) {
+        XResizeWindow(es->x_display, es->x_window, width, height);
+        XFlush(es->x_display);
+    }
+    es->width = width;
+    es->height = height;
+
+    return resize_targets(es);
+}
+
+/*
+ * Send p whatever changed since it last drew. ES 3.0 shares the block
+ * between all programs, so drawing the cells of a mosaic uploads it once.
+*/
+static void upload_inputs(struct esshader *es, struct program *p, GLfloat x, GLfloat y){
+    struct block *b = &es->block, *s = &p->sent;
+    GLfloat values[4][3], times[4];
+    int i;
+
+    if (p->offset >= 0 && (p->fresh || p->sent_offset[0] != x || p->sent_offset[1] != y)) {
+        glUniform2f(p->offset, x, y);
+        p->sent_offset[0] = x;
+        p->sent_offset[1] = y;
+    }
+
+#ifdef GLES3
+    if (es->gles_version >= 3) {
+        if (!es->uploaded || memcmp(&es->sent, b, sizeof(*b))) {
+            glBindBuffer(GL_UNIFORM_BUFFER, es->uniform_buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(*b), b);
+            es->sent = *b;
+            es->uploaded = true;
+        }
+        p->fresh = false;
+        return;
+    }
+#endif
+
+    if (p->res >= 0 && (p->fresh || memcmp(s->resolution, b->resolution, sizeof(b->resolution))))
+        glUniform3fv(p->res, 1, b->resolution);
+    if (p->gtime >= 0 && (p->fresh || s->global_time != b->global_time))
+        glUniform1f(p->gtime, b->global_time);
+    if (p->mouse >= 0 && (p->fresh || memcmp(s->mouse, b->mouse, sizeof(b->mouse))))
+        glUniform4fv(p->mouse, 1, b->mouse);
+    if (p->date >= 0 && (p->fresh || memcmp(s->date, b->date, sizeof(b->date))))
+        glUniform4fv(p->date, 1, b->date);
+    if (p->srate >= 0 && (p->fresh || s->sample_rate != b->sample_rate))
+        glUniform1f(p->srate, b->sample_rate);
+    if (p->cres >= 0 && (p->fresh || memcmp(s->channel_resolution, b->channel_resolution,
+                    sizeof(b->channel_resolution)))) {
+        for (i = 0; i < 4; ++i)
+            memcpy(values[i], b->channel_resolution[i], sizeof(values[i]));
+        glUniform3fv(p->cres, 4, values[0]);
+    }
+    if (p->ctime >= 0 && (p->fresh || memcmp(s->channel_time, b->channel_time,
+                    sizeof(b->channel_time)))) {
+        for (i = 0; i < 4; ++i)
+            times[i] = b->channel_time[i][0];
+        glUniform1fv(p->ctime, 4, times);
+    }
+    *s = *b;
+    p->fresh = false;
+}
+
+/* Unit 0 is left active between frames, and whoever binds a texture binds it there. */
+void esshader_begin(struct esshader *es){
+    GLenum unit = GL_TEXTURE0;
+    int i;
+
+    make_current(es);
+    if (es->image.format >= 0)
+        glBindFramebuffer(GL_FRAMEBUFFER, es->image.framebuffer);
+    for (i = 0; i < 4; ++i) {
+        if (!es->channel[i])
+            continue;
+        if (unit != GL_TEXTURE0 + i)
+            glActiveTexture(unit = GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, es->channel[i]);
+    }
+    if (unit != GL_TEXTURE0)
+        glActiveTexture(GL_TEXTURE0);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    es->bound = 0;
+    es->bound_position = -1;
+}
+
+int esshader_draw(struct esshader *es, unsigned int program, int x, int y, int width, int height){
+    struct program *p = find_program(es, program ? program : es->current);
+
+    if (!p)
+        return program ? fail(es, "Unknown program %u", program) : fail(es, "No program loaded");
+
+    if (p->name != es->bound) {
+        glUseProgram(p->name);
+        es->bound = p->name;
+    }
+    es->block.resolution[0] = (float)width;
+    es->block.resolution[1] = (float)height;
+    upload_inputs(es, p, (GLfloat)x, (GLfloat)y);
+    glViewport(x, y, width, height);
+    if (p->position != es->bound_position) {
+        es->bound_position = p->position;
+        glEnableVertexAttribArray(p->position);
+        glVertexAttribPointer(p->position, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    }
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    return 0;
+}
+
+void esshader_end(struct esshader *es){
+    GLuint texture = es->image.texture, framebuffer = es->image.framebuffer;
+
+    if (es->image.format < 0)
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, es->width, es->height);
+    glUseProgram(es->blit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    //Callers may have set a mipmap filter on it while it was the feedback
+    if (es->feedback.format >= 0) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, es->image.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, es->image.filter);
+    }
+    glEnableVertexAttribArray(es->blit_position);
+    glVertexAttribPointer(es->blit_position, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    if (es->feedback.format >= 0) {
+        //This frame becomes what esshader_feedback() returns next
+        es->image.texture = es->feedback.texture;
+        es->image.framebuffer = es->feedback.framebuffer;
+        es->feedback.texture = texture;
+        es->feedback.framebuffer = framebuffer;
+    }
+}
+
+void esshader_swap(struct esshader *es){
+    eglSwapBuffers(es->egl_display, es->egl_surface);
+}
+
+/* glReadPixels returns the bottom row first */
+static void flip_rows(unsigned char *rgba, int width, int height){
+    size_t stride = (size_t)width * 4, i;
+    unsigned char *top, *bottom, t;
+
+    for (top = rgba, bottom = rgba + (height - 1) * stride; top < bottom;
+            top += stride, bottom -= stride) {
+        for (i = 0; i < stride; ++i) {
+            t = top[i];
+            top[i] = bottom[i];
+            bottom[i] = t;
+        }
+    }
+}
+
+int esshader_render(struct esshader *es, unsigned char *rgba){
+    GLenum error;
+
+    esshader_begin(es);
+    if (esshader_draw(es, 0, 0, 0, es->render_width, es->render_height))
+        return -1;
+    if (rgba) {
+        glReadPixels(0, 0, es->render_width, es->render_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        flip_rows(rgba, es->render_width, es->render_height);
+    }
+    esshader_end(es);
+    esshader_swap(es);
+
+    if ((error = glGetError()) != GL_NO_ERROR)
+        return fail(es, "OpenGL error 0x%x", error);
+
+    return 0;
+}
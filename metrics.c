@@ -0,0 +1,237 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "util.h"
+
+/* how often the textfile is rewritten, in milliseconds */
+#define METRICS_INTERVAL 1000
+
+static const double buckets[] = {
+    0.001, 0.002, 0.004, 0.008, 0.0167, 0.0333, 0.05, 0.1, 0.25, 1.0,
+};
+
+#define NBUCKETS (sizeof(buckets) / sizeof(*buckets))
+
+struct counters {
+    unsigned long frames;
+    unsigned long frame_buckets[NBUCKETS];
+    double frame_seconds;
+    double swap_seconds;
+    unsigned long dropped;
+    double compile_seconds;
+    unsigned long compiles;
+    size_t gpu_bytes;
+    size_t gpu_objects;
+};
+
+static struct counters live;
+static struct counters snapshot;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static bool running;
+static int wake[2] = { -1, -1 };
+static int listen_fd = -1;
+static const char *file_path;
+static const char *socket_path;
+
+static void publish(void){
+    if (pthread_mutex_trylock(&snapshot_lock))
+        return;
+    snapshot = live;
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+static size_t format(char *buf, size_t size){
+    struct counters c;
+    unsigned long cumulative = 0;
+    size_t i, n = 0;
+
+    pthread_mutex_lock(&snapshot_lock);
+    c = snapshot;
+    pthread_mutex_unlock(&snapshot_lock);
+
+#define OUT(...) n += (size_t)snprintf(buf + n, n < size ? size - n : 0, __VA_ARGS__)
+    OUT("# HELP esshader_frames_total Frames rendered.\n"
+        "# TYPE esshader_frames_total counter\n"
+        "esshader_frames_total %lu\n", c.frames);
+    OUT("# HELP esshader_frame_seconds Time between consecutive frames.\n"
+        "# TYPE esshader_frame_seconds histogram\n");
+    for (i = 0; i < NBUCKETS; ++i) {
+        cumulative += c.frame_buckets[i];
+        OUT("esshader_frame_seconds_bucket{le=\"%g\"} %lu\n", buckets[i], cumulative);
+    }
+    OUT("esshader_frame_seconds_bucket{le=\"+Inf\"} %lu\n"
+        "esshader_frame_seconds_sum %.6f\n"
+        "esshader_frame_seconds_count %lu\n", c.frames, c.frame_seconds, c.frames);
+    OUT("# HELP esshader_swap_blocked_seconds_total Time spent inside eglSwapBuffers.\n"
+        "# TYPE esshader_swap_blocked_seconds_total counter\n"
+        "esshader_swap_blocked_seconds_total %.6f\n", c.swap_seconds);
+    OUT("# HELP esshader_dropped_frames_total Frames that took longer than 1.5 frame periods.\n"
+        "# TYPE esshader_dropped_frames_total counter\n"
+        "esshader_dropped_frames_total %lu\n", c.dropped);
+    OUT("# HELP esshader_compile_seconds_total Time spent compiling and linking shaders.\n"
+        "# TYPE esshader_compile_seconds_total counter\n"
+        "esshader_compile_seconds_total %.6f\n", c.compile_seconds);
+    OUT("# HELP esshader_compiles_total Shaders compiled and programs linked.\n"
+        "# TYPE esshader_compiles_total counter\n"
+        "esshader_compiles_total %lu\n", c.compiles);
+    OUT("# HELP esshader_gpu_memory_bytes Estimated GPU memory held.\n"
+        "# TYPE esshader_gpu_memory_bytes gauge\n"
+        "esshader_gpu_memory_bytes %zu\n", c.gpu_bytes);
+    OUT("# HELP esshader_gpu_objects GL objects held.\n"
+        "# TYPE esshader_gpu_objects gauge\n"
+        "esshader_gpu_objects %zu\n", c.gpu_objects);
+#undef OUT
+
+    return n < size ? n : size - 1;
+}
+
+/* Write to a temporary and rename over, so the collector never reads half a file. */
+static void write_file(const char *text, size_t len){
+    char tmp[4096];
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file_path);
+    if (!(fp = fopen(tmp, "w")))
+        return;
+    if (fwrite(text, 1, len, fp) != len) {
+        fclose(fp);
+        unlink(tmp);
+        return;
+    }
+    if (fclose(fp) == 0)
+        rename(tmp, file_path);
+}
+
+static void serve_client(const char *text, size_t len){
+    ssize_t n;
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        for (n = 0; (size_t)n < len; ) {
+            /* a client hanging up early must not SIGPIPE the renderer */
+            ssize_t w = send(fd, text + n, len - n, MSG_NOSIGNAL);
+            if (w <= 0)
+                break;
+            n += w;
+        }
+        close(fd);
+    }
+}
+
+static void *exporter(void *arg){
+    struct pollfd fds[2];
+    char text[8192];
+    size_t len;
+    int nfds;
+
+    (void)arg;
+    fds[0].fd = wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd;
+    fds[1].events = POLLIN;
+    nfds = listen_fd >= 0 ? 2 : 1;
+
+    for (;;) {
+        if (poll(fds, nfds, METRICS_INTERVAL) < 0 && errno != EINTR)
+            break;
+        len = format(text, sizeof(text));
+        if (nfds > 1 && (fds[1].revents & POLLIN))
+            serve_client(text, len);
+        if (fds[0].revents & POLLIN)
+            break;
+        if (file_path)
+            write_file(text, len);
+    }
+
+    if (file_path)
+        write_file(text, format(text, sizeof(text)));
+
+    return NULL;
+}
+
+static void open_socket(const char *path){
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        die("Metrics socket path %s is too long.\n", path);
+    strcpy(addr.sun_path, path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        die("Unable to create metrics socket.\n");
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 4))
+        die("Unable to listen on metrics socket %s.\n", path);
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+}
+
+void metrics_start(const char *file, const char *socket){
+    file_path = file;
+    socket_path = socket;
+    if (socket)
+        open_socket(socket);
+    if (pipe(wake))
+        die("Unable to create metrics pipe.\n");
+    if (pthread_create(&thread, NULL, exporter, NULL))
+        die("Unable to start metrics exporter.\n");
+    running = true;
+}
+
+void metrics_compile(double seconds){
+    live.compile_seconds += seconds;
+    live.compiles++;
+}
+
+void metrics_frame(double frame_seconds, double swap_seconds, int dropped,
+        size_t gpu_bytes, size_t gpu_objects){
+    size_t i;
+
+    live.frames++;
+    live.frame_seconds += frame_seconds;
+    for (i = 0; i < NBUCKETS; ++i) {
+        if (frame_seconds <= buckets[i]) {
+            live.frame_buckets[i]++;
+            break;
+        }
+    }
+    live.swap_seconds += swap_seconds;
+    live.dropped += dropped != 0;
+    live.gpu_bytes = gpu_bytes;
+    live.gpu_objects = gpu_objects;
+    publish();
+}
+
+void metrics_stop(void){
+    if (!running)
+        return;
+
+    /* the last frames must not be lost to a busy exporter */
+    pthread_mutex_lock(&snapshot_lock);
+    snapshot = live;
+    pthread_mutex_unlock(&snapshot_lock);
+
+    if (write(wake[1], "", 1) != 1)
+        warning("Unable to stop metrics exporter.\n");
+    pthread_join(thread, NULL);
+    close(wake[0]);
+    close(wake[1]);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    running = false;
+}
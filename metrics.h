@@ -0,0 +1,13 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Prometheus text exposition of the render loop's counters. The render
+ * thread updates its own copy and hands a snapshot over only when the
+ * exporter is not holding it, so it never waits; the exporter thread
+ * rewrites a textfile collector file and answers UNIX socket clients.
+*/
+void metrics_start(const char *file, const char *socket_path);
+void metrics_compile(double seconds);
+void metrics_frame(double frame_seconds, double swap_seconds, int dropped,
+        size_t gpu_bytes, size_t gpu_objects);
+void metrics_stop(void);
@@ -0,0 +1,66 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "output.h"
+#include "util.h"
+
+void output_open(struct output *out, const char *path, int width, int height, int fps){
+    if (!(out->fp = fopen(path, "wb")))
+        die("Unable to open output file %s.\n", path);
+
+    out->width = width;
+    out->height = height;
+    if (!(out->planes = malloc((size_t)width * height * 3)))
+        die("Unable to allocate output frame.\n");
+
+    fprintf(out->fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+}
+
+/*
+ * BT.601 studio swing, 8 bit fixed point. The GL origin is the bottom
+ * left corner, so rows are flipped on the way.
+*/
+void output_write(struct output *out, const unsigned char *rgba){
+    size_t n = (size_t)out->width * out->height;
+    unsigned char *y = out->planes, *u = y + n, *v = u + n;
+    const unsigned char *p;
+    int r, g, b, row, col;
+
+    for (row = out->height - 1; row >= 0; --row) {
+        p = rgba + (size_t)row * out->width * 4;
+        for (col = 0; col < out->width; ++col, p += 4) {
+            r = p[0];
+            g = p[1];
+            b = p[2];
+            *y++ = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            *u++ = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            *v++ = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    fputs("FRAME\n", out->fp);
+    if (fwrite(out->planes, 1, n * 3, out->fp) != n * 3)
+        die("Error writing output frame.\n");
+}
+
+/*
+ * Write the last frame again without converting it. The stream format
+ * wants every frame in full, so only the XDUP frame parameter, which
+ * readers skip, tells it apart.
+*/
+void output_repeat(struct output *out){
+    size_t n = (size_t)out->width * out->height * 3;
+
+    fputs("FRAME XDUP\n", out->fp);
+    if (fwrite(out->planes, 1, n, out->fp) != n)
+        die("Error writing output frame.\n");
+}
+
+void output_close(struct output *out){
+    if (out->fp)
+        fclose(out->fp);
+    free(out->planes);
+    out->fp = NULL;
+    out->planes = NULL;
+}
@@ -0,0 +1,17 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * YUV4MPEG2 stream writer. Frames are handed over as bottom-up RGBA8
+ * rows straight from glReadPixels and written as 4:4:4 planes.
+*/
+struct output {
+    FILE *fp;
+    int width;
+    int height;
+    unsigned char *planes;
+};
+
+void output_open(struct output *out, const char *path, int width, int height, int fps);
+void output_write(struct output *out, const unsigned char *rgba);
+void output_repeat(struct output *out);
+void output_close(struct output *out);
@@ -0,0 +1,273 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "etc1.h"
+#include "image.h"
+#include "pack.h"
+#include "util.h"
+
+const char *pack_format_names[PACK_FORMAT_LAST] = {
+    [PACK_RGBA8] = "rgba8",
+    [PACK_RGB565] = "rgb565",
+    [PACK_ETC1] = "etc1",
+};
+
+int pack_format(const char *name){
+    int i;
+
+    for (i = 0; i < PACK_FORMAT_LAST; ++i)
+        if (!strcmp(name, pack_format_names[i]))
+            return i;
+
+    return -1;
+}
+
+size_t pack_level_size(int format, uint32_t width, uint32_t height){
+    switch (format) {
+        case PACK_RGBA8:
+            return (size_t)width * height * 4;
+        case PACK_RGB565:
+            return (size_t)width * height * 2;
+        case PACK_ETC1:
+            return etc1_size(width, height);
+        default:
+            return 0;
+    }
+}
+
+static int pack_valid(const struct pack *pack){
+    const struct pack_entry *e;
+    const struct pack_level *l;
+    uint32_t i, j;
+
+    for (i = 0; i < pack->count; ++i) {
+        e = &pack->entries[i];
+        if (e->format >= PACK_FORMAT_LAST || e->levels == 0 || e->levels > PACK_MAX_LEVELS)
+            return 0;
+        if (memchr(e->name, '\0', PACK_NAME_MAX) == NULL)
+            return 0;
+        for (j = 0; j < e->levels; ++j) {
+            l = &e->level[j];
+            if (l->size != pack_level_size(e->format, l->width, l->height))
+                return 0;
+            if (l->offset > pack->size || l->size > pack->size - l->offset)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Map a pack read-only. Returns 0 on success and -1 when the file cannot
+ * be mapped or is not a well formed pack.
+*/
+int pack_open(struct pack *pack, const char *path){
+    const struct pack_header *h;
+    struct stat st;
+    void *data;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    pack->data = data;
+    pack->size = st.st_size;
+    h = data;
+    pack->count = h->count;
+    pack->entries = (const struct pack_entry *)(h + 1);
+
+    if (memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) || h->byte_order != PACK_BYTE_ORDER ||
+            pack->count > (pack->size - sizeof(*h)) / sizeof(struct pack_entry) ||
+            !pack_valid(pack)) {
+        pack_close(pack);
+        return -1;
+    }
+
+    return 0;
+}
+
+const struct pack_entry *pack_find(const struct pack *pack, const char *name){
+    uint32_t i;
+
+    for (i = 0; i < pack->count; ++i)
+        if (!name || !strcmp(pack->entries[i].name, name))
+            return &pack->entries[i];
+
+    return NULL;
+}
+
+void pack_close(struct pack *pack){
+    if (pack->data)
+        munmap((void *)pack->data, pack->size);
+    pack->data = NULL;
+    pack->entries = NULL;
+    pack->count = 0;
+}
+
+/* 2x2 box filter; odd edges reuse their last row or column. */
+static unsigned char *downsample(const unsigned char *src, uint32_t w, uint32_t h,
+        uint32_t dw, uint32_t dh){
+    unsigned char *dst = malloc((size_t)dw * dh * 4);
+    uint32_t x, y, x0, x1, y0, y1;
+    int c;
+
+    if (!dst)
+        die("Unable to allocate mipmap level.\n");
+
+    for (y = 0; y < dh; ++y) {
+        y0 = y * 2 < h ? y * 2 : h - 1;
+        y1 = y * 2 + 1 < h ? y * 2 + 1 : h - 1;
+        for (x = 0; x < dw; ++x) {
+            x0 = x * 2 < w ? x * 2 : w - 1;
+            x1 = x * 2 + 1 < w ? x * 2 + 1 : w - 1;
+            for (c = 0; c < 4; ++c)
+                dst[((size_t)y * dw + x) * 4 + c] = (unsigned char)((
+                    src[((size_t)y0 * w + x0) * 4 + c] + src[((size_t)y0 * w + x1) * 4 + c] +
+                    src[((size_t)y1 * w + x0) * 4 + c] + src[((size_t)y1 * w + x1) * 4 + c] + 2) / 4);
+        }
+    }
+
+    return dst;
+}
+
+static void convert(int format, const unsigned char *rgba, uint32_t w, uint32_t h,
+        unsigned char *out, int threads){
+    size_t i, n = (size_t)w * h;
+    unsigned int r, g, b;
+
+    switch (format) {
+        case PACK_RGBA8:
+            memcpy(out, rgba, n * 4);
+            break;
+        case PACK_RGB565:
+            for (i = 0; i < n; ++i, rgba += 4) {
+                r = (rgba[0] * 31 + 127) / 255;
+                g = (rgba[1] * 63 + 127) / 255;
+                b = (rgba[2] * 31 + 127) / 255;
+                out[i * 2] = (unsigned char)(g << 5 | b);
+                out[i * 2 + 1] = (unsigned char)(r << 3 | g >> 3);
+            }
+            break;
+        case PACK_ETC1:
+            etc1_encode(rgba, w, h, out, threads);
+            break;
+    }
+}
+
+static uint64_t align(uint64_t v, uint64_t a){
+    return (v + a - 1) / a * a;
+}
+
+static int pad(FILE *fp, uint64_t to){
+    long pos = ftell(fp);
+
+    while (pos >= 0 && (uint64_t)pos++ < to)
+        if (fputc(0, fp) == EOF)
+            return -1;
+
+    return pos < 0 ? -1 : 0;
+}
+
+/*
+ * Write images as a pack in the given format, each with a full mipmap
+ * chain down to 1x1 when mipmaps is set. Returns 0 on success and -1 on
+ * write errors or when a mipmapped image exceeds PACK_MAX_SIZE.
+*/
+int pack_write(const char *path, const char *const *names, const struct image *images,
+        uint32_t count, int format, int mipmaps, int threads){
+    struct pack_header header;
+    struct pack_entry *entries;
+    unsigned char *level, *next, *payload;
+    uint32_t i, j, w, h;
+    uint64_t offset;
+    int ret = 0;
+    FILE *fp;
+
+    for (i = 0; i < count; ++i)
+        if (mipmaps && (images[i].width > PACK_MAX_SIZE || images[i].height > PACK_MAX_SIZE))
+            return -1;
+
+    if (!(entries = calloc(count, sizeof(*entries))))
+        die("Unable to allocate pack index.\n");
+
+    offset = align(sizeof(header) + (uint64_t)count * sizeof(*entries), PACK_PAGE);
+    for (i = 0; i < count; ++i) {
+        strncpy(entries[i].name, names[i], PACK_NAME_MAX - 1);
+        entries[i].format = format;
+        w = images[i].width;
+        h = images[i].height;
+        for (j = 0; j < PACK_MAX_LEVELS; ++j) {
+            entries[i].level[j].width = w;
+            entries[i].level[j].height = h;
+            entries[i].level[j].offset = offset;
+            entries[i].level[j].size = pack_level_size(format, w, h);
+            offset = align(offset + entries[i].level[j].size, PACK_LEVEL_ALIGN);
+            entries[i].levels = j + 1;
+            if (!mipmaps || (w == 1 && h == 1))
+                break;
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+        }
+        offset = align(offset, PACK_PAGE);
+    }
+
+    if (!(fp = fopen(path, "wb"))) {
+        free(entries);
+        return -1;
+    }
+
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.count = count;
+    header.byte_order = PACK_BYTE_ORDER;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+            fwrite(entries, sizeof(*entries), count, fp) != count)
+        ret = -1;
+
+    for (i = 0; i < count && ret == 0; ++i) {
+        level = images[i].rgba;
+        for (j = 0; j < entries[i].levels && ret == 0; ++j) {
+            const struct pack_level *l = &entries[i].level[j];
+
+            if (!(payload = malloc(l->size)))
+                die("Unable to allocate pack payload.\n");
+            convert(format, level, l->width, l->height, payload, threads);
+            if (pad(fp, l->offset) || fwrite(payload, 1, l->size, fp) != l->size)
+                ret = -1;
+            free(payload);
+
+            if (j + 1 < entries[i].levels) {
+                next = downsample(level, l->width, l->height,
+                        entries[i].level[j + 1].width, entries[i].level[j + 1].height);
+                if (level != images[i].rgba)
+                    free(level);
+                level = next;
+            }
+        }
+        if (level != images[i].rgba)
+            free(level);
+    }
+    if (ret == 0 && pad(fp, offset))
+        ret = -1;
+
+    if (fclose(fp))
+        ret = -1;
+    free(entries);
+    return ret;
+}
@@ -0,0 +1,60 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Texture packs hold textures in the exact layout GL wants them, so a
+ * channel can be uploaded straight out of a read-only mapping of the
+ * file. A pack is a header, a table of entries and the payloads; every
+ * entry starts on a page boundary and its levels follow each other,
+ * largest first, each padded to PACK_LEVEL_ALIGN. Rows are stored bottom
+ * up and tightly packed. Integers are in the byte order of the host that
+ * wrote the pack, so the structs can be used in place; the header holds
+ * the byte order mark 0x01020304 and packs from a host of the other
+ * order are refused. A full mipmap chain fits PACK_MAX_LEVELS levels, so
+ * mipmapped images are at most PACK_MAX_SIZE pixels wide and high.
+*/
+#define PACK_MAGIC "ESSPACK1"
+#define PACK_BYTE_ORDER 0x01020304
+#define PACK_PAGE 4096
+#define PACK_LEVEL_ALIGN 64
+#define PACK_MAX_LEVELS 16
+#define PACK_MAX_SIZE (1u << (PACK_MAX_LEVELS - 1))
+#define PACK_NAME_MAX 56
+
+enum { PACK_RGBA8, PACK_RGB565, PACK_ETC1, PACK_FORMAT_LAST };
+
+struct pack_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t byte_order;
+};
+
+struct pack_level {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct pack_entry {
+    char name[PACK_NAME_MAX];
+    uint32_t format;
+    uint32_t levels;
+    struct pack_level level[PACK_MAX_LEVELS];
+};
+
+struct pack {
+    const unsigned char *data;
+    size_t size;
+    const struct pack_entry *entries;
+    uint32_t count;
+};
+
+extern const char *pack_format_names[PACK_FORMAT_LAST];
+
+int pack_format(const char *name);
+size_t pack_level_size(int format, uint32_t width, uint32_t height);
+int pack_open(struct pack *pack, const char *path);
+int pack_write(const char *path, const char *const *names, const struct image *images,
+        uint32_t count, int format, int mipmaps, int threads);
+const struct pack_entry *pack_find(const struct pack *pack, const char *name);
+void pack_close(struct pack *pack);
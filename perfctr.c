@@ -0,0 +1,153 @@
+/* See LICENSE file for copyright and license details. */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+#include "util.h"
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llc-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+#define NEVENTS (int)(sizeof(events) / sizeof(*events))
+
+/* with PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING */
+struct reading {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+};
+
+static int fds[NEVENTS];
+static struct reading last[NEVENTS];
+static double total[NEVENTS];
+static double min[NEVENTS];
+static double max[NEVENTS];
+static long frames;
+static FILE *log_fp;
+
+/*
+ * Inherited counters cannot be read as a group, so every counter is its
+ * own event and read separately. Each value is scaled by enabled/running
+ * to make up for time the kernel had it multiplexed out.
+*/
+static int open_event(int i){
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.inherit = 1;
+    /* context switches only ever happen in the kernel */
+    attr.exclude_kernel = events[i].type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static double read_delta(int i){
+    struct reading r;
+    double value;
+
+    if (fds[i] < 0 || read(fds[i], &r, sizeof(r)) != sizeof(r))
+        return 0.0;
+
+    value = (double)(r.value - last[i].value);
+    if (r.running > last[i].running && r.running - last[i].running < r.enabled - last[i].enabled)
+        value *= (double)(r.enabled - last[i].enabled) / (r.running - last[i].running);
+    last[i] = r;
+
+    return value;
+}
+
+/* Returns the number of counters the kernel let us open. */
+int perfctr_open(const char *log_path){
+    int i, n = 0;
+
+    for (i = 0; i < NEVENTS; ++i) {
+        if ((fds[i] = open_event(i)) < 0) {
+            warning("Unable to count %s: %s.\n", events[i].name, strerror(errno));
+            continue;
+        }
+        read_delta(i);
+        n++;
+    }
+    if (!n)
+        return 0;
+
+    if (log_path) {
+        if (!(log_fp = fopen(log_path, "w")))
+            die("Unable to open counter log %s.\n", log_path);
+        fputs("frame", log_fp);
+        for (i = 0; i < NEVENTS; ++i)
+            fprintf(log_fp, ",%s", events[i].name);
+        fputc('\n', log_fp);
+    }
+
+    return n;
+}
+
+void perfctr_frame(long frame){
+    double value;
+    int i;
+
+    if (log_fp)
+        fprintf(log_fp, "%ld", frame);
+    for (i = 0; i < NEVENTS; ++i) {
+        value = read_delta(i);
+        total[i] += value;
+        if (!frames || value < min[i])
+            min[i] = value;
+        if (!frames || value > max[i])
+            max[i] = value;
+        if (log_fp)
+            fprintf(log_fp, ",%.0f", value);
+    }
+    if (log_fp)
+        fputc('\n', log_fp);
+    frames++;
+}
+
+void perfctr_report(void){
+    int i;
+
+    if (!frames)
+        return;
+
+    log_report_begin();
+    info("Counters over %ld frames:   total      per frame (min, max)\n", frames);
+    for (i = 0; i < NEVENTS; ++i)
+        if (fds[i] >= 0)
+            info("  %-16s %14.0f %14.0f (%.0f, %.0f)\n", events[i].name,
+                    total[i], total[i] / frames, min[i], max[i]);
+    if (fds[0] >= 0 && fds[1] >= 0 && total[0] > 0.0)
+        info("  %.2f instructions per cycle\n", total[1] / total[0]);
+    log_report_end();
+}
+
+void perfctr_close(void){
+    int i;
+
+    for (i = 0; i < NEVENTS; ++i)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    if (log_fp)
+        fclose(log_fp);
+    log_fp = NULL;
+}
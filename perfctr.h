@@ -0,0 +1,12 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Per-frame hardware and software counters from perf_event_open. The
+ * counters follow every thread of the process, including the rasteriser
+ * threads of a software GL driver, as long as they are opened before the
+ * driver spawns them.
+*/
+int perfctr_open(const char *log_path);
+void perfctr_frame(long frame);
+void perfctr_report(void);
+void perfctr_close(void);
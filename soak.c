@@ -0,0 +1,157 @@
+/* See LICENSE file for copyright and license details. */
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "gpumem.h"
+#include "soak.h"
+#include "util.h"
+
+/* new highs a metric needs since the baseline before it counts as a leak */
+#define SOAK_RISES 5
+/* and the last of them must be this recent, in samples */
+#define SOAK_RECENT 3
+
+enum {
+    SOAK_RSS,
+    SOAK_FDS,
+    SOAK_GL_OBJECTS,
+    SOAK_GL_BYTES,
+    SOAK_FRAME_TIME,
+    SOAK_LAST
+};
+
+struct metric {
+    const char *name;
+    const char *unit;
+    double relative;        /* growth tolerated over the baseline */
+    double absolute;
+    double base;
+    double max;
+    int rises;
+    int since_rise;
+    bool flagged;
+};
+
+static struct metric metrics[SOAK_LAST] = {
+    [SOAK_RSS] = { "rss", "KiB", 0.10, 4096.0 },
+    [SOAK_FDS] = { "fds", "", 0.0, 2.0 },
+    [SOAK_GL_OBJECTS] = { "gl objects", "", 0.0, 2.0 },
+    [SOAK_GL_BYTES] = { "gl memory", "KiB", 0.05, 256.0 },
+    [SOAK_FRAME_TIME] = { "frame time", "ms", 0.25, 0.5 },
+};
+
+static double interval;
+static double next_sample;
+static double last_elapsed;
+static long last_frames;
+static unsigned long samples;
+
+static double rss_kib(void){
+    unsigned long size, resident = 0;
+    FILE *fp;
+
+    if (!(fp = fopen("/proc/self/statm", "r")))
+        return 0.0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+
+    return (double)resident * sysconf(_SC_PAGESIZE) / 1024.0;
+}
+
+static double open_fds(void){
+    struct dirent *de;
+    DIR *dir;
+    int n = 0;
+
+    if (!(dir = opendir("/proc/self/fd")))
+        return 0.0;
+    while ((de = readdir(dir)))
+        if (de->d_name[0] != '.')
+            n++;
+    closedir(dir);
+
+    /* not counting the descriptor readdir itself holds */
+    return n - 1;
+}
+
+static void update(struct metric *m, double value){
+    if (samples == 2) {
+        m->base = m->max = value;
+        return;
+    }
+
+    m->since_rise++;
+    if (value > m->max) {
+        m->max = value;
+        m->rises++;
+        m->since_rise = 0;
+    }
+
+    if (!m->flagged && m->rises >= SOAK_RISES && m->since_rise < SOAK_RECENT &&
+            m->max > m->base * (1.0 + m->relative) + m->absolute) {
+        m->flagged = true;
+        warning("soak: %s keeps growing, %.1f %s now against %.1f %s after warm-up.\n",
+                m->name, m->max, m->unit, m->base, m->unit);
+    }
+}
+
+void soak_start(double seconds){
+    interval = seconds;
+    next_sample = seconds;
+}
+
+int soak_due(double elapsed){
+    return interval > 0.0 && elapsed >= next_sample;
+}
+
+/*
+ * The first sample only marks the end of warm-up, when lazily created
+ * textures and driver caches have settled; growth is measured from the
+ * second one on.
+*/
+void soak_sample(double elapsed, long frames){
+    double values[SOAK_LAST];
+    int i;
+
+    values[SOAK_RSS] = rss_kib();
+    values[SOAK_FDS] = open_fds();
+    values[SOAK_GL_OBJECTS] = (double)gpumem_count();
+    values[SOAK_GL_BYTES] = gpumem_total() / 1024.0;
+    values[SOAK_FRAME_TIME] = frames > last_frames ?
+        (elapsed - last_elapsed) * 1000.0 / (frames - last_frames) : 0.0;
+
+    info("soak: %.1fs rss %.0f KiB, %.0f fds, %.0f gl objects, %.0f KiB gl, %.2f ms/frame\n",
+            elapsed, values[SOAK_RSS], values[SOAK_FDS], values[SOAK_GL_OBJECTS],
+            values[SOAK_GL_BYTES], values[SOAK_FRAME_TIME]);
+
+    if (++samples >= 2)
+        for (i = 0; i < SOAK_LAST; ++i)
+            update(&metrics[i], values[i]);
+
+    last_elapsed = elapsed;
+    last_frames = frames;
+    next_sample = elapsed + interval;
+}
+
+/* Returns how many metrics were flagged as leaking. */
+int soak_finish(void){
+    int i, leaks = 0;
+
+    if (interval <= 0.0)
+        return 0;
+
+    for (i = 0; i < SOAK_LAST; ++i) {
+        if (!metrics[i].flagged)
+            continue;
+        info("soak: %s grew from %.1f to %.1f %s.\n", metrics[i].name,
+                metrics[i].base, metrics[i].max, metrics[i].unit);
+        leaks++;
+    }
+    info("soak: %lu samples, %s.\n", samples, leaks ? "leaks found" : "no growth found");
+
+    return leaks;
+}
@@ -0,0 +1,11 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Soak testing: sample process and GL resource usage at a fixed interval
+ * and flag anything that keeps climbing past where it settled after the
+ * first interval. Each sample is reported as one line.
+*/
+void soak_start(double interval);
+int soak_due(double elapsed);
+void soak_sample(double elapsed, long frames);
+int soak_finish(void);
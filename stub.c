@@ -0,0 +1,323 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Stand-ins for the Xlib, EGL and OpenGL ES entry points esshader uses,
+ * linked in place of the real libraries by "make bench". Every call is
+ * counted and returns at once, so what is left of a frame is esshader's
+ * own CPU work. Frames are timed from one eglSwapBuffers() to the next
+ * and reported by eglTerminate(). There is no X server behind it, only
+ * --headless runs.
+ *
+ * BENCHMAXNS and BENCHMAXCALLS in the environment set the most
+ * nanoseconds and calls a frame may average; eglTerminate() exits with
+ * an error status when either is exceeded.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <EGL/egl.h>
+#ifdef GLES3
+#include <GLES3/gl3.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+#include <X11/Xutil.h>
+
+struct counter {
+    const char *name;
+    unsigned long calls;
+    int listed;
+    struct counter *next;
+};
+
+static struct counter *counters;
+static int ncounters;
+
+/* frames are counted between the first and the last swap */
+static struct {
+    long swaps;
+    struct timespec first;
+    struct timespec last;
+    long long min_ns;
+    long long max_ns;
+} frames;
+
+/* opaque handles only need to be distinct and not NULL */
+static char display, config, context, surface;
+static EGLContext current = EGL_NO_CONTEXT;
+static GLuint names;
+static GLint locations;
+#ifdef GLES3
+static void *mapped;
+static size_t mapped_size;
+#endif
+
+#define COUNT() do { \
+    static struct counter c = { __func__, 0, 0, NULL }; \
+    count(&c); \
+} while (0)
+
+static void count(struct counter *c){
+    if (!c->listed) {
+        c->listed = 1;
+        c->next = counters;
+        counters = c;
+        ncounters++;
+    }
+    c->calls++;
+}
+
+static long long nanoseconds(const struct timespec *from, const struct timespec *to){
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+}
+
+static int by_calls(const void *a, const void *b){
+    const struct counter *ca = *(struct counter *const *)a, *cb = *(struct counter *const *)b;
+
+    return ca->calls < cb->calls ? 1 : ca->calls > cb->calls ? -1 : strcmp(ca->name, cb->name);
+}
+
+/* Returns the number of limits exceeded. */
+static int report(void){
+    struct counter **sorted, *c;
+    unsigned long total = 0;
+    long n = frames.swaps - 1;
+    long long ns;
+    const char *env;
+    int i = 0, failed = 0;
+
+    if (n <= 0) {
+        fprintf(stderr, "stub: fewer than two frames, nothing to report\n");
+        return 0;
+    }
+    if (!(sorted = malloc(ncounters * sizeof(*sorted))))
+        return 0;
+    for (c = counters; c; c = c->next) {
+        sorted[i++] = c;
+        total += c->calls;
+    }
+    qsort(sorted, ncounters, sizeof(*sorted), by_calls);
+
+    ns = nanoseconds(&frames.first, &frames.last) / n;
+    fprintf(stderr, "stub: %ld frames, %lld ns/frame (min %lld, max %lld), %.2f calls/frame\n",
+            n, ns, frames.min_ns, frames.max_ns, (double)total / n);
+    for (i = 0; i < ncounters; ++i)
+        if (sorted[i]->calls >= (unsigned long)n / 100)
+            fprintf(stderr, "stub: %8.2f %s\n", (double)sorted[i]->calls / n, sorted[i]->name);
+    free(sorted);
+
+    if ((env = getenv("BENCHMAXNS")) && *env && ns > atof(env)) {
+        fprintf(stderr, "stub: %lld ns/frame is over BENCHMAXNS=%s\n", ns, env);
+        failed++;
+    }
+    if ((env = getenv("BENCHMAXCALLS")) && *env && (double)total / n > atof(env)) {
+        fprintf(stderr, "stub: %.2f calls/frame is over BENCHMAXCALLS=%s\n", (double)total / n, env);
+        failed++;
+    }
+    return failed;
+}
+
+/* Calls made before the first frame are startup and not reported. */
+static void frame_done(void){
+    struct timespec now;
+    struct counter *c;
+    long long ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (frames.swaps++ == 0) {
+        frames.first = now;
+        frames.min_ns = -1;
+        for (c = counters; c; c = c->next)
+            c->calls = 0;
+    } else {
+        ns = nanoseconds(&frames.last, &now);
+        if (frames.min_ns < 0 || ns < frames.min_ns)
+            frames.min_ns = ns;
+        if (ns > frames.max_ns)
+            frames.max_ns = ns;
+    }
+    frames.last = now;
+}
+
+static GLint status(GLenum pname){
+    return pname == GL_COMPILE_STATUS || pname == GL_LINK_STATUS ||
+        pname == GL_VALIDATE_STATUS ? GL_TRUE : 0;
+}
+
+/* Xlib */
+
+Display *XOpenDisplay(const char *name){ COUNT(); return NULL; }
+int XCloseDisplay(Display *dpy){ COUNT(); return 0; }
+int XPending(Display *dpy){ COUNT(); return 0; }
+int XNextEvent(Display *dpy, XEvent *ev){ COUNT(); memset(ev, 0, sizeof(*ev)); return 0; }
+KeySym XLookupKeysym(XKeyEvent *ev, int index){ COUNT(); return NoSymbol; }
+int XResizeWindow(Display *dpy, Window w, unsigned int width, unsigned int height){ COUNT(); return 0; }
+Status XGetWindowAttributes(Display *dpy, Window w, XWindowAttributes *attr){ COUNT(); return 0; }
+Colormap XCreateColormap(Display *dpy, Window w, Visual *visual, int alloc){ COUNT(); return 0; }
+Window XCreateWindow(Display *dpy, Window parent, int x, int y, unsigned int width,
+        unsigned int height, unsigned int border, int depth, unsigned int class,
+        Visual *visual, unsigned long mask, XSetWindowAttributes *attr){ COUNT(); return 0; }
+int XFree(void *data){ COUNT(); return 0; }
+XVisualInfo *XGetVisualInfo(Display *dpy, long mask, XVisualInfo *tmpl, int *n){ COUNT(); *n = 0; return NULL; }
+Bool XkbSetDetectableAutoRepeat(Display *dpy, Bool detectable, Bool *supported){ COUNT(); return False; }
+int XStoreName(Display *dpy, Window w, const char *name){ COUNT(); return 0; }
+int XMapWindow(Display *dpy, Window w){ COUNT(); return 0; }
+int XFlush(Display *dpy){ COUNT(); return 0; }
+int XDestroyWindow(Display *dpy, Window w){ COUNT(); return 0; }
+int XFreeColormap(Display *dpy, Colormap cmap){ COUNT(); return 0; }
+
+/* EGL */
+
+EGLDisplay eglGetDisplay(EGLNativeDisplayType id){ COUNT(); return &display; }
+EGLBoolean eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor){ COUNT(); return EGL_TRUE; }
+EGLBoolean eglBindAPI(EGLenum api){ COUNT(); return EGL_TRUE; }
+const char *eglQueryString(EGLDisplay dpy, EGLint name){ COUNT(); return ""; }
+__eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *name){ COUNT(); return NULL; }
+
+EGLBoolean eglChooseConfig(EGLDisplay dpy, const EGLint *attribs, EGLConfig *configs,
+        EGLint size, EGLint *n){
+    COUNT();
+    if (configs && size > 0)
+        configs[0] = &config;
+    *n = 1;
+    return EGL_TRUE;
+}
+
+EGLBoolean eglGetConfigAttrib(EGLDisplay dpy, EGLConfig cfg, EGLint attr, EGLint *value){ COUNT(); *value = 0; return EGL_TRUE; }
+EGLContext eglCreateContext(EGLDisplay dpy, EGLConfig cfg, EGLContext share, const EGLint *attribs){ COUNT(); return &context; }
+EGLSurface eglCreatePbufferSurface(EGLDisplay dpy, EGLConfig cfg, const EGLint *attribs){ COUNT(); return &surface; }
+EGLSurface eglCreateWindowSurface(EGLDisplay dpy, EGLConfig cfg, EGLNativeWindowType win,
+        const EGLint *attribs){ COUNT(); return &surface; }
+EGLBoolean eglDestroyContext(EGLDisplay dpy, EGLContext ctx){ COUNT(); return EGL_TRUE; }
+EGLBoolean eglDestroySurface(EGLDisplay dpy, EGLSurface s){ COUNT(); return EGL_TRUE; }
+EGLContext eglGetCurrentContext(void){ COUNT(); return current; }
+
+EGLBoolean eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx){
+    COUNT();
+    current = ctx;
+    return EGL_TRUE;
+}
+
+EGLBoolean eglSwapBuffers(EGLDisplay dpy, EGLSurface s){
+    COUNT();
+    frame_done();
+    return EGL_TRUE;
+}
+
+EGLBoolean eglTerminate(EGLDisplay dpy){
+    COUNT();
+    if (report())
+        exit(EXIT_FAILURE);
+    return EGL_TRUE;
+}
+
+/* OpenGL ES */
+
+void glActiveTexture(GLenum texture){ COUNT(); }
+void glAttachShader(GLuint program, GLuint shader){ COUNT(); }
+void glBindBuffer(GLenum target, GLuint buffer){ COUNT(); }
+void glBindFramebuffer(GLenum target, GLuint framebuffer){ COUNT(); }
+void glBindTexture(GLenum target, GLuint texture){ COUNT(); }
+void glBlendFunc(GLenum sfactor, GLenum dfactor){ COUNT(); }
+void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage){ COUNT(); }
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data){ COUNT(); }
+GLenum glCheckFramebufferStatus(GLenum target){ COUNT(); return GL_FRAMEBUFFER_COMPLETE; }
+void glClear(GLbitfield mask){ COUNT(); }
+void glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a){ COUNT(); }
+void glCompileShader(GLuint shader){ COUNT(); }
+void glCompressedTexImage2D(GLenum target, GLint level, GLenum format, GLsizei width,
+        GLsizei height, GLint border, GLsizei size, const void *data){ COUNT(); }
+GLuint glCreateProgram(void){ COUNT(); return ++names; }
+GLuint glCreateShader(GLenum type){ COUNT(); return ++names; }
+void glDeleteBuffers(GLsizei n, const GLuint *buffers){ COUNT(); }
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers){ COUNT(); }
+void glDeleteProgram(GLuint program){ COUNT(); }
+void glDeleteShader(GLuint shader){ COUNT(); }
+void glDeleteTextures(GLsizei n, const GLuint *textures){ COUNT(); }
+void glDisable(GLenum cap){ COUNT(); }
+void glDisableVertexAttribArray(GLuint index){ COUNT(); }
+void glDrawArrays(GLenum mode, GLint first, GLsizei n){ COUNT(); }
+void glEnable(GLenum cap){ COUNT(); }
+void glEnableVertexAttribArray(GLuint index){ COUNT(); }
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget,
+        GLuint texture, GLint level){ COUNT(); }
+void glGenerateMipmap(GLenum target){ COUNT(); }
+GLint glGetAttribLocation(GLuint program, const GLchar *name){ COUNT(); return 0; }
+GLenum glGetError(void){ COUNT(); return GL_NO_ERROR; }
+void glGetIntegerv(GLenum pname, GLint *data){ COUNT(); *data = 0; }
+void glGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *len, GLchar *log){ COUNT(); if (len) *len = 0; if (size > 0) *log = '\0'; }
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params){ COUNT(); *params = status(pname); }
+void glGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *len, GLchar *log){ COUNT(); if (len) *len = 0; if (size > 0) *log = '\0'; }
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params){ COUNT(); *params = status(pname); }
+const GLubyte *glGetString(GLenum name){ COUNT(); return (const GLubyte *)""; }
+/* distinct locations keep every uniform upload in the measured path */
+GLint glGetUniformLocation(GLuint program, const GLchar *name){ COUNT(); return locations++; }
+void glLinkProgram(GLuint program){ COUNT(); }
+void glPixelStorei(GLenum pname, GLint param){ COUNT(); }
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+        GLenum type, void *pixels){ COUNT(); }
+void glReleaseShaderCompiler(void){ COUNT(); }
+void glShaderSource(GLuint shader, GLsizei n, const GLchar *const *string, const GLint *length){ COUNT(); }
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width,
+        GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels){ COUNT(); }
+void glTexParameteri(GLenum target, GLenum pname, GLint param){ COUNT(); }
+void glTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width,
+        GLsizei height, GLenum format, GLenum type, const void *pixels){ COUNT(); }
+void glUniform1f(GLint location, GLfloat v0){ COUNT(); }
+void glUniform1fv(GLint location, GLsizei n, const GLfloat *value){ COUNT(); }
+void glUniform1i(GLint location, GLint v0){ COUNT(); }
+void glUniform2f(GLint location, GLfloat v0, GLfloat v1){ COUNT(); }
+void glUniform2fv(GLint location, GLsizei n, const GLfloat *value){ COUNT(); }
+void glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2){ COUNT(); }
+void glUniform3fv(GLint location, GLsizei n, const GLfloat *value){ COUNT(); }
+void glUniform4fv(GLint location, GLsizei n, const GLfloat *value){ COUNT(); }
+void glUseProgram(GLuint program){ COUNT(); }
+void glValidateProgram(GLuint program){ COUNT(); }
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+        GLsizei stride, const void *pointer){ COUNT(); }
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height){ COUNT(); }
+
+void glGenBuffers(GLsizei n, GLuint *buffers){
+    COUNT();
+    while (n-- > 0)
+        *buffers++ = ++names;
+}
+
+void glGenFramebuffers(GLsizei n, GLuint *framebuffers){
+    COUNT();
+    while (n-- > 0)
+        *framebuffers++ = ++names;
+}
+
+void glGenTextures(GLsizei n, GLuint *textures){
+    COUNT();
+    while (n-- > 0)
+        *textures++ = ++names;
+}
+
+#ifdef GLES3
+void glBindBufferBase(GLenum target, GLuint index, GLuint buffer){ COUNT(); }
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout){ COUNT(); return GL_ALREADY_SIGNALED; }
+void glDeleteSync(GLsync sync){ COUNT(); }
+GLsync glFenceSync(GLenum condition, GLbitfield flags){ COUNT(); return (GLsync)&surface; }
+GLuint glGetUniformBlockIndex(GLuint program, const GLchar *name){ COUNT(); return 0; }
+void glUniformBlockBinding(GLuint program, GLuint index, GLuint binding){ COUNT(); }
+GLboolean glUnmapBuffer(GLenum target){ COUNT(); return GL_TRUE; }
+
+/* readbacks copy out of the mapping, so it has to be real memory */
+void *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access){
+    void *p;
+
+    COUNT();
+    if ((size_t)length > mapped_size) {
+        if (!(p = realloc(mapped, length)))
+            return NULL;
+        mapped = p;
+        mapped_size = length;
+    }
+    return mapped;
+}
+#endif
@@ -0,0 +1,144 @@
+/* See LICENSE file for copyright and license details. */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "sync.h"
+#include "util.h"
+
+/* how long a wait goes before it is logged */
+#define SYNC_PATIENCE_SECONDS 2
+
+/* Lives in the segment, zeroed by whoever creates it */
+struct group {
+    uint32_t instances;
+    uint32_t joined;
+    uint32_t members;       /* still attached, the last out removes the segment */
+    uint32_t started;       /* futex: start is set */
+    uint32_t arrived;       /* at the current barrier */
+    uint32_t generation;    /* futex: barriers passed */
+    uint32_t closing;       /* an instance left, barriers are off */
+    int64_t start;          /* CLOCK_MONOTONIC, nanoseconds */
+    int64_t time;           /* stamped at the last barrier, nanoseconds since start */
+};
+
+static struct group *group;
+static char path[256];
+static int index_in_group;
+static int barrier_enabled;
+static int64_t start_ns;
+
+static int64_t now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Waits while *word holds value; 0 once the patience ran out */
+static int futex_wait(uint32_t *word, uint32_t value){
+    struct timespec timeout = { SYNC_PATIENCE_SECONDS, 0 };
+
+    if (syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0) < 0 && errno == ETIMEDOUT)
+        return 0;
+    return 1;
+}
+
+static void futex_wake(uint32_t *word){
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void sync_join(const char *name, int instances, int barrier, struct timespec *start){
+    uint32_t expected = 0, joined;
+    int fd;
+
+    if (strchr(name, '/') || snprintf(path, sizeof(path), "/esshader-%s", name) >= (int)sizeof(path))
+        die("Invalid sync group name %s.\n", name);
+    if ((fd = shm_open(path, O_RDWR | O_CREAT, 0600)) < 0)
+        die("Unable to open sync group %s: %s\n", name, strerror(errno));
+    if (ftruncate(fd, sizeof(*group)) < 0)
+        die("Unable to size sync group %s: %s\n", name, strerror(errno));
+    group = mmap(NULL, sizeof(*group), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (group == MAP_FAILED)
+        die("Unable to map sync group %s: %s\n", name, strerror(errno));
+
+    if (!__atomic_compare_exchange_n(&group->instances, &expected, instances, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && expected != (uint32_t)instances)
+        die("Sync group %s is for %u instances, not %d.\n", name, expected, instances);
+    if ((index_in_group = __atomic_fetch_add(&group->joined, 1, __ATOMIC_ACQ_REL)) >= instances)
+        die("Sync group %s is full; if no instance is running, remove /dev/shm%s.\n", name, path);
+    __atomic_fetch_add(&group->members, 1, __ATOMIC_ACQ_REL);
+    barrier_enabled = barrier;
+    info("Joined sync group %s as instance %d of %d.\n", name, index_in_group + 1, instances);
+
+    if (index_in_group == instances - 1) {
+        __atomic_store_n(&group->start, now_ns(), __ATOMIC_RELAXED);
+        __atomic_store_n(&group->time, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&group->started, 1, __ATOMIC_RELEASE);
+        futex_wake(&group->started);
+    }
+    while (!__atomic_load_n(&group->started, __ATOMIC_ACQUIRE)) {
+        if (!futex_wait(&group->started, 0)) {
+            joined = __atomic_load_n(&group->joined, __ATOMIC_RELAXED);
+            info("Waiting for %u more instances to join %s.\n", instances - joined, name);
+        }
+    }
+    start_ns = __atomic_load_n(&group->start, __ATOMIC_RELAXED);
+    start->tv_sec = start_ns / 1000000000;
+    start->tv_nsec = start_ns % 1000000000;
+}
+
+/*
+ * A generation barrier: the last instance in resets the count, stamps
+ * the next frame time and moves the generation on, which is what the
+ * others sleep on. Once an instance has left nobody waits any more.
+*/
+void sync_swap(void){
+    uint32_t generation;
+
+    if (!barrier_enabled || __atomic_load_n(&group->closing, __ATOMIC_ACQUIRE))
+        return;
+    generation = __atomic_load_n(&group->generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&group->arrived, 1, __ATOMIC_ACQ_REL) == group->instances) {
+        __atomic_store_n(&group->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&group->time, now_ns() - start_ns, __ATOMIC_RELAXED);
+        __atomic_store_n(&group->generation, generation + 1, __ATOMIC_RELEASE);
+        futex_wake(&group->generation);
+        return;
+    }
+    while (__atomic_load_n(&group->generation, __ATOMIC_ACQUIRE) == generation) {
+        if (!futex_wait(&group->generation, generation))
+            warning("Instance %d waiting for the others at the swap barrier.\n", index_in_group + 1);
+    }
+}
+
+/* Without a barrier to stamp it, the shared start alone has to do */
+double sync_time(void){
+    if (!barrier_enabled || __atomic_load_n(&group->closing, __ATOMIC_ACQUIRE))
+        return (now_ns() - start_ns) / 1e9;
+    return __atomic_load_n(&group->time, __ATOMIC_RELAXED) / 1e9;
+}
+
+void sync_leave(void){
+    if (!group)
+        return;
+    if (barrier_enabled && !__atomic_exchange_n(&group->closing, 1, __ATOMIC_ACQ_REL)) {
+        __atomic_fetch_add(&group->generation, 1, __ATOMIC_RELEASE);
+        futex_wake(&group->generation);
+    }
+    if (__atomic_sub_fetch(&group->members, 1, __ATOMIC_ACQ_REL) == 0)
+        shm_unlink(path);
+    munmap(group, sizeof(*group));
+    group = NULL;
+}
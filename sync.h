@@ -0,0 +1,15 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Lockstep for several instances driving one video wall. Instances join
+ * a group by name, a shared memory segment, and wait until all of them
+ * are there; the last to arrive stamps the common start time. With the
+ * swap barrier every instance also waits in sync_swap() for the others
+ * before presenting, and the last one in stamps the time all of them
+ * render next; sync_time() returns it, or the time since the common
+ * start without the barrier. Waiting is done on futexes.
+*/
+void sync_join(const char *name, int instances, int barrier, struct timespec *start);
+void sync_swap(void);
+double sync_time(void);
+void sync_leave(void);
@@ -0,0 +1,816 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#ifdef GLES3
+#include <GLES3/gl3.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+
+#define TRACE_REAL
+#include "trace.h"
+
+#define MAX_ATTRIBS 16
+
+#define X(name) #name,
+const char *const trace_call_names[TRACE_LAST] = {
+    TRACE_CALLS
+};
+#undef X
+
+/*
+ * Pointer arguments are only meaningful together with the state they
+ * were issued under, so enough of it is shadowed here to know how many
+ * bytes a call reads and whether a pointer is really a buffer offset.
+*/
+static struct {
+    FILE *fp;
+    int failed;
+    size_t used;
+    unsigned char buf[1 << 16];
+    GLint unpack_alignment;
+    GLuint array_buffer;
+    GLuint pack_buffer;
+    struct {
+        int enabled;
+        GLint size;
+        GLenum type;
+        GLsizei stride;
+        const void *pointer;
+    } attribs[MAX_ATTRIBS];
+} trace = { .unpack_alignment = 4 };
+
+static void flush(void){
+    if (trace.used && fwrite(trace.buf, 1, trace.used, trace.fp) != trace.used)
+        trace.failed = 1;
+    trace.used = 0;
+}
+
+static void put(const void *data, size_t len){
+    if (trace.used + len > sizeof(trace.buf))
+        flush();
+    if (len > sizeof(trace.buf)) {
+        if (fwrite(data, 1, len, trace.fp) != len)
+            trace.failed = 1;
+        return;
+    }
+    memcpy(trace.buf + trace.used, data, len);
+    trace.used += len;
+}
+
+static void begin(int call, int nwords, const uint32_t *words, int blob){
+    uint16_t head[2];
+
+    head[0] = (uint16_t)call;
+    head[1] = (uint16_t)(nwords | (blob ? TRACE_BLOB : 0));
+    put(head, sizeof(head));
+    put(words, nwords * sizeof(*words));
+}
+
+/* Blobs are padded so that every record starts four byte aligned. */
+static void pad(size_t len){
+    static const unsigned char zero[3];
+
+    put(zero, -len & 3);
+}
+
+static void emit(int call, int nwords, const uint32_t *words, const void *blob, size_t len){
+    uint32_t n = (uint32_t)len;
+
+    begin(call, nwords, words, blob != NULL);
+    if (blob) {
+        put(&n, sizeof(n));
+        put(blob, len);
+        pad(len);
+    }
+}
+
+#define RECORD(call, ...) do { \
+    uint32_t w_[] = { __VA_ARGS__ }; \
+    emit(TRACE_##call, sizeof(w_) / sizeof(*w_), w_, NULL, 0); \
+} while (0)
+
+#define RECORD_BLOB(call, blob, len, ...) do { \
+    uint32_t w_[] = { __VA_ARGS__ }; \
+    emit(TRACE_##call, sizeof(w_) / sizeof(*w_), w_, blob, len); \
+} while (0)
+
+static uint32_t fbits(GLfloat f){
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static uint32_t lo(const void *p){
+    return (uint32_t)(uintptr_t)p;
+}
+
+static uint32_t hi(const void *p){
+    return (uint32_t)((uint64_t)(uintptr_t)p >> 32);
+}
+
+static size_t type_size(GLenum type){
+    switch (type) {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+#ifdef GLES3
+        case GL_HALF_FLOAT:
+#endif
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+/* Bytes a texel upload reads under the current unpack alignment. */
+static size_t image_bytes(GLsizei width, GLsizei height, GLenum format, GLenum type){
+    size_t texel, row, align = trace.unpack_alignment;
+
+    switch (type) {
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            texel = 2;
+            break;
+        default:
+            switch (format) {
+                case GL_RGBA:
+                    texel = 4;
+                    break;
+                case GL_RGB:
+                    texel = 3;
+                    break;
+                case GL_LUMINANCE_ALPHA:
+                    texel = 2;
+                    break;
+                default:
+                    texel = 1;
+            }
+            texel *= type_size(type);
+    }
+    if (width <= 0 || height <= 0)
+        return 0;
+    row = (width * texel + align - 1) / align * align;
+
+    return row * (height - 1) + width * texel;
+}
+
+static void record_uniform(int call, GLint location, GLsizei count, const GLfloat *value, int n){
+    uint32_t w[2] = { location, count };
+
+    emit(call, 2, w, value, count > 0 ? count * n * sizeof(*value) : 0);
+}
+
+static void record_names(int call, GLsizei n, const GLuint *names){
+    uint32_t w = n;
+
+    emit(call, 1, &w, names, n > 0 ? n * sizeof(*names) : 0);
+}
+
+static void record_attribs(int call, const EGLint *attribs){
+    size_t n = 0;
+
+    if (attribs)
+        while (attribs[n] != EGL_NONE)
+            n += 2;
+    emit(call, 0, NULL, attribs ? (const void *)attribs : (const void *)"", n * sizeof(*attribs));
+}
+
+int trace_open(const char *path, int width, int height, int flags){
+    int32_t header[5] = { 0x01020304, TRACE_VERSION, width, height, flags };
+
+    if (!(trace.fp = fopen(path, "wb")))
+        return -1;
+    trace.failed = 0;
+    trace.used = 0;
+    put("ESTRACE", 8);
+    put(header, sizeof(header));
+
+    return 0;
+}
+
+int trace_close(void){
+    int failed;
+
+    if (!trace.fp)
+        return 0;
+    flush();
+    failed = trace.failed || fclose(trace.fp) != 0;
+    trace.fp = NULL;
+
+    return failed ? -1 : 0;
+}
+
+void trace_glActiveTexture(GLenum texture){
+    if (trace.fp)
+        RECORD(glActiveTexture, texture);
+    glActiveTexture(texture);
+}
+
+void trace_glAttachShader(GLuint program, GLuint shader){
+    if (trace.fp)
+        RECORD(glAttachShader, program, shader);
+    glAttachShader(program, shader);
+}
+
+void trace_glBindBuffer(GLenum target, GLuint buffer){
+    if (target == GL_ARRAY_BUFFER)
+        trace.array_buffer = buffer;
+#ifdef GLES3
+    else if (target == GL_PIXEL_PACK_BUFFER)
+        trace.pack_buffer = buffer;
+#endif
+    if (trace.fp)
+        RECORD(glBindBuffer, target, buffer);
+    glBindBuffer(target, buffer);
+}
+
+void trace_glBindFramebuffer(GLenum target, GLuint framebuffer){
+    if (trace.fp)
+        RECORD(glBindFramebuffer, target, framebuffer);
+    glBindFramebuffer(target, framebuffer);
+}
+
+void trace_glBindTexture(GLenum target, GLuint texture){
+    if (trace.fp)
+        RECORD(glBindTexture, target, texture);
+    glBindTexture(target, texture);
+}
+
+void trace_glBlendFunc(GLenum sfactor, GLenum dfactor){
+    if (trace.fp)
+        RECORD(glBlendFunc, sfactor, dfactor);
+    glBlendFunc(sfactor, dfactor);
+}
+
+void trace_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage){
+    if (trace.fp)
+        RECORD_BLOB(glBufferData, data, data ? size : 0, target, (uint32_t)size, usage);
+    glBufferData(target, size, data, usage);
+}
+
+void trace_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data){
+    if (trace.fp)
+        RECORD_BLOB(glBufferSubData, data, size, target, (uint32_t)offset, (uint32_t)size);
+    glBufferSubData(target, offset, size, data);
+}
+
+GLenum trace_glCheckFramebufferStatus(GLenum target){
+    GLenum status = glCheckFramebufferStatus(target);
+
+    if (trace.fp)
+        RECORD(glCheckFramebufferStatus, target, status);
+    return status;
+}
+
+void trace_glClear(GLbitfield mask){
+    if (trace.fp)
+        RECORD(glClear, mask);
+    glClear(mask);
+}
+
+void trace_glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a){
+    if (trace.fp)
+        RECORD(glClearColor, fbits(r), fbits(g), fbits(b), fbits(a));
+    glClearColor(r, g, b, a);
+}
+
+void trace_glCompileShader(GLuint shader){
+    if (trace.fp)
+        RECORD(glCompileShader, shader);
+    glCompileShader(shader);
+}
+
+void trace_glCompressedTexImage2D(GLenum target, GLint level, GLenum format, GLsizei width,
+        GLsizei height, GLint border, GLsizei size, const void *data){
+    if (trace.fp)
+        RECORD_BLOB(glCompressedTexImage2D, data, data ? size : 0,
+                target, level, format, width, height, border, size);
+    glCompressedTexImage2D(target, level, format, width, height, border, size, data);
+}
+
+GLuint trace_glCreateProgram(void){
+    GLuint program = glCreateProgram();
+
+    if (trace.fp)
+        RECORD(glCreateProgram, program);
+    return program;
+}
+
+GLuint trace_glCreateShader(GLenum type){
+    GLuint shader = glCreateShader(type);
+
+    if (trace.fp)
+        RECORD(glCreateShader, type, shader);
+    return shader;
+}
+
+void trace_glDeleteBuffers(GLsizei n, const GLuint *buffers){
+    if (trace.fp)
+        record_names(TRACE_glDeleteBuffers, n, buffers);
+    glDeleteBuffers(n, buffers);
+}
+
+void trace_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers){
+    if (trace.fp)
+        record_names(TRACE_glDeleteFramebuffers, n, framebuffers);
+    glDeleteFramebuffers(n, framebuffers);
+}
+
+void trace_glDeleteProgram(GLuint program){
+    if (trace.fp)
+        RECORD(glDeleteProgram, program);
+    glDeleteProgram(program);
+}
+
+void trace_glDeleteShader(GLuint shader){
+    if (trace.fp)
+        RECORD(glDeleteShader, shader);
+    glDeleteShader(shader);
+}
+
+void trace_glDeleteTextures(GLsizei n, const GLuint *textures){
+    if (trace.fp)
+        record_names(TRACE_glDeleteTextures, n, textures);
+    glDeleteTextures(n, textures);
+}
+
+void trace_glDisable(GLenum cap){
+    if (trace.fp)
+        RECORD(glDisable, cap);
+    glDisable(cap);
+}
+
+void trace_glDisableVertexAttribArray(GLuint index){
+    if (index < MAX_ATTRIBS)
+        trace.attribs[index].enabled = 0;
+    if (trace.fp)
+        RECORD(glDisableVertexAttribArray, index);
+    glDisableVertexAttribArray(index);
+}
+
+/*
+ * Client arrays are read at draw time, so that is when they go into the
+ * trace: every stretch of memory the enabled ones cover, once, tagged
+ * with its address. Interleaved arrays thus share a single copy.
+*/
+void trace_glDrawArrays(GLenum mode, GLint first, GLsizei count){
+    uintptr_t start[MAX_ATTRIBS], end[MAX_ATTRIBS];
+    size_t element, stride;
+    int i, j, n = 0;
+
+    if (trace.fp && count > 0) {
+        for (i = 0; i < MAX_ATTRIBS; ++i) {
+            if (!trace.attribs[i].enabled || !trace.attribs[i].pointer)
+                continue;
+            element = trace.attribs[i].size * type_size(trace.attribs[i].type);
+            stride = trace.attribs[i].stride ? (size_t)trace.attribs[i].stride : element;
+            start[n] = (uintptr_t)trace.attribs[i].pointer;
+            end[n] = start[n] + (first + count - 1) * stride + element;
+            n++;
+        }
+        for (i = 0; i < n; ++i) {
+            for (j = i + 1; j < n; ++j) {
+                if (start[j] > end[i] || end[j] < start[i])
+                    continue;
+                start[i] = start[j] < start[i] ? start[j] : start[i];
+                end[i] = end[j] > end[i] ? end[j] : end[i];
+                start[j] = start[--n];
+                end[j] = end[n];
+                j = i;
+            }
+            RECORD_BLOB(attrib_data, (const void *)start[i], end[i] - start[i],
+                    lo((const void *)start[i]), hi((const void *)start[i]));
+        }
+    }
+    if (trace.fp)
+        RECORD(glDrawArrays, mode, first, count);
+    glDrawArrays(mode, first, count);
+}
+
+void trace_glEnable(GLenum cap){
+    if (trace.fp)
+        RECORD(glEnable, cap);
+    glEnable(cap);
+}
+
+void trace_glEnableVertexAttribArray(GLuint index){
+    if (index < MAX_ATTRIBS)
+        trace.attribs[index].enabled = 1;
+    if (trace.fp)
+        RECORD(glEnableVertexAttribArray, index);
+    glEnableVertexAttribArray(index);
+}
+
+void trace_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget,
+        GLuint texture, GLint level){
+    if (trace.fp)
+        RECORD(glFramebufferTexture2D, target, attachment, textarget, texture, level);
+    glFramebufferTexture2D(target, attachment, textarget, texture, level);
+}
+
+void trace_glGenBuffers(GLsizei n, GLuint *buffers){
+    glGenBuffers(n, buffers);
+    if (trace.fp)
+        record_names(TRACE_glGenBuffers, n, buffers);
+}
+
+void trace_glGenFramebuffers(GLsizei n, GLuint *framebuffers){
+    glGenFramebuffers(n, framebuffers);
+    if (trace.fp)
+        record_names(TRACE_glGenFramebuffers, n, framebuffers);
+}
+
+void trace_glGenTextures(GLsizei n, GLuint *textures){
+    glGenTextures(n, textures);
+    if (trace.fp)
+        record_names(TRACE_glGenTextures, n, textures);
+}
+
+void trace_glGenerateMipmap(GLenum target){
+    if (trace.fp)
+        RECORD(glGenerateMipmap, target);
+    glGenerateMipmap(target);
+}
+
+GLint trace_glGetAttribLocation(GLuint program, const GLchar *name){
+    GLint location = glGetAttribLocation(program, name);
+
+    if (trace.fp)
+        RECORD_BLOB(glGetAttribLocation, name, strlen(name), program, location);
+    return location;
+}
+
+GLenum trace_glGetError(void){
+    GLenum error = glGetError();
+
+    if (trace.fp)
+        RECORD(glGetError, error);
+    return error;
+}
+
+void trace_glGetIntegerv(GLenum pname, GLint *data){
+    if (trace.fp)
+        RECORD(glGetIntegerv, pname);
+    glGetIntegerv(pname, data);
+}
+
+void trace_glGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *length, GLchar *log){
+    if (trace.fp)
+        RECORD(glGetProgramInfoLog, program, size);
+    glGetProgramInfoLog(program, size, length, log);
+}
+
+void trace_glGetProgramiv(GLuint program, GLenum pname, GLint *params){
+    if (trace.fp)
+        RECORD(glGetProgramiv, program, pname);
+    glGetProgramiv(program, pname, params);
+}
+
+void trace_glGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *length, GLchar *log){
+    if (trace.fp)
+        RECORD(glGetShaderInfoLog, shader, size);
+    glGetShaderInfoLog(shader, size, length, log);
+}
+
+void trace_glGetShaderiv(GLuint shader, GLenum pname, GLint *params){
+    if (trace.fp)
+        RECORD(glGetShaderiv, shader, pname);
+    glGetShaderiv(shader, pname, params);
+}
+
+const GLubyte *trace_glGetString(GLenum name){
+    if (trace.fp)
+        RECORD(glGetString, name);
+    return glGetString(name);
+}
+
+GLint trace_glGetUniformLocation(GLuint program, const GLchar *name){
+    GLint location = glGetUniformLocation(program, name);
+
+    if (trace.fp)
+        RECORD_BLOB(glGetUniformLocation, name, strlen(name), program, location);
+    return location;
+}
+
+void trace_glLinkProgram(GLuint program){
+    if (trace.fp)
+        RECORD(glLinkProgram, program);
+    glLinkProgram(program);
+}
+
+void trace_glPixelStorei(GLenum pname, GLint param){
+    if (pname == GL_UNPACK_ALIGNMENT)
+        trace.unpack_alignment = param;
+    if (trace.fp)
+        RECORD(glPixelStorei, pname, param);
+    glPixelStorei(pname, param);
+}
+
+/* Into a pack buffer, pixels is an offset and kept as one. */
+void trace_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+        GLenum type, void *pixels){
+    if (trace.fp)
+        RECORD(glReadPixels, x, y, width, height, format, type,
+                trace.pack_buffer != 0, trace.pack_buffer ? lo(pixels) : 0);
+    glReadPixels(x, y, width, height, format, type, pixels);
+}
+
+void trace_glReleaseShaderCompiler(void){
+    if (trace.fp)
+        emit(TRACE_glReleaseShaderCompiler, 0, NULL, NULL, 0);
+    glReleaseShaderCompiler();
+}
+
+/* Words are the shader, the count and each length; the blob all strings. */
+void trace_glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+        const GLint *length){
+    uint32_t w[2 + 16], n = 0;
+    GLsizei i;
+
+    if (trace.fp && count > 0 && count <= 16) {
+        w[0] = shader;
+        w[1] = count;
+        for (i = 0; i < count; ++i) {
+            w[2 + i] = length && length[i] >= 0 ? (uint32_t)length[i] : strlen(string[i]);
+            n += w[2 + i];
+        }
+        begin(TRACE_glShaderSource, 2 + count, w, 1);
+        put(&n, sizeof(n));
+        for (i = 0; i < count; ++i)
+            put(string[i], w[2 + i]);
+        pad(n);
+    }
+    glShaderSource(shader, count, string, length);
+}
+
+void trace_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width,
+        GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels){
+    if (trace.fp)
+        RECORD_BLOB(glTexImage2D, pixels, pixels ? image_bytes(width, height, format, type) : 0,
+                target, level, internalformat, width, height, border, format, type);
+    glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+void trace_glTexParameteri(GLenum target, GLenum pname, GLint param){
+    if (trace.fp)
+        RECORD(glTexParameteri, target, pname, param);
+    glTexParameteri(target, pname, param);
+}
+
+void trace_glTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width,
+        GLsizei height, GLenum format, GLenum type, const void *pixels){
+    if (trace.fp)
+        RECORD_BLOB(glTexSubImage2D, pixels, image_bytes(width, height, format, type),
+                target, level, x, y, width, height, format, type);
+    glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+}
+
+void trace_glUniform1f(GLint location, GLfloat v0){
+    if (trace.fp)
+        RECORD(glUniform1f, location, fbits(v0));
+    glUniform1f(location, v0);
+}
+
+void trace_glUniform1fv(GLint location, GLsizei count, const GLfloat *value){
+    if (trace.fp)
+        record_uniform(TRACE_glUniform1fv, location, count, value, 1);
+    glUniform1fv(location, count, value);
+}
+
+void trace_glUniform1i(GLint location, GLint v0){
+    if (trace.fp)
+        RECORD(glUniform1i, location, v0);
+    glUniform1i(location, v0);
+}
+
+void trace_glUniform2f(GLint location, GLfloat v0, GLfloat v1){
+    if (trace.fp)
+        RECORD(glUniform2f, location, fbits(v0), fbits(v1));
+    glUniform2f(location, v0, v1);
+}
+
+void trace_glUniform2fv(GLint location, GLsizei count, const GLfloat *value){
+    if (trace.fp)
+        record_uniform(TRACE_glUniform2fv, location, count, value, 2);
+    glUniform2fv(location, count, value);
+}
+
+void trace_glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2){
+    if (trace.fp)
+        RECORD(glUniform3f, location, fbits(v0), fbits(v1), fbits(v2));
+    glUniform3f(location, v0, v1, v2);
+}
+
+void trace_glUniform3fv(GLint location, GLsizei count, const GLfloat *value){
+    if (trace.fp)
+        record_uniform(TRACE_glUniform3fv, location, count, value, 3);
+    glUniform3fv(location, count, value);
+}
+
+void trace_glUniform4fv(GLint location, GLsizei count, const GLfloat *value){
+    if (trace.fp)
+        record_uniform(TRACE_glUniform4fv, location, count, value, 4);
+    glUniform4fv(location, count, value);
+}
+
+void trace_glUseProgram(GLuint program){
+    if (trace.fp)
+        RECORD(glUseProgram, program);
+    glUseProgram(program);
+}
+
+void trace_glValidateProgram(GLuint program){
+    if (trace.fp)
+        RECORD(glValidateProgram, program);
+    glValidateProgram(program);
+}
+
+/* The pointer is a buffer offset if one is bound, else an address into client memory. */
+void trace_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+        GLsizei stride, const void *pointer){
+    if (index < MAX_ATTRIBS) {
+        trace.attribs[index].size = size;
+        trace.attribs[index].type = type;
+        trace.attribs[index].stride = stride;
+        trace.attribs[index].pointer = trace.array_buffer ? NULL : pointer;
+    }
+    if (trace.fp)
+        RECORD(glVertexAttribPointer, index, size, type, normalized, stride,
+                trace.array_buffer != 0, lo(pointer), hi(pointer));
+    glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void trace_glViewport(GLint x, GLint y, GLsizei width, GLsizei height){
+    if (trace.fp)
+        RECORD(glViewport, x, y, width, height);
+    glViewport(x, y, width, height);
+}
+
+#ifdef GLES3
+void trace_glBindBufferBase(GLenum target, GLuint index, GLuint buffer){
+    if (trace.fp)
+        RECORD(glBindBufferBase, target, index, buffer);
+    glBindBufferBase(target, index, buffer);
+}
+
+/* Syncs are pointers; the replay only needs them to tell them apart. */
+GLenum trace_glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout){
+    GLenum status = glClientWaitSync(sync, flags, timeout);
+
+    if (trace.fp)
+        RECORD(glClientWaitSync, lo(sync), hi(sync), flags,
+                (uint32_t)timeout, (uint32_t)(timeout >> 32), status);
+    return status;
+}
+
+void trace_glDeleteSync(GLsync sync){
+    if (trace.fp)
+        RECORD(glDeleteSync, lo(sync), hi(sync));
+    glDeleteSync(sync);
+}
+
+GLsync trace_glFenceSync(GLenum condition, GLbitfield flags){
+    GLsync sync = glFenceSync(condition, flags);
+
+    if (trace.fp)
+        RECORD(glFenceSync, condition, flags, lo(sync), hi(sync));
+    return sync;
+}
+
+GLuint trace_glGetUniformBlockIndex(GLuint program, const GLchar *name){
+    GLuint index = glGetUniformBlockIndex(program, name);
+
+    if (trace.fp)
+        RECORD_BLOB(glGetUniformBlockIndex, name, strlen(name), program, index);
+    return index;
+}
+
+void *trace_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length,
+        GLbitfield access){
+    if (trace.fp)
+        RECORD(glMapBufferRange, target, (uint32_t)offset, (uint32_t)length, access);
+    return glMapBufferRange(target, offset, length, access);
+}
+
+void trace_glUniformBlockBinding(GLuint program, GLuint index, GLuint binding){
+    if (trace.fp)
+        RECORD(glUniformBlockBinding, program, index, binding);
+    glUniformBlockBinding(program, index, binding);
+}
+
+GLboolean trace_glUnmapBuffer(GLenum target){
+    if (trace.fp)
+        RECORD(glUnmapBuffer, target);
+    return glUnmapBuffer(target);
+}
+#endif
+
+/*
+ * EGL handles mean nothing to a replay, which makes its own context;
+ * the calls are kept so a trace shows where contexts and frames begin.
+*/
+EGLBoolean trace_eglBindAPI(EGLenum api){
+    if (trace.fp)
+        RECORD(eglBindAPI, api);
+    return eglBindAPI(api);
+}
+
+EGLBoolean trace_eglChooseConfig(EGLDisplay dpy, const EGLint *attribs, EGLConfig *configs,
+        EGLint size, EGLint *n){
+    if (trace.fp)
+        record_attribs(TRACE_eglChooseConfig, attribs);
+    return eglChooseConfig(dpy, attribs, configs, size, n);
+}
+
+EGLContext trace_eglCreateContext(EGLDisplay dpy, EGLConfig config, EGLContext share,
+        const EGLint *attribs){
+    if (trace.fp)
+        record_attribs(TRACE_eglCreateContext, attribs);
+    return eglCreateContext(dpy, config, share, attribs);
+}
+
+EGLSurface trace_eglCreatePbufferSurface(EGLDisplay dpy, EGLConfig config,
+        const EGLint *attribs){
+    if (trace.fp)
+        record_attribs(TRACE_eglCreatePbufferSurface, attribs);
+    return eglCreatePbufferSurface(dpy, config, attribs);
+}
+
+EGLSurface trace_eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config,
+        EGLNativeWindowType win, const EGLint *attribs){
+    if (trace.fp)
+        record_attribs(TRACE_eglCreateWindowSurface, attribs);
+    return eglCreateWindowSurface(dpy, config, win, attribs);
+}
+
+EGLBoolean trace_eglDestroyContext(EGLDisplay dpy, EGLContext ctx){
+    if (trace.fp)
+        emit(TRACE_eglDestroyContext, 0, NULL, NULL, 0);
+    return eglDestroyContext(dpy, ctx);
+}
+
+EGLBoolean trace_eglDestroySurface(EGLDisplay dpy, EGLSurface surface){
+    if (trace.fp)
+        emit(TRACE_eglDestroySurface, 0, NULL, NULL, 0);
+    return eglDestroySurface(dpy, surface);
+}
+
+EGLBoolean trace_eglGetConfigAttrib(EGLDisplay dpy, EGLConfig config, EGLint attr,
+        EGLint *value){
+    if (trace.fp)
+        RECORD(eglGetConfigAttrib, attr);
+    return eglGetConfigAttrib(dpy, config, attr, value);
+}
+
+EGLContext trace_eglGetCurrentContext(void){
+    if (trace.fp)
+        emit(TRACE_eglGetCurrentContext, 0, NULL, NULL, 0);
+    return eglGetCurrentContext();
+}
+
+EGLDisplay trace_eglGetDisplay(EGLNativeDisplayType id){
+    if (trace.fp)
+        emit(TRACE_eglGetDisplay, 0, NULL, NULL, 0);
+    return eglGetDisplay(id);
+}
+
+EGLBoolean trace_eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor){
+    if (trace.fp)
+        emit(TRACE_eglInitialize, 0, NULL, NULL, 0);
+    return eglInitialize(dpy, major, minor);
+}
+
+EGLBoolean trace_eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read,
+        EGLContext ctx){
+    if (trace.fp)
+        emit(TRACE_eglMakeCurrent, 0, NULL, NULL, 0);
+    return eglMakeCurrent(dpy, draw, read, ctx);
+}
+
+const char *trace_eglQueryString(EGLDisplay dpy, EGLint name){
+    if (trace.fp)
+        RECORD(eglQueryString, name);
+    return eglQueryString(dpy, name);
+}
+
+EGLBoolean trace_eglSwapBuffers(EGLDisplay dpy, EGLSurface surface){
+    if (trace.fp)
+        emit(TRACE_eglSwapBuffers, 0, NULL, NULL, 0);
+    return eglSwapBuffers(dpy, surface);
+}
+
+/* Flushed here too, so a trace is complete even if trace_close() never runs. */
+EGLBoolean trace_eglTerminate(EGLDisplay dpy){
+    if (trace.fp) {
+        emit(TRACE_eglTerminate, 0, NULL, NULL, 0);
+        flush();
+    }
+    return eglTerminate(dpy);
+}
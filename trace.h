@@ -0,0 +1,251 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * GL and EGL call traces. Sources that include this after the GL, EGL
+ * and X headers have their calls routed through trace_*() wrappers,
+ * which cost a branch while no trace is open. An open trace appends
+ * each call to a buffer that goes out in large writes:
+ *
+ *   header   "ESTRACE" 0, then int32 byte order mark 0x01020304,
+ *            version, width, height and esshader flags
+ *   record   uint16 call, uint16 word count (top bit: a blob follows),
+ *            the 32 bit words, then uint32 blob length and the bytes,
+ *            zero padded to a multiple of four
+ *
+ * Words are the scalar arguments in call order, with floats as their
+ * bits and returned names or locations after them. Blobs carry what the
+ * call read from memory: shader sources, uniform arrays, texel uploads
+ * and client vertex arrays, the latter as TRACE_ATTRIB_DATA records
+ * of the memory behind them, with its address, ahead of each draw.
+ * Everything is in host byte order. One thread at a time may issue
+ * traced calls.
+*/
+#define TRACE_CALLS \
+    X(glActiveTexture) X(glAttachShader) X(glBindBuffer) X(glBindFramebuffer) \
+    X(glBindTexture) X(glBlendFunc) X(glBufferData) X(glBufferSubData) \
+    X(glCheckFramebufferStatus) X(glClear) X(glClearColor) X(glCompileShader) \
+    X(glCompressedTexImage2D) X(glCreateProgram) X(glCreateShader) X(glDeleteBuffers) \
+    X(glDeleteFramebuffers) X(glDeleteProgram) X(glDeleteShader) X(glDeleteTextures) \
+    X(glDisable) X(glDisableVertexAttribArray) X(glDrawArrays) X(glEnable) \
+    X(glEnableVertexAttribArray) X(glFramebufferTexture2D) X(glGenBuffers) \
+    X(glGenFramebuffers) X(glGenTextures) X(glGenerateMipmap) X(glGetAttribLocation) \
+    X(glGetError) X(glGetIntegerv) X(glGetProgramInfoLog) X(glGetProgramiv) \
+    X(glGetShaderInfoLog) X(glGetShaderiv) X(glGetString) X(glGetUniformLocation) \
+    X(glLinkProgram) X(glPixelStorei) X(glReadPixels) X(glReleaseShaderCompiler) \
+    X(glShaderSource) X(glTexImage2D) X(glTexParameteri) X(glTexSubImage2D) \
+    X(glUniform1f) X(glUniform1fv) X(glUniform1i) X(glUniform2f) X(glUniform2fv) \
+    X(glUniform3f) X(glUniform3fv) X(glUniform4fv) X(glUseProgram) \
+    X(glValidateProgram) X(glVertexAttribPointer) X(glViewport) \
+    X(glBindBufferBase) X(glClientWaitSync) X(glDeleteSync) X(glFenceSync) \
+    X(glGetUniformBlockIndex) X(glMapBufferRange) X(glUniformBlockBinding) \
+    X(glUnmapBuffer) \
+    X(eglBindAPI) X(eglChooseConfig) X(eglCreateContext) X(eglCreatePbufferSurface) \
+    X(eglCreateWindowSurface) X(eglDestroyContext) X(eglDestroySurface) \
+    X(eglGetConfigAttrib) X(eglGetCurrentContext) X(eglGetDisplay) X(eglInitialize) \
+    X(eglMakeCurrent) X(eglQueryString) X(eglSwapBuffers) X(eglTerminate) \
+    X(attrib_data)
+
+/* Call numbers are part of the file format: only ever append. */
+#define X(name) TRACE_##name,
+enum {
+    TRACE_CALLS
+    TRACE_LAST
+};
+#undef X
+
+#define TRACE_ATTRIB_DATA TRACE_attrib_data
+#define TRACE_VERSION 1
+#define TRACE_BLOB 0x8000
+
+extern const char *const trace_call_names[TRACE_LAST];
+
+/* Returns -1 if path cannot be created; trace_close() returns -1 if writing failed. */
+int trace_open(const char *path, int width, int height, int flags);
+int trace_close(void);
+
+void trace_glActiveTexture(GLenum texture);
+void trace_glAttachShader(GLuint program, GLuint shader);
+void trace_glBindBuffer(GLenum target, GLuint buffer);
+void trace_glBindFramebuffer(GLenum target, GLuint framebuffer);
+void trace_glBindTexture(GLenum target, GLuint texture);
+void trace_glBlendFunc(GLenum sfactor, GLenum dfactor);
+void trace_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+void trace_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+GLenum trace_glCheckFramebufferStatus(GLenum target);
+void trace_glClear(GLbitfield mask);
+void trace_glClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+void trace_glCompileShader(GLuint shader);
+void trace_glCompressedTexImage2D(GLenum target, GLint level, GLenum format, GLsizei width,
+        GLsizei height, GLint border, GLsizei size, const void *data);
+GLuint trace_glCreateProgram(void);
+GLuint trace_glCreateShader(GLenum type);
+void trace_glDeleteBuffers(GLsizei n, const GLuint *buffers);
+void trace_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+void trace_glDeleteProgram(GLuint program);
+void trace_glDeleteShader(GLuint shader);
+void trace_glDeleteTextures(GLsizei n, const GLuint *textures);
+void trace_glDisable(GLenum cap);
+void trace_glDisableVertexAttribArray(GLuint index);
+void trace_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void trace_glEnable(GLenum cap);
+void trace_glEnableVertexAttribArray(GLuint index);
+void trace_glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget,
+        GLuint texture, GLint level);
+void trace_glGenBuffers(GLsizei n, GLuint *buffers);
+void trace_glGenFramebuffers(GLsizei n, GLuint *framebuffers);
+void trace_glGenTextures(GLsizei n, GLuint *textures);
+void trace_glGenerateMipmap(GLenum target);
+GLint trace_glGetAttribLocation(GLuint program, const GLchar *name);
+GLenum trace_glGetError(void);
+void trace_glGetIntegerv(GLenum pname, GLint *data);
+void trace_glGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *length, GLchar *log);
+void trace_glGetProgramiv(GLuint program, GLenum pname, GLint *params);
+void trace_glGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *length, GLchar *log);
+void trace_glGetShaderiv(GLuint shader, GLenum pname, GLint *params);
+const GLubyte *trace_glGetString(GLenum name);
+GLint trace_glGetUniformLocation(GLuint program, const GLchar *name);
+void trace_glLinkProgram(GLuint program);
+void trace_glPixelStorei(GLenum pname, GLint param);
+void trace_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+        GLenum type, void *pixels);
+void trace_glReleaseShaderCompiler(void);
+void trace_glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+        const GLint *length);
+void trace_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width,
+        GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels);
+void trace_glTexParameteri(GLenum target, GLenum pname, GLint param);
+void trace_glTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width,
+        GLsizei height, GLenum format, GLenum type, const void *pixels);
+void trace_glUniform1f(GLint location, GLfloat v0);
+void trace_glUniform1fv(GLint location, GLsizei count, const GLfloat *value);
+void trace_glUniform1i(GLint location, GLint v0);
+void trace_glUniform2f(GLint location, GLfloat v0, GLfloat v1);
+void trace_glUniform2fv(GLint location, GLsizei count, const GLfloat *value);
+void trace_glUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+void trace_glUniform3fv(GLint location, GLsizei count, const GLfloat *value);
+void trace_glUniform4fv(GLint location, GLsizei count, const GLfloat *value);
+void trace_glUseProgram(GLuint program);
+void trace_glValidateProgram(GLuint program);
+void trace_glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+        GLsizei stride, const void *pointer);
+void trace_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+#ifdef GLES3
+void trace_glBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+GLenum trace_glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+void trace_glDeleteSync(GLsync sync);
+GLsync trace_glFenceSync(GLenum condition, GLbitfield flags);
+GLuint trace_glGetUniformBlockIndex(GLuint program, const GLchar *name);
+void *trace_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length,
+        GLbitfield access);
+void trace_glUniformBlockBinding(GLuint program, GLuint index, GLuint binding);
+GLboolean trace_glUnmapBuffer(GLenum target);
+#endif
+
+EGLBoolean trace_eglBindAPI(EGLenum api);
+EGLBoolean trace_eglChooseConfig(EGLDisplay dpy, const EGLint *attribs, EGLConfig *configs,
+        EGLint size, EGLint *n);
+EGLContext trace_eglCreateContext(EGLDisplay dpy, EGLConfig config, EGLContext share,
+        const EGLint *attribs);
+EGLSurface trace_eglCreatePbufferSurface(EGLDisplay dpy, EGLConfig config,
+        const EGLint *attribs);
+EGLSurface trace_eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config,
+        EGLNativeWindowType win, const EGLint *attribs);
+EGLBoolean trace_eglDestroyContext(EGLDisplay dpy, EGLContext ctx);
+EGLBoolean trace_eglDestroySurface(EGLDisplay dpy, EGLSurface surface);
+EGLBoolean trace_eglGetConfigAttrib(EGLDisplay dpy, EGLConfig config, EGLint attr,
+        EGLint *value);
+EGLContext trace_eglGetCurrentContext(void);
+EGLDisplay trace_eglGetDisplay(EGLNativeDisplayType id);
+EGLBoolean trace_eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor);
+EGLBoolean trace_eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read,
+        EGLContext ctx);
+const char *trace_eglQueryString(EGLDisplay dpy, EGLint name);
+EGLBoolean trace_eglSwapBuffers(EGLDisplay dpy, EGLSurface surface);
+EGLBoolean trace_eglTerminate(EGLDisplay dpy);
+
+#ifndef TRACE_REAL
+#define glActiveTexture trace_glActiveTexture
+#define glAttachShader trace_glAttachShader
+#define glBindBuffer trace_glBindBuffer
+#define glBindFramebuffer trace_glBindFramebuffer
+#define glBindTexture trace_glBindTexture
+#define glBlendFunc trace_glBlendFunc
+#define glBufferData trace_glBufferData
+#define glBufferSubData trace_glBufferSubData
+#define glCheckFramebufferStatus trace_glCheckFramebufferStatus
+#define glClear trace_glClear
+#define glClearColor trace_glClearColor
+#define glCompileShader trace_glCompileShader
+#define glCompressedTexImage2D trace_glCompressedTexImage2D
+#define glCreateProgram trace_glCreateProgram
+#define glCreateShader trace_glCreateShader
+#define glDeleteBuffers trace_glDeleteBuffers
+#define glDeleteFramebuffers trace_glDeleteFramebuffers
+#define glDeleteProgram trace_glDeleteProgram
+#define glDeleteShader trace_glDeleteShader
+#define glDeleteTextures trace_glDeleteTextures
+#define glDisable trace_glDisable
+#define glDisableVertexAttribArray trace_glDisableVertexAttribArray
+#define glDrawArrays trace_glDrawArrays
+#define glEnable trace_glEnable
+#define glEnableVertexAttribArray trace_glEnableVertexAttribArray
+#define glFramebufferTexture2D trace_glFramebufferTexture2D
+#define glGenBuffers trace_glGenBuffers
+#define glGenFramebuffers trace_glGenFramebuffers
+#define glGenTextures trace_glGenTextures
+#define glGenerateMipmap trace_glGenerateMipmap
+#define glGetAttribLocation trace_glGetAttribLocation
+#define glGetError trace_glGetError
+#define glGetIntegerv trace_glGetIntegerv
+#define glGetProgramInfoLog trace_glGetProgramInfoLog
+#define glGetProgramiv trace_glGetProgramiv
+#define glGetShaderInfoLog trace_glGetShaderInfoLog
+#define glGetShaderiv trace_glGetShaderiv
+#define glGetString trace_glGetString
+#define glGetUniformLocation trace_glGetUniformLocation
+#define glLinkProgram trace_glLinkProgram
+#define glPixelStorei trace_glPixelStorei
+#define glReadPixels trace_glReadPixels
+#define glReleaseShaderCompiler trace_glReleaseShaderCompiler
+#define glShaderSource trace_glShaderSource
+#define glTexImage2D trace_glTexImage2D
+#define glTexParameteri trace_glTexParameteri
+#define glTexSubImage2D trace_glTexSubImage2D
+#define glUniform1f trace_glUniform1f
+#define glUniform1fv trace_glUniform1fv
+#define glUniform1i trace_glUniform1i
+#define glUniform2f trace_glUniform2f
+#define glUniform2fv trace_glUniform2fv
+#define glUniform3f trace_glUniform3f
+#define glUniform3fv trace_glUniform3fv
+#define glUniform4fv trace_glUniform4fv
+#define glUseProgram trace_glUseProgram
+#define glValidateProgram trace_glValidateProgram
+#define glVertexAttribPointer trace_glVertexAttribPointer
+#define glViewport trace_glViewport
+#ifdef GLES3
+#define glBindBufferBase trace_glBindBufferBase
+#define glClientWaitSync trace_glClientWaitSync
+#define glDeleteSync trace_glDeleteSync
+#define glFenceSync trace_glFenceSync
+#define glGetUniformBlockIndex trace_glGetUniformBlockIndex
+#define glMapBufferRange trace_glMapBufferRange
+#define glUniformBlockBinding trace_glUniformBlockBinding
+#define glUnmapBuffer trace_glUnmapBuffer
+#endif
+#define eglBindAPI trace_eglBindAPI
+#define eglChooseConfig trace_eglChooseConfig
+#define eglCreateContext trace_eglCreateContext
+#define eglCreatePbufferSurface trace_eglCreatePbufferSurface
+#define eglCreateWindowSurface trace_eglCreateWindowSurface
+#define eglDestroyContext trace_eglDestroyContext
+#define eglDestroySurface trace_eglDestroySurface
+#define eglGetConfigAttrib trace_eglGetConfigAttrib
+#define eglGetCurrentContext trace_eglGetCurrentContext
+#define eglGetDisplay trace_eglGetDisplay
+#define eglInitialize trace_eglInitialize
+#define eglMakeCurrent trace_eglMakeCurrent
+#define eglQueryString trace_eglQueryString
+#define eglSwapBuffers trace_eglSwapBuffers
+#define eglTerminate trace_eglTerminate
+#endif
@@ -0,0 +1,367 @@
+/* See LICENSE file for copyright and license details. */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+/* records in flight, a power of two */
+#define LOG_SLOTS 256
+#define LOG_TEXT 496
+/* records a single call site may emit per second */
+#define LOG_BURST 10
+#define LOG_SITES 64
+/* how long the writer sleeps when the ring is empty, in nanoseconds */
+#define LOG_IDLE 10000000L
+
+/*
+ * Bounded multi-producer ring: a slot is free for the producer whose
+ * position equals its sequence and readable once the sequence is one
+ * ahead of it, so producers only ever contend on the head counter.
+*/
+struct record {
+    unsigned long seq;
+    int level;
+    struct timespec time;
+    char text[LOG_TEXT];
+};
+
+struct site {
+    const char *format;
+    int level;
+    long window;
+    unsigned int count;
+    unsigned int suppressed;
+};
+
+static const char *level_names[LOG_LAST] = {
+    [LOG_DEBUG] = "debug",
+    [LOG_INFO] = "info",
+    [LOG_WARNING] = "warning",
+    [LOG_ERROR] = "error",
+};
+
+static struct record ring[LOG_SLOTS];
+static unsigned long head;
+static unsigned long tail;
+static unsigned long dropped;
+static struct site sites[LOG_SITES];
+static int min_level = LOG_INFO;
+static int json;
+static int running;
+static int stopping;
+static pthread_t writer;
+/* report depth of the calling thread, reports are not rate limited */
+static __thread int reporting;
+/*
+ * A line built from several calls is limited as a whole: the call that
+ * starts it decides for the rest, and a suppressed count waits for the
+ * line to end.
+*/
+static __thread int mid_line;
+static __thread int dropping_line;
+static __thread int pending_suppressed;
+
+/* JSON records are whole lines; partial info() calls are joined first */
+static char line[LOG_TEXT * 4];
+static size_t line_len;
+static int line_level;
+
+/*
+ * Returns how many earlier messages from this call site were suppressed,
+ * or -1 if this one should be too.
+*/
+static int rate_limit(int level, const char *format, const struct timespec *now){
+    uintptr_t h = ((uintptr_t)format >> 3) % LOG_SITES;
+    const char *expected;
+    struct site *s;
+    unsigned int suppressed;
+    int i;
+
+    for (i = 0; i < LOG_SITES; ++i, h = (h + 1) % LOG_SITES) {
+        s = &sites[h];
+        expected = NULL;
+        if (__atomic_load_n(&s->format, __ATOMIC_ACQUIRE) == format ||
+                __atomic_compare_exchange_n(&s->format, &expected, format, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            break;
+    }
+    /* table full, let it through */
+    if (i == LOG_SITES)
+        return 0;
+    s->level = level;
+
+    if (__atomic_exchange_n(&s->window, (long)now->tv_sec, __ATOMIC_RELAXED) != now->tv_sec)
+        __atomic_store_n(&s->count, 0, __ATOMIC_RELAXED);
+    if (__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED) >= LOG_BURST) {
+        __atomic_fetch_add(&s->suppressed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    suppressed = __atomic_exchange_n(&s->suppressed, 0, __ATOMIC_RELAXED);
+
+    return (int)suppressed;
+}
+
+static void write_json(FILE *fp, int level, const struct timespec *time, const char *text, size_t len){
+    const char *p;
+
+    fprintf(fp, "{\"time\":%ld.%06ld,\"level\":\"%s\",\"message\":\"",
+            (long)time->tv_sec, time->tv_nsec / 1000, level_names[level]);
+    for (p = text; p < text + len; ++p) {
+        if (*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if (*p == '\n')
+            fputs("\\n", fp);
+        else if ((unsigned char)*p < 0x20)
+            fprintf(fp, "\\u%04x", *p);
+        else
+            fputc(*p, fp);
+    }
+    fputs("\"}\n", fp);
+}
+
+static void emit(int level, const struct timespec *time, const char *text){
+    size_t len = strlen(text);
+
+    if (!json) {
+        fputs(text, level >= LOG_WARNING ? stderr : stdout);
+        return;
+    }
+
+    if (line_len && line_level != level) {
+        write_json(stderr, line_level, time, line, line_len);
+        line_len = 0;
+    }
+    if (len > sizeof(line) - line_len)
+        len = sizeof(line) - line_len;
+    memcpy(line + line_len, text, len);
+    line_len += len;
+    line_level = level;
+    if (line_len && (line[line_len - 1] == '\n' || line_len == sizeof(line))) {
+        write_json(stderr, level, time, line, line[line_len - 1] == '\n' ? line_len - 1 : line_len);
+        line_len = 0;
+    }
+}
+
+/* Consume everything published so far, returns whether there was any. */
+static int drain(void){
+    struct record *r;
+    struct timespec now;
+    unsigned long lost;
+    char text[96];
+    int any = 0;
+
+    for (;;) {
+        r = &ring[tail % LOG_SLOTS];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        emit(r->level, &r->time, r->text);
+        __atomic_store_n(&r->seq, tail + LOG_SLOTS, __ATOMIC_RELEASE);
+        tail++;
+        any = 1;
+    }
+    if ((lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED))) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(text, sizeof(text), "%lu log records dropped, output is too slow.\n", lost);
+        emit(LOG_WARNING, &now, text);
+        any = 1;
+    }
+    if (any) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return any;
+}
+
+static void *write_records(void *arg){
+    struct timespec idle = { 0, LOG_IDLE };
+
+    (void)arg;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+        if (!drain())
+            nanosleep(&idle, NULL);
+    drain();
+
+    return NULL;
+}
+
+static int push(int level, const struct timespec *time, const char *format, va_list args){
+    unsigned long pos, seq;
+    struct record *r;
+
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+        r = &ring[pos % LOG_SLOTS];
+        seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (seq < pos) {
+            /* full */
+            return 0;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    r->level = level;
+    r->time = *time;
+    vsnprintf(r->text, sizeof(r->text), format, args);
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static void output(int level, const struct timespec *time, const char *format, va_list args){
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        vfprintf(level >= LOG_WARNING ? stderr : stdout, format, args);
+    else if (!push(level, time, format, args))
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void note(int level, const struct timespec *time, const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    output(level, time, format, args);
+    va_end(args);
+}
+
+static void vlog(int level, const char *format, va_list args){
+    struct timespec now;
+    size_t len = strlen(format);
+    int suppressed = 0;
+
+    if (level < min_level)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (!mid_line)
+        dropping_line = level < LOG_ERROR && !reporting &&
+            (suppressed = rate_limit(level, format, &now)) < 0;
+    mid_line = !len || format[len - 1] != '\n';
+    if (dropping_line)
+        return;
+
+    output(level, &now, format, args);
+    pending_suppressed += suppressed;
+    if (!mid_line && pending_suppressed > 0) {
+        note(level, &now, "(%d similar messages suppressed)\n", pending_suppressed);
+        pending_suppressed = 0;
+    }
+}
+
+void die(const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vlog(LOG_ERROR, format, args);
+    va_end(args);
+
+    log_stop();
+    exit(EXIT_FAILURE);
+}
+
+void warning(const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vlog(LOG_WARNING, format, args);
+    va_end(args);
+}
+
+void info(const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vlog(LOG_INFO, format, args);
+    va_end(args);
+}
+
+void debug(const char *format, ...){
+    va_list args;
+
+    va_start(args, format);
+    vlog(LOG_DEBUG, format, args);
+    va_end(args);
+}
+
+/* Returns -1 for an unknown name. */
+int log_level_from_name(const char *name){
+    int level;
+
+    for (level = 0; level < LOG_LAST; ++level)
+        if (!strcmp(name, level_names[level]))
+            return level;
+
+    return -1;
+}
+
+void log_start(int level, int json_lines){
+    unsigned long i;
+
+    min_level = level;
+    json = json_lines;
+    for (i = 0; i < LOG_SLOTS; ++i)
+        ring[i].seq = i;
+    head = tail = 0;
+    fflush(stdout);
+    if (pthread_create(&writer, NULL, write_records, NULL))
+        return;
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
+
+void log_report_begin(void){
+    reporting++;
+}
+
+void log_report_end(void){
+    reporting--;
+}
+
+/*
+ * Count what call sites have held back since their last message, which
+ * nothing after them would otherwise ever mention.
+*/
+static void flush_suppressed(void){
+    struct timespec now;
+    unsigned int suppressed;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < LOG_SITES; ++i) {
+        if (!__atomic_load_n(&sites[i].format, __ATOMIC_ACQUIRE) ||
+                !(suppressed = __atomic_exchange_n(&sites[i].suppressed, 0, __ATOMIC_RELAXED)))
+            continue;
+        note(sites[i].level, &now, "(%u more messages like \"%.*s\" suppressed)\n", suppressed,
+                (int)strcspn(sites[i].format, "\n"), sites[i].format);
+    }
+}
+
+/* Write out whatever is still queued and go back to writing directly. */
+void log_stop(void){
+    struct timespec now;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    flush_suppressed();
+    if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    if (line_len) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        write_json(stderr, line_level, &now, line, line_len);
+        line_len = 0;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    stopping = 0;
+}
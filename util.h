@@ -0,0 +1,29 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Logging. Once log_start() has run, records are formatted into a ring
+ * and written out by a background thread, so a slow terminal or pipe
+ * never holds up the caller; a full ring drops records rather than wait.
+ * Every call site is rate limited on its own, a line built from several
+ * calls by the site that starts it, except between log_report_begin()
+ * and log_report_end() on the calling thread, for reports that must
+ * come out whole; log_stop() tells what was held back. die() flushes
+ * and exits.
+*/
+enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR,
+    LOG_LAST
+};
+
+void die(const char *format, ...);
+void warning(const char *format, ...);
+void info(const char *format, ...);
+void debug(const char *format, ...);
+int log_level_from_name(const char *name);
+void log_start(int level, int json);
+void log_stop(void);
+void log_report_begin(void);
+void log_report_end(void);